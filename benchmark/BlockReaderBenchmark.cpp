@@ -0,0 +1,114 @@
+#include "TFTPBlockReader.h"
+#include "TFTPPacket.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * Measures reading a file block by block, the way a WRQ sends it.
+ *
+ * TFTPPacket::readDataBlock opens, seeks and closes the file for every block; a
+ * TFTPBlockReader opens it once and reads with pread and readahead. Every run starts with
+ * the file dropped from the page cache (as far as POSIX_FADV_DONTNEED allows without
+ * privileges) and is repeated with the file cached.
+ *
+ * Usage: blockReaderBenchmark [file size in MB]
+ */
+
+static const char* BENCHMARK_FILE_NAME = "/tmp/tftpBlockReaderBenchmark.bin";
+
+/**
+ * @brief Ask the kernel to drop the benchmark file from the page cache.
+ */
+static void dropCache() {
+    int fd = open(BENCHMARK_FILE_NAME, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/**
+ * @brief Read every block of the benchmark file and print the throughput.
+ *
+ * @param name The name of the reader.
+ * @param blockSize The block size.
+ * @param fileSize The size of the file.
+ * @param cold Drop the file from the page cache first.
+ * @param readBlock Reads a block into the buffer and returns its size, -1 on error.
+ */
+static void runBenchmark(const std::string& name, size_t blockSize, off_t fileSize, bool cold, const std::function<ssize_t(uint16_t, char*)>& readBlock) {
+    std::vector<char> data(blockSize);
+    if (cold) {
+        dropCache();
+    }
+    auto start = std::chrono::steady_clock::now();
+    off_t total = 0;
+    for (uint16_t blockNumber = 1; ; blockNumber++) {
+        ssize_t result = readBlock(blockNumber, data.data());
+        if (result < 0) {
+            std::cerr << "Error reading block " << blockNumber << std::endl;
+            return;
+        }
+        total += result;
+        if ((size_t)result < blockSize) {
+            break;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::setw(14) << name
+              << std::setw(8) << blockSize
+              << std::setw(8) << (cold ? "cold" : "cached")
+              << std::setw(10) << std::fixed << std::setprecision(3) << seconds << " s"
+              << std::setw(10) << std::setprecision(2) << (total / seconds / (1 << 20)) << " MB/s"
+              << std::setw(10) << std::setprecision(2) << (seconds * 1e6 * blockSize / fileSize) << " us/block"
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    off_t fileSize = (argc > 1 ? atol(argv[1]) : 16) << 20;
+
+    int fileFd = open(BENCHMARK_FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::vector<char> data(fileSize);
+    for (off_t i = 0; i < fileSize; i++) {
+        data[i] = (char)rand();
+    }
+    if (fileFd < 0 || write(fileFd, data.data(), data.size()) != (ssize_t)data.size()) {
+        std::cerr << "Error creating benchmark file" << std::endl;
+        return 1;
+    }
+    close(fileFd);
+
+    std::cout << "Reading " << (fileSize >> 20) << " MB block by block" << std::endl;
+    for (size_t blockSize : {(size_t)DEFAULT_BLOCK_SIZE, (size_t)1428, (size_t)8192}) {
+        if (fileSize / blockSize >= UINT16_MAX) {
+            // Block numbers of readDataBlock do not wrap around
+            continue;
+        }
+        for (bool cold : {true, false}) {
+            runBenchmark("readDataBlock", blockSize, fileSize, cold, [&](uint16_t blockNumber, char* block) {
+                size_t dataSize;
+                TFTPPacket::readDataBlock(BENCHMARK_FILE_NAME, blockNumber, block, dataSize, blockSize);
+                return (ssize_t)dataSize;
+            });
+            TFTPBlockReader reader;
+            if (!reader.open(BENCHMARK_FILE_NAME)) {
+                std::cerr << "Error opening benchmark file" << std::endl;
+                return 1;
+            }
+            runBenchmark("BlockReader", blockSize, fileSize, cold, [&](uint16_t blockNumber, char* block) {
+                return reader.readBlock(blockNumber, block, blockSize);
+            });
+        }
+    }
+
+    unlink(BENCHMARK_FILE_NAME);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "TFTPIOEngine.h"
+#include "TFTPPacket.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+/*
+ * Compares the system call and io_uring I/O engines on the RRQ data path.
+ *
+ * Every simulated session reads the same file block by block through the engine and
+ * sends it as a DATA packet over loopback; a plain client socket acknowledges each
+ * block and the engine receives the ACK. The engine side mirrors what the event loop
+ * does per round, so "engine syscalls/block" is the server cost being optimized.
+ *
+ * Usage: ioEngineBenchmark [sessions] [file size in KB]
+ */
+
+struct BenchmarkSession {
+    int serverSocket;
+    int clientSocket;
+    struct sockaddr_in serverAddress;
+    struct sockaddr_in clientAddress;
+    uint32_t blockIndex;
+    size_t dataSize;
+    bool finished;
+    uint8_t packet[MAX_PACKET_SIZE];
+};
+
+/**
+ * @brief Create a non-blocking UDP socket bound to a kernel chosen loopback port.
+ *
+ * @param address Set to the bound address.
+ * @return The socket descriptor.
+ */
+static int createLoopbackSocket(struct sockaddr_in& address) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    address.sin_port = htons(0);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        std::cerr << "Error binding benchmark socket" << std::endl;
+        exit(1);
+    }
+    socklen_t addressLen = sizeof(address);
+    getsockname(sock, (struct sockaddr*)&address, &addressLen);
+    return sock;
+}
+
+/**
+ * @brief Queue the read of the session's current block and the linked DATA send.
+ */
+static void queueBlock(TFTPIOEngine& engine, BenchmarkSession& session, int fileFd, off_t fileSize) {
+    off_t offset = (off_t)(session.blockIndex - 1) * 512;
+    session.dataSize = offset < fileSize ? std::min<off_t>(512, fileSize - offset) : 0;
+    TFTPPacket::createDataPacket(session.packet, (uint16_t)session.blockIndex, "", 0);
+    if (session.dataSize > 0) {
+        engine.prepareRead(fileFd, session.packet + 4, session.dataSize, offset, true, TFTPIOCallback());
+    }
+    engine.prepareSend(session.serverSocket, session.packet, session.dataSize + 4, session.clientAddress);
+}
+
+/**
+ * @brief Transfer the file to every session with the given backend and print the results.
+ */
+static void runBenchmark(int backend, const char* name, int sessionCount, const std::string& filePath, off_t fileSize) {
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(backend));
+    int fileFd = open(filePath.c_str(), O_RDONLY);
+    std::vector<BenchmarkSession> sessions(sessionCount);
+    for (BenchmarkSession& session : sessions) {
+        session.serverSocket = createLoopbackSocket(session.serverAddress);
+        session.clientSocket = createLoopbackSocket(session.clientAddress);
+        fcntl(session.clientSocket, F_SETFL, fcntl(session.clientSocket, F_GETFL) & ~O_NONBLOCK);
+        session.blockIndex = 1;
+        session.finished = false;
+        queueBlock(*engine, session, fileFd, fileSize);
+    }
+
+    uint64_t blocks = 0;
+    int active = sessionCount;
+    auto begin = std::chrono::steady_clock::now();
+    while (active > 0) {
+        engine->submit();
+
+        // Client side: receive the DATA packet and acknowledge it
+        for (BenchmarkSession& session : sessions) {
+            if (session.finished) {
+                continue;
+            }
+            uint8_t buffer[MAX_PACKET_SIZE];
+            if (recv(session.clientSocket, buffer, sizeof(buffer), 0) < 4) {
+                std::cerr << "Error receiving DATA packet" << std::endl;
+                exit(1);
+            }
+            uint8_t ack[4];
+            TFTPPacket::createACKPacket(ack, (buffer[2] << 8) | buffer[3]);
+            sendto(session.clientSocket, ack, sizeof(ack), 0, (struct sockaddr*)&session.serverAddress, sizeof(session.serverAddress));
+        }
+
+        // Server side: receive the ACKs and queue the next blocks
+        for (BenchmarkSession& session : sessions) {
+            if (session.finished) {
+                continue;
+            }
+            BenchmarkSession* current = &session;
+            engine->prepareRecv(session.serverSocket, MAX_PACKET_SIZE, [&, current](const uint8_t* buffer, ssize_t bytesRead, struct sockaddr_in recvAddress) {
+                if (bytesRead < 4) {
+                    std::cerr << "Error receiving ACK packet" << std::endl;
+                    exit(1);
+                }
+                blocks++;
+                if (current->dataSize < 512) {
+                    current->finished = true;
+                    active--;
+                    return;
+                }
+                current->blockIndex++;
+                queueBlock(*engine, *current, fileFd, fileSize);
+            });
+        }
+        engine->submit();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << std::left << std::setw(10) << name
+              << std::right << std::setw(10) << blocks << " blocks"
+              << std::setw(10) << std::fixed << std::setprecision(3) << seconds << " s"
+              << std::setw(10) << std::setprecision(2) << (blocks * 512.0 / seconds / (1 << 20)) << " MB/s"
+              << std::setw(10) << std::setprecision(3) << ((double)engine->getSystemCalls() / blocks) << " engine syscalls/block"
+              << std::endl;
+
+    for (BenchmarkSession& session : sessions) {
+        close(session.serverSocket);
+        close(session.clientSocket);
+    }
+    close(fileFd);
+}
+
+int main(int argc, char* argv[]) {
+    int sessionCount = argc > 1 ? atoi(argv[1]) : 32;
+    off_t fileSize = (argc > 2 ? atol(argv[2]) : 1024) * 1024;
+
+    // Create the file every session reads
+    char filePath[] = "/tmp/tftpIOEngineBenchmarkXXXXXX";
+    int fileFd = mkstemp(filePath);
+    std::vector<char> data(fileSize);
+    for (off_t i = 0; i < fileSize; i++) {
+        data[i] = (char)rand();
+    }
+    if (fileFd < 0 || write(fileFd, data.data(), data.size()) != (ssize_t)data.size()) {
+        std::cerr << "Error creating benchmark file" << std::endl;
+        return 1;
+    }
+    close(fileFd);
+
+    std::cout << sessionCount << " sessions reading " << fileSize / 1024 << " KB each" << std::endl;
+    runBenchmark(IO_BACKEND_SYSCALL, "syscall", sessionCount, filePath, fileSize);
+    runBenchmark(IO_BACKEND_IO_URING, "io_uring", sessionCount, filePath, fileSize);
+    unlink(filePath);
+    return 0;
+}
@@ -0,0 +1,757 @@
+#include "TFTPPacket.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+/*
+ * Loads a running server with thousands of virtual clients over loopback.
+ *
+ * Every virtual client has its own socket and runs one transfer after the other for the
+ * duration of the run, drawing each from a weighted mix of RRQ, WRQ, LS and DELETE. The
+ * clients are spread over a few threads, each driving its clients with epoll, so the
+ * generator costs far less than the server it measures. Reads pick one of the files of
+ * the read set, which are uploaded once before the run as load-<KB>k.bin; writes upload
+ * a file of one of the same sizes under a new name, and deletes remove the oldest upload
+ * of the same client, so the server database does not grow. A DELETE drawn by a client
+ * with no upload left runs a WRQ instead. Uploads still on the server after the run are
+ * deleted.
+ *
+ * Reported per operation: completed transfers and errors (an ERROR packet or no answer
+ * after LOAD_MAX_RETRY retransmissions), transfers/s, payload MB/s, and the 50th, 99th
+ * and 99.9th percentile of the completion latency, from the request to the last packet.
+ * With --server-pid the CPU time the server used during the run is reported too. A
+ * release can be gated with --min-rate and --max-p99-ms: the benchmark then exits with
+ * status 1 if the total rate or the total p99 latency is worse.
+ *
+ * Usage: loadBenchmark [--server IP] [--port N] [--clients N] [--threads N] [--duration S]
+ *                      [--mix RRQ:WRQ:LS:DELETE] [--sizes KB,KB,...] [--blksize N] [--windowsize N]
+ *                      [--timeout-ms MS] [--server-pid PID] [--min-rate N] [--max-p99-ms MS]
+ */
+
+#define LOAD_MAX_RETRY          5   // retransmissions before a transfer counts as an error
+#define LOAD_EPOLL_WAIT_MS      5   // also the granularity of the retransmission timer
+#define LOAD_RECV_BUFFER_SIZE   (1 << 20)
+
+/* Operations, in mix order */
+#define LOAD_RRQ                0
+#define LOAD_WRQ                1
+#define LOAD_LS                 2
+#define LOAD_DELETE             3
+#define LOAD_OPERATION_COUNT    4
+
+static const char* const OPERATION_NAMES[LOAD_OPERATION_COUNT] = {"RRQ", "WRQ", "LS", "DELETE"};
+
+struct LoadConfig {
+    std::string serverIP = "127.0.0.1";
+    int port = 69;
+    int clientCount = 1000;
+    int threadCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+    int durationSeconds = 10;
+    int mix[LOAD_OPERATION_COUNT] = {70, 10, 10, 10};
+    std::vector<size_t> sizes = {1 << 10, 64 << 10, 1 << 20};
+    size_t blockSize = DEFAULT_BLOCK_SIZE;
+    size_t windowSize = 1;
+    int timeoutMs = 1000;
+    pid_t serverPid = 0;
+    double minRate = 0;
+    double maxP99Ms = 0;
+};
+
+/**
+ * @brief Completed transfers of one thread, or of the whole run once merged.
+ */
+struct LoadResults {
+    uint64_t transfers[LOAD_OPERATION_COUNT] = {};
+    uint64_t errors[LOAD_OPERATION_COUNT] = {};
+    uint64_t bytes[LOAD_OPERATION_COUNT] = {};
+    std::vector<int64_t> latencies[LOAD_OPERATION_COUNT];  // ns
+};
+
+/**
+ * @brief A virtual client and the transfer it is running.
+ */
+struct VirtualClient {
+    int sock;
+    int id;
+    unsigned int seed;
+    bool running;
+    int operation;
+    std::string filename;
+    size_t fileSize;                    // size of the upload (WRQ)
+    size_t blockSize;                   // negotiated, the default without an OACK
+    size_t windowSize;
+    struct sockaddr_in address;         // the listener until the server answers from its session port
+    bool tidKnown;
+    bool started;                       // first ACK or OACK received (WRQ)
+    uint32_t expectedBlock;             // next block expected (RRQ, LS)
+    size_t receivedInWindow;
+    uint32_t ackedBlock;                // last block acknowledged (WRQ)
+    uint32_t lastSentBlock;
+    bool finalSent;
+    bool windowResent;
+    uint8_t packet[MAX_PACKET_SIZE];    // request or last ACK, kept for retransmission
+    size_t packetSize;
+    int retries;
+    uint64_t bytes;
+    uint64_t uploadCount;
+    std::deque<std::string> uploads;    // files uploaded and not deleted yet
+    std::chrono::steady_clock::time_point startedAt;
+    std::chrono::steady_clock::time_point sentAt;
+};
+
+static std::vector<char> zeroData(MAX_BLOCK_SIZE);
+
+/**
+ * @brief Create a non-blocking UDP socket bound to a kernel chosen loopback port.
+ */
+static int createClientSocket() {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    address.sin_port = htons(0);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        std::cerr << "Error binding benchmark socket: " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    int receiveBuffer = LOAD_RECV_BUFFER_SIZE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    return sock;
+}
+
+static std::string readSetName(size_t size) {
+    return "load-" + std::to_string(size >> 10) + "k.bin";
+}
+
+static void sendPacket(VirtualClient& client) {
+    sendto(client.sock, client.packet, client.packetSize, 0, (struct sockaddr*)&client.address, sizeof(client.address));
+    client.sentAt = std::chrono::steady_clock::now();
+}
+
+static void sendACK(VirtualClient& client, uint32_t block) {
+    TFTPPacket::createACKPacket(client.packet, (uint16_t)block);
+    client.packetSize = 4;
+    sendPacket(client);
+}
+
+/**
+ * @brief Send the blocks of the upload that follow the last acknowledged one.
+ */
+static void sendWindow(VirtualClient& client) {
+    uint8_t packet[MAX_BLOCK_PACKET_SIZE];
+    client.finalSent = false;
+    for (size_t i = 1; i <= client.windowSize && !client.finalSent; i++) {
+        uint32_t block = client.ackedBlock + i;
+        size_t offset = (size_t)(block - 1) * client.blockSize;
+        size_t dataSize = offset < client.fileSize ? std::min(client.blockSize, client.fileSize - offset) : 0;
+        TFTPPacket::createDataPacket(packet, (uint16_t)block, zeroData.data(), dataSize);
+        sendto(client.sock, packet, dataSize + 4, 0, (struct sockaddr*)&client.address, sizeof(client.address));
+        client.lastSentBlock = block;
+        client.finalSent = dataSize < client.blockSize;
+    }
+    client.sentAt = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Send the request of a transfer.
+ *
+ * @param client A client not running a transfer.
+ * @param config The load configuration.
+ * @param operation One of the LOAD operations.
+ * @param filename The file read, written or deleted, ignored for LS.
+ * @param fileSize The size of the upload (WRQ).
+ * @param listener The server's listener address.
+ */
+static void startOperation(VirtualClient& client, const LoadConfig& config, int operation, const std::string& filename, size_t fileSize,
+                           const struct sockaddr_in& listener) {
+    client.running = true;
+    client.operation = operation;
+    client.filename = filename;
+    client.fileSize = fileSize;
+    client.blockSize = DEFAULT_BLOCK_SIZE;
+    client.windowSize = 1;
+    client.address = listener;
+    client.tidKnown = false;
+    client.started = false;
+    client.expectedBlock = 1;
+    client.receivedInWindow = 0;
+    client.ackedBlock = 0;
+    client.lastSentBlock = 0;
+    client.finalSent = false;
+    client.windowResent = false;
+    client.retries = 0;
+    client.bytes = 0;
+
+    TFTPOptions options;
+    if (config.blockSize != DEFAULT_BLOCK_SIZE) {
+        options[TFTP_OPTION_BLKSIZE] = std::to_string(config.blockSize);
+    }
+    if (config.windowSize != 1) {
+        options[TFTP_OPTION_WINDOWSIZE] = std::to_string(config.windowSize);
+    }
+    if (operation == LOAD_RRQ) {
+        client.packetSize = TFTPPacket::createRRQPacket(client.packet, filename, TFTP_DEFAULT_TRANSFER_MODE, options);
+    }
+    else if (operation == LOAD_WRQ) {
+        client.packetSize = TFTPPacket::createWRQPacket(client.packet, filename, TFTP_DEFAULT_TRANSFER_MODE, options);
+    }
+    else if (operation == LOAD_LS) {
+        TFTPPacket::createLSPacket(client.packet);
+        client.packetSize = 3;
+    }
+    else {
+        TFTPPacket::createDeletePacket(client.packet, filename);
+        client.packetSize = 2 + filename.size() + 1 + strlen(TFTP_DEFAULT_TRANSFER_MODE) + 1;
+    }
+    client.startedAt = std::chrono::steady_clock::now();
+    sendPacket(client);
+}
+
+/**
+ * @brief Draw the next transfer of a client from the mix and start it.
+ */
+static void startRandomOperation(VirtualClient& client, const LoadConfig& config, const struct sockaddr_in& listener) {
+    int total = 0;
+    for (int weight : config.mix) {
+        total += weight;
+    }
+    int draw = rand_r(&client.seed) % total;
+    int operation = 0;
+    while (draw >= config.mix[operation]) {
+        draw -= config.mix[operation++];
+    }
+    if (operation == LOAD_DELETE && client.uploads.empty()) {
+        operation = LOAD_WRQ;
+    }
+    size_t size = config.sizes[rand_r(&client.seed) % config.sizes.size()];
+    if (operation == LOAD_RRQ) {
+        startOperation(client, config, operation, readSetName(size), 0, listener);
+    }
+    else if (operation == LOAD_WRQ) {
+        std::string filename = "load-" + std::to_string(getpid()) + "-" + std::to_string(client.id) + "-" + std::to_string(client.uploadCount++) + ".bin";
+        startOperation(client, config, operation, filename, size, listener);
+    }
+    else if (operation == LOAD_LS) {
+        startOperation(client, config, operation, "", 0, listener);
+    }
+    else {
+        startOperation(client, config, operation, client.uploads.front(), 0, listener);
+    }
+}
+
+/**
+ * @brief End the transfer of a client and count it.
+ */
+static void finishOperation(VirtualClient& client, bool succeeded, LoadResults& results) {
+    client.running = false;
+    if (client.operation == LOAD_WRQ && succeeded) {
+        client.uploads.push_back(client.filename);
+    }
+    else if (client.operation == LOAD_DELETE) {
+        // Deleted, or gone anyway
+        client.uploads.pop_front();
+    }
+    if (!succeeded) {
+        results.errors[client.operation]++;
+        return;
+    }
+    results.transfers[client.operation]++;
+    results.bytes[client.operation] += client.bytes;
+    results.latencies[client.operation].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - client.startedAt).count());
+}
+
+/**
+ * @brief Read the options the server accepted from its OACK.
+ */
+static void applyOACK(VirtualClient& client, const uint8_t* buffer, size_t size) {
+    TFTPOptions accepted;
+    if (!TFTPPacket::parseOptions(buffer, size, 2, accepted)) {
+        return;
+    }
+    if (accepted.count(TFTP_OPTION_BLKSIZE)) {
+        client.blockSize = atol(accepted[TFTP_OPTION_BLKSIZE].c_str());
+    }
+    if (accepted.count(TFTP_OPTION_WINDOWSIZE)) {
+        client.windowSize = atol(accepted[TFTP_OPTION_WINDOWSIZE].c_str());
+    }
+}
+
+/**
+ * @brief Advance the transfer of a client with a datagram it received.
+ */
+static void handleDatagram(VirtualClient& client, const uint8_t* buffer, size_t size, const struct sockaddr_in& from, LoadResults& results) {
+    if (!client.running || size < 4 || from.sin_addr.s_addr != client.address.sin_addr.s_addr) {
+        return;
+    }
+    if (!client.tidKnown) {
+        client.address.sin_port = from.sin_port;
+        client.tidKnown = true;
+    }
+    else if (from.sin_port != client.address.sin_port) {
+        return;
+    }
+    uint16_t opcode = (buffer[0] << 8) | buffer[1];
+    uint16_t blockNumber = (buffer[2] << 8) | buffer[3];
+    if (opcode == TFTP_OPCODE_ERROR) {
+        finishOperation(client, false, results);
+        return;
+    }
+    client.retries = 0;
+    if (client.operation == LOAD_DELETE) {
+        finishOperation(client, opcode == TFTP_OPCODE_ACK, results);
+    }
+    else if (client.operation == LOAD_WRQ) {
+        if (!client.started) {
+            if (opcode == TFTP_OPCODE_OACK) {
+                applyOACK(client, buffer, size);
+            }
+            else if (opcode != TFTP_OPCODE_ACK || blockNumber != 0) {
+                return;
+            }
+            client.started = true;
+            sendWindow(client);
+            return;
+        }
+        if (opcode != TFTP_OPCODE_ACK) {
+            return;
+        }
+        // Widen the 16 bit block number, relative to the last acknowledged block
+        uint32_t acked = client.ackedBlock + (uint16_t)(blockNumber - (uint16_t)client.ackedBlock);
+        if (acked == client.ackedBlock && client.windowSize > 1 && !client.windowResent) {
+            // The first block of the window was lost
+            client.windowResent = true;
+            sendWindow(client);
+            return;
+        }
+        if (acked <= client.ackedBlock || acked > client.lastSentBlock) {
+            return;
+        }
+        client.bytes += std::min<size_t>(client.fileSize, (size_t)acked * client.blockSize) - std::min<size_t>(client.fileSize, (size_t)client.ackedBlock * client.blockSize);
+        if (client.finalSent && acked == client.lastSentBlock) {
+            finishOperation(client, true, results);
+            return;
+        }
+        client.ackedBlock = acked;
+        client.windowResent = false;
+        sendWindow(client);
+    }
+    else {
+        if (opcode == TFTP_OPCODE_OACK && client.expectedBlock == 1) {
+            applyOACK(client, buffer, size);
+            sendACK(client, 0);
+            return;
+        }
+        if (opcode != TFTP_OPCODE_DATA) {
+            return;
+        }
+        if (blockNumber != (uint16_t)client.expectedBlock) {
+            // Lost or repeated block, the server resumes after the last block received in order
+            if (client.receivedInWindow > 0 || blockNumber == (uint16_t)(client.expectedBlock - 1)) {
+                client.receivedInWindow = 0;
+                sendACK(client, client.expectedBlock - 1);
+            }
+            return;
+        }
+        size_t dataSize = size - 4;
+        client.bytes += dataSize;
+        bool finalBlock = dataSize < client.blockSize;
+        if (++client.receivedInWindow == client.windowSize || finalBlock) {
+            sendACK(client, client.expectedBlock);
+            client.receivedInWindow = 0;
+        }
+        client.expectedBlock++;
+        if (finalBlock) {
+            finishOperation(client, true, results);
+        }
+    }
+}
+
+/**
+ * @brief Retransmit for a client whose answer is late, or give its transfer up.
+ */
+static void handleTimeout(VirtualClient& client, LoadResults& results) {
+    if (++client.retries > LOAD_MAX_RETRY) {
+        finishOperation(client, false, results);
+        return;
+    }
+    if (client.operation == LOAD_WRQ && client.started) {
+        sendWindow(client);
+    }
+    else {
+        // The request, or the last ACK which makes the server resume after it
+        if (client.operation != LOAD_WRQ && client.operation != LOAD_DELETE && client.expectedBlock > 1) {
+            client.receivedInWindow = 0;
+            sendACK(client, client.expectedBlock - 1);
+        }
+        else {
+            sendPacket(client);
+        }
+    }
+}
+
+/**
+ * @brief Receive every datagram waiting on the socket of a client.
+ */
+static void receiveDatagrams(VirtualClient& client, std::vector<uint8_t>& buffer, LoadResults& results) {
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+        ssize_t size = recvfrom(client.sock, buffer.data(), buffer.size(), 0, (struct sockaddr*)&from, &fromLen);
+        if (size < 0) {
+            return;
+        }
+        handleDatagram(client, buffer.data(), size, from, results);
+    }
+}
+
+/**
+ * @brief Run one transfer of a client alone and wait for its end, outside of the measured run.
+ *
+ * @return true if the transfer succeeded.
+ */
+static bool runOperation(VirtualClient& client, const LoadConfig& config, int operation, const std::string& filename, size_t fileSize,
+                         const struct sockaddr_in& listener) {
+    LoadResults results;
+    std::vector<uint8_t> buffer(MAX_BLOCK_PACKET_SIZE);
+    startOperation(client, config, operation, filename, fileSize, listener);
+    while (client.running) {
+        struct pollfd ready = {client.sock, POLLIN, 0};
+        if (poll(&ready, 1, config.timeoutMs) > 0) {
+            receiveDatagrams(client, buffer, results);
+        }
+        else {
+            handleTimeout(client, results);
+        }
+    }
+    return results.transfers[operation] == 1;
+}
+
+/**
+ * @brief Drive the clients of one thread until the deadline.
+ */
+static void runClients(VirtualClient* clients, size_t count, const LoadConfig& config, const struct sockaddr_in& listener,
+                       std::chrono::steady_clock::time_point deadline, LoadResults& results) {
+    int epollFd = epoll_create1(0);
+    for (size_t i = 0; i < count; i++) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].sock, &event);
+        startRandomOperation(clients[i], config, listener);
+    }
+    std::vector<uint8_t> buffer(MAX_BLOCK_PACKET_SIZE);
+    std::vector<struct epoll_event> events(count);
+    std::chrono::milliseconds timeout(config.timeoutMs);
+    std::chrono::steady_clock::time_point lastScan = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() < deadline) {
+        int ready = epoll_wait(epollFd, events.data(), events.size(), LOAD_EPOLL_WAIT_MS);
+        for (int i = 0; i < ready; i++) {
+            VirtualClient& client = clients[events[i].data.u64];
+            receiveDatagrams(client, buffer, results);
+            if (!client.running) {
+                startRandomOperation(client, config, listener);
+            }
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - lastScan < std::chrono::milliseconds(LOAD_EPOLL_WAIT_MS)) {
+            continue;
+        }
+        lastScan = now;
+        for (size_t i = 0; i < count; i++) {
+            if (clients[i].running && now - clients[i].sentAt >= timeout) {
+                handleTimeout(clients[i], results);
+                if (!clients[i].running) {
+                    startRandomOperation(clients[i], config, listener);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        // Cut short by the deadline: an upload may still complete
+        if (clients[i].running && clients[i].operation == LOAD_WRQ) {
+            clients[i].uploads.push_back(clients[i].filename);
+        }
+        clients[i].running = false;
+    }
+    close(epollFd);
+}
+
+/**
+ * @brief CPU time used by a process so far, from /proc.
+ *
+ * @return The user and system time in seconds, or a negative value if it cannot be read.
+ */
+static double readProcessCPU(pid_t pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t end = stat.rfind(')');
+    if (end == std::string::npos) {
+        return -1;
+    }
+    // Fields after the command name start with the state, utime and stime are the 12th and 13th
+    std::istringstream fields(stat.substr(end + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 0; i < 13 && fields >> field; i++) {
+        if (i == 11) {
+            utime = std::stoull(field);
+        }
+        else if (i == 12) {
+            stime = std::stoull(field);
+        }
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double readOwnCPU() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/**
+ * @param latencies Sorted latencies in ns.
+ * @param percentile Between 0 and 100.
+ * @return The percentile in ms, 0 if there is no latency.
+ */
+static double getPercentileMs(const std::vector<int64_t>& latencies, double percentile) {
+    if (latencies.empty()) {
+        return 0;
+    }
+    size_t rank = std::max<size_t>(1, (size_t)std::ceil(percentile / 100 * latencies.size()));
+    return latencies[rank - 1] / 1e6;
+}
+
+static void printRow(const std::string& name, uint64_t transfers, uint64_t errors, uint64_t bytes, const std::vector<int64_t>& latencies, double seconds) {
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::setw(11) << transfers
+              << std::setw(9) << errors
+              << std::setw(14) << std::fixed << std::setprecision(1) << transfers / seconds
+              << std::setw(10) << std::setprecision(2) << bytes / seconds / (1 << 20)
+              << std::setw(10) << std::setprecision(3) << getPercentileMs(latencies, 50)
+              << std::setw(10) << getPercentileMs(latencies, 99)
+              << std::setw(10) << getPercentileMs(latencies, 99.9)
+              << std::endl;
+}
+
+static bool parseArguments(int argc, char* argv[], LoadConfig& config) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--server") {
+            config.serverIP = value;
+        }
+        else if (arg == "--port") {
+            config.port = atoi(value.c_str());
+        }
+        else if (arg == "--clients") {
+            config.clientCount = atoi(value.c_str());
+        }
+        else if (arg == "--threads") {
+            config.threadCount = atoi(value.c_str());
+        }
+        else if (arg == "--duration") {
+            config.durationSeconds = atoi(value.c_str());
+        }
+        else if (arg == "--mix") {
+            int total = 0;
+            std::istringstream weights(value);
+            std::string weight;
+            for (int j = 0; j < LOAD_OPERATION_COUNT; j++) {
+                if (!std::getline(weights, weight, ':')) {
+                    return false;
+                }
+                config.mix[j] = atoi(weight.c_str());
+                if (config.mix[j] < 0) {
+                    return false;
+                }
+                total += config.mix[j];
+            }
+            if (total == 0) {
+                return false;
+            }
+        }
+        else if (arg == "--sizes") {
+            config.sizes.clear();
+            std::istringstream sizes(value);
+            std::string size;
+            while (std::getline(sizes, size, ',')) {
+                config.sizes.push_back((size_t)atol(size.c_str()) << 10);
+            }
+            if (config.sizes.empty()) {
+                return false;
+            }
+        }
+        else if (arg == "--blksize") {
+            config.blockSize = atol(value.c_str());
+            if (config.blockSize < MIN_BLOCK_SIZE || config.blockSize > MAX_BLOCK_SIZE) {
+                return false;
+            }
+        }
+        else if (arg == "--windowsize") {
+            config.windowSize = atol(value.c_str());
+        }
+        else if (arg == "--timeout-ms") {
+            config.timeoutMs = atoi(value.c_str());
+        }
+        else if (arg == "--server-pid") {
+            config.serverPid = atoi(value.c_str());
+        }
+        else if (arg == "--min-rate") {
+            config.minRate = atof(value.c_str());
+        }
+        else if (arg == "--max-p99-ms") {
+            config.maxP99Ms = atof(value.c_str());
+        }
+        else {
+            return false;
+        }
+    }
+    return config.clientCount > 0 && config.threadCount > 0 && config.durationSeconds > 0 && config.windowSize > 0 && config.timeoutMs > 0;
+}
+
+int main(int argc, char* argv[]) {
+    LoadConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cout << "Usage: " << argv[0] << " [--server IP] [--port N] [--clients N] [--threads N] [--duration S]"
+                  << " [--mix RRQ:WRQ:LS:DELETE] [--sizes KB,KB,...] [--blksize N] [--windowsize N]"
+                  << " [--timeout-ms MS] [--server-pid PID] [--min-rate N] [--max-p99-ms MS]" << std::endl;
+        return 1;
+    }
+    config.threadCount = std::min(config.threadCount, config.clientCount);
+
+    // One socket per client
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if ((rlim_t)config.clientCount + 64 > limit.rlim_cur) {
+        std::cerr << "Error: " << config.clientCount << " clients need more than the " << limit.rlim_cur << " descriptors allowed" << std::endl;
+        return 1;
+    }
+
+    struct sockaddr_in listener;
+    memset(&listener, 0, sizeof(listener));
+    listener.sin_family = AF_INET;
+    listener.sin_addr.s_addr = inet_addr(config.serverIP.c_str());
+    listener.sin_port = htons(config.port);
+
+    std::vector<VirtualClient> clients(config.clientCount);
+    for (int i = 0; i < config.clientCount; i++) {
+        clients[i].sock = createClientSocket();
+        clients[i].id = i;
+        clients[i].seed = i + 1;
+        clients[i].running = false;
+        clients[i].uploadCount = 0;
+    }
+
+    // Upload the read set, a file left by an earlier run is kept
+    for (size_t size : config.sizes) {
+        if (!runOperation(clients[0], config, LOAD_WRQ, readSetName(size), size, listener) && clients[0].retries > LOAD_MAX_RETRY) {
+            std::cerr << "Error: no answer from " << config.serverIP << ":" << config.port << std::endl;
+            return 1;
+        }
+    }
+    clients[0].uploads.clear();
+
+    std::cout << config.clientCount << " clients on " << config.threadCount << " threads for " << config.durationSeconds << " s against "
+              << config.serverIP << ":" << config.port << ", mix";
+    for (int i = 0; i < LOAD_OPERATION_COUNT; i++) {
+        std::cout << " " << OPERATION_NAMES[i] << " " << config.mix[i];
+    }
+    std::cout << ", sizes";
+    for (size_t size : config.sizes) {
+        std::cout << " " << (size >> 10);
+    }
+    std::cout << " KB, blksize " << config.blockSize << ", windowsize " << config.windowSize << std::endl;
+
+    double serverCPU = config.serverPid > 0 ? readProcessCPU(config.serverPid) : -1;
+    double ownCPU = readOwnCPU();
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = begin + std::chrono::seconds(config.durationSeconds);
+    std::vector<LoadResults> threadResults(config.threadCount);
+    std::vector<std::thread> threads;
+    size_t first = 0;
+    for (int i = 0; i < config.threadCount; i++) {
+        size_t count = config.clientCount / config.threadCount + (i < config.clientCount % config.threadCount ? 1 : 0);
+        threads.emplace_back(runClients, &clients[first], count, std::cref(config), std::cref(listener), deadline, std::ref(threadResults[i]));
+        first += count;
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (serverCPU >= 0) {
+        serverCPU = readProcessCPU(config.serverPid) - serverCPU;
+    }
+    ownCPU = readOwnCPU() - ownCPU;
+
+    LoadResults total;
+    for (LoadResults& results : threadResults) {
+        for (int i = 0; i < LOAD_OPERATION_COUNT; i++) {
+            total.transfers[i] += results.transfers[i];
+            total.errors[i] += results.errors[i];
+            total.bytes[i] += results.bytes[i];
+            total.latencies[i].insert(total.latencies[i].end(), results.latencies[i].begin(), results.latencies[i].end());
+        }
+    }
+    std::cout << std::left << std::setw(10) << "operation" << std::right << std::setw(11) << "transfers" << std::setw(9) << "errors"
+              << std::setw(14) << "transfers/s" << std::setw(10) << "MB/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+              << std::setw(10) << "p999 ms" << std::endl;
+    uint64_t transfers = 0, errors = 0, bytes = 0;
+    std::vector<int64_t> latencies;
+    for (int i = 0; i < LOAD_OPERATION_COUNT; i++) {
+        std::sort(total.latencies[i].begin(), total.latencies[i].end());
+        printRow(OPERATION_NAMES[i], total.transfers[i], total.errors[i], total.bytes[i], total.latencies[i], seconds);
+        transfers += total.transfers[i];
+        errors += total.errors[i];
+        bytes += total.bytes[i];
+        latencies.insert(latencies.end(), total.latencies[i].begin(), total.latencies[i].end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printRow("total", transfers, errors, bytes, latencies, seconds);
+    if (serverCPU >= 0) {
+        std::cout << "server CPU " << std::setprecision(1) << serverCPU / seconds * 100 << " %, ";
+    }
+    std::cout << "generator CPU " << std::setprecision(1) << ownCPU / seconds * 100 << " %" << std::endl;
+
+    // Leave the server database as it was, but for the read set
+    for (VirtualClient& client : clients) {
+        while (!client.uploads.empty()) {
+            runOperation(client, config, LOAD_DELETE, client.uploads.front(), 0, listener);
+        }
+        close(client.sock);
+    }
+
+    bool passed = true;
+    if (config.minRate > 0 && transfers / seconds < config.minRate) {
+        std::cerr << "Error: " << transfers / seconds << " transfers/s is below " << config.minRate << std::endl;
+        passed = false;
+    }
+    if (config.maxP99Ms > 0 && getPercentileMs(latencies, 99) > config.maxP99Ms) {
+        std::cerr << "Error: p99 latency " << getPercentileMs(latencies, 99) << " ms is above " << config.maxP99Ms << " ms" << std::endl;
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+#include "TFTPSession.h"
+#include "TFTPIOEngine.h"
+#include "TFTPPacket.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+/*
+ * Measures RRQ throughput against the negotiated window size (RFC 7440).
+ *
+ * A TFTPSession sends the file over loopback from its own thread, driven the same way
+ * as in the thread server mode. The client side acknowledges the last block of every
+ * window, or the last block received in order after a loss. Loopback has almost no
+ * round trip time, so the client can wait before every ACK to emulate a network RTT.
+ *
+ * Usage: windowBenchmark [file size in MB] [rtt in us] [blksize]
+ */
+
+static const char* BENCHMARK_FILE_NAME = "window.bin";
+
+/**
+ * @brief Create a UDP socket bound to a kernel chosen loopback port.
+ *
+ * @param address Set to the bound address.
+ * @param timeoutMs Receive timeout in milliseconds.
+ * @return The socket descriptor.
+ */
+static int createLoopbackSocket(struct sockaddr_in& address, int timeoutMs) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    address.sin_port = htons(0);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        std::cerr << "Error binding benchmark socket" << std::endl;
+        exit(1);
+    }
+    socklen_t addressLen = sizeof(address);
+    getsockname(sock, (struct sockaddr*)&address, &addressLen);
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int receiveBuffer = 8 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    return sock;
+}
+
+/**
+ * @brief Drive the session until it finishes, as TFTPServer::runSession does.
+ */
+static void runSession(TFTPSession& session, TFTPIOEngine& engine) {
+    session.start();
+    engine.submit();
+    std::vector<uint8_t> buffer(session.getMaxPacketSize() + 1);
+    while (!session.isFinished()) {
+        struct sockaddr_in recvAddress;
+        socklen_t recvAddressLen = sizeof(recvAddress);
+        int bytesRead = recvfrom(session.getSocket(), buffer.data(), buffer.size(), 0, (struct sockaddr*)&recvAddress, &recvAddressLen);
+        if (bytesRead < 0) {
+            session.handleTimeout();
+        }
+        else {
+            session.handlePacket(buffer.data(), bytesRead, recvAddress);
+        }
+        engine.submit();
+    }
+}
+
+/**
+ * @brief Send an ACK for the block, after the emulated round trip time.
+ */
+static void sendACK(int sock, uint16_t blockNumber, const struct sockaddr_in& address, int rttMicros) {
+    if (rttMicros > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(rttMicros));
+    }
+    uint8_t ack[4];
+    TFTPPacket::createACKPacket(ack, blockNumber);
+    sendto(sock, ack, sizeof(ack), 0, (struct sockaddr*)&address, sizeof(address));
+}
+
+/**
+ * @brief Download the file with the given window size and print the throughput.
+ */
+static void runBenchmark(size_t windowSize, size_t blockSize, int rttMicros, off_t fileSize) {
+    TFTPFileIndex files;
+    files.insert(BENCHMARK_FILE_NAME, fileSize, timespec{0, 0});
+
+    struct sockaddr_in sessionAddress;
+    struct sockaddr_in clientAddress;
+    int sessionSocket = createLoopbackSocket(sessionAddress, 1000);
+    int clientSocket = createLoopbackSocket(clientAddress, 5000);
+
+    TFTPOptions options;
+    options[TFTP_OPTION_BLKSIZE] = std::to_string(blockSize);
+    options[TFTP_OPTION_WINDOWSIZE] = std::to_string(windowSize);
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(IO_BACKEND_SYSCALL));
+    TFTPSession session(*engine, sessionSocket, 0, TFTP_OPCODE_RRQ, BENCHMARK_FILE_NAME, options, clientAddress, files);
+
+    auto begin = std::chrono::steady_clock::now();
+    std::thread sender([&session, &engine]() {
+        runSession(session, *engine);
+    });
+
+    std::vector<uint8_t> buffer(blockSize + 4);
+    uint16_t expectedBlockNumber = 1;
+    size_t receivedInWindow = 0;
+    uint64_t blocks = 0;
+    uint64_t acks = 0;
+    bool done = false;
+    while (!done) {
+        ssize_t bytesRead = recv(clientSocket, buffer.data(), buffer.size(), 0);
+        if (bytesRead < 4) {
+            std::cerr << "Error receiving DATA packet" << std::endl;
+            exit(1);
+        }
+        uint16_t opcode = (buffer[0] << 8) | buffer[1];
+        uint16_t blockNumber = (buffer[2] << 8) | buffer[3];
+        if (opcode == TFTP_OPCODE_OACK) {
+            sendACK(clientSocket, 0, sessionAddress, rttMicros);
+            acks++;
+            continue;
+        }
+        if (opcode != TFTP_OPCODE_DATA) {
+            std::cerr << "Unexpected opcode " << opcode << std::endl;
+            exit(1);
+        }
+        if (blockNumber != expectedBlockNumber) {
+            sendACK(clientSocket, expectedBlockNumber - 1, sessionAddress, rttMicros);
+            acks++;
+            receivedInWindow = 0;
+            continue;
+        }
+        blocks++;
+        expectedBlockNumber++;
+        done = (size_t)bytesRead - 4 < blockSize;
+        if (++receivedInWindow == windowSize || done) {
+            sendACK(clientSocket, blockNumber, sessionAddress, rttMicros);
+            acks++;
+            receivedInWindow = 0;
+        }
+    }
+    sender.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << std::setw(8) << windowSize
+              << std::setw(10) << blocks << " blocks"
+              << std::setw(10) << acks << " acks"
+              << std::setw(10) << std::fixed << std::setprecision(3) << seconds << " s"
+              << std::setw(10) << std::setprecision(2) << (fileSize / seconds / (1 << 20)) << " MB/s"
+              << std::endl;
+
+    close(sessionSocket);
+    close(clientSocket);
+}
+
+int main(int argc, char* argv[]) {
+    off_t fileSize = (argc > 1 ? atol(argv[1]) : 16) << 20;
+    int rttMicros = argc > 2 ? atoi(argv[2]) : 100;
+    size_t blockSize = argc > 3 ? atol(argv[3]) : DEFAULT_BLOCK_SIZE;
+
+    // The session reads from serverDatabase/ in the working directory
+    char directory[] = "/tmp/tftpWindowBenchmarkXXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) < 0 || mkdir("serverDatabase", 0755) < 0) {
+        std::cerr << "Error creating benchmark directory" << std::endl;
+        return 1;
+    }
+    std::string filePath = std::string("serverDatabase/") + BENCHMARK_FILE_NAME;
+    int fileFd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::vector<char> data(fileSize);
+    for (off_t i = 0; i < fileSize; i++) {
+        data[i] = (char)rand();
+    }
+    if (fileFd < 0 || write(fileFd, data.data(), data.size()) != (ssize_t)data.size()) {
+        std::cerr << "Error creating benchmark file" << std::endl;
+        return 1;
+    }
+    close(fileFd);
+
+    std::cout << "RRQ of " << (fileSize >> 20) << " MB, blksize " << blockSize << ", emulated RTT " << rttMicros << " us" << std::endl;
+    std::cout << std::setw(8) << "window" << std::endl;
+    for (size_t windowSize = 1; windowSize <= SESSION_MAX_WINDOW_SIZE; windowSize *= 2) {
+        runBenchmark(windowSize, blockSize, rttMicros, fileSize);
+    }
+
+    unlink(filePath.c_str());
+    rmdir("serverDatabase");
+    chdir("/");
+    rmdir(directory);
+    return 0;
+}
@@ -1,5 +1,29 @@
 #include <gtest/gtest.h>
 #include "TFTPPacket.h"
+#include "TFTPTimerWheel.h"
+#include "TFTPBlockReader.h"
+#include "TFTPFileCache.h"
+#include "TFTPPacketCache.h"
+#include "TFTPFileIndex.h"
+#include "TFTPFileWatcher.h"
+#include "TFTPFileWriter.h"
+#include "TFTPFileCommitter.h"
+#include "TFTPLogger.h"
+#include "TFTPMetrics.h"
+#include "TFTPTransferTrace.h"
+#include "TFTPSession.h"
+#include "TFTPIOEngine.h"
+#include "TFTPMappingGuard.h"
+#include "TFTPRetransmitTimer.h"
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+#include <arpa/inet.h>
 
 TEST(tftpTests, Test1){
     
@@ -9,7 +33,7 @@ TEST(tftpTests, Test1){
 
     uint8_t expected[10];
     expected[0] = 0x00;
-    expected[1] = 0x07;
+    expected[1] = 0x15;
     expected[2] = 0x00;
 
     ASSERT_EQ(memcmp(expected, buffer, 3), 0);
@@ -268,7 +292,7 @@ TEST(tftpTests, Test13){
  
     uint8_t expected[packetSize];
     expected[0] = 0x00;
-    expected[1] = 0x06;
+    expected[1] = 0x14;
     memcpy(expected+2, data.c_str(), data.length());
     expected[2+data.length()]=0x00;
     memcpy(expected +2 + data.length()+1, mode.c_str(), mode.length());
@@ -283,3 +307,787 @@ TEST(tftpTests, Test13){
 
 
 
+
+TEST(tftpTests, Test14){ 
+
+    TFTPOptions options;
+    options["timeout"] = "3";
+    uint8_t funcResult[20];
+
+    size_t packetSize = TFTPPacket::createOACKPacket(funcResult, options);
+
+    uint8_t expected[] = {0x00, 0x06, 't', 'i', 'm', 'e', 'o', 'u', 't', 0x00, '3', 0x00};
+
+    ASSERT_EQ(packetSize, sizeof(expected));
+    ASSERT_EQ(memcmp(funcResult, expected, packetSize), 0);
+}
+
+TEST(tftpTests, Test15){ 
+
+    TFTPOptions options;
+    options["tsize"] = "0";
+    uint8_t packet[64];
+    size_t packetSize = TFTPPacket::createRRQPacket(packet, "file.txt", "octet", options);
+
+    TFTPOptions parsed;
+    size_t offset = 2 + strlen("file.txt") + 1 + strlen("octet") + 1;
+
+    ASSERT_TRUE(TFTPPacket::parseOptions(packet, packetSize, offset, parsed));
+    ASSERT_EQ(parsed, options);
+    ASSERT_FALSE(TFTPPacket::parseOptions(packet, packetSize - 1, offset, parsed));
+}
+
+TEST(tftpTests, Test16){ 
+
+    uint64_t value = 0;
+
+    ASSERT_TRUE(TFTPPacket::parseOptionValue("255", 1, 255, value));
+    ASSERT_EQ(value, 255u);
+    ASSERT_FALSE(TFTPPacket::parseOptionValue("256", 1, 255, value));
+    ASSERT_FALSE(TFTPPacket::parseOptionValue("0", 1, 255, value));
+    ASSERT_FALSE(TFTPPacket::parseOptionValue("3s", 1, 255, value));
+    ASSERT_FALSE(TFTPPacket::parseOptionValue("", 1, 255, value));
+}
+
+TEST(tftpTests, Test17){ 
+
+    std::string filename = "blksizeTest.bin";
+    std::string content = "0123456789abcdefXYZ";
+    FILE* file = fopen(filename.c_str(), "wb");
+    fwrite(content.c_str(), 1, content.length(), file);
+    fclose(file);
+
+    char data[16];
+    size_t dataSize = 0;
+    size_t second = TFTPPacket::readDataBlock(filename, 2, data, dataSize, 16);
+    size_t third = TFTPPacket::readDataBlock(filename, 3, data, dataSize, 8);
+    remove(filename.c_str());
+
+    ASSERT_EQ(second, 3u);
+    ASSERT_EQ(third, 3u);
+    ASSERT_EQ(memcmp(data, "XYZ", 3), 0);
+}
+
+TEST(tftpTests, Test18){ 
+
+    TFTPTimerWheel timers;
+    auto now = std::chrono::steady_clock::now();
+    std::vector<int> expired;
+    timers.schedule(3, now + std::chrono::milliseconds(10));
+    timers.schedule(7, now + std::chrono::milliseconds(400));
+    timers.schedule(5, now + std::chrono::seconds(70));
+    timers.schedule(9, now + std::chrono::milliseconds(20));
+    timers.cancel(9);
+
+    ASSERT_EQ(timers.size(), 3u);
+    ASSERT_EQ(timers.expire(now + std::chrono::milliseconds(5), expired), 0u);
+    ASSERT_EQ(timers.expire(now + std::chrono::milliseconds(11), expired), 1u);
+    ASSERT_EQ(expired, std::vector<int>({3}));
+    ASSERT_EQ(timers.expire(now + std::chrono::milliseconds(399), expired), 0u);
+    ASSERT_EQ(timers.expire(now + std::chrono::milliseconds(401), expired), 1u);
+    ASSERT_EQ(timers.expire(now + std::chrono::seconds(69), expired), 0u);
+    ASSERT_EQ(timers.expire(now + std::chrono::seconds(71), expired), 1u);
+    ASSERT_EQ(expired, std::vector<int>({3, 7, 5}));
+    ASSERT_EQ(timers.size(), 0u);
+}
+
+TEST(tftpTests, Test19){ 
+
+    TFTPTimerWheel timers;
+    auto now = std::chrono::steady_clock::now();
+    std::vector<int> expired;
+    timers.schedule(1, now + std::chrono::seconds(1));
+    timers.schedule(1, now + std::chrono::milliseconds(50));
+    timers.schedule(2, now - std::chrono::seconds(1));
+
+    ASSERT_TRUE(timers.isScheduled(1));
+    ASSERT_LE(timers.nextExpiry(), now + std::chrono::milliseconds(2));
+    ASSERT_EQ(timers.expire(now + std::chrono::milliseconds(2), expired), 1u);
+    ASSERT_EQ(expired, std::vector<int>({2}));
+    ASSERT_GE(timers.nextExpiry(), now + std::chrono::milliseconds(50));
+    ASSERT_EQ(timers.expire(now + std::chrono::milliseconds(51), expired), 1u);
+    ASSERT_FALSE(timers.isScheduled(1));
+    ASSERT_EQ(timers.nextExpiry(), std::chrono::steady_clock::time_point::max());
+}
+
+TEST(tftpTests, Test20){ 
+
+    std::string filename = "blockReaderTest.bin";
+    std::string content = "0123456789abcdefXYZ";
+    FILE* file = fopen(filename.c_str(), "wb");
+    fwrite(content.c_str(), 1, content.length(), file);
+    fclose(file);
+
+    TFTPBlockReader reader;
+    ASSERT_TRUE(reader.open(filename));
+    remove(filename.c_str());
+
+    char data[16];
+    ASSERT_EQ(reader.getSize(), 19);
+    ASSERT_EQ(reader.readBlock(2, data, 16), 3);
+    ASSERT_EQ(memcmp(data, "XYZ", 3), 0);
+    ASSERT_EQ(reader.readBlock(1, data, 16), 16);
+    ASSERT_EQ(memcmp(data, "0123456789abcdef", 16), 0);
+    ASSERT_EQ(reader.readBlock(3, data, 16), 0);
+    ASSERT_FALSE(reader.open("missingBlockReaderTest.bin"));
+    ASSERT_FALSE(reader.isOpen());
+}
+
+TEST(tftpTests, Test21){ 
+
+    std::string first = "fileCacheFirst.bin";
+    std::string second = "fileCacheSecond.bin";
+    FILE* file = fopen(first.c_str(), "wb");
+    fwrite("first file", 1, 10, file);
+    fclose(file);
+    file = fopen(second.c_str(), "wb");
+    fwrite("second file", 1, 11, file);
+    fclose(file);
+
+    // Room for one of the files once nothing reads them
+    TFTPFileCache cache(16);
+    auto reader = cache.acquire(first);
+    ASSERT_TRUE(reader != nullptr);
+    ASSERT_EQ(memcmp(reader->data, "first file", 10), 0);
+    ASSERT_EQ(cache.acquire(first), reader);
+    auto secondReader = cache.acquire(second);
+    ASSERT_EQ(cache.getStats().files, 2u);
+
+    // Evicted once it is no longer read, its reader keeps the mapping until then
+    secondReader.reset();
+    cache.invalidate(first);
+    ASSERT_EQ(memcmp(reader->data, "first file", 10), 0);
+    ASSERT_NE(cache.acquire(first), reader);
+    ASSERT_EQ(cache.getStats().files, 1u);
+    ASSERT_TRUE(cache.acquire("missingFileCache.bin") == nullptr);
+    remove(first.c_str());
+    remove(second.c_str());
+
+    TFTPFileCacheStats stats = cache.getStats();
+    ASSERT_EQ(stats.lookups, 4u);
+    ASSERT_EQ(stats.hits, 1u);
+    ASSERT_EQ(stats.evictions, 1u);
+    ASSERT_EQ(stats.invalidations, 1u);
+}
+
+TEST(tftpTests, Test22){ 
+
+    std::string filename = "packetCacheTest.bin";
+    FILE* file = fopen(filename.c_str(), "wb");
+    fwrite("0123456789abcdefXYZ", 1, 19, file);
+    fclose(file);
+
+    TFTPFileCache files;
+    auto mapped = files.acquire(filename);
+    remove(filename.c_str());
+    ASSERT_TRUE(mapped != nullptr);
+
+    // Hot from the second read
+    TFTPPacketCache cache(1 << 20, 2);
+    ASSERT_TRUE(cache.acquire(*mapped, 8) == nullptr);
+    auto image = cache.acquire(*mapped, 8);
+    ASSERT_TRUE(image != nullptr);
+    ASSERT_EQ(image->getPacketSize(2), 12u);
+    ASSERT_EQ(image->getPacketSize(3), 7u);
+    uint8_t expected[] = {0x00, 0x03, 0x00, 0x03, 'X', 'Y', 'Z'};
+    ASSERT_EQ(memcmp(image->getPacket(3), expected, sizeof(expected)), 0);
+    ASSERT_EQ(cache.acquire(*mapped, 8), image);
+
+    // Another block size is another image
+    ASSERT_TRUE(cache.acquire(*mapped, 16) != nullptr);
+    cache.invalidate(filename);
+    TFTPPacketCacheStats stats = cache.getStats();
+    ASSERT_EQ(stats.images, 0u);
+    ASSERT_EQ(stats.builds, 2u);
+    ASSERT_EQ(stats.hits, 1u);
+}
+
+TEST(tftpTests, Test23){ 
+
+    TFTPFileIndex files;
+    ASSERT_TRUE(files.insert("boot.img", 0, {}));
+    ASSERT_FALSE(files.insert("boot.img", 0, {}));
+    ASSERT_FALSE(files.acquireReader("missing.img"));
+
+    // Readers of the same file from many threads
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 8; i++) {
+        readers.emplace_back([&files]() {
+            for (int j = 0; j < 10000; j++) {
+                files.acquireReader("boot.img");
+                files.releaseReader("boot.img");
+            }
+            files.acquireReader("boot.img");
+        });
+    }
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(files.getReaders("boot.img"), 8);
+
+    bool removed = false;
+    ASSERT_EQ(files.remove("boot.img", [&removed]() { removed = true; return true; }), FILE_INDEX_BUSY);
+    for (int i = 0; i < 8; i++) {
+        files.releaseReader("boot.img");
+    }
+    files.insert("a.img", 0, {});
+    ASSERT_EQ(files.remove("a.img", []() { return false; }), FILE_INDEX_FAILED);
+    ASSERT_EQ(files.remove("boot.img", [&removed]() { removed = true; return true; }), FILE_INDEX_REMOVED);
+    ASSERT_TRUE(removed);
+    ASSERT_EQ(files.remove("boot.img", []() { return true; }), FILE_INDEX_NOT_FOUND);
+    ASSERT_EQ(files.snapshot().size(), 1u);
+    ASSERT_EQ(files.snapshot()[0].name, "a.img");
+}
+
+TEST(tftpTests, Test24){ 
+
+    std::string snapshotPath = "fileIndexTest.index";
+    struct timespec version = {1700000000, 42};
+    TFTPFileIndex files;
+    files.insert("boot.img", 0, {});
+    files.insert("kernel.img", 4096, {1600000000, 7});
+    files.acquireReader("boot.img");
+    ASSERT_TRUE(files.save(snapshotPath, version));
+
+    TFTPFileIndex loaded;
+    struct timespec otherVersion = {1700000000, 43};
+    ASSERT_FALSE(loaded.load(snapshotPath, otherVersion));
+    ASSERT_EQ(loaded.size(), 0u);
+    ASSERT_TRUE(loaded.load(snapshotPath, version));
+    ASSERT_EQ(loaded.size(), 2u);
+    ASSERT_EQ(loaded.getReaders("boot.img"), 0);
+    ASSERT_EQ(loaded.snapshot()[1].name, "kernel.img");
+    ASSERT_EQ(loaded.snapshot()[1].size, 4096);
+    ASSERT_EQ(loaded.snapshot()[1].modified.tv_sec, 1600000000);
+    ASSERT_EQ(loaded.snapshot()[1].modified.tv_nsec, 7);
+    remove(snapshotPath.c_str());
+    ASSERT_FALSE(loaded.load(snapshotPath, version));
+
+    // Deleted and created again behind the server's back while read
+    files.erase("boot.img");
+    ASSERT_FALSE(files.contains("boot.img"));
+    files.insert("boot.img", 0, {});
+    files.releaseReader("boot.img");
+    ASSERT_EQ(files.getReaders("boot.img"), 0);
+}
+
+TEST(tftpTests, Test25){ 
+
+    std::string directory = "fileWatcherTest";
+    mkdir(directory.c_str(), 0755);
+    std::mutex mutex;
+    std::multiset<std::string> changed;
+    TFTPFileWatcher watcher;
+    ASSERT_TRUE(watcher.watch(directory));
+
+    // Queued before start() and delivered after it
+    FILE* file = fopen((directory + "/written.bin").c_str(), "wb");
+    fputs("data", file);
+    fclose(file);
+    watcher.start([&](const std::string& name) { std::lock_guard<std::mutex> lock(mutex); changed.insert(name); }, []() {});
+    rename((directory + "/written.bin").c_str(), (directory + "/moved.bin").c_str());
+
+    // An upload unlinked before it is closed is only reported deleted
+    file = fopen((directory + "/partial.bin").c_str(), "wb");
+    remove((directory + "/partial.bin").c_str());
+    fclose(file);
+    remove((directory + "/moved.bin").c_str());
+    ASSERT_TRUE(watcher.stop());
+    rmdir(directory.c_str());
+
+    ASSERT_EQ(changed, std::multiset<std::string>({"written.bin", "written.bin", "moved.bin", "moved.bin", "partial.bin"}));
+}
+
+TEST(tftpTests, Test26){ 
+
+    TFTPFileIndex files;
+    files.insert("kernel.img", 0, {});
+    files.insert("boot.img", 0, {});
+    std::shared_ptr<const std::string> listing = files.getListing();
+    ASSERT_EQ(*listing, "boot.img\t [Active Readers] : 0\t [Size] : 0\t [Modified] : 1970-01-01T00:00:00Z\n"
+                        "kernel.img\t [Active Readers] : 0\t [Size] : 0\t [Modified] : 1970-01-01T00:00:00Z\n");
+    ASSERT_EQ(files.getListing(), listing);
+
+    files.acquireReader("boot.img");
+    std::shared_ptr<const std::string> reading = files.getListing();
+    ASSERT_NE(reading, listing);
+    ASSERT_EQ(reading->substr(0, reading->find('\n')), "boot.img\t [Active Readers] : 1\t [Size] : 0\t [Modified] : 1970-01-01T00:00:00Z");
+    ASSERT_EQ(files.getListing(), reading);
+    files.insert("boot.img", 0, {});
+    ASSERT_EQ(files.getListing(), reading);
+    files.insert("boot.img", 512, {});
+    ASSERT_NE(files.getListing(), reading);
+    files.erase("kernel.img");
+    ASSERT_EQ(*files.getListing(), "boot.img\t [Active Readers] : 1\t [Size] : 512\t [Modified] : 1970-01-01T00:00:00Z\n");
+}
+
+TEST(tftpTests, Test27){ 
+
+    TFTPFileIndex files;
+    files.insert("boot.img", 300, {1700000300, 0});
+    files.insert("initrd.img", 200, {1700000100, 0});
+    files.insert("kernel.img", 200, {1700000200, 0});
+    files.insert("readme.txt", 100, {1700000400, 0});
+    auto names = [](const std::string& listing) {
+        std::string result;
+        for (size_t line = 0; line < listing.size(); line = listing.find('\n', line) + 1) {
+            result += listing.substr(line, listing.find('\t', line) - line) + " ";
+        }
+        return result;
+    };
+
+    TFTPListQuery query;
+    ASSERT_EQ(files.getListing(query), files.getListing());
+    query.pattern = "*.img";
+    ASSERT_EQ(names(*files.getListing(query)), "boot.img initrd.img kernel.img ");
+    query.sortKey = LIST_SORT_SIZE;
+    ASSERT_EQ(names(*files.getListing(query)), "initrd.img kernel.img boot.img ");
+    query.descending = true;
+    query.offset = 1;
+    query.limit = 1;
+    ASSERT_EQ(names(*files.getListing(query)), "kernel.img ");
+    query.offset = 10;
+    ASSERT_EQ(*files.getListing(query), "");
+
+    TFTPListQuery newest;
+    newest.prefix = "b";
+    ASSERT_EQ(names(*files.getListing(newest)), "boot.img ");
+    newest.prefix.clear();
+    newest.sortKey = LIST_SORT_MODIFIED;
+    newest.descending = true;
+    newest.limit = 2;
+    ASSERT_EQ(names(*files.getListing(newest)), "readme.txt boot.img ");
+}
+
+TEST(tftpTests, Test28){ 
+
+    std::vector<uint8_t> data(WRITE_BEHIND_BUFFER_SIZE * (WRITE_BEHIND_MAX_BUFFERS + 2) + 1000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 7 + i / 511);
+    }
+    std::string path = "writeStreamTest.bin";
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    TFTPFileWriter writer(2);
+    std::shared_ptr<TFTPWriteStream> stream = writer.open(fd);
+    ASSERT_TRUE(stream->preallocate(data.size() * 2));
+    for (size_t offset = 0; offset < data.size(); offset += 1428) {
+        ASSERT_TRUE(stream->append(data.data() + offset, std::min<size_t>(1428, data.size() - offset)));
+    }
+    stream->flush();
+    ASSERT_EQ(stream->getSize(), (off_t)data.size());
+    while (!stream->isIdle()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(WRITE_BEHIND_POLL_US));
+    }
+    ASSERT_FALSE(stream->hasFailed());
+    ASSERT_TRUE(stream->trim());
+    stream.reset();
+
+    // Preallocated space past the upload is given back, and every buffer landed at its offset
+    struct stat fileStat;
+    ASSERT_EQ(stat(path.c_str(), &fileStat), 0);
+    ASSERT_EQ(fileStat.st_size, (off_t)data.size());
+    std::vector<uint8_t> written(data.size());
+    FILE* file = fopen(path.c_str(), "rb");
+    ASSERT_EQ(fread(written.data(), 1, written.size(), file), data.size());
+    fclose(file);
+    remove(path.c_str());
+    ASSERT_EQ(written, data);
+    TFTPFileWriterStats stats = writer.getStats();
+    ASSERT_EQ(stats.bytes, data.size());
+    ASSERT_EQ(stats.writes + stats.inlineWrites, (uint64_t)(WRITE_BEHIND_MAX_BUFFERS + 3));
+    ASSERT_EQ(stats.failures, 0u);
+}
+
+TEST(tftpTests, Test29){ 
+
+    std::string directory = "fileCommitterTest";
+    mkdir(directory.c_str(), 0755);
+    auto createTemp = [&](const std::string& name, const std::string& content) {
+        std::string tempPath = directory + "/" + name + ".part";
+        int fd = open(tempPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        EXPECT_EQ(write(fd, content.data(), content.size()), (ssize_t)content.size());
+        return fd;
+    };
+    auto waitFor = [](const std::shared_ptr<TFTPFileCommit>& commit) {
+        while (commit->status.load() == FILE_COMMIT_PENDING) {
+            std::this_thread::sleep_for(std::chrono::microseconds(FILE_COMMIT_POLL_US));
+        }
+        return commit->status.load();
+    };
+
+    std::vector<std::shared_ptr<TFTPFileCommit>> commits;
+    {
+        TFTPFileCommitter committer(directory);
+        for (std::string name : {"a.bin", "b.bin", "c.bin"}) {
+            commits.push_back(committer.commit(createTemp(name, name + " data"), directory + "/" + name + ".part", directory + "/" + name));
+        }
+        for (const std::shared_ptr<TFTPFileCommit>& commit : commits) {
+            ASSERT_EQ(waitFor(commit), FILE_COMMIT_DONE);
+            ASSERT_EQ(commit->fileStat.st_size, 10);
+        }
+        // A published file is never replaced, the losing upload is dropped
+        std::shared_ptr<TFTPFileCommit> second = committer.commit(createTemp("a.bin", "other"), directory + "/a.bin.part", directory + "/a.bin");
+        ASSERT_EQ(waitFor(second), FILE_COMMIT_EXISTS);
+        TFTPFileCommitterStats stats = committer.getStats();
+        ASSERT_EQ(stats.commits, 4u);
+        ASSERT_EQ(stats.failures, 1u);
+        ASSERT_LE(stats.groups, 4u);
+    }
+    std::shared_ptr<TFTPFileCommit> unsynced = TFTPFileCommitter::publish(createTemp("d.bin", "d"), directory + "/d.bin.part", directory + "/d.bin");
+    ASSERT_EQ(unsynced->status.load(), FILE_COMMIT_DONE);
+
+    struct stat fileStat;
+    char content[16] = {0};
+    FILE* file = fopen((directory + "/a.bin").c_str(), "rb");
+    ASSERT_EQ(fread(content, 1, sizeof(content), file), 10u);
+    fclose(file);
+    ASSERT_STREQ(content, "a.bin data");
+    for (std::string name : {"a.bin", "b.bin", "c.bin", "d.bin"}) {
+        ASSERT_NE(stat((directory + "/" + name + ".part").c_str(), &fileStat), 0);
+        ASSERT_EQ(remove((directory + "/" + name).c_str()), 0);
+    }
+    ASSERT_EQ(rmdir(directory.c_str()), 0);
+}
+
+TEST(tftpTests, Test30){ 
+
+    // Capture what the logger writes to stderr
+    std::string path = "loggerTest.log";
+    int savedStderr = dup(STDERR_FILENO);
+    int logFd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    ASSERT_GE(logFd, 0);
+    TFTPLogger::flush();
+    dup2(logFd, STDERR_FILENO);
+
+    TFTPLogger::setLevel(LOG_LEVEL_DEBUG);
+    LOG_DEBUG("compiled out below LOG_COMPILED_LEVEL");
+    LOG_INFO("block " << 7 << " sent");
+    std::thread other([]() { LOG_ERROR("from " << std::hex << 255 << " thread"); });
+    other.join();
+    TFTPLogger::setLevel(LOG_LEVEL_WARN);
+    LOG_INFO("filtered at run time");
+    LOG_WARN(std::string(LOG_RECORD_TEXT_SIZE + 10, 'x'));
+    LOG_WARN("hex reset " << 255);
+    TFTPLogger::setLevel(LOG_LEVEL_INFO);
+    TFTPLogger::flush();
+
+    dup2(savedStderr, STDERR_FILENO);
+    close(savedStderr);
+    close(logFd);
+    std::ifstream logFile(path);
+    std::string logged((std::istreambuf_iterator<char>(logFile)), std::istreambuf_iterator<char>());
+    remove(path.c_str());
+    ASSERT_EQ(logged, "[LOG] : block 7 sent\n"
+                      "[ERROR] : from ff thread\n"
+                      "[WARN] : " + std::string(LOG_RECORD_TEXT_SIZE, 'x') + "\n"
+                      "[WARN] : hex reset 255\n");
+}
+
+TEST(tftpTests, Test31){ 
+
+    // Events are formatted by the drain thread in text mode
+    std::string path = "loggerEventTest.log";
+    int savedStderr = dup(STDERR_FILENO);
+    int logFd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    ASSERT_GE(logFd, 0);
+    TFTPLogger::flush();
+    dup2(logFd, STDERR_FILENO);
+    LOG_INFO_EVENT(LOG_EVENT_ERROR_SENT, htonl(0x7F000001), ERROR_FILE_NOT_FOUND);
+    LOG_WARN_EVENT(LOG_EVENT_TIMEOUT, 9801, (uint64_t)250000);
+    TFTPLogger::flush();
+    dup2(savedStderr, STDERR_FILENO);
+    close(savedStderr);
+    close(logFd);
+    std::ifstream logFile(path);
+    std::string logged((std::istreambuf_iterator<char>(logFile)), std::istreambuf_iterator<char>());
+    remove(path.c_str());
+    ASSERT_EQ(logged, "[LOG] : Error packet send to client 127.0.0.1 with error code: 1\n"
+                      "[WARN] : TIMEOUT Occured. Retransmitting to client 9801 with timeout 250000 us\n");
+
+    // A binary log decodes to the same text
+    TFTPLogRecord records[3];
+    records[0].timestamp = 1;
+    records[0].level = LOG_LEVEL_DEBUG;
+    records[0].event = LOG_EVENT_REQUEST;
+    records[0].length = 3;
+    records[0].args[0] = TFTP_OPCODE_WRQ;
+    records[0].args[1] = htonl(0x0A000002);
+    records[0].args[2] = 40000;
+    records[1].timestamp = 2;
+    records[1].level = LOG_LEVEL_ERROR;
+    records[1].event = LOG_EVENT_TEXT;
+    records[1].length = 5;
+    memcpy(records[1].text, "plain", 5);
+    records[2].timestamp = 3;
+    records[2].level = LOG_LEVEL_INFO;
+    records[2].event = LOG_EVENT_COUNT + 1;
+    records[2].length = 1;
+    records[2].args[0] = -4;
+    std::string binary;
+    for (const TFTPLogRecord& record : records) {
+        TFTPLogger::encodeRecord(binary, record);
+    }
+    std::string decoded;
+    size_t offset = 0;
+    TFTPLogRecord record;
+    while (TFTPLogger::decodeRecord(binary, offset, record)) {
+        TFTPLogger::formatRecord(decoded, record);
+    }
+    ASSERT_EQ(offset, binary.size());
+    ASSERT_EQ(decoded, "[DEBUG] : WRQ request from 10.0.0.2:40000\n"
+                       "[ERROR] : plain\n"
+                       "[LOG] : Unknown event " + std::to_string(LOG_EVENT_COUNT + 1) + " -4\n");
+
+    // A record cut short is not decoded
+    binary.resize(binary.size() - 1);
+    offset = 0;
+    int count = 0;
+    while (TFTPLogger::decodeRecord(binary, offset, record)) {
+        count++;
+    }
+    ASSERT_EQ(count, 2);
+}
+
+TEST(tftpTests, Test32){ 
+
+    // Every value falls in a bucket whose bounds are within 12.5% of it
+    for (uint64_t value : {(uint64_t)0, (uint64_t)7, (uint64_t)8, (uint64_t)1000, (uint64_t)123456789, UINT64_MAX}) {
+        size_t index = TFTPMetrics::bucketIndex(value);
+        ASSERT_LT(index, (size_t)METRIC_HISTOGRAM_BUCKETS);
+        ASSERT_LE(TFTPMetrics::bucketLowerBound(index), value);
+        ASSERT_GE(TFTPMetrics::bucketLowerBound(index), value - value / 8);
+        if (index + 1 < METRIC_HISTOGRAM_BUCKETS) {
+            ASSERT_GT(TFTPMetrics::bucketLowerBound(index + 1), value);
+        }
+    }
+
+    // Values of running and exited threads are summed
+    TFTPMetricsSnapshot before;
+    TFTPMetrics::snapshot(before);
+    TFTPMetrics::add(METRIC_TIMEOUTS);
+    std::thread other([]() {
+        TFTPMetrics::add(METRIC_TIMEOUTS, 2);
+        for (int i = 1; i <= 1000; i++) {
+            TFTPMetrics::record(METRIC_DISK_READ, i * 1000);
+        }
+    });
+    other.join();
+    TFTPMetricsSnapshot after;
+    TFTPMetrics::snapshot(after);
+    ASSERT_EQ(after.counters[METRIC_TIMEOUTS] - before.counters[METRIC_TIMEOUTS], (uint64_t)3);
+    ASSERT_EQ(after.getCount(METRIC_DISK_READ) - before.getCount(METRIC_DISK_READ), (uint64_t)1000);
+    if (before.getCount(METRIC_DISK_READ) == 0) {
+        uint64_t p50 = after.getPercentile(METRIC_DISK_READ, 50);
+        uint64_t p999 = after.getPercentile(METRIC_DISK_READ, 99.9);
+        ASSERT_GE(p50, (uint64_t)500000);
+        ASSERT_LE(p50, (uint64_t)500000 + 500000 / 8);
+        ASSERT_GE(p999, (uint64_t)999000);
+        ASSERT_LE(p999, (uint64_t)999000 + 999000 / 8);
+    }
+
+    std::string output;
+    TFTPMetrics::format(output);
+    ASSERT_NE(output.find("# TYPE tftp_requests_total counter\n"), std::string::npos);
+    ASSERT_NE(output.find("tftp_timeouts_total " + std::to_string(after.counters[METRIC_TIMEOUTS]) + "\n"), std::string::npos);
+    ASSERT_NE(output.find("tftp_disk_read_seconds_bucket{le=\"+Inf\"} " + std::to_string(after.getCount(METRIC_DISK_READ)) + "\n"), std::string::npos);
+    ASSERT_NE(output.find("tftp_disk_read_quantile_seconds{quantile=\"0.99\"}"), std::string::npos);
+}
+
+TEST(tftpTests, Test33){ 
+
+    // The ring keeps the last events, the stage totals cover all of them
+    TFTPTransferTrace trace("RRQ \"big.bin\" client 1");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() - std::chrono::microseconds(50);
+    for (uint32_t block = 1; block <= TRACE_RING_SIZE + 10; block++) {
+        trace.span(TRACE_STAGE_SEND, block, start);
+    }
+    trace.mark(TRACE_STAGE_TIMEOUT, 7);
+    std::vector<TFTPTraceEvent> events = trace.getEvents();
+    ASSERT_EQ(events.size(), (size_t)TRACE_RING_SIZE);
+    ASSERT_EQ(events.front().block, (uint32_t)12);
+    ASSERT_EQ(events.back().stage, TRACE_STAGE_TIMEOUT);
+    ASSERT_LT(events.back().duration, 0);
+    TFTPTraceStageStats sends = trace.getStageStats(TRACE_STAGE_SEND);
+    ASSERT_EQ(sends.count, (uint64_t)TRACE_RING_SIZE + 10);
+    ASSERT_GE(sends.maxDuration, 50000);
+    ASSERT_EQ(trace.getStageStats(TRACE_STAGE_READ).count, (uint64_t)0);
+    std::string summary = trace.summary();
+    ASSERT_EQ(summary.find("send " + std::to_string(TRACE_RING_SIZE + 10) + " x "), (size_t)0);
+    ASSERT_NE(summary.find(", timeout 1"), std::string::npos);
+
+    // Chrome trace JSON, with the name escaped
+    const std::string path = "trace-test.json";
+    ASSERT_TRUE(trace.dump(path));
+    std::ifstream file(path);
+    std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["), (size_t)0);
+    ASSERT_NE(json.find("\"args\":{\"name\":\"RRQ \\\"big.bin\\\" client 1\"}"), std::string::npos);
+    ASSERT_NE(json.find("{\"name\":\"send\",\"ph\":\"X\",\"pid\":1,\"tid\":2,"), std::string::npos);
+    ASSERT_NE(json.find("\"args\":{\"block\":12}}"), std::string::npos);
+    ASSERT_EQ(json.find("\"args\":{\"block\":11}}"), std::string::npos);
+    ASSERT_NE(json.find("{\"name\":\"timeout\",\"ph\":\"i\""), std::string::npos);
+    ASSERT_EQ(json.substr(json.size() - 4), "\n]}\n");
+    remove(path.c_str());
+}
+
+TEST(tftpTests, Test34){ 
+
+    // An LS session run on its own thread and socket, as in thread mode, applies its options
+    TFTPFileIndex files;
+    files.insert("boot.img", 300, {1700000300, 0});
+    files.insert("initrd.img", 200, {1700000100, 0});
+    files.insert("kernel.img", 250, {1700000200, 0});
+    files.insert("readme.txt", 100, {1700000400, 0});
+    int serverSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    int clientSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in serverAddress, clientAddress;
+    socklen_t addressLength = sizeof(struct sockaddr_in);
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    clientAddress = serverAddress;
+    ASSERT_EQ(bind(serverSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)), 0);
+    ASSERT_EQ(bind(clientSocket, (struct sockaddr*)&clientAddress, sizeof(clientAddress)), 0);
+    getsockname(serverSocket, (struct sockaddr*)&serverAddress, &addressLength);
+    getsockname(clientSocket, (struct sockaddr*)&clientAddress, &addressLength);
+    struct timeval timeout = {1, 0};
+    setsockopt(serverSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    TFTPOptions options = {{"match", "*.img"}, {"sort", "-size"}, {"offset", "1"}, {"limit", "1"}};
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(IO_BACKEND_SYSCALL));
+    TFTPSession session(*engine, serverSocket, 1, TFTP_OPCODE_LS, "", options, clientAddress, files);
+    std::thread sessionThread([&session, &engine, serverSocket] {
+        session.start();
+        engine->submit();
+        uint8_t buffer[MAX_PACKET_SIZE];
+        for (int rounds = 0; rounds < 5 && !session.isFinished(); rounds++) {
+            struct sockaddr_in recvAddress;
+            socklen_t recvAddressLength = sizeof(recvAddress);
+            int bytesRead = recvfrom(serverSocket, buffer, sizeof(buffer), 0, (struct sockaddr*)&recvAddress, &recvAddressLength);
+            if (bytesRead >= 0) {
+                session.handlePacket(buffer, bytesRead, recvAddress);
+            }
+            else {
+                session.handleTimeout();
+            }
+            engine->submit();
+        }
+    });
+
+    uint8_t packet[MAX_PACKET_SIZE];
+    int bytesRead = recv(clientSocket, packet, sizeof(packet), 0);
+    ASSERT_GE(bytesRead, 4);
+    ASSERT_EQ(packet[1], TFTP_OPCODE_DATA);
+    ASSERT_EQ(std::string((char*)packet + 4, bytesRead - 4), "kernel.img\t [Active Readers] : 0\t [Size] : 250\t [Modified] : 2023-11-14T22:16:40Z\n");
+    uint8_t ack[4];
+    TFTPPacket::createACKPacket(ack, 1);
+    sendto(clientSocket, ack, sizeof(ack), 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress));
+    sessionThread.join();
+    ASSERT_TRUE(session.isFinished());
+    close(clientSocket);
+    close(serverSocket);
+}
+
+TEST(tftpTests, Test35){ 
+
+    std::string filename = "mappingGuardTest.bin";
+    std::vector<uint8_t> data(3 * 4096, 'x');
+    FILE* file = fopen(filename.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+    TFTPFileCache files;
+    auto mapped = files.acquire(filename);
+    ASSERT_TRUE(mapped != nullptr);
+    uint8_t copied[16];
+    ASSERT_TRUE(TFTPMappingGuard::copy(copied, mapped->data + 4096, sizeof(copied)));
+    ASSERT_EQ(copied[0], 'x');
+
+    // Truncated by another tool while mapped: the pages are gone, the copies fail
+    ASSERT_EQ(truncate(filename.c_str(), 100), 0);
+    ASSERT_TRUE(TFTPMappingGuard::copy(copied, mapped->data, sizeof(copied)));
+    ASSERT_FALSE(TFTPMappingGuard::copy(copied, mapped->data + 4096, sizeof(copied)));
+    ASSERT_FALSE(TFTPMappingGuard::copy(copied, mapped->data + 8192, sizeof(copied)));
+    TFTPPacketCache cache(1 << 20, 1);
+    ASSERT_TRUE(cache.acquire(*mapped, 512) == nullptr);
+    ASSERT_EQ(cache.getStats().images, 0u);
+    remove(filename.c_str());
+}
+
+TEST(tftpTests, Test36){ 
+
+    // RFC 6298: the first sample sets SRTT and RTTVAR, later ones are smoothed
+    TFTPRetransmitTimer timer;
+    ASSERT_EQ(timer.getTimeout(), std::chrono::milliseconds(RTO_INITIAL_MS));
+    timer.addSample(std::chrono::milliseconds(100));
+    ASSERT_EQ(timer.getSRTT(), std::chrono::milliseconds(100));
+    ASSERT_EQ(timer.getRTTVAR(), std::chrono::milliseconds(50));
+    ASSERT_EQ(timer.getTimeout(), std::chrono::milliseconds(300));
+    timer.addSample(std::chrono::milliseconds(200));
+    ASSERT_EQ(timer.getSRTT(), std::chrono::microseconds(112500));
+    ASSERT_EQ(timer.getRTTVAR(), std::chrono::microseconds(62500));
+    ASSERT_EQ(timer.getTimeout(), std::chrono::microseconds(362500));
+
+    // Every timeout doubles it up to the maximum, until the next sample
+    timer.backoff();
+    ASSERT_EQ(timer.getTimeout(), std::chrono::microseconds(725000));
+    timer.backoff();
+    timer.backoff();
+    timer.backoff();
+    ASSERT_EQ(timer.getTimeout(), std::chrono::milliseconds(RTO_DEFAULT_MAX_MS));
+    ASSERT_EQ(timer.getTimeouts(), 4u);
+    ASSERT_FALSE(timer.restoreFixedTimeout());
+    ASSERT_EQ(timer.getTimeout(), std::chrono::milliseconds(RTO_DEFAULT_MAX_MS));
+    timer.addSample(std::chrono::microseconds(112500));
+    ASSERT_EQ(timer.getTimeout(), std::chrono::milliseconds(300));
+    ASSERT_EQ(timer.getSamples(), 3u);
+
+    // Clamped to the limits
+    TFTPRetransmitTimer bounded;
+    bounded.setLimits(std::chrono::milliseconds(50), std::chrono::milliseconds(100));
+    ASSERT_EQ(bounded.getTimeout(), std::chrono::milliseconds(100));
+    bounded.addSample(std::chrono::milliseconds(1));
+    ASSERT_EQ(bounded.getTimeout(), std::chrono::milliseconds(50));
+
+    // A negotiated timeout ignores the estimate and comes back after a backoff
+    TFTPRetransmitTimer negotiated;
+    negotiated.setFixedTimeout(std::chrono::seconds(1));
+    negotiated.backoff();
+    ASSERT_EQ(negotiated.getTimeout(), std::chrono::seconds(2));
+    negotiated.addSample(std::chrono::milliseconds(10));
+    ASSERT_EQ(negotiated.getTimeout(), std::chrono::seconds(1));
+    for (int i = 0; i < 5; i++) {
+        negotiated.backoff();
+    }
+    ASSERT_EQ(negotiated.getTimeout(), std::chrono::milliseconds(RTO_DEFAULT_MAX_MS));
+    ASSERT_TRUE(negotiated.restoreFixedTimeout());
+    ASSERT_EQ(negotiated.getTimeout(), std::chrono::seconds(1));
+    ASSERT_FALSE(negotiated.restoreFixedTimeout());
+}
+
+TEST(tftpTests, Test37){ 
+
+    // A session dropped before it started is not counted as finished
+    TFTPMetricsSnapshot before;
+    TFTPMetrics::snapshot(before);
+    {
+        TFTPFileIndex files;
+        struct sockaddr_in clientAddress;
+        memset(&clientAddress, 0, sizeof(clientAddress));
+        std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(IO_BACKEND_SYSCALL));
+        TFTPSession session(*engine, -1, 1, TFTP_OPCODE_RRQ, "missing.bin", TFTPOptions(), clientAddress, files);
+    }
+    TFTPMetricsSnapshot after;
+    TFTPMetrics::snapshot(after);
+    ASSERT_EQ(after.counters[METRIC_SESSIONS_STARTED], before.counters[METRIC_SESSIONS_STARTED]);
+    ASSERT_EQ(after.counters[METRIC_SESSIONS_FINISHED], before.counters[METRIC_SESSIONS_FINISHED]);
+
+    // More finishes than starts seen, e.g. by a snapshot racing a session, make no negative gauge
+    uint64_t extra = after.counters[METRIC_SESSIONS_STARTED] - after.counters[METRIC_SESSIONS_FINISHED] + 1;
+    TFTPMetrics::add(METRIC_SESSIONS_FINISHED, extra);
+    std::string output;
+    TFTPMetrics::format(output);
+    ASSERT_NE(output.find("\ntftp_active_sessions 0\n"), std::string::npos);
+    TFTPMetrics::add(METRIC_SESSIONS_STARTED, extra);
+}
@@ -0,0 +1,89 @@
+#include "TFTPBlockReader.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+/**
+ * @brief Constructor for the TFTPBlockReader class. No file is open.
+ */
+TFTPBlockReader::TFTPBlockReader() : fd(-1), size(0), nextOffset(0), readaheadOffset(0) {
+}
+
+TFTPBlockReader::~TFTPBlockReader() {
+    close();
+}
+
+/**
+ * @brief Open a file to read it block by block.
+ *
+ * @param filename The file to read.
+ * @return true if the file is open, false otherwise.
+ */
+bool TFTPBlockReader::open(const std::string& filename) {
+    close();
+    fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) < 0) {
+        close();
+        return false;
+    }
+    size = fileStat.st_size;
+    nextOffset = 0;
+    readaheadOffset = 0;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+}
+
+void TFTPBlockReader::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    size = 0;
+}
+
+/**
+ * @brief Read a block of the file.
+ *
+ * @param blockNumber The block to read, from 1.
+ * @param data Receives the block, at least blockSize bytes.
+ * @param blockSize The size of every block but the last one.
+ * @return The size of the block (0 past the end of the file), or -1 on error.
+ */
+ssize_t TFTPBlockReader::readBlock(uint32_t blockNumber, char* data, size_t blockSize) {
+    if (fd < 0 || blockNumber == 0) {
+        return -1;
+    }
+    off_t offset = (off_t)(blockNumber - 1) * blockSize;
+    if (offset >= size) {
+        return 0;
+    }
+    if (offset == nextOffset && offset + (off_t)blockSize > readaheadOffset) {
+        // Sequential read reaching the end of the previous readahead, ask for the next range
+        readaheadOffset = std::min<off_t>(offset + BLOCK_READER_READAHEAD_BYTES, size);
+        posix_fadvise(fd, offset, readaheadOffset - offset, POSIX_FADV_WILLNEED);
+    }
+    nextOffset = offset + blockSize;
+    size_t length = std::min<off_t>(blockSize, size - offset);
+    size_t total = 0;
+    while (total < length) {
+        ssize_t result = pread(fd, data + total, length - total, offset + total);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        total += result;
+    }
+    return total;
+}
+
+bool TFTPBlockReader::isOpen() const {
+    return fd >= 0;
+}
+
+off_t TFTPBlockReader::getSize() const {
+    return size;
+}
@@ -0,0 +1,39 @@
+#ifndef TFTP_BLOCK_READER_H
+#define TFTP_BLOCK_READER_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include "TFTPPacket.h"
+
+#define BLOCK_READER_READAHEAD_BYTES    (1 << 20)   // read ahead of sequential reads in steps of this size
+
+/**
+ * @brief Reads the blocks of one file through a descriptor opened once.
+ *
+ * Blocks are read with pread, so a window can be read again after a loss without
+ * seeking. The kernel is told the file is read sequentially and, while blocks are read
+ * in order, asked to read ahead BLOCK_READER_READAHEAD_BYTES past the current block so
+ * the next blocks are in the page cache when they are needed.
+ */
+class TFTPBlockReader {
+public:
+    TFTPBlockReader();
+    ~TFTPBlockReader();
+    TFTPBlockReader(const TFTPBlockReader&) = delete;
+    TFTPBlockReader& operator=(const TFTPBlockReader&) = delete;
+    bool open(const std::string& filename);
+    void close();
+    ssize_t readBlock(uint32_t blockNumber, char* data, size_t blockSize = DEFAULT_BLOCK_SIZE);
+    bool isOpen() const;
+    off_t getSize() const;
+
+private:
+    int fd;
+    off_t size;
+    off_t nextOffset;               // offset that continues a sequential read
+    off_t readaheadOffset;          // end of the range the kernel was asked to read ahead
+};
+
+#endif
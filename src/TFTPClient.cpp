@@ -1,7 +1,9 @@
 #include "TFTPClient.h"
+#include "TFTPLogger.h"
 #include "TFTPCompression.h"
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 #include <unistd.h>
 
 
@@ -10,11 +12,11 @@
 
 
 
-TFTPClient::TFTPClient(const std::string& serverIP) {
+TFTPClient::TFTPClient(const std::string& serverIP) : blockSize(DEFAULT_BLOCK_SIZE), windowSize(1) {
     // Create a UDP socket
     clientSocket = socket(AF_INET, SOCK_DGRAM, 0);
     if (clientSocket < 0) {
-        std::cerr << "Error creating client socket" << std::endl;
+        LOG_ERROR("Error creating client socket");
         exit(1);
     }
     // Configure the server address
@@ -23,17 +25,10 @@ TFTPClient::TFTPClient(const std::string& serverIP) {
     serverAddress.sin_addr.s_addr = inet_addr(serverIP.c_str());
     serverAddress.sin_port = htons(SERVER_DEFAULT_PORT);
 
-    // Set a timeout for socket operations
-    struct timeval timeout;
-    timeout.tv_sec = 5;  // seconds
-    timeout.tv_usec = 0; // microseconds
-
-    // Connect to the server (optional, but can be useful for a connection-oriented protocol)
-    if (setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
-            std::cerr << "Error setting receive timeout" << std::endl;
-            exit(1);
-        }
-    std::cerr << "[LOG] Socket timeout set successfully" << std::endl;
+    // Set the initial retransmission timeout for socket operations
+    lastSentOnce = false;
+    applyRetransmitTimeout();
+    LOG_DEBUG("Socket timeout set successfully");
 
 }
 
@@ -48,13 +43,13 @@ TFTPClient::TFTPClient(const std::string& serverIP) {
  * @return true if the LS packet is successfully sent, false otherwise.
  */
 bool TFTPClient::sendLSPacket(int clientSocket, struct sockaddr_in serverAddress){
-    uint8_t packet[3];
-    TFTPPacket::createLSPacket(packet);
-    if (sendto(clientSocket, packet, sizeof(packet), 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send LS packet" << std::endl;
+    uint8_t packet[MAX_PACKET_SIZE];
+    size_t packetSize = TFTPPacket::createLSPacket(packet, requestedOptions);
+    if (sendto(clientSocket, packet, packetSize, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+        LOG_ERROR("fail to send LS packet");
         return false;
     }
-    std::cerr << "[LOG] : LS packet send to server " << serverAddress.sin_addr.s_addr << std::endl;
+    LOG_DEBUG("LS packet send to server " << serverAddress.sin_addr.s_addr);
     return true;
 }
 
@@ -74,22 +69,155 @@ bool TFTPClient::sendLSPacket(int clientSocket, struct sockaddr_in serverAddress
 bool TFTPClient::sendDELETEPacket(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename){
     std::string mode = "octet";
     uint8_t packet[4 + filename.size() + mode.size()];
-    std::cerr << "filename: " << filename << std::endl;
+    LOG_DEBUG("filename: " << filename);
     TFTPPacket::createDeletePacket(packet, filename);
-    std::cerr << "Packet content: ";
-    std::cerr << std::hex << static_cast<uint8_t>(packet[0]) << std::hex << static_cast<uint8_t>(packet[0]);
-    for (std::size_t i = 2; i < sizeof(packet); ++i) {
-        std::cerr << packet[i];
-    }
-    std::cerr << std::endl;
+    LOG_DEBUG("Packet content: " << std::string((const char*)packet + 2, sizeof(packet) - 2));
     if (sendto(clientSocket, packet, sizeof(packet), 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send Delete packet" << std::endl;
+        LOG_ERROR("fail to send Delete packet");
         return false;
     }
-    std::cerr << "[LOG] : Delete packet send to server " << serverAddress.sin_addr.s_addr << std::endl;
+    LOG_DEBUG("Delete packet send to server " << serverAddress.sin_addr.s_addr);
+    return true;
+}
+
+
+/**
+ * @brief Sets the options requested with RRQ and WRQ (RFC 2347).
+ *
+ * @param options The options and their requested values.
+ */
+void TFTPClient::setOptions(const TFTPOptions& options) {
+    requestedOptions = options;
+}
+
+
+/**
+ * @brief Handles an OACK (Option Acknowledgment) packet from the TFTP server.
+ *
+ * This function parses the options accepted by the server and applies them. An OACK
+ * carrying an option that was not requested is refused with error code 8.
+ *
+ * @param clientSocket The socket descriptor for communication with the server.
+ * @param buffer The received OACK packet.
+ * @param readBytes The size of the received packet in bytes.
+ * @param serverAddress The server's sockaddr_in structure containing the IP address and port.
+ * @return true if the options are accepted, false otherwise.
+ */
+bool TFTPClient::handleOACK(int clientSocket, const char* buffer, int readBytes, struct sockaddr_in serverAddress) {
+    if (!TFTPPacket::parseOptions(reinterpret_cast<const uint8_t*>(buffer), readBytes, 2, negotiatedOptions)) {
+        const std::string errorMessage = "Malformed options";
+        sendError(clientSocket, ERROR_OPTION_NEGOTIATION, errorMessage, serverAddress);
+        return false;
+    }
+    for (const auto& option : negotiatedOptions) {
+        if (requestedOptions.find(option.first) == requestedOptions.end()) {
+            LOG_ERROR("server acknowledged option " << option.first << " that was not requested");
+            const std::string errorMessage = "Option not requested";
+            sendError(clientSocket, ERROR_OPTION_NEGOTIATION, errorMessage, serverAddress);
+            return false;
+        }
+        LOG_INFO("Option " << option.first << " negotiated with value " << option.second);
+    }
+    uint64_t value;
+    auto option = negotiatedOptions.find(TFTP_OPTION_BLKSIZE);
+    if (option != negotiatedOptions.end()) {
+        // The server may only lower the requested block size
+        uint64_t requested;
+        if (!TFTPPacket::parseOptionValue(option->second, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, value)
+            || !TFTPPacket::parseOptionValue(requestedOptions[TFTP_OPTION_BLKSIZE], MIN_BLOCK_SIZE, UINT64_MAX, requested)
+            || value > requested) {
+            LOG_ERROR("invalid blksize " << option->second << " acknowledged by server");
+            const std::string errorMessage = "Invalid blksize";
+            sendError(clientSocket, ERROR_OPTION_NEGOTIATION, errorMessage, serverAddress);
+            return false;
+        }
+        blockSize = value;
+    }
+    option = negotiatedOptions.find(TFTP_OPTION_WINDOWSIZE);
+    if (option != negotiatedOptions.end()) {
+        // The server may only lower the requested window size
+        uint64_t requested;
+        if (!TFTPPacket::parseOptionValue(option->second, 1, MAX_WINDOW_SIZE, value)
+            || !TFTPPacket::parseOptionValue(requestedOptions[TFTP_OPTION_WINDOWSIZE], 1, MAX_WINDOW_SIZE, requested)
+            || value > requested) {
+            LOG_ERROR("invalid windowsize " << option->second << " acknowledged by server");
+            const std::string errorMessage = "Invalid windowsize";
+            sendError(clientSocket, ERROR_OPTION_NEGOTIATION, errorMessage, serverAddress);
+            return false;
+        }
+        windowSize = value;
+        // Room for a whole window of DATA, a smaller buffer drops the end of every window
+        int receiveBuffer = windowSize * (blockSize + 4) * 2;
+        setsockopt(clientSocket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+    option = negotiatedOptions.find(TFTP_OPTION_TIMEOUT);
+    if (option != negotiatedOptions.end() && TFTPPacket::parseOptionValue(option->second, 1, 255, value)) {
+        retransmitTimer.setFixedTimeout(std::chrono::seconds(value));
+        applyRetransmitTimeout();
+    }
     return true;
 }
 
+/**
+ * @brief Trace the transfer and write its breakdown to a file once it is done.
+ *
+ * @param path The Chrome trace JSON file, empty to not trace.
+ */
+void TFTPClient::setTrace(const std::string& path) {
+    tracePath = path;
+}
+
+/**
+ * @brief Set the socket receive timeout to the current retransmission timeout.
+ */
+void TFTPClient::applyRetransmitTimeout() {
+    std::chrono::microseconds rto = retransmitTimer.getTimeout();
+    struct timeval timeout;
+    timeout.tv_sec = rto.count() / 1000000;
+    timeout.tv_usec = rto.count() % 1000000;
+    if (setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
+        LOG_ERROR("Error setting receive timeout");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Note the send time of a packet the server is expected to answer.
+ *
+ * @param retransmission true if the packet was sent before, its answer gives no RTT sample.
+ */
+void TFTPClient::startRetransmitClock(bool retransmission) {
+    lastSentAt = std::chrono::steady_clock::now();
+    lastSentOnce = !retransmission;
+}
+
+/**
+ * @brief Take an RTT sample from the answer of the last packet sent, if it was sent once,
+ * and undo the backoff of a negotiated timeout.
+ */
+void TFTPClient::sampleRetransmitClock() {
+    if (!lastSentOnce) {
+        // No sample, but the server answered: a negotiated timeout is no longer backed off
+        if (retransmitTimer.restoreFixedTimeout()) {
+            applyRetransmitTimeout();
+        }
+        return;
+    }
+    lastSentOnce = false;
+    retransmitTimer.addSample(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - lastSentAt));
+    applyRetransmitTimeout();
+}
+
+/**
+ * @brief Double the retransmission timeout after a receive timed out.
+ */
+void TFTPClient::backoffRetransmitTimeout() {
+    retransmitTimer.backoff();
+    lastSentOnce = false;
+    applyRetransmitTimeout();
+    LOG_DEBUG("Retransmission timeout " << retransmitTimer.getTimeout().count() << " us");
+}
+
 
 /**
  * @brief Starts the TFTP client with the specified operation and filename.
@@ -107,7 +235,7 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
     clientAddress.sin_port = htons(CLIENT_DEFAULT_PORT);
 
     if (bind(clientSocket, (struct sockaddr*)&clientAddress, sizeof(clientAddress)) < 0) {
-        std::cerr << "Error binding client socket" << std::endl;
+        LOG_ERROR("Error binding client socket");
         exit(1);
     }
     std::cout << "client binded to port " << CLIENT_DEFAULT_PORT << std::endl;
@@ -115,6 +243,10 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
     serverAddress.sin_family = AF_INET;
     serverAddress.sin_addr.s_addr = inet_addr("127.0.0.1");
     serverAddress.sin_port = htons(69);
+    if (!tracePath.empty()) {
+        const char* request = opcode == TFTP_OPCODE_RRQ ? "READ" : opcode == TFTP_OPCODE_WRQ ? "WRITE" : opcode == TFTP_OPCODE_LS ? "LS" : "DELETE";
+        trace.reset(new TFTPTransferTrace(std::string(request) + " " + filename));
+    }
 
     // implemented logic for handling client according to opcode
     switch (opcode)
@@ -123,7 +255,7 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
             if (handleLSRequest(clientSocket, serverAddress))
             {
                 std::cout << "Output is stored in file ls.txt in /clientDatabase directory." << std::endl;
-                std::cerr << "exiting" << std::endl;
+                LOG_DEBUG("exiting");
                 break;
             }
             std::cout << "[ERROR received] " << std::endl;
@@ -132,7 +264,7 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
             if (handleDELETERequest(clientSocket, serverAddress, filename))
             {
                 std::cout << "FILE deleted successfully" << std::endl;
-                std::cerr << "exiting" << std::endl;
+                LOG_DEBUG("exiting");
                 break;
             }
             std::cout << "[ERROR received]: check error log " << std::endl;
@@ -141,7 +273,7 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
             if (handleRRQRequest(clientSocket, serverAddress, filename))
             {
                 std::cout << "FILE READ successful." << std::endl;
-                std::cerr << "exiting" << std::endl;
+                LOG_DEBUG("exiting");
                 break;
             }
             std::cout << "[ERROR received]: check error log " << std::endl;
@@ -150,16 +282,24 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
             if (handleWRQRequest(clientSocket, serverAddress, filename))
             {
                 std::cout << "FILE WRITE successful." << std::endl;
-                std::cerr << "exiting" << std::endl;
+                LOG_DEBUG("exiting");
                 break;
             }
             std::cout << "[ERROR received]: check error log " << std::endl;
             break;
         default:
-            std::cerr << "Invalid Request Opcode" << std::endl;
+            LOG_ERROR("Invalid Request Opcode");
             std::cout << "[ERROR received]: check error log " << std::endl;
             break;
     }
+    if (trace) {
+        if (trace->dump(tracePath)) {
+            LOG_INFO("Trace written to " << tracePath << ": " << trace->summary());
+        }
+        else {
+            LOG_ERROR("fail to write trace " << tracePath);
+        }
+    }
     close(clientSocket);
     return;
 }
@@ -179,47 +319,61 @@ void TFTPClient::startClient(int opcode, const std::string& filename) {
 bool TFTPClient::handleRRQRequest(int clientSocket, struct sockaddr_in serverAddress, const std::string& prevFilename) {
     if (prevFilename.empty())
     {
-        std::cerr << "[ERROR] : filename is empty" << std::endl;
+        LOG_ERROR("filename is empty");
         return false;
     }
     std::string strFilename(prevFilename);
     std::string filenameWithoutExtension = strFilename.substr(0, strFilename.find_last_of("."));
     std::string filename = filenameWithoutExtension + "compress.bin";
+    startRetransmitClock(false);
     if (!sendRRQPacket(clientSocket, serverAddress, filename))
     {
-        std::cerr << "[ERROR] : fail to send RRQ packet" << std::endl;
+        LOG_ERROR("fail to send RRQ packet");
         return false;
     }
-    std::cerr << "[LOG] : sent RRQ packet" << std::endl;
+    LOG_DEBUG("sent RRQ packet");
     // std::string directory = "clientDatabase/";
     // std::string filePath = directory + filename;
     std::ofstream file(filename, std::ios::binary);
     if (!file) {
         // Send an error packet (Disk full or allocation exceeded - Error Code 3)
-        std::cerr << "[ERROR] : Cannot create file" << std::endl;
+        LOG_ERROR("Cannot create file");
         const std::string errorMessage = "Disk full or allocation exceeded.";
         sendError(clientSocket, ERROR_DISK_FULL, errorMessage, clientAddress);
         return false;
     } 
-    char recievedBuffer[516];
-    memset(recievedBuffer, 0, sizeof(recievedBuffer));
+    // Grown to the negotiated block size once the OACK is received
+    std::vector<char> recievedBuffer(MAX_PACKET_SIZE);
     uint16_t expectedBlockNumber = 1;
+    size_t receivedInWindow = 0;
     int retry = MAX_RETRY;
     bool initialPacket = true;
     while (retry)
     {
         struct sockaddr_in recvAddress;
         socklen_t recvAddressLen = sizeof(recvAddress);
-        int readBytes = recvfrom(clientSocket, recievedBuffer, 516, 0, (struct sockaddr*)&recvAddress, &recvAddressLen);
+        std::chrono::steady_clock::time_point waitStartedAt = std::chrono::steady_clock::now();
+        int readBytes = recvfrom(clientSocket, recievedBuffer.data(), recievedBuffer.size(), 0, (struct sockaddr*)&recvAddress, &recvAddressLen);
         if (readBytes < 0)
         {
-            std::cerr << "TIMEOUT Occured" << std::endl;
+            LOG_WARN("TIMEOUT Occured");
             retry--;
+            backoffRetransmitTimeout();
+            if (trace) {
+                trace->mark(TRACE_STAGE_TIMEOUT, expectedBlockNumber);
+            }
+            if (!initialPacket && retry) {
+                // Acknowledge the last block received in order again, the server resumes after it
+                if (trace) {
+                    trace->mark(TRACE_STAGE_RETRANSMIT, expectedBlockNumber - 1);
+                }
+                sendACK(clientSocket, expectedBlockNumber - 1, serverAddress);
+            }
             continue;
         }
-        else if (readBytes > MAX_PACKET_SIZE)
+        else if ((size_t)readBytes > blockSize + 4)
         {
-            std::cerr << "Invalid packet received" << std::endl;
+            LOG_WARN("Invalid packet received");
             const std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, recvAddress);
             continue;
@@ -227,10 +381,10 @@ bool TFTPClient::handleRRQRequest(int clientSocket, struct sockaddr_in serverAdd
         else {
             retry = MAX_RETRY;
         }
-        std::cerr << "Received packet" << std::endl;
+        LOG_DEBUG("Received packet");
         if (recvAddress.sin_addr.s_addr != serverAddress.sin_addr.s_addr)
         {
-            std::cerr << "Corrupt packet from different IP received" << std::endl;
+            LOG_WARN("Corrupt packet from different IP received");
             const std::string errorMessage = "Unknown transfer ID";
             sendError(clientSocket, ERROR_UNKNOWN_TID, errorMessage, recvAddress);
             continue;
@@ -239,73 +393,109 @@ bool TFTPClient::handleRRQRequest(int clientSocket, struct sockaddr_in serverAdd
         {
             serverAddress.sin_port = recvAddress.sin_port;
             initialPacket = false;
-            std::cerr << "[LOG] : server port no. indentified" << std::endl;
+            LOG_DEBUG("server port no. indentified");
         }
         else if (serverAddress.sin_port != recvAddress.sin_port)
         {
-            std::cerr << "Corrupt packet from different port received" << std::endl;
+            LOG_WARN("Corrupt packet from different port received");
             const std::string errorMessage = "Unknown transfer ID";
             sendError(clientSocket, ERROR_UNKNOWN_TID, errorMessage, recvAddress);
             continue;
         }
-        std::cerr << "[LOG] : Source Verified" << std::endl;
+        LOG_DEBUG("Source Verified");
         uint16_t opcode = (uint16_t)(((recievedBuffer[1] & 0xFF) << 8) | (recievedBuffer[0] & 0XFF));
         opcode = ntohs(opcode);
-        std::cerr << "Recieved Opcode:" << opcode << std::endl;
+        LOG_DEBUG("Recieved Opcode:" << opcode);
 
+        if (opcode == TFTP_OPCODE_OACK && expectedBlockNumber == 1) {
+            // The server accepted options, acknowledge them with ACK 0
+            if (!handleOACK(clientSocket, recievedBuffer.data(), readBytes, serverAddress)) {
+                file.close();
+                return false;
+            }
+            recievedBuffer.resize(std::max<size_t>(blockSize + 4, MAX_PACKET_SIZE));
+            sampleRetransmitClock();
+            sendACK(clientSocket, 0, serverAddress);
+            startRetransmitClock(false);
+            continue;
+        }
         if (opcode != TFTP_OPCODE_ERROR && opcode != TFTP_OPCODE_DATA) {
-            std::cerr << "Illegal Opcode Recieved" << std::endl;
+            LOG_WARN("Illegal Opcode Recieved");
             std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, recvAddress);
             file.close();
             return false;
         }
-        std::cerr << "[LOG] : Opcode Verified" << std::endl;
-        std::cerr << "Read Bytes: " << readBytes << std::endl;
+        LOG_DEBUG("Opcode Verified");
+        LOG_DEBUG("Read Bytes: " << readBytes);
         uint16_t recvBlockNumber = (uint16_t)(((recievedBuffer[3] & 0xFF) << 8) | (recievedBuffer[2] & 0XFF));
         recvBlockNumber = ntohs(recvBlockNumber);
         int dataLength = readBytes - 4;
         char recvData[dataLength];
         memset(recvData, 0, dataLength);
-        std::cerr << "Copying data memory" << std::endl;
-        memcpy(recvData, recievedBuffer + 4, dataLength);
+        LOG_DEBUG("Copying data memory");
+        memcpy(recvData, recievedBuffer.data() + 4, dataLength);
         if (opcode == TFTP_OPCODE_ERROR)
         {
-            std::cerr << "Error packet recieved from server with error code: " << recvBlockNumber << std::endl;
-            std::cerr << "Recieved data size: " << dataLength << std::endl;
-            std::cerr << "[ERROR " << recvBlockNumber << "] " << recvData << std::endl;
+            LOG_WARN("Error packet recieved from server with error code: " << recvBlockNumber);
+            LOG_DEBUG("Recieved data size: " << dataLength);
+            LOG_WARN("Error message from server: " << recvData);
             std::cout << "[ERROR " << recvBlockNumber << "] " << recvData << std::endl;
             return false;
         }
         if (recvBlockNumber != expectedBlockNumber)
         {
-            std::cerr << "Block number did no match" << std::endl;
-            sendACK(clientSocket, expectedBlockNumber-1, serverAddress);
+            // Lost or repeated block: the server resumes after the last block received in order.
+            // Only the first gap of a window or a lone repeat of the previous block is
+            // acknowledged, every further ACK for the same block would resend the window again.
+            LOG_WARN("Block number did no match");
+            if (receivedInWindow > 0 || recvBlockNumber == (uint16_t)(expectedBlockNumber - 1)) {
+                sendACK(clientSocket, expectedBlockNumber-1, serverAddress);
+                startRetransmitClock(true);
+                receivedInWindow = 0;
+            }
             continue;
         }
         
-        std::cerr << "Writing data in file" << std::endl;
+        if (trace) {
+            trace->span(TRACE_STAGE_RECEIVE, recvBlockNumber, waitStartedAt);
+            if (receivedInWindow == 0) {
+                trace->span(TRACE_STAGE_RTT, (uint16_t)(recvBlockNumber - 1), lastSentAt);
+            }
+        }
+        LOG_DEBUG("Writing data in file");
+        std::chrono::steady_clock::time_point writtenAt = std::chrono::steady_clock::now();
         file.write(reinterpret_cast<char*>(recvData), dataLength);
         if (file.fail())
         {
-            std::cerr << "File write error" << std::endl;
+            LOG_ERROR("File write error");
             const std::string errorMessage = "Disk full or allocation exceeded.";
             sendError(clientSocket, ERROR_DISK_FULL, errorMessage, serverAddress);
             // code logic for rewrite.
             file.close();
             return false;
         }
-        sendACK(clientSocket, recvBlockNumber, clientAddress);
+        if (trace) {
+            trace->span(TRACE_STAGE_WRITE, recvBlockNumber, writtenAt);
+        }
         expectedBlockNumber++;
-        if(dataLength < 512) {
-            std::cerr << "File recieved Successfuly." << std::endl;
+        // The first block after our ACK (or the RRQ) answers it
+        sampleRetransmitClock();
+        // Only the last block of a window is acknowledged (RFC 7440)
+        if (++receivedInWindow == windowSize || (size_t)dataLength < blockSize) {
+            sendACK(clientSocket, recvBlockNumber, serverAddress);
+            startRetransmitClock(false);
+            receivedInWindow = 0;
+        }
+        if((size_t)dataLength < blockSize) {
+            LOG_INFO("File recieved Successfuly.");
             file.close();
-            std::cerr << "Starting decompression of filename: " << filename << std::endl;
+            LOG_INFO("Starting decompression of filename: " << filename);
             const char delimiter[] = {static_cast<char>(0x7F), static_cast<char>(0xFE)};
             size_t delimiterSize = sizeof(delimiter);
             separateBinaryFile(filename, "output_file1.bin", "output_file2.bin", delimiter, delimiterSize);
             std::map<char, std::string> result = decodeBinaryFileToMap("output_file1.bin");
-            std::cerr << "Decompressed file" << std::endl;
+            LOG_INFO("Decompressed file");
             readBinaryFile("output_file2.bin");
             // call decompression function here
             inflate("output_file2.txt",result, prevFilename);
@@ -316,7 +506,7 @@ bool TFTPClient::handleRRQRequest(int clientSocket, struct sockaddr_in serverAdd
                     fs::remove(myStringArray[i]);
                 }
             }
-            std::cerr << "[DEBUG] : removed unnecessory files" << std::endl;
+            LOG_DEBUG("removed unnecessory files");
 
             return true;
         }
@@ -324,7 +514,7 @@ bool TFTPClient::handleRRQRequest(int clientSocket, struct sockaddr_in serverAdd
     }
     if (!retry)
     {
-        std::cerr << "Max retry for receiving timeout exceeded. Shutting down server" << std::endl;
+        LOG_ERROR("Max retry for receiving timeout exceeded. Shutting down server");
         file.close();
     }
     return false;
@@ -346,20 +536,15 @@ bool TFTPClient::handleRRQRequest(int clientSocket, struct sockaddr_in serverAdd
 
 bool TFTPClient::sendRRQPacket(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename) {
     std::string mode = "octet";
-    uint8_t packet[4 + filename.size() + mode.size()];
-    TFTPPacket::createRRQPacket(packet, filename, mode);
-    std::cerr << "RRQ Packet created successfully of size: " << sizeof(packet) << std::endl; 
-    std::cerr << "Packet content: ";
-    std::cerr << std::hex << static_cast<uint8_t>(packet[0]) << std::hex << static_cast<uint8_t>(packet[0]);
-    for (std::size_t i = 2; i < sizeof(packet); ++i) {
-        std::cerr << packet[i];
-    }
-    std::cerr << std::endl;
-    if (sendto(clientSocket, packet, sizeof(packet), 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send RRQ request packet" << std::endl;
+    uint8_t packet[MAX_PACKET_SIZE];
+    size_t packetSize = TFTPPacket::createRRQPacket(packet, filename, mode, requestedOptions);
+    LOG_DEBUG("RRQ Packet created successfully of size: " << packetSize);
+    LOG_DEBUG("Packet content: " << std::string((const char*)packet + 2, packetSize - 2));
+    if (sendto(clientSocket, packet, packetSize, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+        LOG_ERROR("fail to send RRQ request packet");
         return false;
     }
-    std::cerr << "[LOG] : RRQ request packet send to server " << serverAddress.sin_addr.s_addr << std::endl;
+    LOG_DEBUG("RRQ request packet send to server " << serverAddress.sin_addr.s_addr);
     return true;
 }
 
@@ -378,33 +563,41 @@ bool TFTPClient::sendRRQPacket(int clientSocket, struct sockaddr_in serverAddres
 bool TFTPClient::handleWRQRequest(int clientSocket, struct sockaddr_in serverAddress, const std::string& prevFilename) {
     if (prevFilename.empty())
     {
-        std::cerr << "[ERROR] : filename is empty" << std::endl;
+        LOG_ERROR("filename is empty");
         return false;
     }
     // std::string path = "clientDatabase/";
     // std::string newFilePath = path + prevFilename;
     deflate(prevFilename);
-    std::cerr << "File compressed" << std::endl;
+    LOG_INFO("File compressed");
     std::string strFilename(prevFilename);
     std::string filenameWithoutExtension = strFilename.substr(0, strFilename.find_last_of("."));
     std::string filename = filenameWithoutExtension + "compress.bin";
+    if (requestedOptions.count(TFTP_OPTION_TSIZE) && fs::exists(filename)) {
+        // Announce the size of the file being written
+        requestedOptions[TFTP_OPTION_TSIZE] = std::to_string(fs::file_size(filename));
+    }
+    startRetransmitClock(false);
     if (!sendWRQPacket(clientSocket, serverAddress, filename))
     {
-        std::cerr << "[ERROR] : fail to send WRQ packet" << std::endl;
+        LOG_ERROR("fail to send WRQ packet");
         return false;
     }
-    std::cerr << "[LOG] : sent WRQ packet" << std::endl;
+    LOG_DEBUG("sent WRQ packet");
 
-    char dataBuffer[512];
-    uint16_t expectedBlockNumber = 0;
+    bool started = false;               // ACK 0 or the OACK received
+    bool finalSent = false;             // the last block is in flight
+    bool windowResent = false;          // window sent again for an ACK of the block before it
+    uint16_t ackedBlockNumber = 0;
+    uint16_t lastSentBlockNumber = 0;
     int retry = MAX_RETRY;
     bool initialPacket = true;
     // std::string directory = "clientDatabase/";
     // std::string filePath = directory + filename;
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
+    // Opened once, every window is read from the same descriptor
+    if (!blockReader.open(filename)) {
         // Send an error packet (Disk full or allocation exceeded - Error Code 3)
-        std::cerr << "[ERROR] : Cannot create file" << std::endl;
+        LOG_ERROR("Cannot create file");
         const std::string errorMessage = "Disk full or allocation exceeded.";
         sendError(clientSocket, ERROR_DISK_FULL, errorMessage, clientAddress);
         return false;
@@ -418,13 +611,25 @@ bool TFTPClient::handleWRQRequest(int clientSocket, struct sockaddr_in serverAdd
         int readBytes = recvfrom(clientSocket, recievedBuffer, sizeof(recievedBuffer), 0, (struct sockaddr*)&recvAddress, &recvAddressLen);
         if (readBytes < 0)
         {
-            std::cerr << "TIMEOUT Occured" << std::endl;
+            LOG_WARN("TIMEOUT Occured");
             retry--;
+            backoffRetransmitTimeout();
+            if (trace) {
+                trace->mark(TRACE_STAGE_TIMEOUT, (uint16_t)(ackedBlockNumber + 1));
+                if (started && retry) {
+                    trace->mark(TRACE_STAGE_RETRANSMIT, (uint16_t)(ackedBlockNumber + 1));
+                }
+            }
+            // Send the whole window again
+            if (started && retry && !sendDataWindow(clientSocket, serverAddress, ackedBlockNumber, lastSentBlockNumber, finalSent)) {
+                blockReader.close();
+                return false;
+            }
             continue;
         }
         else if (readBytes > MAX_PACKET_SIZE)
         {
-            std::cerr << "Invalid packet received" << std::endl;
+            LOG_WARN("Invalid packet received");
             const std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, recvAddress);
             continue;
@@ -432,10 +637,10 @@ bool TFTPClient::handleWRQRequest(int clientSocket, struct sockaddr_in serverAdd
         else {
             retry = MAX_RETRY;
         }
-        std::cerr << "Received packet" << std::endl;
+        LOG_DEBUG("Received packet");
         if (recvAddress.sin_addr.s_addr != serverAddress.sin_addr.s_addr)
         {
-            std::cerr << "Corrupt packet from different IP received" << std::endl;
+            LOG_WARN("Corrupt packet from different IP received");
             const std::string errorMessage = "Unknown transfer ID";
             sendError(clientSocket, ERROR_UNKNOWN_TID, errorMessage, recvAddress);
             continue;
@@ -444,94 +649,173 @@ bool TFTPClient::handleWRQRequest(int clientSocket, struct sockaddr_in serverAdd
         {
             serverAddress.sin_port = recvAddress.sin_port;
             initialPacket = false;
-            std::cerr << "[LOG] : server port no. indentified" << std::endl;
+            LOG_DEBUG("server port no. indentified");
         }
         else if (serverAddress.sin_port != recvAddress.sin_port)
         {
-            std::cerr << "Corrupt packet from different port received" << std::endl;
+            LOG_WARN("Corrupt packet from different port received");
             const std::string errorMessage = "Unknown transfer ID";
             sendError(clientSocket, ERROR_UNKNOWN_TID, errorMessage, recvAddress);
             continue;
         }
-        std::cerr << "[LOG] : Source Verified" << std::endl;
+        LOG_DEBUG("Source Verified");
         uint16_t opcode = (uint16_t)(((recievedBuffer[1] & 0xFF) << 8) | (recievedBuffer[0] & 0XFF));
         opcode = ntohs(opcode);
-        std::cerr << "Recieved Opcode:" << opcode << std::endl;
+        LOG_DEBUG("Recieved Opcode:" << opcode);
+        if (opcode == TFTP_OPCODE_OACK && !started) {
+            // The server accepted options, the OACK stands for ACK 0
+            if (!handleOACK(clientSocket, recievedBuffer, readBytes, serverAddress)) {
+                blockReader.close();
+                return false;
+            }
+            opcode = TFTP_OPCODE_ACK;
+            recievedBuffer[2] = 0x00;
+            recievedBuffer[3] = 0x00;
+        }
         if (opcode != TFTP_OPCODE_ERROR && opcode != TFTP_OPCODE_ACK) {
-            std::cerr << "Illegal Opcode Recieved" << std::endl;
+            LOG_WARN("Illegal Opcode Recieved");
             std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, recvAddress);
-            file.close();
+            blockReader.close();
             return false;
         }
-        std::cerr << "[LOG] : Opcode Verified" << std::endl;
-        std::cerr << "Read Bytes: " << readBytes << std::endl;
+        LOG_DEBUG("Opcode Verified");
+        LOG_DEBUG("Read Bytes: " << readBytes);
         uint16_t recvBlockNumber = (uint16_t)(((recievedBuffer[3] & 0xFF) << 8) | (recievedBuffer[2] & 0XFF));
         recvBlockNumber = ntohs(recvBlockNumber);
         if (opcode == TFTP_OPCODE_ERROR)
         {
-            std::cerr << "Error packet recieved from server with error code: " << recvBlockNumber << std::endl;
+            LOG_WARN("Error packet recieved from server with error code: " << recvBlockNumber);
             int dataLength = readBytes - 4;
             char recvData[dataLength];
             memset(recvData, 0, dataLength);
-            std::cerr << "Copying data memory" << std::endl;
+            LOG_DEBUG("Copying data memory");
             memcpy(recvData, recievedBuffer + 4, dataLength);
-            std::cerr << "Recieved data size: " << dataLength << std::endl;
-            std::cerr << "[ERROR " << recvBlockNumber << "] " << recvData << std::endl;
+            LOG_DEBUG("Recieved data size: " << dataLength);
+            LOG_WARN("Error message from server: " << recvData);
             std::cout << "[ERROR " << recvBlockNumber << "] " << recvData << std::endl;
             return false;
         }
         if (opcode == TFTP_OPCODE_ACK)
         {
-            std::cerr << "ACK recieved" << std::endl;
-            if (recvBlockNumber != expectedBlockNumber) {
-                std::cerr << "Illegal ACK Recieved" << std::endl;
-                if (expectedBlockNumber == 0)
+            LOG_DEBUG("ACK recieved");
+            if (!started) {
+                if (recvBlockNumber != 0)
                 {    
+                    LOG_WARN("Illegal ACK Recieved");
                     std::string errorMessage = "Illegal TFTP operation";
                     sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, recvAddress);
-                    file.close();
+                    blockReader.close();
+                    return false;
+                }
+                started = true;
+            }
+            else if (recvBlockNumber == ackedBlockNumber && windowSize > 1 && !windowResent) {
+                // The first block of the window was lost, send the window again once
+                windowResent = true;
+                startRetransmitClock(true);
+                if (trace) {
+                    trace->mark(TRACE_STAGE_RETRANSMIT, (uint16_t)(ackedBlockNumber + 1));
+                }
+                if (!sendDataWindow(clientSocket, serverAddress, ackedBlockNumber, lastSentBlockNumber, finalSent)) {
+                    blockReader.close();
                     return false;
                 }
                 continue;
             }
+            else if ((uint16_t)(recvBlockNumber - ackedBlockNumber) == 0
+                     || (uint16_t)(recvBlockNumber - ackedBlockNumber) > (uint16_t)(lastSentBlockNumber - ackedBlockNumber)) {
+                // Not a block in flight, e.g. a delayed or duplicate ACK
+                LOG_WARN("Illegal ACK Recieved");
+                continue;
+            }
+            else if (finalSent && recvBlockNumber == lastSentBlockNumber) {
+                if (trace) {
+                    trace->span(TRACE_STAGE_RTT, recvBlockNumber, lastSentAt);
+                }
+                LOG_INFO("File recieved Successfuly.");
+                blockReader.close();
+                return true;
+            }
         }
-        std::cerr << "[LOG] : ACK Verified" << std::endl;
-        expectedBlockNumber++;
-        
-
-        uint8_t packet[516];
-        memset(packet, 0, sizeof(packet));
-        memset(dataBuffer, 0, 512);
-        size_t dataSize = file.gcount();
-        dataSize = TFTPPacket::readDataBlock(filename, expectedBlockNumber, dataBuffer, dataSize);
-        if (dataSize == 0) {
-            break; // End of file
-        }
-        std::cerr << "Data Size: " << dataSize << std::endl;
-        TFTPPacket::createDataPacket(packet, expectedBlockNumber, dataBuffer, dataSize);
-        if (sendto(clientSocket, packet, dataSize + 4, 0, (struct sockaddr*)&recvAddress, sizeof(recvAddress)) < 0) {
-            std::cerr << "[ERROR] : fail to send DATA packet" << std::endl;
-            return false;
+        LOG_DEBUG("ACK Verified");
+        // An ACK before the end of the window means the blocks after it were lost,
+        // the next window starts right after it (RFC 7440)
+        ackedBlockNumber = recvBlockNumber;
+        windowResent = false;
+        if (trace) {
+            trace->span(TRACE_STAGE_RTT, recvBlockNumber, lastSentAt);
         }
-        std::cerr << "[LOG] : DATA packet send to server " << serverAddress.sin_addr.s_addr << std::endl;
-        if (dataSize < 512) {
-            std::cerr << "[LOG] : File recieved Successfuly." << std::endl;
-            file.close();
-            return true;
+        sampleRetransmitClock();
+        startRetransmitClock(false);
+        if (!sendDataWindow(clientSocket, serverAddress, ackedBlockNumber, lastSentBlockNumber, finalSent)) {
+            blockReader.close();
+            return false;
         }
     }
     
     if (!retry)
     {
-        std::cerr << "Max retry for receiving timeout exceeded. Shutting down server" << std::endl;
-        file.close();
+        LOG_ERROR("Max retry for receiving timeout exceeded. Shutting down server");
+        blockReader.close();
     }
     return false;
 
 }
 
 
+/**
+ * @brief Sends the window of DATA blocks following the last acknowledged block.
+ *
+ * Up to windowSize blocks are read from the file and sent (RFC 7440). Sending stops
+ * after the last block, which is shorter than the block size (possibly empty).
+ *
+ * @param clientSocket The socket descriptor for communication with the server.
+ * @param serverAddress The server's sockaddr_in structure containing the IP address and port.
+ * @param ackedBlockNumber The last block acknowledged by the server.
+ * @param lastSentBlockNumber Set to the last block sent.
+ * @param finalSent Set to true if the last block of the file was sent.
+ * @return true if the window is sent, false otherwise.
+ */
+bool TFTPClient::sendDataWindow(int clientSocket, struct sockaddr_in serverAddress, uint16_t ackedBlockNumber, uint16_t& lastSentBlockNumber, bool& finalSent) {
+    std::vector<char> dataBuffer(blockSize);
+    std::vector<uint8_t> packet(blockSize + 4);
+    finalSent = false;
+    for (size_t i = 1; i <= windowSize && !finalSent; i++) {
+        uint16_t blockNumber = ackedBlockNumber + i;
+        std::chrono::steady_clock::time_point stageStartedAt = std::chrono::steady_clock::now();
+        ssize_t readBytes = blockReader.readBlock(blockNumber, dataBuffer.data(), blockSize);
+        if (readBytes < 0) {
+            LOG_ERROR("fail to read DATA block " << blockNumber);
+            return false;
+        }
+        if (trace) {
+            trace->span(TRACE_STAGE_READ, blockNumber, stageStartedAt);
+            stageStartedAt = std::chrono::steady_clock::now();
+        }
+        size_t dataSize = readBytes;
+        LOG_DEBUG("Data Size: " << dataSize);
+        TFTPPacket::createDataPacket(packet.data(), blockNumber, dataBuffer.data(), dataSize);
+        if (trace) {
+            trace->span(TRACE_STAGE_BUILD, blockNumber, stageStartedAt);
+            stageStartedAt = std::chrono::steady_clock::now();
+        }
+        if (sendto(clientSocket, packet.data(), dataSize + 4, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+            LOG_ERROR("fail to send DATA packet");
+            return false;
+        }
+        if (trace) {
+            trace->span(TRACE_STAGE_SEND, blockNumber, stageStartedAt);
+        }
+        LOG_DEBUG("DATA packet send to server " << serverAddress.sin_addr.s_addr);
+        lastSentBlockNumber = blockNumber;
+        // An empty block still has to be sent when the file ends on a block boundary
+        finalSent = dataSize < blockSize;
+    }
+    return true;
+}
+
+
 /**
  * @brief Sends a Write Request (WRQ) packet to the TFTP server.
  *
@@ -547,13 +831,13 @@ bool TFTPClient::handleWRQRequest(int clientSocket, struct sockaddr_in serverAdd
 
 bool TFTPClient::sendWRQPacket(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename) {
     std::string mode = "octet";
-    uint8_t packet[4 + filename.size() + mode.size()];
-    TFTPPacket::createWRQPacket(packet, filename, mode);
-    if (sendto(clientSocket, packet, 4 + filename.size() + mode.size(), 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send WRQ request packet" << std::endl;
+    uint8_t packet[MAX_PACKET_SIZE];
+    size_t packetSize = TFTPPacket::createWRQPacket(packet, filename, mode, requestedOptions);
+    if (sendto(clientSocket, packet, packetSize, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+        LOG_ERROR("fail to send WRQ request packet");
         return false;
     }
-    std::cerr << "[LOG] : WRQ request packet send to server " << serverAddress.sin_addr.s_addr << std::endl;
+    LOG_DEBUG("WRQ request packet send to server " << serverAddress.sin_addr.s_addr);
     return true;
 }
 
@@ -576,10 +860,10 @@ void TFTPClient::sendError(int clientSocket, uint16_t errorCode, const std::stri
     TFTPPacket::createErrorPacket(packet, errorCode, errorMsg);
     packet[4 + errorMsg.size()] = '\0';
     if(sendto(clientSocket, packet, 4 + errorMsg.size() + 1, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send error packet" << std::endl;
+        LOG_ERROR("fail to send error packet");
         return;
     }
-    std::cerr << "[LOG] : Error packet send to server " << serverAddress.sin_addr.s_addr << " with error code: " << errorCode << std::endl;
+    LOG_INFO("Error packet send to server " << serverAddress.sin_addr.s_addr << " with error code: " << errorCode);
 }
 
 
@@ -599,15 +883,15 @@ void TFTPClient::sendError(int clientSocket, uint16_t errorCode, const std::stri
 bool TFTPClient::handleDELETERequest(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename) {
     if (filename.empty())
     {
-        std::cerr << "[ERROR] : filename is empty" << std::endl;
+        LOG_ERROR("filename is empty");
         return false;
     }
     if (!sendDELETEPacket(clientSocket, serverAddress, filename))
     {
-        std::cerr << "[ERROR] : fail to send DELETE packet" << std::endl;
+        LOG_ERROR("fail to send DELETE packet");
         return false;
     }
-    std::cerr << "[LOG] : sent DELETE packet" << std::endl;
+    LOG_DEBUG("sent DELETE packet");
     char recievedBuffer[516];
     uint16_t expectedBlockNumber = 1;
     int retry = MAX_RETRY;
@@ -618,13 +902,14 @@ bool TFTPClient::handleDELETERequest(int clientSocket, struct sockaddr_in server
         int readBytes = recvfrom(clientSocket, recievedBuffer, sizeof(recievedBuffer), 0, (struct sockaddr*)&recvAddress, &recvAddressLen);
         if (readBytes < 0)
         {
-            std::cerr << "TIMEOUT Occured" << std::endl;
+            LOG_WARN("TIMEOUT Occured");
             retry--;
+            backoffRetransmitTimeout();
             continue;
         }
         else if (readBytes > MAX_PACKET_SIZE)
         {
-            std::cerr << "Invalid packet received" << std::endl;
+            LOG_WARN("Invalid packet received");
             const std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, recvAddress);
             continue;
@@ -632,54 +917,54 @@ bool TFTPClient::handleDELETERequest(int clientSocket, struct sockaddr_in server
         else {
             retry = MAX_RETRY;
         }
-        std::cerr << "Received data" << std::endl;
+        LOG_DEBUG("Received data");
         if (recvAddress.sin_addr.s_addr != serverAddress.sin_addr.s_addr)
         {
-            std::cerr << "Corrupt packet from different IP received" << std::endl;
+            LOG_WARN("Corrupt packet from different IP received");
             const std::string errorMessage = "Unknown transfer ID";
             sendError(clientSocket, ERROR_UNKNOWN_TID, errorMessage, recvAddress);
             continue;
         }
         uint16_t opcode = (uint16_t)(((recievedBuffer[1] & 0xFF) << 8) | (recievedBuffer[0] & 0XFF));
         opcode = ntohs(opcode);
-        std::cerr << "Recieved Opcode:" << opcode << std::endl;
+        LOG_DEBUG("Recieved Opcode:" << opcode);
 
         if (opcode != TFTP_OPCODE_ERROR && opcode != TFTP_OPCODE_ACK) {
-            std::cerr << "Illegal Opcode Recieved" << std::endl;
+            LOG_WARN("Illegal Opcode Recieved");
             std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, recvAddress);
             return false;
         }
-        std::cerr << "Read Bytes: " << readBytes << std::endl;
+        LOG_DEBUG("Read Bytes: " << readBytes);
         uint16_t recvBlockNumber = (uint16_t)(((recievedBuffer[3] & 0xFF) << 8) | (recievedBuffer[2] & 0XFF));
         recvBlockNumber = ntohs(recvBlockNumber);
         if (opcode == TFTP_OPCODE_ACK)
         {
-            std::cerr << "ACK recieved" << std::endl;
+            LOG_DEBUG("ACK recieved");
             if (recvBlockNumber == ACK_OK) 
             {
                 std::cout << "ACK OK Recieved." << std::endl;
                 return true;
             }
-            std::cerr << "[ERROR] Incorrect ACK recieved with code: " << recvBlockNumber << std::endl;
+            LOG_WARN("Incorrect ACK recieved with code: " << recvBlockNumber);
             return false;
         }
         if (opcode == TFTP_OPCODE_ERROR)
         {
-            std::cerr << "Error packet recieved from server with error code: " << recvBlockNumber << std::endl;
+            LOG_WARN("Error packet recieved from server with error code: " << recvBlockNumber);
             int dataLength = readBytes - 4;
             char recvData[dataLength];
             memset(recvData, 0, dataLength);
-            std::cerr << "Copying data memory" << std::endl;
+            LOG_DEBUG("Copying data memory");
             memcpy(recvData, recievedBuffer + 4, dataLength);
-            std::cerr << "Recieved data size: " << dataLength << std::endl;
-            std::cerr << "[ERROR " << recvBlockNumber << "] " << recvData << std::endl;
+            LOG_DEBUG("Recieved data size: " << dataLength);
+            LOG_WARN("Error message from server: " << recvData);
             std::cout << "[ERROR " << recvBlockNumber << "] " << recvData << std::endl;
             return false;
         }
         
     }
-    std::cerr << "Max retry exceeded for timeout." << std::endl;
+    LOG_ERROR("Max retry exceeded for timeout.");
     return false;
 }
 
@@ -699,10 +984,10 @@ bool TFTPClient::handleDELETERequest(int clientSocket, struct sockaddr_in server
  */
 bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddress) {
     if (!sendLSPacket(clientSocket, serverAddress)) {
-        std::cerr << "[ERROR] : fail to send LS packet" << std::endl;
+        LOG_ERROR("fail to send LS packet");
         return false;
     }
-    std::cerr << "[LOG] : sent LS packet" << std::endl;
+    LOG_DEBUG("sent LS packet");
     std::string directory = "clientDatabase/";
     std::string filePath = directory + DEFAULT_LS_FILE_NAME;
     std::ofstream file(filePath, std::ios::binary); 
@@ -724,13 +1009,14 @@ bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddr
         int readBytes = recvfrom(clientSocket, recievedBuffer, sizeof(recievedBuffer), 0, (struct sockaddr*)&recvAddress, &recvAddressLen);
         if (readBytes < 0)
         {
-            std::cerr << "TIMEOUT Occured" << std::endl;
+            LOG_WARN("TIMEOUT Occured");
             retry--;
+            backoffRetransmitTimeout();
             continue;
         }
         else if (readBytes > MAX_PACKET_SIZE)
         {
-            std::cerr << "Invalid packet received" << std::endl;
+            LOG_WARN("Invalid packet received");
             const std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, recvAddress);
             continue;
@@ -738,10 +1024,10 @@ bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddr
         else {
             retry = MAX_RETRY;
         }
-        std::cerr << "Received data" << std::endl;
+        LOG_DEBUG("Received data");
         if (recvAddress.sin_addr.s_addr != serverAddress.sin_addr.s_addr)
         {
-            std::cerr << "Corrupt packet from different IP received" << std::endl;
+            LOG_WARN("Corrupt packet from different IP received");
             const std::string errorMessage = "Unknown transfer ID";
             sendError(clientSocket, ERROR_UNKNOWN_TID, errorMessage, recvAddress);
             continue;
@@ -750,37 +1036,37 @@ bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddr
         // Extract the opcode from the received packet
         uint16_t opcode = (uint16_t)(((recievedBuffer[1] & 0xFF) << 8) | (recievedBuffer[0] & 0XFF));
         opcode = ntohs(opcode);
-        std::cerr << "Recieved Opcode:" << opcode << std::endl;
+        LOG_DEBUG("Recieved Opcode:" << opcode);
 
         if (opcode != TFTP_OPCODE_DATA) {
-            std::cerr << "Illegal Opcode Recieved" << std::endl;
+            LOG_WARN("Illegal Opcode Recieved");
             std::string errorMessage = "Illegal TFTP operation";
             sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, recvAddress);
             return false;
         }
         uint16_t recvBlockNumber = (uint16_t)(((recievedBuffer[3] & 0xFF) << 8) | (recievedBuffer[2] & 0XFF));
         recvBlockNumber = ntohs(recvBlockNumber);
-        std::cerr << "Recieved Block Number:" << recvBlockNumber << std::endl;
+        LOG_DEBUG("Recieved Block Number:" << recvBlockNumber);
         if (recvBlockNumber != expectedBlockNumber) {
-            std::cerr << "Incorrect Block Number Recieved" << std::endl;
+            LOG_WARN("Incorrect Block Number Recieved");
             // std::string errorMessage = "Incorrect Block Number Recieved. Resend";
             // sendError(clientSocket, ERROR_NOT_DEFINED, errorMessage, recvAddress);
             // return false;
             continue;
         }
-        std::cerr << "Read Bytes: " << readBytes << std::endl;
+        LOG_DEBUG("Read Bytes: " << readBytes);
         int dataLength = readBytes - 4;
         char recvData[dataLength];
         memset(recvData, 0, dataLength);
-        std::cerr << "Copying data memory" << std::endl;
+        LOG_DEBUG("Copying data memory");
         memcpy(recvData, recievedBuffer + 4, dataLength);
-        std::cerr << "Recieved data size: " << dataLength << std::endl;
+        LOG_DEBUG("Recieved data size: " << dataLength);
         // std::cerr << "Received Data: " << std::endl << std::endl << recvData << std::endl;
-        std::cerr << "Writing data in file" << std::endl;
+        LOG_DEBUG("Writing data in file");
         file.write(reinterpret_cast<char*>(recvData), dataLength);
         if (file.fail())
         {
-            std::cerr << "File write error" << std::endl;
+            LOG_ERROR("File write error");
             const std::string errorMessage = "Disk full or allocation exceeded.";
             sendError(clientSocket, ERROR_DISK_FULL, errorMessage, serverAddress);
             // code logic for rewrite.
@@ -791,7 +1077,7 @@ bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddr
         if (readBytes < MAX_PACKET_SIZE)
         {
             success = true;
-            std::cerr << "File recieved Successfuly." << std::endl;
+            LOG_INFO("File recieved Successfuly.");
             /* code */
             break;
         }
@@ -800,7 +1086,7 @@ bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddr
     file.close();
     if (!retry)
     {
-        std::cerr << "Max retry for receiving timeout exceeded." << std::endl;
+        LOG_ERROR("Max retry for receiving timeout exceeded.");
     }
     return success;
 }
@@ -819,15 +1105,19 @@ bool TFTPClient::handleLSRequest(int clientSocket, struct sockaddr_in serverAddr
 void TFTPClient::sendACK(int clientSocket, uint16_t blockNumber, struct sockaddr_in serverAddress) {
     uint8_t packet[4];
     TFTPPacket::createACKPacket(packet, blockNumber);
+    std::chrono::steady_clock::time_point sentAt = std::chrono::steady_clock::now();
     int retry = 5;
     while (retry)
     {
         if (sendto(clientSocket, packet, 4, 0, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-            std::cerr << "[ERROR] : fail to send ACK packet. Retryinggg" << std::endl;
+            LOG_WARN("fail to send ACK packet. Retryinggg");
             retry--;
             continue;
         }
-        std::cerr << "[LOG] : ACK packet send to client " << serverAddress.sin_addr.s_addr << " with Block Number: " << blockNumber << std::endl;
+        if (trace) {
+            trace->span(TRACE_STAGE_SEND, blockNumber, sentAt);
+        }
+        LOG_DEBUG("ACK packet send to client " << serverAddress.sin_addr.s_addr << " with Block Number: " << blockNumber);
         return;
         /* code */
     }
@@ -839,6 +1129,22 @@ int main(int argc, char* argv[]){
     std::string filename;
     std::string serverIP;
     std::string request;
+    TFTPOptions options;
+    std::string tracePath;
+    // A leading --trace FILE writes the timings of every block of the transfer to FILE
+    if (argc > 2 && std::string(argv[1]) == "--trace") {
+        tracePath = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    // Trailing arguments of the form name=value are requested as options (RFC 2347)
+    while (argc > 1 && std::string(argv[argc - 1]).find('=') != std::string::npos) {
+        std::string option = argv[argc - 1];
+        size_t separator = option.find('=');
+        options[option.substr(0, separator)] = option.substr(separator + 1);
+        --argc;
+    }
     switch (argc)
     {
         case 4:
@@ -881,6 +1187,8 @@ int main(int argc, char* argv[]){
     }
 
     TFTPClient client(serverIP);
+    client.setOptions(options);
+    client.setTrace(tracePath);
     client.startClient(opcode, filename);
 
     return 1;
@@ -3,10 +3,16 @@
 
 #include <string>
 #include "TFTPPacket.h"
+#include "TFTPRetransmitTimer.h"
+#include "TFTPBlockReader.h"
+#include "TFTPTransferTrace.h"
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <filesystem>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <memory>
 
 namespace fs = std::filesystem;
 
@@ -22,15 +28,33 @@ public:
     struct sockaddr_in serverAddress;
     struct sockaddr_in clientAddress;
     void startClient(int opcode, const std::string& filename);
+    void setOptions(const TFTPOptions& options);
+    void setTrace(const std::string& path);
 
 private:
     std::string serverIP;
     int serverPort;
     int clientSocket;
+    TFTPOptions requestedOptions;
+    TFTPOptions negotiatedOptions;
+    size_t blockSize;
+    size_t windowSize;
+    TFTPRetransmitTimer retransmitTimer;
+    TFTPBlockReader blockReader;        // file being written to the server
+    std::chrono::steady_clock::time_point lastSentAt;
+    bool lastSentOnce;                  // the packet awaiting an answer was sent once, it may give an RTT sample (Karn)
+    std::string tracePath;              // where the trace of the transfer is written, empty if not traced
+    std::unique_ptr<TFTPTransferTrace> trace;
+    void applyRetransmitTimeout();
+    void startRetransmitClock(bool retransmission);
+    void sampleRetransmitClock();
+    void backoffRetransmitTimeout();
+    bool handleOACK(int clientSocket, const char* buffer, int readBytes, struct sockaddr_in serverAddress);
     bool handleRRQRequest(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename);
     bool sendRRQPacket(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename);
     bool handleWRQRequest(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename);
     bool sendWRQPacket(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename);
+    bool sendDataWindow(int clientSocket, struct sockaddr_in serverAddress, uint16_t ackedBlockNumber, uint16_t& lastSentBlockNumber, bool& finalSent);
     bool handleLSRequest(int clientSocket, struct sockaddr_in serverAddress);
     bool sendLSPacket(int clientSocket, struct sockaddr_in serverAddress);
     bool handleDELETERequest(int clientSocket, struct sockaddr_in serverAddress, const std::string& filename);
@@ -1,4 +1,5 @@
 #include "TFTPCompression.h"
+#include "TFTPLogger.h"
 
 /**
  * @brief Read a binary file and write its binary content to a text file.
@@ -54,7 +55,7 @@ void readBinaryFile(const char* filename) {
     }
     }
     else{
-        std::cerr << "Not able to open text file." << std::endl;
+        LOG_ERROR("Not able to open text file.");
         return;
 
     }
@@ -62,7 +63,7 @@ void readBinaryFile(const char* filename) {
     }
 
     else{
-        std::cerr << "Not able to open binary file." << std::endl;
+        LOG_ERROR("Not able to open binary file.");
         return;
 
     }
@@ -131,7 +132,7 @@ void combineBinaryFiles(const std::string& file1Path, const std::string& file2Pa
     // Read the contents of the first binary file
     std::ifstream file1(file1Path, std::ios::binary | std::ios::ate);
     if (!file1.is_open()) {
-        std::cerr << "Error opening file: " << file1Path << std::endl;
+        LOG_ERROR("Error opening file: " << file1Path);
         return;
     }
     std::streamsize fileSize1 = file1.tellg();
@@ -143,7 +144,7 @@ void combineBinaryFiles(const std::string& file1Path, const std::string& file2Pa
     // Read the contents of the second binary file
     std::ifstream file2(file2Path, std::ios::binary | std::ios::ate);
     if (!file2.is_open()) {
-        std::cerr << "Error opening file: " << file2Path << std::endl;
+        LOG_ERROR("Error opening file: " << file2Path);
         return;
     }
     std::streamsize fileSize2 = file2.tellg();
@@ -159,7 +160,7 @@ void combineBinaryFiles(const std::string& file1Path, const std::string& file2Pa
     // Combine the data and add the delimiter
     std::ofstream outputFile(outputPath, std::ios::binary);
     if (!outputFile.is_open()) {
-        std::cerr << "Error opening file: " << outputPath << std::endl;
+        LOG_ERROR("Error opening file: " << outputPath);
         return;
     }
     outputFile.write(data1.data(), fileSize1);
@@ -186,7 +187,7 @@ void separateBinaryFile(const std::string& inputPath, const std::string& output1
     // Read the contents of the combined binary file
     std::ifstream inputFile(inputPath, std::ios::binary | std::ios::ate);
     if (!inputFile.is_open()) {
-        std::cerr << "Error opening file: " << inputPath << std::endl;
+        LOG_ERROR("Error opening file: " << inputPath);
         return;
     }
     std::streamsize combinedFileSize = inputFile.tellg();
@@ -208,7 +209,7 @@ void separateBinaryFile(const std::string& inputPath, const std::string& output1
 
     // Check if the delimiter was found
     if (delimiterIndex + delimiterSize > combinedData.size()) {
-        std::cerr << "Delimiter not found in the combined binary file." << std::endl;
+        LOG_ERROR("Delimiter not found in the combined binary file.");
         return;
     }
 
@@ -219,7 +220,7 @@ void separateBinaryFile(const std::string& inputPath, const std::string& output1
     // Write the separated data to the output files
     std::ofstream output1File(output1Path, std::ios::binary);
     if (!output1File.is_open()) {
-        std::cerr << "Error opening file: " << output1Path << std::endl;
+        LOG_ERROR("Error opening file: " << output1Path);
         return;
     }
     output1File.write(data1.data(), data1.size());
@@ -227,7 +228,7 @@ void separateBinaryFile(const std::string& inputPath, const std::string& output1
 
     std::ofstream output2File(output2Path, std::ios::binary);
     if (!output2File.is_open()) {
-        std::cerr << "Error opening file: " << output2Path << std::endl;
+        LOG_ERROR("Error opening file: " << output2Path);
         return;
     }
     output2File.write(data2.data(), data2.size());
@@ -284,7 +285,7 @@ std::map<char, std::string> decodeBinaryFileToMap(const std::string& filename) {
 
     // Check if the file is open
     if (!inFileBin.is_open()) {
-        std::cerr << "Error opening file: " << filename << "\n";
+        LOG_ERROR("Error opening file: " << filename);
         return myMap; // Return an empty map on error
     }
 
@@ -590,7 +591,7 @@ void deflate(std::string filename){
     }
     }
     else{
-        std::cerr << "error opening file " << std::endl;
+        LOG_ERROR("error opening file ");
         return;
 
     }
@@ -673,13 +674,13 @@ void deflate(std::string filename){
     }
     else
     {
-        std::cerr << "Error opening the file for writing." << std::endl;
+        LOG_ERROR("Error opening the file for writing.");
         return;
     }
     output.close();
     }
     else{
-        std::cerr << "Error opening the file for writing." << std::endl;
+        LOG_ERROR("Error opening the file for writing.");
         return;
     }
     decodeFile.close();
@@ -724,7 +725,7 @@ void inflate(std::string filename, std::map<char, std::string> result, std::stri
  
     if (!hufmanoutput.is_open())
     {
-        std::cout << "Error huffman output is not open.";
+        LOG_ERROR("Error huffman output is not open.");
         return ;
     }
     while(heoutput.get(c))
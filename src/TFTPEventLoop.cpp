@@ -0,0 +1,92 @@
+#include "TFTPEventLoop.h"
+#include "TFTPLogger.h"
+#include <cerrno>
+#include <unistd.h>
+
+/**
+ * @brief Constructor for the TFTPEventLoop class.
+ *
+ * Creates the epoll instance used to wait on the listener and session sockets.
+ */
+TFTPEventLoop::TFTPEventLoop() : events(EVENT_LOOP_MAX_EVENTS) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        LOG_ERROR("Error creating epoll instance");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Destructor for the TFTPEventLoop class.
+ */
+TFTPEventLoop::~TFTPEventLoop() {
+    close(epollFd);
+}
+
+/**
+ * @brief Start watching a socket for incoming datagrams.
+ *
+ * @param socket The socket to watch.
+ * @param oneShot If set, the socket is registered disarmed and only reports events once rearmed.
+ * @return true if the socket was registered, false otherwise.
+ */
+bool TFTPEventLoop::addSocket(int socket, bool oneShot) {
+    struct epoll_event event;
+    event.events = oneShot ? EPOLLONESHOT : EPOLLIN;
+    event.data.fd = socket;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &event) < 0) {
+        LOG_ERROR("fail to add socket " << socket << " to epoll");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Report the next readiness event of a one-shot socket. Safe to call from any thread.
+ *
+ * @param socket The one-shot socket to rearm.
+ * @return true if the socket was rearmed, false otherwise.
+ */
+bool TFTPEventLoop::rearmSocket(int socket) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = socket;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, socket, &event) < 0) {
+        LOG_ERROR("fail to rearm socket " << socket << " in epoll");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop watching a socket. Must be called before the socket is closed.
+ *
+ * @param socket The socket to remove.
+ * @return true if the socket was removed, false otherwise.
+ */
+bool TFTPEventLoop::removeSocket(int socket) {
+    if (epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr) < 0) {
+        LOG_ERROR("fail to remove socket " << socket << " from epoll");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Wait until at least one watched socket is readable or the timeout expires.
+ *
+ * @param readySockets Filled with the sockets that have datagrams waiting.
+ * @param timeoutMs The maximum time to wait in milliseconds.
+ * @return The number of ready sockets, or -1 on error. Interruption by a signal returns 0.
+ */
+int TFTPEventLoop::waitForEvents(std::vector<int>& readySockets, int timeoutMs) {
+    readySockets.clear();
+    int count = epoll_wait(epollFd, events.data(), events.size(), timeoutMs);
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < count; i++) {
+        readySockets.push_back(events[i].data.fd);
+    }
+    return count;
+}
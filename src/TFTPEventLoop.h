@@ -0,0 +1,30 @@
+#ifndef TFTP_EVENT_LOOP_H
+#define TFTP_EVENT_LOOP_H
+
+#include <vector>
+#include <sys/epoll.h>
+
+#define EVENT_LOOP_MAX_EVENTS   256
+#define EVENT_LOOP_TICK_MS      100
+
+/**
+ * @brief Thin wrapper around an epoll instance watching UDP sockets for readability.
+ *
+ * One-shot sockets report a single readiness event and are then ignored until they
+ * are rearmed, so only one worker at a time handles the packets of a session.
+ */
+class TFTPEventLoop {
+public:
+    TFTPEventLoop();
+    ~TFTPEventLoop();
+    bool addSocket(int socket, bool oneShot = false);
+    bool rearmSocket(int socket);
+    bool removeSocket(int socket);
+    int waitForEvents(std::vector<int>& readySockets, int timeoutMs);
+
+private:
+    int epollFd;
+    std::vector<struct epoll_event> events;
+};
+
+#endif
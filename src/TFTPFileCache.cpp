@@ -0,0 +1,157 @@
+#include "TFTPFileCache.h"
+#include "TFTPLogger.h"
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+TFTPCachedFile::~TFTPCachedFile() {
+    if (data != nullptr) {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+}
+
+/**
+ * @brief Constructor for the TFTPFileCache class.
+ *
+ * @param capacity The mapped bytes kept for files no session is reading.
+ */
+TFTPFileCache::TFTPFileCache(size_t capacity) : capacity(capacity) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Get the mapping of a file, mapping it if it is not cached or changed.
+ *
+ * @param path The path of the file.
+ * @return The mapped file, or nullptr if it cannot be opened or mapped.
+ */
+std::shared_ptr<const TFTPCachedFile> TFTPFileCache::acquire(const std::string& path) {
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) < 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.lookups++;
+    auto it = index.find(path);
+    if (it != index.end()) {
+        const TFTPCachedFile& file = **it->second;
+        if (file.device == fileStat.st_dev && file.inode == fileStat.st_ino && file.size == fileStat.st_size
+            && file.modified.tv_sec == fileStat.st_mtim.tv_sec && file.modified.tv_nsec == fileStat.st_mtim.tv_nsec) {
+            stats.hits++;
+            recentFiles.splice(recentFiles.begin(), recentFiles, it->second);
+            return recentFiles.front();
+        }
+        // Replaced or modified behind the server's back
+        stats.invalidations++;
+        erase(it);
+    }
+    std::shared_ptr<const TFTPCachedFile> file = mapFile(path);
+    if (!file) {
+        return nullptr;
+    }
+    recentFiles.push_front(file);
+    index[path] = recentFiles.begin();
+    stats.mappedBytes += file->size;
+    stats.files++;
+    evict();
+    return file;
+}
+
+/**
+ * @brief Drop the mapping of a file that is written or deleted. Its readers keep their mapping.
+ *
+ * @param path The path of the file.
+ */
+void TFTPFileCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(path);
+    if (it != index.end()) {
+        stats.invalidations++;
+        erase(it);
+    }
+}
+
+/**
+ * @brief Change the capacity, evicting mappings if the cache is over it.
+ *
+ * @param capacity The mapped bytes kept for files no session is reading.
+ */
+void TFTPFileCache::setCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->capacity = capacity;
+    evict();
+}
+
+TFTPFileCacheStats TFTPFileCache::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+/**
+ * @brief Open and map a file read-only. The descriptor is closed once the file is mapped.
+ *
+ * @param path The path of the file.
+ * @return The mapped file, or nullptr on failure.
+ */
+std::shared_ptr<const TFTPCachedFile> TFTPFileCache::mapFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return nullptr;
+    }
+    std::shared_ptr<TFTPCachedFile> file = std::make_shared<TFTPCachedFile>();
+    file->path = path;
+    file->device = fileStat.st_dev;
+    file->inode = fileStat.st_ino;
+    file->size = fileStat.st_size;
+    file->modified = fileStat.st_mtim;
+    file->data = nullptr;
+    if (file->size > 0) {
+        void* mapping = mmap(nullptr, file->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            LOG_ERROR("fail to map " << path << ": " << strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+        // Readers go through the file from the start
+        madvise(mapping, file->size, MADV_SEQUENTIAL);
+        file->data = (const uint8_t*)mapping;
+    }
+    close(fd);
+    return file;
+}
+
+/**
+ * @brief Remove a file from the cache. Called with the mutex held.
+ *
+ * @param it The index entry of the file.
+ */
+void TFTPFileCache::erase(std::unordered_map<std::string, TFTPCachedFileList::iterator>::iterator it) {
+    stats.mappedBytes -= (*it->second)->size;
+    stats.files--;
+    recentFiles.erase(it->second);
+    index.erase(it);
+}
+
+/**
+ * @brief Drop the least recently used mappings no session is reading until the cache
+ * fits its capacity. Called with the mutex held.
+ */
+void TFTPFileCache::evict() {
+    auto it = recentFiles.end();
+    while (stats.mappedBytes > capacity && it != recentFiles.begin()) {
+        --it;
+        if (it->use_count() > 1) {
+            // Still read, evicting it would only map the file twice
+            continue;
+        }
+        auto next = std::next(it);
+        stats.evictions++;
+        erase(index.find((*it)->path));
+        it = next;
+    }
+}
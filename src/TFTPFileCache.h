@@ -0,0 +1,77 @@
+#ifndef TFTP_FILE_CACHE_H
+#define TFTP_FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define FILE_CACHE_DEFAULT_MB   256     // mapped bytes kept for files no session is reading
+
+/**
+ * @brief A file mapped read-only, shared by every session reading it.
+ *
+ * The mapping is released with the last reference, so a file evicted or invalidated
+ * while it is read stays valid for its readers.
+ */
+struct TFTPCachedFile {
+    std::string path;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    const uint8_t* data;        // nullptr for an empty file
+    ~TFTPCachedFile();
+};
+
+/**
+ * @brief Counters of a file cache.
+ */
+struct TFTPFileCacheStats {
+    uint64_t lookups;
+    uint64_t hits;              // lookups served by an existing mapping
+    uint64_t evictions;         // mappings dropped to stay within the capacity
+    uint64_t invalidations;     // mappings dropped because the file changed or was removed
+    size_t mappedBytes;         // size of the cached mappings
+    size_t files;
+};
+
+/**
+ * @brief Server wide cache of read-only file mappings, so concurrent readers of a file
+ * share one descriptor, one mapping and the page cache behind it.
+ *
+ * Files are identified by device, inode, size and modification time: a lookup stats
+ * the path and replaces a mapping whose file changed. Writes and deletes invalidate
+ * the mapping of their path. The least recently used mappings are dropped once the
+ * cached bytes exceed the capacity; mappings still read are never unmapped, they only
+ * leave the cache. All members are thread safe.
+ * The mappings are shared, so a file truncated meanwhile no longer backs its pages:
+ * their readers must send them through the kernel, which fails with EFAULT, or copy
+ * them with TFTPMappingGuard, touching them directly raises SIGBUS.
+ */
+class TFTPFileCache {
+public:
+    TFTPFileCache(size_t capacity = (size_t)FILE_CACHE_DEFAULT_MB << 20);
+    std::shared_ptr<const TFTPCachedFile> acquire(const std::string& path);
+    void invalidate(const std::string& path);
+    void setCapacity(size_t capacity);
+    TFTPFileCacheStats getStats();
+
+private:
+    typedef std::list<std::shared_ptr<const TFTPCachedFile>> TFTPCachedFileList;
+    size_t capacity;
+    std::mutex mutex;
+    TFTPCachedFileList recentFiles;     // most recently used first
+    std::unordered_map<std::string, TFTPCachedFileList::iterator> index;
+    TFTPFileCacheStats stats;
+    std::shared_ptr<const TFTPCachedFile> mapFile(const std::string& path);
+    void erase(std::unordered_map<std::string, TFTPCachedFileList::iterator>::iterator it);
+    void evict();
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "TFTPFileCommitter.h"
+#include "TFTPLogger.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * @brief Constructor for the TFTPFileCommitter class.
+ *
+ * @param directory The directory the files are published in, synced after every group.
+ */
+TFTPFileCommitter::TFTPFileCommitter(const std::string& directory) : directory(directory), stopping(false) {
+    memset(&stats, 0, sizeof(stats));
+    thread = std::thread(&TFTPFileCommitter::run, this);
+}
+
+/**
+ * @brief Commit the queued files and stop the thread.
+ */
+TFTPFileCommitter::~TFTPFileCommitter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    commitsReady.notify_one();
+    thread.join();
+}
+
+/**
+ * @brief Queue a finished upload to be synced and published.
+ *
+ * @param fd The temporary file, owned by the committer from now on.
+ * @param tempPath The path of the temporary file.
+ * @param path The path the file is published under.
+ * @return The commit, whose status changes once it is done.
+ */
+std::shared_ptr<TFTPFileCommit> TFTPFileCommitter::commit(int fd, const std::string& tempPath, const std::string& path) {
+    std::shared_ptr<TFTPFileCommit> commit = std::make_shared<TFTPFileCommit>();
+    commit->fd = fd;
+    commit->tempPath = tempPath;
+    commit->path = path;
+    commit->status.store(FILE_COMMIT_PENDING);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commits.push_back(commit);
+    }
+    commitsReady.notify_one();
+    return commit;
+}
+
+TFTPFileCommitterStats TFTPFileCommitter::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+/**
+ * @brief Publish a finished upload right away, without syncing it.
+ *
+ * For sessions without a committer: a reader still never sees a partial file, but an
+ * acknowledged upload may be lost in a crash.
+ *
+ * @param fd The temporary file, closed before returning.
+ * @param tempPath The path of the temporary file.
+ * @param path The path the file is published under.
+ * @return The commit, already done.
+ */
+std::shared_ptr<TFTPFileCommit> TFTPFileCommitter::publish(int fd, const std::string& tempPath, const std::string& path) {
+    std::shared_ptr<TFTPFileCommit> commit = std::make_shared<TFTPFileCommit>();
+    commit->fd = -1;
+    commit->tempPath = tempPath;
+    commit->path = path;
+    int status = fstat(fd, &commit->fileStat) == 0 ? publishFile(tempPath, path) : FILE_COMMIT_FAILED;
+    close(fd);
+    if (status != FILE_COMMIT_DONE) {
+        unlink(tempPath.c_str());
+    }
+    commit->status.store(status);
+    return commit;
+}
+
+/**
+ * @brief Move a temporary file to its name, unless a file has that name already.
+ *
+ * @return FILE_COMMIT_DONE, FILE_COMMIT_EXISTS or FILE_COMMIT_FAILED.
+ */
+int TFTPFileCommitter::publishFile(const std::string& tempPath, const std::string& path) {
+    int result = renameat2(AT_FDCWD, tempPath.c_str(), AT_FDCWD, path.c_str(), RENAME_NOREPLACE);
+    if (result < 0 && errno == EINVAL) {
+        // The file system cannot rename without replacing, a link cannot replace either
+        result = link(tempPath.c_str(), path.c_str());
+        if (result == 0) {
+            unlink(tempPath.c_str());
+        }
+    }
+    if (result == 0) {
+        return FILE_COMMIT_DONE;
+    }
+    if (errno == EEXIST) {
+        return FILE_COMMIT_EXISTS;
+    }
+    LOG_ERROR("fail to publish " << path << ": " << strerror(errno));
+    return FILE_COMMIT_FAILED;
+}
+
+void TFTPFileCommitter::run() {
+    std::vector<std::shared_ptr<TFTPFileCommit>> group;
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        commitsReady.wait(lock, [this]() { return stopping || !commits.empty(); });
+        if (commits.empty()) {
+            return;
+        }
+        size_t groupSize = std::min(commits.size(), (size_t)FILE_COMMIT_MAX_GROUP);
+        group.assign(commits.begin(), commits.begin() + groupSize);
+        commits.erase(commits.begin(), commits.begin() + groupSize);
+        lock.unlock();
+        commitGroup(group);
+        group.clear();
+    }
+}
+
+/**
+ * @brief Sync and publish a group of files, then sync the directory once for all of them.
+ *
+ * @param group The commits of the group, all done on return.
+ */
+void TFTPFileCommitter::commitGroup(std::vector<std::shared_ptr<TFTPFileCommit>>& group) {
+    // Every file is on its way to the disk before the first sync waits
+    for (const std::shared_ptr<TFTPFileCommit>& commit : group) {
+        sync_file_range(commit->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+    std::vector<int> results(group.size());
+    bool published = false;
+    uint64_t failures = 0;
+    for (size_t i = 0; i < group.size(); i++) {
+        TFTPFileCommit& commit = *group[i];
+        if (fdatasync(commit.fd) < 0 || fstat(commit.fd, &commit.fileStat) < 0) {
+            LOG_ERROR("fail to sync " << commit.tempPath << ": " << strerror(errno));
+            results[i] = FILE_COMMIT_FAILED;
+        }
+        else {
+            results[i] = publishFile(commit.tempPath, commit.path);
+        }
+        close(commit.fd);
+        commit.fd = -1;
+        if (results[i] == FILE_COMMIT_DONE) {
+            published = true;
+        }
+        else {
+            unlink(commit.tempPath.c_str());
+            failures++;
+        }
+    }
+    if (published) {
+        int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd < 0 || fsync(directoryFd) < 0) {
+            // The files are published already, only their names may not survive a crash
+            LOG_ERROR("fail to sync " << directory << ": " << strerror(errno));
+        }
+        if (directoryFd >= 0) {
+            close(directoryFd);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.commits += group.size();
+        stats.groups++;
+        stats.largestGroup = std::max(stats.largestGroup, (uint64_t)group.size());
+        stats.failures += failures;
+    }
+    for (size_t i = 0; i < group.size(); i++) {
+        group[i]->status.store(results[i], std::memory_order_release);
+    }
+}
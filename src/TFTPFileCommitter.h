@@ -0,0 +1,80 @@
+#ifndef TFTP_FILE_COMMITTER_H
+#define TFTP_FILE_COMMITTER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <sys/stat.h>
+
+/* Commit Status */
+#define FILE_COMMIT_PENDING     0
+#define FILE_COMMIT_DONE        1   // durable and published under its name
+#define FILE_COMMIT_FAILED      2
+#define FILE_COMMIT_EXISTS      3   // another file of the same name was published first
+
+#define FILE_COMMIT_MAX_GROUP   64      // commits sharing one directory sync
+#define FILE_COMMIT_POLL_US     500     // how often a session checks its commit
+
+/**
+ * @brief A finished upload on its way from its temporary file to its name.
+ */
+struct TFTPFileCommit {
+    int fd;                     // owned by the committer until the commit is done
+    std::string tempPath;
+    std::string path;
+    struct stat fileStat;       // the published file, valid once done
+    std::atomic<int> status;
+};
+
+/**
+ * @brief Counters of a file committer.
+ */
+struct TFTPFileCommitterStats {
+    uint64_t commits;
+    uint64_t groups;            // directory syncs
+    uint64_t largestGroup;
+    uint64_t failures;
+};
+
+/**
+ * @brief Publishes finished uploads durably, in groups.
+ *
+ * An upload is written to a temporary file outside the database directory and handed
+ * over once complete. The committer thread takes every commit queued meanwhile as one
+ * group: it starts the writeback of all their files before waiting for any, syncs
+ * them, renames them into the directory without replacing an existing file and syncs
+ * the directory once for the whole group. A commit is only reported done after that,
+ * so an acknowledged upload survives a crash, and a reader or a restart never sees a
+ * partial file. Commits arriving while a group is synced form the next group, so many
+ * concurrent uploads share the syncs instead of waiting for one each.
+ *
+ * The committer owns the temporary file once it is handed over: it publishes it or
+ * removes it, even if the session that handed it over is gone.
+ */
+class TFTPFileCommitter {
+public:
+    TFTPFileCommitter(const std::string& directory);
+    ~TFTPFileCommitter();
+    std::shared_ptr<TFTPFileCommit> commit(int fd, const std::string& tempPath, const std::string& path);
+    TFTPFileCommitterStats getStats();
+    static std::shared_ptr<TFTPFileCommit> publish(int fd, const std::string& tempPath, const std::string& path);
+
+private:
+    std::string directory;
+    std::mutex mutex;
+    std::condition_variable commitsReady;
+    std::vector<std::shared_ptr<TFTPFileCommit>> commits;
+    bool stopping;
+    TFTPFileCommitterStats stats;
+    std::thread thread;
+    void run();
+    void commitGroup(std::vector<std::shared_ptr<TFTPFileCommit>>& group);
+    static int publishFile(const std::string& tempPath, const std::string& path);
+};
+
+#endif
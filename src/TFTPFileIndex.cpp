@@ -0,0 +1,326 @@
+#include "TFTPFileIndex.h"
+#include <algorithm>
+#include <mutex>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fnmatch.h>
+
+/**
+ * @brief Add a file with no readers, or update the size and modification time of an
+ * indexed one.
+ *
+ * @param name The file name.
+ * @param size The size of the file.
+ * @param modified The modification time of the file.
+ * @return true if the file was added, false if it was already indexed.
+ */
+bool TFTPFileIndex::insert(const std::string& name, off_t size, const struct timespec& modified) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto inserted = shard.entries.try_emplace(name);
+    TFTPFileIndexEntry& entry = inserted.first->second;
+    if (inserted.second || entry.size != size || entry.modified.tv_sec != modified.tv_sec || entry.modified.tv_nsec != modified.tv_nsec) {
+        entry.size = size;
+        entry.modified = modified;
+        shard.version.fetch_add(1, std::memory_order_release);
+    }
+    return inserted.second;
+}
+
+bool TFTPFileIndex::contains(const std::string& name) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.entries.find(name) != shard.entries.end();
+}
+
+/**
+ * @brief Register a reader of a file.
+ *
+ * @param name The file name.
+ * @return true if the file is indexed and now counts the reader, false otherwise.
+ */
+bool TFTPFileIndex::acquireReader(const std::string& name) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.entries.find(name);
+    if (it == shard.entries.end()) {
+        return false;
+    }
+    it->second.readers.fetch_add(1, std::memory_order_relaxed);
+    shard.version.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Unregister a reader registered with acquireReader().
+ *
+ * @param name The file name.
+ */
+void TFTPFileIndex::releaseReader(const std::string& name) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.entries.find(name);
+    if (it == shard.entries.end()) {
+        return;
+    }
+    // The file may have been deleted and created again behind the server's back meanwhile
+    int readers = it->second.readers.load(std::memory_order_relaxed);
+    while (readers > 0 && !it->second.readers.compare_exchange_weak(readers, readers - 1, std::memory_order_relaxed)) {
+    }
+    shard.version.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * @brief Get the active reader count of a file.
+ *
+ * @param name The file name.
+ * @return The number of readers, or -1 if the file is not indexed.
+ */
+int TFTPFileIndex::getReaders(const std::string& name) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.entries.find(name);
+    return it != shard.entries.end() ? it->second.readers.load(std::memory_order_relaxed) : -1;
+}
+
+/**
+ * @brief Remove a file that has no active readers.
+ *
+ * @param name The file name.
+ * @param removeFile Removes the file from disk, called with the shard locked; the file
+ * stays indexed if it returns false.
+ * @return FILE_INDEX_REMOVED, FILE_INDEX_NOT_FOUND, FILE_INDEX_BUSY or FILE_INDEX_FAILED.
+ */
+int TFTPFileIndex::remove(const std::string& name, const std::function<bool()>& removeFile) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.entries.find(name);
+    if (it == shard.entries.end()) {
+        return FILE_INDEX_NOT_FOUND;
+    }
+    if (it->second.readers.load(std::memory_order_relaxed) > 0) {
+        return FILE_INDEX_BUSY;
+    }
+    if (!removeFile()) {
+        return FILE_INDEX_FAILED;
+    }
+    shard.entries.erase(it);
+    shard.version.fetch_add(1, std::memory_order_release);
+    return FILE_INDEX_REMOVED;
+}
+
+/**
+ * @brief Drop a file removed from disk behind the server's back, whatever its readers.
+ * They keep reading the file they opened.
+ *
+ * @param name The file name.
+ */
+void TFTPFileIndex::erase(const std::string& name) {
+    TFTPFileIndexShard& shard = getShard(name);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (shard.entries.erase(name) > 0) {
+        shard.version.fetch_add(1, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief Copy the indexed files.
+ *
+ * Every shard is copied consistently, the shards one after the other.
+ *
+ * @return The files sorted by name.
+ */
+std::vector<TFTPFileInfo> TFTPFileIndex::snapshot() {
+    std::vector<TFTPFileInfo> files;
+    for (TFTPFileIndexShard& shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& entry : shard.entries) {
+            files.push_back({entry.first, entry.second.readers.load(std::memory_order_relaxed), entry.second.size, entry.second.modified});
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const TFTPFileInfo& a, const TFTPFileInfo& b) { return a.name < b.name; });
+    return files;
+}
+
+size_t TFTPFileIndex::size() {
+    size_t files = 0;
+    for (TFTPFileIndexShard& shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        files += shard.entries.size();
+    }
+    return files;
+}
+
+/**
+ * @brief Get the LS listing of every file, by name.
+ *
+ * The listing is rebuilt only if a shard changed since the last one was built. The
+ * shard versions are read before the files, so a change made while it is built makes
+ * the next call build it again.
+ *
+ * @return The listing, which stays valid for as long as it is held.
+ */
+std::shared_ptr<const std::string> TFTPFileIndex::getListing() {
+    uint64_t versions[FILE_INDEX_SHARDS];
+    for (int i = 0; i < FILE_INDEX_SHARDS; i++) {
+        versions[i] = shards[i].version.load(std::memory_order_acquire);
+    }
+    {
+        std::lock_guard<std::mutex> lock(listingMutex);
+        if (listing && memcmp(versions, listingVersions, sizeof(versions)) == 0) {
+            return listing;
+        }
+    }
+    std::string text;
+    for (const TFTPFileInfo& file : snapshot()) {
+        appendListingLine(text, file);
+    }
+    std::shared_ptr<const std::string> built = std::make_shared<const std::string>(std::move(text));
+    std::lock_guard<std::mutex> lock(listingMutex);
+    listing = built;
+    memcpy(listingVersions, versions, sizeof(versions));
+    return built;
+}
+
+/**
+ * @brief Get an LS listing of the files a query selects.
+ *
+ * Files are filtered by prefix and pattern, sorted, ties by name, and then paged; the
+ * listing of every file by name is the cached one.
+ *
+ * @param query The files to list and their order.
+ * @return The listing, which stays valid for as long as it is held.
+ */
+std::shared_ptr<const std::string> TFTPFileIndex::getListing(const TFTPListQuery& query) {
+    if (query.prefix.empty() && query.pattern.empty() && query.sortKey == LIST_SORT_NAME && !query.descending
+        && query.offset == 0 && query.limit == 0) {
+        return getListing();
+    }
+    std::vector<TFTPFileInfo> files = snapshot();
+    files.erase(std::remove_if(files.begin(), files.end(), [&query](const TFTPFileInfo& file) {
+        return file.name.compare(0, query.prefix.size(), query.prefix) != 0
+            || (!query.pattern.empty() && fnmatch(query.pattern.c_str(), file.name.c_str(), 0) != 0);
+    }), files.end());
+    if (query.sortKey == LIST_SORT_SIZE) {
+        std::stable_sort(files.begin(), files.end(), [](const TFTPFileInfo& a, const TFTPFileInfo& b) { return a.size < b.size; });
+    }
+    else if (query.sortKey == LIST_SORT_MODIFIED) {
+        std::stable_sort(files.begin(), files.end(), [](const TFTPFileInfo& a, const TFTPFileInfo& b) {
+            return a.modified.tv_sec < b.modified.tv_sec || (a.modified.tv_sec == b.modified.tv_sec && a.modified.tv_nsec < b.modified.tv_nsec);
+        });
+    }
+    if (query.descending) {
+        std::reverse(files.begin(), files.end());
+    }
+    size_t first = std::min<uint64_t>(query.offset, files.size());
+    size_t last = query.limit > 0 ? std::min<uint64_t>(first + query.limit, files.size()) : files.size();
+    std::string text;
+    for (size_t i = first; i < last; i++) {
+        appendListingLine(text, files[i]);
+    }
+    return std::make_shared<const std::string>(std::move(text));
+}
+
+/**
+ * @brief Write the indexed files to a snapshot file.
+ *
+ * The snapshot is the magic, the version as two 64 bit integers, then for every file
+ * its size, modification seconds and nanoseconds as 64 bit integers and its name
+ * terminated by a NUL. It is written next to the path and renamed over it, so a crash
+ * never leaves a truncated snapshot behind.
+ *
+ * @param path The path of the snapshot.
+ * @param version The modification time of the directory, taken before the index was
+ * last brought up to date with it.
+ * @return true if the snapshot was written.
+ */
+bool TFTPFileIndex::save(const std::string& path, const struct timespec& version) {
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream snapshotFile(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!snapshotFile) {
+        return false;
+    }
+    int64_t header[2] = {(int64_t)version.tv_sec, (int64_t)version.tv_nsec};
+    snapshotFile.write(FILE_INDEX_SNAPSHOT_MAGIC, strlen(FILE_INDEX_SNAPSHOT_MAGIC));
+    snapshotFile.write((const char*)header, sizeof(header));
+    for (TFTPFileIndexShard& shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& entry : shard.entries) {
+            int64_t metadata[3] = {(int64_t)entry.second.size, (int64_t)entry.second.modified.tv_sec, (int64_t)entry.second.modified.tv_nsec};
+            snapshotFile.write((const char*)metadata, sizeof(metadata));
+            snapshotFile.write(entry.first.c_str(), entry.first.size() + 1);
+        }
+    }
+    snapshotFile.close();
+    if (!snapshotFile || std::rename(temporaryPath.c_str(), path.c_str()) < 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Add the files of a snapshot written by save() for the same version of the directory.
+ *
+ * @param path The path of the snapshot.
+ * @param version The current modification time of the directory.
+ * @return true if the files were added, false if the snapshot is missing, damaged or
+ * of another version, in which case the index is left unchanged.
+ */
+bool TFTPFileIndex::load(const std::string& path, const struct timespec& version) {
+    std::ifstream snapshotFile(path, std::ios::binary);
+    if (!snapshotFile) {
+        return false;
+    }
+    std::string contents((std::istreambuf_iterator<char>(snapshotFile)), std::istreambuf_iterator<char>());
+    size_t magicSize = strlen(FILE_INDEX_SNAPSHOT_MAGIC);
+    int64_t header[2];
+    if (contents.size() < magicSize + sizeof(header) || contents.compare(0, magicSize, FILE_INDEX_SNAPSHOT_MAGIC) != 0) {
+        return false;
+    }
+    memcpy(header, contents.data() + magicSize, sizeof(header));
+    if (header[0] != (int64_t)version.tv_sec || header[1] != (int64_t)version.tv_nsec) {
+        return false;
+    }
+    std::vector<TFTPFileInfo> files;
+    size_t offset = magicSize + sizeof(header);
+    while (offset < contents.size()) {
+        int64_t metadata[3];
+        size_t end = offset + sizeof(metadata) < contents.size() ? contents.find('\0', offset + sizeof(metadata)) : std::string::npos;
+        if (end == std::string::npos) {
+            // Cut short
+            return false;
+        }
+        memcpy(metadata, contents.data() + offset, sizeof(metadata));
+        offset += sizeof(metadata);
+        files.push_back({contents.substr(offset, end - offset), 0, (off_t)metadata[0], {(time_t)metadata[1], (long)metadata[2]}});
+        offset = end + 1;
+    }
+    for (const TFTPFileInfo& file : files) {
+        insert(file.name, file.size, file.modified);
+    }
+    return true;
+}
+
+TFTPFileIndexShard& TFTPFileIndex::getShard(const std::string& name) {
+    return shards[std::hash<std::string>()(name) % FILE_INDEX_SHARDS];
+}
+
+/**
+ * @brief Append the LS line of a file: its name, reader count, size and modification
+ * time in UTC.
+ *
+ * @param text The listing.
+ * @param file The file.
+ */
+void TFTPFileIndex::appendListingLine(std::string& text, const TFTPFileInfo& file) {
+    struct tm modified;
+    char modifiedText[32];
+    gmtime_r(&file.modified.tv_sec, &modified);
+    strftime(modifiedText, sizeof(modifiedText), "%Y-%m-%dT%H:%M:%SZ", &modified);
+    text += file.name + "\t [Active Readers] : " + std::to_string(file.readers) + "\t [Size] : " + std::to_string(file.size)
+        + "\t [Modified] : " + modifiedText + "\n";
+}
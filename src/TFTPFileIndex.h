@@ -0,0 +1,118 @@
+#ifndef TFTP_FILE_INDEX_H
+#define TFTP_FILE_INDEX_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <functional>
+#include <shared_mutex>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <sys/types.h>
+
+#define FILE_INDEX_SHARDS       64
+#define FILE_INDEX_SNAPSHOT_MAGIC   "TFTPIDX2"
+
+/* Results of TFTPFileIndex::remove */
+#define FILE_INDEX_REMOVED      0
+#define FILE_INDEX_NOT_FOUND    1
+#define FILE_INDEX_BUSY         2   // the file has active readers
+#define FILE_INDEX_FAILED       3   // the file could not be removed from disk
+
+/* Sort keys of a listing */
+#define LIST_SORT_NAME          0
+#define LIST_SORT_SIZE          1
+#define LIST_SORT_MODIFIED      2
+
+/**
+ * @brief An indexed file: its active reader count and the size and modification time
+ * it had when it was last indexed.
+ */
+struct TFTPFileIndexEntry {
+    std::atomic<int> readers{0};
+    off_t size = 0;
+    struct timespec modified = {0, 0};
+};
+
+/**
+ * @brief A copy of an indexed file.
+ */
+struct TFTPFileInfo {
+    std::string name;
+    int readers;
+    off_t size;
+    struct timespec modified;
+};
+
+/**
+ * @brief Which files a listing shows and in which order.
+ */
+struct TFTPListQuery {
+    std::string prefix;         // names starting with it
+    std::string pattern;        // names matching this shell pattern, empty for any
+    int sortKey = LIST_SORT_NAME;
+    bool descending = false;
+    uint64_t offset = 0;        // matching files skipped
+    uint64_t limit = 0;         // files listed after them, 0 for all
+};
+
+/**
+ * @brief Files of one shard of the index.
+ */
+struct alignas(64) TFTPFileIndexShard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, TFTPFileIndexEntry> entries;
+    std::atomic<uint64_t> version{0};   // bumped by every change of the shard
+};
+
+/**
+ * @brief Thread safe index of the files the server serves, with their active reader
+ * counts, sizes and modification times.
+ *
+ * Names are spread over FILE_INDEX_SHARDS shards by hash, each with its own lock, so
+ * requests for different files rarely meet. Lookups and reader counting only take the
+ * shard lock shared and update the count atomically, so concurrent readers of one file
+ * do not serialize; inserting and removing a file take it exclusively. Removal checks
+ * the reader count under the exclusive lock, so a file cannot gain a reader while it
+ * is deleted.
+ *
+ * LS listings are built from the index, never from the disk. The listing of every file
+ * is kept until a shard changes, every shard counting its changes, so back to back LS
+ * share one listing; filtered and paged listings are built for their request.
+ *
+ * The files can be saved to a snapshot tagged with a version of the directory they
+ * were read from, so the next start only loads them instead of scanning the directory.
+ * The version only changes when files are added or removed, so sizes and times of
+ * files rewritten in place while the server was down stay those of the snapshot until
+ * the files change again.
+ */
+class TFTPFileIndex {
+public:
+    bool insert(const std::string& name, off_t size, const struct timespec& modified);
+    bool contains(const std::string& name);
+    bool acquireReader(const std::string& name);
+    void releaseReader(const std::string& name);
+    int getReaders(const std::string& name);
+    int remove(const std::string& name, const std::function<bool()>& removeFile);
+    void erase(const std::string& name);
+    std::vector<TFTPFileInfo> snapshot();
+    size_t size();
+    std::shared_ptr<const std::string> getListing();
+    std::shared_ptr<const std::string> getListing(const TFTPListQuery& query);
+    bool save(const std::string& path, const struct timespec& version);
+    bool load(const std::string& path, const struct timespec& version);
+
+private:
+    TFTPFileIndexShard shards[FILE_INDEX_SHARDS];
+    std::mutex listingMutex;
+    std::shared_ptr<const std::string> listing;
+    uint64_t listingVersions[FILE_INDEX_SHARDS];    // shard versions the listing was built from
+    TFTPFileIndexShard& getShard(const std::string& name);
+    static void appendListingLine(std::string& text, const TFTPFileInfo& file);
+};
+
+#endif
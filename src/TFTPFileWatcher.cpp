@@ -0,0 +1,129 @@
+#include "TFTPFileWatcher.h"
+#include "TFTPLogger.h"
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+TFTPFileWatcher::TFTPFileWatcher() : inotifyFd(-1), stopFd(-1), watching(false) {
+}
+
+TFTPFileWatcher::~TFTPFileWatcher() {
+    stop();
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+    }
+    if (stopFd >= 0) {
+        close(stopFd);
+    }
+}
+
+/**
+ * @brief Start queueing the changes of the files of a directory.
+ *
+ * @param directory The directory to watch.
+ * @return true if the directory is watched.
+ */
+bool TFTPFileWatcher::watch(const std::string& directory) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotifyFd < 0 || stopFd < 0) {
+        LOG_ERROR("fail to create the file watcher: " << strerror(errno));
+        return false;
+    }
+    // IN_EXCL_UNLINK: an upload unlinked before it is closed is never reported
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR | IN_EXCL_UNLINK;
+    if (inotify_add_watch(inotifyFd, directory.c_str(), mask) < 0) {
+        LOG_ERROR("fail to watch " << directory << ": " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Start delivering the queued changes and the ones to come.
+ *
+ * @param onChange Called with the name of every changed file.
+ * @param onOverflow Called when changes were lost.
+ */
+void TFTPFileWatcher::start(std::function<void(const std::string&)> onChange, std::function<void()> onOverflow) {
+    this->onChange = onChange;
+    this->onOverflow = onOverflow;
+    watching = true;
+    thread = std::thread(&TFTPFileWatcher::run, this);
+}
+
+/**
+ * @brief Deliver the queued changes and stop the thread.
+ *
+ * @return true if every change was delivered since start().
+ */
+bool TFTPFileWatcher::stop() {
+    if (!thread.joinable()) {
+        return false;
+    }
+    uint64_t stopValue = 1;
+    if (write(stopFd, &stopValue, sizeof(stopValue)) < 0) {
+        LOG_ERROR("fail to stop the file watcher: " << strerror(errno));
+    }
+    thread.join();
+    return watching;
+}
+
+void TFTPFileWatcher::run() {
+    struct pollfd pollFds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+    while (true) {
+        if (poll(pollFds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("file watcher poll failed: " << strerror(errno));
+            watching = false;
+            return;
+        }
+        if (!readEvents()) {
+            watching = false;
+            return;
+        }
+        if (pollFds[1].revents & POLLIN) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Read and deliver the queued events.
+ *
+ * @return false once the directory is no longer watched.
+ */
+bool TFTPFileWatcher::readEvents() {
+    alignas(struct inotify_event) char buffer[FILE_WATCHER_BUFFER_SIZE];
+    while (true) {
+        ssize_t bytesRead = read(inotifyFd, buffer, sizeof(buffer));
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                LOG_ERROR("file watcher read failed: " << strerror(errno));
+            }
+            return errno == EAGAIN;
+        }
+        for (char* next = buffer; next < buffer + bytesRead; ) {
+            const struct inotify_event* event = (const struct inotify_event*)next;
+            next += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                LOG_WARN("file watcher queue overflowed");
+                onOverflow();
+            }
+            else if (event->mask & IN_IGNORED) {
+                LOG_ERROR("watched directory was removed");
+                return false;
+            }
+            else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                onChange(event->name);
+            }
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef TFTP_FILE_WATCHER_H
+#define TFTP_FILE_WATCHER_H
+
+#include <string>
+#include <thread>
+#include <functional>
+
+#define FILE_WATCHER_BUFFER_SIZE    65536   // inotify events read at once
+
+/**
+ * @brief Watches the files of a directory with inotify and reports their changes from
+ * its own thread.
+ *
+ * A file is reported by name once it is written and closed, moved in, deleted or moved
+ * out; the receiver checks the disk to tell which. Files are not reported while they
+ * are being written, nor when they are closed after being unlinked. When the kernel
+ * drops events because the queue overflowed, the overflow callback is called instead,
+ * and the receiver has to scan the directory again.
+ *
+ * watch() starts queueing events, start() starts delivering them, so the receiver can
+ * scan the directory in between without missing a change. stop() delivers the queued
+ * events before the thread exits.
+ */
+class TFTPFileWatcher {
+public:
+    TFTPFileWatcher();
+    ~TFTPFileWatcher();
+    bool watch(const std::string& directory);
+    void start(std::function<void(const std::string&)> onChange, std::function<void()> onOverflow);
+    bool stop();
+
+private:
+    int inotifyFd;
+    int stopFd;
+    std::thread thread;
+    bool watching;      // set by the thread, read once it is joined
+    std::function<void(const std::string&)> onChange;
+    std::function<void()> onOverflow;
+    void run();
+    bool readEvents();
+};
+
+#endif
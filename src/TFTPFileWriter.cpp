@@ -0,0 +1,286 @@
+#include "TFTPFileWriter.h"
+#include "TFTPLogger.h"
+#include "TFTPMetrics.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * @brief Write a whole buffer at an offset of a file.
+ *
+ * @return true if every byte was written.
+ */
+bool TFTPWriteStream::writeAll(int fd, const uint8_t* data, size_t size, off_t offset) {
+    std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    TFTPMetrics::record(METRIC_DISK_WRITE, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count());
+    return true;
+}
+
+/**
+ * @brief Constructor for the TFTPWriteStream class.
+ *
+ * @param writer The writer whose threads write the buffers.
+ * @param fd The file being uploaded, owned by the stream from now on.
+ */
+TFTPWriteStream::TFTPWriteStream(TFTPFileWriter& writer, int fd)
+    : writer(writer), fd(fd), buffer(nullptr), bufferUsed(0), bufferOffset(0), preallocated(false), queued(0), failed(false) {
+}
+
+TFTPWriteStream::~TFTPWriteStream() {
+    free(buffer);
+    for (uint8_t* freeBuffer : freeBuffers) {
+        free(freeBuffer);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Allocate the disk space of the upload before it arrives, so it is not fragmented.
+ *
+ * The file size is left alone; trim() gives back the space the upload did not use.
+ *
+ * @param size The size the client announced.
+ * @return false if there is no room for the file, true otherwise, also if the file
+ * system cannot preallocate.
+ */
+bool TFTPWriteStream::preallocate(off_t size) {
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) < 0) {
+        return errno != ENOSPC && errno != EFBIG;
+    }
+    preallocated = true;
+    writer.recordPreallocation();
+    return true;
+}
+
+/**
+ * @brief Append the next received bytes of the file.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return false if a write of the upload failed.
+ */
+bool TFTPWriteStream::append(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!freeBuffers.empty()) {
+                buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+            }
+            else if (posix_memalign((void**)&buffer, WRITE_BEHIND_ALIGNMENT, WRITE_BEHIND_BUFFER_SIZE) != 0) {
+                buffer = nullptr;
+                failed = true;
+                return false;
+            }
+        }
+        size_t copied = std::min(size, WRITE_BEHIND_BUFFER_SIZE - bufferUsed);
+        memcpy(buffer + bufferUsed, data, copied);
+        bufferUsed += copied;
+        data += copied;
+        size -= copied;
+        if (bufferUsed == WRITE_BEHIND_BUFFER_SIZE) {
+            submit();
+        }
+    }
+    return !hasFailed();
+}
+
+/**
+ * @brief Hand the bytes appended since the last full buffer to the writer.
+ */
+void TFTPWriteStream::flush() {
+    if (bufferUsed > 0) {
+        submit();
+    }
+}
+
+/**
+ * @brief Whether every appended byte handed to the writer was written (or failed to).
+ */
+bool TFTPWriteStream::isIdle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queued == 0;
+}
+
+bool TFTPWriteStream::hasFailed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+/**
+ * @brief Give back the preallocated space past the end of the upload. Called once the
+ * stream is idle.
+ *
+ * @return false if the space could not be given back.
+ */
+bool TFTPWriteStream::trim() {
+    return !preallocated || ftruncate(fd, getSize()) == 0;
+}
+
+/**
+ * @brief Hand the file over to the caller. Called once the stream is idle.
+ *
+ * @return The file descriptor, no longer closed by the stream.
+ */
+int TFTPWriteStream::release() {
+    int released = fd;
+    fd = -1;
+    return released;
+}
+
+int TFTPWriteStream::getFd() const {
+    return fd;
+}
+
+/**
+ * @brief The number of bytes appended.
+ */
+off_t TFTPWriteStream::getSize() const {
+    return bufferOffset + bufferUsed;
+}
+
+/**
+ * @brief Queue the buffer being filled, or write it here if the upload has no other
+ * buffer left to fill.
+ */
+void TFTPWriteStream::submit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queued + 1 < WRITE_BEHIND_MAX_BUFFERS) {
+        queued++;
+        lock.unlock();
+        writer.enqueue({shared_from_this(), buffer, bufferUsed, bufferOffset});
+        buffer = nullptr;
+    }
+    else {
+        lock.unlock();
+        bool success = writeAll(fd, buffer, bufferUsed, bufferOffset);
+        writer.recordWrite(bufferUsed, success, true);
+        if (!success) {
+            lock.lock();
+            failed = true;
+        }
+    }
+    bufferOffset += bufferUsed;
+    bufferUsed = 0;
+}
+
+/**
+ * @brief Take back a buffer written by a writer thread.
+ *
+ * @param written The buffer.
+ * @param success Whether it was written.
+ */
+void TFTPWriteStream::complete(uint8_t* written, bool success) {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeBuffers.push_back(written);
+    queued--;
+    if (!success) {
+        failed = true;
+    }
+}
+
+/**
+ * @brief Constructor for the TFTPFileWriter class.
+ *
+ * @param threadCount The number of writer threads.
+ */
+TFTPFileWriter::TFTPFileWriter(int threadCount) : stopping(false) {
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back(&TFTPFileWriter::run, this);
+    }
+}
+
+/**
+ * @brief Write the queued buffers and stop the threads.
+ */
+TFTPFileWriter::~TFTPFileWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobsReady.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Start writing an upload behind its session.
+ *
+ * @param fd The file being uploaded, owned by the stream from now on.
+ * @return The stream of the upload.
+ */
+std::shared_ptr<TFTPWriteStream> TFTPFileWriter::open(int fd) {
+    return std::make_shared<TFTPWriteStream>(*this, fd);
+}
+
+TFTPFileWriterStats TFTPFileWriter::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void TFTPFileWriter::enqueue(TFTPWriteJob job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    jobsReady.notify_one();
+}
+
+void TFTPFileWriter::recordWrite(size_t size, bool success, bool inlineWrite) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (inlineWrite) {
+        stats.inlineWrites++;
+    }
+    else {
+        stats.writes++;
+    }
+    if (success) {
+        stats.bytes += size;
+    }
+    else {
+        stats.failures++;
+    }
+}
+
+void TFTPFileWriter::recordPreallocation() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.preallocations++;
+}
+
+void TFTPFileWriter::run() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobsReady.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty()) {
+            return;
+        }
+        TFTPWriteJob job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+        bool success = TFTPWriteStream::writeAll(job.stream->getFd(), job.buffer, job.size, job.offset);
+        if (!success) {
+            LOG_ERROR("write behind failed: " << strerror(errno));
+        }
+        recordWrite(job.size, success, false);
+        job.stream->complete(job.buffer, success);
+    }
+}
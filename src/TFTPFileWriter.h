@@ -0,0 +1,107 @@
+#ifndef TFTP_FILE_WRITER_H
+#define TFTP_FILE_WRITER_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+#define WRITE_BEHIND_BUFFER_SIZE    (256 << 10)     // received bytes gathered into one write
+#define WRITE_BEHIND_MAX_BUFFERS    4               // buffers of one upload, the last one is always being filled
+#define WRITE_BEHIND_ALIGNMENT      4096
+#define WRITE_BEHIND_DEFAULT_THREADS 2
+#define WRITE_BEHIND_POLL_US        500             // how often a finished upload checks for its last writes
+
+class TFTPFileWriter;
+
+/**
+ * @brief Counters of a file writer.
+ */
+struct TFTPFileWriterStats {
+    uint64_t writes;            // buffers written by the writer threads
+    uint64_t inlineWrites;      // buffers written by the session, its upload had every other buffer queued
+    uint64_t bytes;
+    uint64_t failures;
+    uint64_t preallocations;
+};
+
+/**
+ * @brief One upload written behind the session.
+ *
+ * Blocks are appended in order and gathered into WRITE_BEHIND_BUFFER_SIZE buffers
+ * that are aligned in memory and in the file; every full buffer is handed to the
+ * writer threads, so the session acknowledges blocks without waiting for the disk.
+ * An upload has at most WRITE_BEHIND_MAX_BUFFERS buffers; once all but the one being
+ * filled are queued, the session writes the next full buffer itself, which slows it
+ * down to the disk. The stream owns the file descriptor and closes it once neither the
+ * session nor a queued write holds the stream, unless the session released it.
+ *
+ * A failed write is reported by the next append() and by hasFailed().
+ */
+class TFTPWriteStream : public std::enable_shared_from_this<TFTPWriteStream> {
+public:
+    TFTPWriteStream(TFTPFileWriter& writer, int fd);
+    ~TFTPWriteStream();
+    bool preallocate(off_t size);
+    bool append(const uint8_t* data, size_t size);
+    void flush();
+    bool isIdle();
+    bool hasFailed();
+    bool trim();
+    int release();
+    int getFd() const;
+    off_t getSize() const;
+
+private:
+    friend class TFTPFileWriter;
+    TFTPFileWriter& writer;
+    int fd;
+    uint8_t* buffer;            // being filled, nullptr until the next block
+    size_t bufferUsed;
+    off_t bufferOffset;         // file offset of the buffer
+    bool preallocated;
+    std::mutex mutex;           // guards the members below, shared with the writer threads
+    std::vector<uint8_t*> freeBuffers;
+    int queued;                 // queued or being written
+    bool failed;
+    void submit();
+    void complete(uint8_t* written, bool success);
+    static bool writeAll(int fd, const uint8_t* data, size_t size, off_t offset);
+};
+
+/**
+ * @brief Server wide pool of threads writing the buffers of the uploads.
+ */
+class TFTPFileWriter {
+public:
+    TFTPFileWriter(int threadCount = WRITE_BEHIND_DEFAULT_THREADS);
+    ~TFTPFileWriter();
+    std::shared_ptr<TFTPWriteStream> open(int fd);
+    TFTPFileWriterStats getStats();
+
+private:
+    friend class TFTPWriteStream;
+    struct TFTPWriteJob {
+        std::shared_ptr<TFTPWriteStream> stream;
+        uint8_t* buffer;
+        size_t size;
+        off_t offset;
+    };
+    std::mutex mutex;
+    std::condition_variable jobsReady;
+    std::deque<TFTPWriteJob> jobs;
+    bool stopping;
+    std::vector<std::thread> threads;
+    TFTPFileWriterStats stats;
+    void enqueue(TFTPWriteJob job);
+    void recordWrite(size_t size, bool success, bool inlineWrite);
+    void recordPreallocation();
+    void run();
+};
+
+#endif
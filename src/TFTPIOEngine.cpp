@@ -0,0 +1,562 @@
+#include "TFTPIOEngine.h"
+#include "TFTPLogger.h"
+#include "TFTPMetrics.h"
+#include <cstring>
+#include <chrono>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+TFTPIOEngine::TFTPIOEngine()
+    : systemCalls(0), operations(0), recvRequests(0), recvDatagrams(0), sendRequests(0), sendDatagrams(0), submits(0) {
+}
+
+/**
+ * @brief Create an I/O engine for the requested backend.
+ *
+ * Falls back to the system call engine when io_uring is not available on this kernel.
+ *
+ * @param backend The backend to use (IO_BACKEND_SYSCALL or IO_BACKEND_IO_URING).
+ * @return A newly allocated engine owned by the caller.
+ */
+TFTPIOEngine* TFTPIOEngine::create(int backend) {
+    if (backend == IO_BACKEND_IO_URING) {
+        TFTPUringEngine* engine = new TFTPUringEngine();
+        if (engine->isReady()) {
+            return engine;
+        }
+        delete engine;
+        LOG_WARN("io_uring is not available. Falling back to system calls");
+    }
+    return new TFTPSyscallEngine();
+}
+
+/**
+ * @brief Queue the receive of the datagrams waiting on a socket. The socket must be non-blocking.
+ *
+ * The callback runs once per received datagram, in arrival order. Backends that cannot
+ * batch receives return a single datagram.
+ *
+ * @param socket The socket to receive from.
+ * @param bufferSize The largest datagram accepted.
+ * @param callback Called with each datagram, or once with a negative errno (-EAGAIN if none was waiting).
+ * @param maxDatagrams The most datagrams taken by this receive.
+ */
+void TFTPIOEngine::prepareRecv(int socket, size_t bufferSize, TFTPRecvCallback callback, int maxDatagrams) {
+    pending.emplace_back();
+    TFTPIOOperation& operation = pending.back();
+    operation.type = IO_OPERATION_RECV;
+    operation.fd = socket;
+    operation.maxDatagrams = std::max(1, maxDatagrams);
+    operation.datagramCount = 0;
+    operation.recvBuffer.resize(bufferSize * operation.maxDatagrams);
+    operation.buffer = operation.recvBuffer.data();
+    operation.size = bufferSize;
+    operation.offset = 0;
+    operation.linked = false;
+    operation.recvCallback = callback;
+}
+
+/**
+ * @brief Queue the send of a datagram.
+ *
+ * @param socket The socket to send on.
+ * @param packet The datagram to send.
+ * @param size The size of the datagram in bytes.
+ * @param address The destination address.
+ * @param callback Called with the number of bytes sent or a negative errno. May be empty.
+ */
+void TFTPIOEngine::prepareSend(int socket, const uint8_t* packet, size_t size, struct sockaddr_in address, TFTPIOCallback callback) {
+    prepareSend(socket, packet, size, nullptr, 0, address, 0, callback);
+}
+
+/**
+ * @brief Queue the send of a datagram gathered from a header and a payload.
+ *
+ * The payload is not copied, e.g. a DATA block is sent straight from a file mapping
+ * after its header. With MSG_ZEROCOPY the socket must have SO_ZEROCOPY set and the
+ * payload must stay unchanged until the kernel reports the send complete on the
+ * socket's error queue.
+ *
+ * @param socket The socket to send on.
+ * @param header The start of the datagram.
+ * @param headerSize The size of the header in bytes.
+ * @param payload The rest of the datagram, may be nullptr if payloadSize is 0.
+ * @param payloadSize The size of the payload in bytes.
+ * @param address The destination address.
+ * @param flags The send flags.
+ * @param callback Called with the number of bytes sent or a negative errno. May be empty.
+ */
+void TFTPIOEngine::prepareSend(int socket, const uint8_t* header, size_t headerSize, const void* payload, size_t payloadSize, struct sockaddr_in address, int flags, TFTPIOCallback callback) {
+    pending.emplace_back();
+    TFTPIOOperation& operation = pending.back();
+    operation.type = IO_OPERATION_SEND;
+    operation.fd = socket;
+    operation.buffer = const_cast<uint8_t*>(header);
+    operation.size = headerSize;
+    operation.payload = payload;
+    operation.payloadSize = payloadSize;
+    operation.flags = flags;
+    operation.offset = 0;
+    operation.linked = false;
+    operation.address = address;
+    operation.callback = callback;
+}
+
+/**
+ * @brief Queue a positional read from a file.
+ *
+ * @param fd The file to read from.
+ * @param buffer The buffer receiving the data.
+ * @param size The number of bytes to read.
+ * @param offset The file offset to read at.
+ * @param linked Only run the next prepared operation if this read returns size bytes.
+ * @param callback Called with the number of bytes read or a negative errno. May be empty.
+ */
+void TFTPIOEngine::prepareRead(int fd, void* buffer, size_t size, off_t offset, bool linked, TFTPIOCallback callback) {
+    pending.emplace_back();
+    TFTPIOOperation& operation = pending.back();
+    operation.type = IO_OPERATION_READ;
+    operation.fd = fd;
+    operation.buffer = buffer;
+    operation.size = size;
+    operation.offset = offset;
+    operation.linked = linked;
+    operation.callback = callback;
+}
+
+/**
+ * @brief Queue a positional write to a file.
+ *
+ * @param fd The file to write to.
+ * @param buffer The data to write.
+ * @param size The number of bytes to write.
+ * @param offset The file offset to write at.
+ * @param linked Only run the next prepared operation if this write stores size bytes.
+ * @param callback Called with the number of bytes written or a negative errno. May be empty.
+ */
+void TFTPIOEngine::prepareWrite(int fd, const void* buffer, size_t size, off_t offset, bool linked, TFTPIOCallback callback) {
+    pending.emplace_back();
+    TFTPIOOperation& operation = pending.back();
+    operation.type = IO_OPERATION_WRITE;
+    operation.fd = fd;
+    operation.buffer = const_cast<void*>(buffer);
+    operation.size = size;
+    operation.offset = offset;
+    operation.linked = linked;
+    operation.callback = callback;
+}
+
+/**
+ * @brief Execute every prepared operation and run their callbacks in preparation order.
+ *
+ * @return The number of operations executed.
+ */
+int TFTPIOEngine::submit() {
+    if (pending.empty()) {
+        return 0;
+    }
+    std::vector<TFTPIOOperation> batch;
+    batch.swap(pending);
+    // Operations prepared from now on, callbacks included, belong to the next submit
+    submits++;
+    for (TFTPIOOperation& operation : batch) {
+        operation.iov[0].iov_base = operation.buffer;
+        operation.iov[0].iov_len = operation.size;
+        operation.iov[1].iov_base = const_cast<void*>(operation.payload);
+        operation.iov[1].iov_len = operation.payloadSize;
+        memset(&operation.message, 0, sizeof(operation.message));
+        operation.message.msg_name = &operation.address;
+        operation.message.msg_namelen = sizeof(operation.address);
+        operation.message.msg_iov = operation.iov;
+        operation.message.msg_iovlen = operation.payloadSize > 0 ? 2 : 1;
+    }
+    execute(batch);
+    operations += batch.size();
+
+    uint64_t bytesSent = 0, bytesReceived = 0;
+    for (TFTPIOOperation& operation : batch) {
+        if (operation.type == IO_OPERATION_SEND && operation.result > 0) {
+            bytesSent += operation.result;
+        }
+        else if (operation.type == IO_OPERATION_RECV && operation.result > 0) {
+            if (operation.datagramCount == 0) {
+                bytesReceived += operation.result;
+            }
+            for (int i = 0; i < operation.datagramCount; i++) {
+                bytesReceived += operation.datagramSizes[i];
+            }
+        }
+    }
+    TFTPMetrics::add(METRIC_BYTES_SENT, bytesSent);
+    TFTPMetrics::add(METRIC_BYTES_RECEIVED, bytesReceived);
+
+    for (TFTPIOOperation& operation : batch) {
+        if (operation.type == IO_OPERATION_RECV && operation.result < 0) {
+            operation.recvCallback(operation.recvBuffer.data(), operation.result, operation.address);
+        }
+        else if (operation.type == IO_OPERATION_RECV && operation.datagramCount == 0) {
+            // Single datagram received into the operation's own message
+            recvRequests++;
+            recvDatagrams++;
+            operation.recvCallback(operation.recvBuffer.data(), operation.result, operation.address);
+        }
+        else if (operation.type == IO_OPERATION_RECV) {
+            recvRequests++;
+            recvDatagrams += operation.datagramCount;
+            for (int i = 0; i < operation.datagramCount; i++) {
+                operation.recvCallback(operation.recvBuffer.data() + i * operation.size, operation.datagramSizes[i], operation.datagramAddresses[i]);
+            }
+        }
+        else if (operation.callback) {
+            operation.callback(operation.result);
+        }
+        else if (operation.result < 0 && operation.result != -ECANCELED) {
+            LOG_ERROR("I/O operation failed: " << strerror(-operation.result));
+        }
+    }
+    return batch.size();
+}
+
+bool TFTPIOEngine::hasPending() const {
+    return !pending.empty();
+}
+
+uint64_t TFTPIOEngine::getSystemCalls() const {
+    return systemCalls;
+}
+
+uint64_t TFTPIOEngine::getOperations() const {
+    return operations;
+}
+
+uint64_t TFTPIOEngine::getRecvRequests() const {
+    return recvRequests;
+}
+
+uint64_t TFTPIOEngine::getRecvDatagrams() const {
+    return recvDatagrams;
+}
+
+uint64_t TFTPIOEngine::getSendRequests() const {
+    return sendRequests;
+}
+
+uint64_t TFTPIOEngine::getSendDatagrams() const {
+    return sendDatagrams;
+}
+
+/**
+ * @brief Number of submit() calls that executed operations; an operation prepared
+ * while it had a value is still pending until it changes.
+ *
+ * @return The submit count.
+ */
+uint64_t TFTPIOEngine::getSubmits() const {
+    return submits;
+}
+
+/**
+ * @brief Run the batch with one system call per operation or group of sends, honouring linked operations.
+ *
+ * @param batch The operations to execute; their results are filled in.
+ */
+void TFTPSyscallEngine::execute(std::vector<TFTPIOOperation>& batch) {
+    bool cancelled = false;
+    size_t index = 0;
+    while (index < batch.size()) {
+        TFTPIOOperation& operation = batch[index];
+        if (cancelled) {
+            operation.result = -ECANCELED;
+            cancelled = operation.linked;
+            index++;
+            continue;
+        }
+        if (operation.type == IO_OPERATION_SEND) {
+            // Sends are never linked, so a group of them cannot cancel anything
+            index += sendBatch(batch, index);
+            continue;
+        }
+        ssize_t result = -1;
+        std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+        switch (operation.type) {
+            case IO_OPERATION_RECV:
+                receiveBatch(operation);
+                break;
+            case IO_OPERATION_READ:
+                result = pread(operation.fd, operation.buffer, operation.size, operation.offset);
+                operation.result = result < 0 ? -errno : result;
+                TFTPMetrics::record(METRIC_DISK_READ, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count());
+                break;
+            case IO_OPERATION_WRITE:
+                result = pwrite(operation.fd, operation.buffer, operation.size, operation.offset);
+                operation.result = result < 0 ? -errno : result;
+                TFTPMetrics::record(METRIC_DISK_WRITE, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count());
+                break;
+        }
+        systemCalls++;
+        cancelled = operation.linked && operation.result != (ssize_t)operation.size;
+        index++;
+    }
+}
+
+/**
+ * @brief Receive up to the operation's maximum number of datagrams with one recvmmsg.
+ *
+ * @param operation The receive operation; its result is the number of datagrams or a negative errno.
+ */
+void TFTPSyscallEngine::receiveBatch(TFTPIOOperation& operation) {
+    std::vector<struct mmsghdr> messages(operation.maxDatagrams);
+    std::vector<struct iovec> iovs(operation.maxDatagrams);
+    operation.datagramAddresses.resize(operation.maxDatagrams);
+    for (int i = 0; i < operation.maxDatagrams; i++) {
+        iovs[i].iov_base = operation.recvBuffer.data() + i * operation.size;
+        iovs[i].iov_len = operation.size;
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_name = &operation.datagramAddresses[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        messages[i].msg_hdr.msg_iov = &iovs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int count = recvmmsg(operation.fd, messages.data(), operation.maxDatagrams, MSG_DONTWAIT, nullptr);
+    if (count <= 0) {
+        operation.result = count < 0 ? -errno : -EAGAIN;
+        return;
+    }
+    operation.datagramCount = count;
+    operation.datagramSizes.resize(count);
+    for (int i = 0; i < count; i++) {
+        operation.datagramSizes[i] = messages[i].msg_len;
+    }
+    operation.result = count;
+}
+
+/**
+ * @brief Send the run of consecutive sends on the same socket and with the same flags starting at first with one sendmmsg.
+ *
+ * @param batch The operations being executed.
+ * @param first The index of the first send of the run.
+ * @return The number of operations executed.
+ */
+size_t TFTPSyscallEngine::sendBatch(std::vector<TFTPIOOperation>& batch, size_t first) {
+    size_t count = 1;
+    while (first + count < batch.size() && batch[first + count].type == IO_OPERATION_SEND && batch[first + count].fd == batch[first].fd
+           && batch[first + count].flags == batch[first].flags) {
+        count++;
+    }
+    std::vector<struct mmsghdr> messages(count);
+    for (size_t i = 0; i < count; i++) {
+        messages[i].msg_hdr = batch[first + i].message;
+        messages[i].msg_len = 0;
+    }
+    size_t sent = 0;
+    while (sent < count) {
+        int result = sendmmsg(batch[first].fd, messages.data() + sent, count - sent, batch[first].flags);
+        systemCalls++;
+        if (result <= 0) {
+            // The first unsent datagram failed, report it and carry on with the rest
+            batch[first + sent].result = result < 0 ? -errno : -EAGAIN;
+            sent++;
+            continue;
+        }
+        sendRequests++;
+        sendDatagrams += result;
+        for (int i = 0; i < result; i++) {
+            batch[first + sent + i].result = messages[sent + i].msg_len;
+        }
+        sent += result;
+    }
+    return count;
+}
+
+/**
+ * @brief Constructor for the TFTPUringEngine class.
+ *
+ * Sets up an io_uring instance and maps its submission and completion rings.
+ * isReady() reports whether the kernel accepted the setup.
+ */
+TFTPUringEngine::TFTPUringEngine()
+    : ringFd(-1), queueDepth(0), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0),
+      sqes((struct io_uring_sqe*)MAP_FAILED), sqesSize(0), generation(0) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = syscall(__NR_io_uring_setup, IO_URING_QUEUE_DEPTH, &params);
+    if (ringFd < 0) {
+        return;
+    }
+    queueDepth = params.sq_entries;
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        return;
+    }
+    cqRing = singleMmap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+        return;
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return;
+    }
+
+    char* sq = (char*)sqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)cqRing;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+/**
+ * @brief Destructor for the TFTPUringEngine class.
+ */
+TFTPUringEngine::~TFTPUringEngine() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd >= 0) {
+        close(ringFd);
+    }
+}
+
+bool TFTPUringEngine::isReady() const {
+    return ringFd >= 0 && sqRing != MAP_FAILED && cqRing != MAP_FAILED && sqes != MAP_FAILED;
+}
+
+/**
+ * @brief Submit the batch as submission queue entries and wait for all completions.
+ *
+ * Batches larger than the queue depth are split, never inside a linked chain. Every
+ * entry carries the generation of its part in the upper half of its user data, so a
+ * completion left over from a part that gave up waiting is recognized and dropped.
+ *
+ * @param batch The operations to execute; their results are filled in.
+ */
+void TFTPUringEngine::execute(std::vector<TFTPIOOperation>& batch) {
+    size_t index = 0;
+    while (index < batch.size()) {
+        unsigned tail = *sqTail;
+        unsigned count = 0;
+        generation++;
+        while (index + count < batch.size() && count < queueDepth) {
+            TFTPIOOperation& operation = batch[index + count];
+            if (operation.linked && count + 1 == queueDepth && count > 0) {
+                break;
+            }
+            unsigned slot = (tail + count) & *sqMask;
+            struct io_uring_sqe* sqe = &sqes[slot];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = operation.fd;
+            sqe->user_data = ((uint64_t)generation << 32) | (index + count);
+            operation.result = -EINPROGRESS;
+            if (operation.linked) {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+            switch (operation.type) {
+                case IO_OPERATION_RECV:
+                    sqe->opcode = IORING_OP_RECVMSG;
+                    sqe->addr = (uint64_t)&operation.message;
+                    sqe->len = 1;
+                    sqe->msg_flags = MSG_DONTWAIT;
+                    break;
+                case IO_OPERATION_SEND:
+                    sendRequests++;
+                    sendDatagrams++;
+                    sqe->opcode = IORING_OP_SENDMSG;
+                    sqe->addr = (uint64_t)&operation.message;
+                    sqe->len = 1;
+                    sqe->msg_flags = operation.flags;
+                    break;
+                case IO_OPERATION_READ:
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->addr = (uint64_t)operation.buffer;
+                    sqe->len = operation.size;
+                    sqe->off = operation.offset;
+                    break;
+                case IO_OPERATION_WRITE:
+                    sqe->opcode = IORING_OP_WRITE;
+                    sqe->addr = (uint64_t)operation.buffer;
+                    sqe->len = operation.size;
+                    sqe->off = operation.offset;
+                    break;
+            }
+            sqArray[slot] = slot;
+            count++;
+        }
+        __atomic_store_n(sqTail, tail + count, __ATOMIC_RELEASE);
+
+        // Submit the entries and wait for their completions
+        std::chrono::steady_clock::time_point submittedAt = std::chrono::steady_clock::now();
+        unsigned toSubmit = count;
+        unsigned inFlight = count;
+        unsigned reaped = 0;
+        while (reaped < inFlight) {
+            int result = syscall(__NR_io_uring_enter, ringFd, toSubmit, inFlight - reaped, IORING_ENTER_GETEVENTS, nullptr, 0);
+            int error = errno;
+            systemCalls++;
+            if (result < 0 && error != EINTR && toSubmit > 0) {
+                LOG_ERROR("io_uring_enter failed: " << strerror(error));
+                // Entries the kernel did not take are failed and taken back out of the ring,
+                // the ones it took are still waited for
+                unsigned consumed = std::min(__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) - tail, count);
+                for (unsigned i = consumed; i < count; i++) {
+                    batch[index + i].result = -error;
+                }
+                __atomic_store_n(sqTail, tail + consumed, __ATOMIC_RELEASE);
+                toSubmit = 0;
+                inFlight = consumed;
+                continue;
+            }
+            if (result < 0 && error != EINTR && error != EAGAIN && error != EBUSY) {
+                LOG_ERROR("io_uring_enter failed while waiting: " << strerror(error));
+                // Give up on the entries in flight, their late completions are dropped
+                for (unsigned i = 0; i < inFlight; i++) {
+                    if (batch[index + i].result == -EINPROGRESS) {
+                        batch[index + i].result = -error;
+                    }
+                }
+                break;
+            }
+            if (result > 0) {
+                toSubmit -= std::min<unsigned>(toSubmit, result);
+            }
+            unsigned head = *cqHead;
+            unsigned completed = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != completed) {
+                struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+                head++;
+                if ((uint32_t)(cqe->user_data >> 32) != generation) {
+                    continue;
+                }
+                TFTPIOOperation& completedOperation = batch[(uint32_t)cqe->user_data];
+                completedOperation.result = cqe->res;
+                if (completedOperation.type == IO_OPERATION_READ || completedOperation.type == IO_OPERATION_WRITE) {
+                    TFTPMetrics::record(completedOperation.type == IO_OPERATION_READ ? METRIC_DISK_READ : METRIC_DISK_WRITE,
+                                        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - submittedAt).count());
+                }
+                reaped++;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        index += count;
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef TFTP_IO_ENGINE_H
+#define TFTP_IO_ENGINE_H
+
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+/* I/O Backends */
+#define IO_BACKEND_SYSCALL      0   // one blocking system call per operation
+#define IO_BACKEND_IO_URING     1   // operations batched as io_uring submission entries
+
+#define IO_URING_QUEUE_DEPTH    256
+
+/* Operation Types */
+#define IO_OPERATION_RECV       0
+#define IO_OPERATION_SEND       1
+#define IO_OPERATION_READ       2
+#define IO_OPERATION_WRITE      3
+
+typedef std::function<void(ssize_t result)> TFTPIOCallback;
+typedef std::function<void(const uint8_t* buffer, ssize_t bytesRead, struct sockaddr_in recvAddress)> TFTPRecvCallback;
+
+struct TFTPIOOperation {
+    int type;
+    int fd;
+    void* buffer;
+    size_t size;
+    off_t offset;
+    bool linked;
+    ssize_t result;
+    struct sockaddr_in address;
+    const void* payload;        // second part of a send, e.g. a block sent from a file mapping
+    size_t payloadSize;
+    int flags;                  // send flags, e.g. MSG_ZEROCOPY
+    struct msghdr message;
+    struct iovec iov[2];
+    std::vector<uint8_t> recvBuffer;
+    int maxDatagrams;
+    int datagramCount;
+    std::vector<size_t> datagramSizes;
+    std::vector<struct sockaddr_in> datagramAddresses;
+    TFTPIOCallback callback;
+    TFTPRecvCallback recvCallback;
+};
+
+/**
+ * @brief Batches socket and file operations of sessions and executes them on submit().
+ *
+ * Buffers passed to the prepare functions must stay valid and unchanged until submit()
+ * returns. An operation prepared with linked set only runs the following operation if
+ * it completed in full, e.g. a DATA packet is only sent once its block was read.
+ * Callbacks run inside submit(); operations they prepare are executed by the next submit().
+ * Batching counters report how many datagrams each receive or send request moved.
+ */
+class TFTPIOEngine {
+public:
+    virtual ~TFTPIOEngine() {}
+    void prepareRecv(int socket, size_t bufferSize, TFTPRecvCallback callback, int maxDatagrams = 1);
+    void prepareSend(int socket, const uint8_t* packet, size_t size, struct sockaddr_in address, TFTPIOCallback callback = nullptr);
+    void prepareSend(int socket, const uint8_t* header, size_t headerSize, const void* payload, size_t payloadSize, struct sockaddr_in address, int flags, TFTPIOCallback callback = nullptr);
+    void prepareRead(int fd, void* buffer, size_t size, off_t offset, bool linked, TFTPIOCallback callback);
+    void prepareWrite(int fd, const void* buffer, size_t size, off_t offset, bool linked, TFTPIOCallback callback);
+    int submit();
+    bool hasPending() const;
+    uint64_t getSystemCalls() const;
+    uint64_t getOperations() const;
+    uint64_t getRecvRequests() const;
+    uint64_t getRecvDatagrams() const;
+    uint64_t getSendRequests() const;
+    uint64_t getSendDatagrams() const;
+    uint64_t getSubmits() const;
+    static TFTPIOEngine* create(int backend);
+
+protected:
+    TFTPIOEngine();
+    virtual void execute(std::vector<TFTPIOOperation>& batch) = 0;
+    std::atomic<uint64_t> systemCalls;
+    std::atomic<uint64_t> operations;
+    std::atomic<uint64_t> recvRequests;
+    std::atomic<uint64_t> recvDatagrams;
+    std::atomic<uint64_t> sendRequests;
+    std::atomic<uint64_t> sendDatagrams;
+    std::atomic<uint64_t> submits;
+
+private:
+    std::vector<TFTPIOOperation> pending;
+};
+
+/**
+ * @brief Executes operations with recvmmsg, sendmmsg, pread and pwrite calls.
+ *
+ * A receive takes up to its maximum number of datagrams with one recvmmsg, and
+ * consecutive sends on the same socket with the same flags go out with one sendmmsg.
+ */
+class TFTPSyscallEngine : public TFTPIOEngine {
+protected:
+    void execute(std::vector<TFTPIOOperation>& batch) override;
+
+private:
+    void receiveBatch(TFTPIOOperation& operation);
+    size_t sendBatch(std::vector<TFTPIOOperation>& batch, size_t first);
+};
+
+/**
+ * @brief Executes a batch with a single io_uring_enter call per queue depth of operations.
+ */
+class TFTPUringEngine : public TFTPIOEngine {
+public:
+    TFTPUringEngine();
+    ~TFTPUringEngine();
+    bool isReady() const;
+
+protected:
+    void execute(std::vector<TFTPIOOperation>& batch) override;
+
+private:
+    int ringFd;
+    unsigned queueDepth;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    uint32_t generation;        // of the part of a batch being executed, tags its entries
+};
+
+#endif
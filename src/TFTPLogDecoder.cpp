@@ -0,0 +1,72 @@
+#include "TFTPLogger.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+#define LOG_DECODER_CHUNK_SIZE  (1 << 20)
+
+/**
+ * @brief Render a binary log written by the server with --log-binary as text, the
+ * same text the server writes to stderr without it.
+ *
+ * ./logdecoder [--time] FILE
+ */
+int main(int argc, char* argv[]) {
+    bool showTime = false;
+    std::string path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--time") {
+            showTime = true;
+        }
+        else if (path.empty()) {
+            path = arg;
+        }
+        else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        std::cout << "Usage: " << argv[0] << " [--time] FILE" << std::endl;
+        return 1;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "[ERROR] TFTP Log Decoder : Cannot open " << path << std::endl;
+        return 1;
+    }
+    TFTPLogFileHeader header;
+    if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, LOG_BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << "[ERROR] TFTP Log Decoder : " << path << " is not a binary log" << std::endl;
+        return 1;
+    }
+
+    // Decode chunk by chunk, a record cut by the end of a chunk is completed by the next
+    std::string input;
+    std::string output;
+    size_t decoded = sizeof(header);
+    TFTPLogRecord record;
+    std::vector<char> chunk(LOG_DECODER_CHUNK_SIZE);
+    while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0) {
+        input.append(chunk.data(), file.gcount());
+        size_t offset = 0;
+        while (TFTPLogger::decodeRecord(input, offset, record)) {
+            if (showTime) {
+                TFTPLogger::formatTime(output, record.timestamp, header.clockOffset);
+            }
+            TFTPLogger::formatRecord(output, record);
+        }
+        std::cout << output;
+        output.clear();
+        input.erase(0, offset);
+        decoded += offset;
+    }
+    if (!input.empty()) {
+        // The server stopped while writing it, or the file is damaged
+        std::cerr << "[ERROR] TFTP Log Decoder : Corrupt or truncated record at byte " << decoded << std::endl;
+        return 1;
+    }
+    return 0;
+}
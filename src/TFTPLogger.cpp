@@ -0,0 +1,437 @@
+#include "TFTPLogger.h"
+#include "TFTPPacket.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+std::atomic<int> TFTPLogger::minimumLevel(LOG_LEVEL_INFO);
+
+/*
+ * Formats of the events, indexed by their LOG_EVENT value. {} is a number, {ip} an IPv4
+ * address in network order and {op} a TFTP opcode. Ids are never reused, so old binary
+ * logs still decode.
+ */
+const char* const TFTPLogger::formats[LOG_EVENT_COUNT] = {
+    "",
+    "{} log messages dropped",
+    "{op} request from {ip}:{}",
+    "Server binded to port {}",
+    "ACK packet send to client {ip} with Block Number: {}",
+    "Error packet send to client {ip} with error code: {}",
+    "Error packet recieved from client {} with error code: {}",
+    "Duplicate acknowledgment received from client {} for blocknumber: {}",
+    "TIMEOUT Occured. Retransmitting to client {} with timeout {} us",
+    "Max retry for receiving timeout exceeded for client {}",
+    "File sent successfully to client {} in {} blocks",
+    "File recieved Successfuly from client {}, {} bytes",
+    "Client {} srtt {} us, rttvar {} us, rto {} us, {} timeouts",
+    "Client {} {} zero-copy sends, {} copied by the kernel",
+};
+
+void TFTPLogger::TFTPLogBuffer::reset(char* text, size_t size) {
+    setp(text, text + size);
+}
+
+size_t TFTPLogger::TFTPLogBuffer::length() const {
+    return pptr() - pbase();
+}
+
+/**
+ * @brief Create the ring of a thread on its first message.
+ */
+TFTPLogger::TFTPThreadLog::TFTPThreadLog() : ring(new TFTPLogRing()), record(nullptr), stream(&buffer) {
+    instance().addRing(ring);
+}
+
+/**
+ * @brief Leave the ring of an exiting thread to the drain thread, which frees it.
+ */
+TFTPLogger::TFTPThreadLog::~TFTPThreadLog() {
+    ring->closed.store(true, std::memory_order_release);
+}
+
+TFTPLogger::TFTPLogger() : outputFd(STDERR_FILENO), binary(false), stopped(false), stopping(false) {
+    thread = std::thread(&TFTPLogger::run, this);
+    atexit(&TFTPLogger::stop);
+}
+
+/**
+ * @brief The logger, started on the first message and never destroyed, so threads and
+ * exit handlers can log until the process ends.
+ */
+TFTPLogger& TFTPLogger::instance() {
+    static TFTPLogger* logger = new TFTPLogger();
+    return *logger;
+}
+
+TFTPLogger::TFTPThreadLog& TFTPLogger::threadLog() {
+    thread_local TFTPThreadLog log;
+    return log;
+}
+
+bool TFTPLogger::isEnabled(int level) {
+    return level >= LOG_COMPILED_LEVEL && level >= minimumLevel.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Start a message of this thread.
+ *
+ * @return A stream writing into the next record of the thread's ring, committed by commit().
+ */
+std::ostream& TFTPLogger::stream() {
+    TFTPThreadLog& log = threadLog();
+    log.buffer.reset(nextRecord().text, LOG_RECORD_TEXT_SIZE);
+    log.stream.clear();
+    log.stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    return log.stream;
+}
+
+/**
+ * @brief Hand the message started by stream() over to the drain thread.
+ *
+ * @param level The level of the message.
+ */
+void TFTPLogger::commit(int level) {
+    TFTPThreadLog& log = threadLog();
+    log.record->event = LOG_EVENT_TEXT;
+    log.record->length = log.buffer.length();
+    publish(level);
+}
+
+/**
+ * @return The next record of this thread's ring, the overflow record if the ring is full.
+ */
+TFTPLogRecord& TFTPLogger::nextRecord() {
+    TFTPThreadLog& log = threadLog();
+    uint64_t head = log.ring->head.load(std::memory_order_relaxed);
+    bool full = head - log.ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE;
+    log.record = full ? &log.overflow : &log.ring->records[head % LOG_RING_SIZE];
+    return *log.record;
+}
+
+/**
+ * @brief Timestamp the record returned by nextRecord() and make it visible to the drain thread.
+ *
+ * @param level The level of the record.
+ */
+void TFTPLogger::publish(int level) {
+    TFTPThreadLog& log = threadLog();
+    TFTPLogRecord& record = *log.record;
+    record.level = level;
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    TFTPLogger& logger = instance();
+    if (logger.stopped.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(logger.mutex);
+        std::string output;
+        logger.writeRecord(output, record);
+        logger.writeOutput(output);
+        return;
+    }
+    if (log.record == &log.overflow) {
+        log.ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    log.ring->head.store(log.ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Set the lowest level logged, call sites below LOG_COMPILED_LEVEL stay out.
+ *
+ * @param level One of the LOG_LEVEL values.
+ */
+void TFTPLogger::setLevel(int level) {
+    minimumLevel.store(level, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Parse a level name.
+ *
+ * @param name debug, info, warn or error.
+ * @return The level, -1 for an unknown name.
+ */
+int TFTPLogger::parseLevel(const std::string& name) {
+    static const char* names[] = {"debug", "info", "warn", "error"};
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; level++) {
+        if (name == names[level]) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Write every message committed so far.
+ */
+void TFTPLogger::flush() {
+    instance().drain();
+}
+
+/**
+ * @brief Exit handler: write the buffered messages and stop the drain thread, later
+ * messages are written directly.
+ */
+void TFTPLogger::stop() {
+    TFTPLogger& logger = instance();
+    {
+        std::lock_guard<std::mutex> lock(logger.mutex);
+        logger.stopping = true;
+    }
+    logger.stopRequested.notify_one();
+    logger.thread.join();
+    logger.stopped.store(true, std::memory_order_release);
+    logger.drain();
+}
+
+/**
+ * @brief Write the log to a binary file from now on, for the log decoder to render.
+ *
+ * @param path The file, replaced if it exists.
+ * @return true if the file could be created, false otherwise.
+ */
+bool TFTPLogger::setBinaryOutput(const std::string& path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    TFTPLogFileHeader header;
+    memcpy(header.magic, LOG_BINARY_MAGIC, sizeof(header.magic));
+    header.clockOffset = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+                         - std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        close(fd);
+        return false;
+    }
+    TFTPLogger& logger = instance();
+    // The messages logged so far go where they were meant to
+    logger.drain();
+    std::lock_guard<std::mutex> lock(logger.mutex);
+    if (logger.outputFd != STDERR_FILENO) {
+        close(logger.outputFd);
+    }
+    logger.outputFd = fd;
+    logger.binary = true;
+    return true;
+}
+
+/**
+ * @brief Format a record as a line of text.
+ *
+ * @param output The line is appended to it.
+ * @param record A formatted message or an event.
+ */
+void TFTPLogger::formatRecord(std::string& output, const TFTPLogRecord& record) {
+    static const char* prefixes[] = {"[DEBUG] : ", "[LOG] : ", "[WARN] : ", "[ERROR] : "};
+    output += prefixes[record.level];
+    if (record.event == LOG_EVENT_TEXT) {
+        output.append(record.text, record.length);
+    }
+    else if (record.event >= LOG_EVENT_COUNT) {
+        // Logged by a newer server
+        output += "Unknown event " + std::to_string(record.event);
+        for (uint32_t i = 0; i < record.length; i++) {
+            output += " " + std::to_string(record.args[i]);
+        }
+    }
+    else {
+        uint32_t next = 0;
+        for (const char* format = formats[record.event]; *format != '\0'; ) {
+            if (*format != '{') {
+                output += *format++;
+                continue;
+            }
+            const char* end = strchr(format, '}');
+            std::string kind(format + 1, end);
+            format = end + 1;
+            if (next >= record.length) {
+                output += '?';
+                continue;
+            }
+            int64_t value = record.args[next++];
+            if (kind == "ip") {
+                struct in_addr address;
+                address.s_addr = (uint32_t)value;
+                char text[INET_ADDRSTRLEN];
+                output += inet_ntop(AF_INET, &address, text, sizeof(text));
+            }
+            else if (kind == "op") {
+                output += opcodeName(value);
+            }
+            else {
+                output += std::to_string(value);
+            }
+        }
+    }
+    output += '\n';
+}
+
+/**
+ * @brief Append a record to a binary log.
+ *
+ * @param output The encoded record is appended to it.
+ * @param record A formatted message or an event.
+ */
+void TFTPLogger::encodeRecord(std::string& output, const TFTPLogRecord& record) {
+    TFTPLogFileRecord entry;
+    entry.timestamp = record.timestamp;
+    entry.event = record.event;
+    entry.level = record.level;
+    entry.unused = 0;
+    entry.length = record.length;
+    output.append((const char*)&entry, sizeof(entry));
+    if (record.event == LOG_EVENT_TEXT) {
+        output.append(record.text, record.length);
+    }
+    else {
+        output.append((const char*)record.args, record.length * sizeof(int64_t));
+    }
+}
+
+/**
+ * @brief Read a record of a binary log.
+ *
+ * @param input The binary log, without its header.
+ * @param offset Where the record starts, moved past it if it is read.
+ * @param record Set to the record.
+ * @return true if a record was read, false if the input ends or the record is corrupt.
+ */
+bool TFTPLogger::decodeRecord(const std::string& input, size_t& offset, TFTPLogRecord& record) {
+    TFTPLogFileRecord entry;
+    if (input.size() - offset < sizeof(entry)) {
+        return false;
+    }
+    memcpy(&entry, input.data() + offset, sizeof(entry));
+    bool text = entry.event == LOG_EVENT_TEXT;
+    size_t size = text ? entry.length : entry.length * sizeof(int64_t);
+    if (entry.level > LOG_LEVEL_ERROR || entry.length > (text ? LOG_RECORD_TEXT_SIZE : LOG_EVENT_MAX_ARGS)
+        || input.size() - offset - sizeof(entry) < size) {
+        return false;
+    }
+    record.timestamp = entry.timestamp;
+    record.level = entry.level;
+    record.event = entry.event;
+    record.length = entry.length;
+    memcpy(text ? (void*)record.text : (void*)record.args, input.data() + offset + sizeof(entry), size);
+    offset += sizeof(entry) + size;
+    return true;
+}
+
+/**
+ * @brief Format the wall clock time of a record.
+ *
+ * @param output The time, with microseconds and followed by a space, is appended to it.
+ * @param timestamp The steady clock timestamp of the record, in ns.
+ * @param clockOffset The offset from the steady clock to the system clock, from the log header.
+ */
+void TFTPLogger::formatTime(std::string& output, int64_t timestamp, int64_t clockOffset) {
+    int64_t time = timestamp + clockOffset;
+    time_t seconds = time / 1000000000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char text[64];
+    size_t length = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(text + length, sizeof(text) - length, ".%06lld ", (long long)(time % 1000000000 / 1000));
+    output += text;
+}
+
+std::string TFTPLogger::opcodeName(int64_t opcode) {
+    switch (opcode) {
+        case TFTP_OPCODE_RRQ: return "RRQ";
+        case TFTP_OPCODE_WRQ: return "WRQ";
+        case TFTP_OPCODE_DATA: return "DATA";
+        case TFTP_OPCODE_ACK: return "ACK";
+        case TFTP_OPCODE_ERROR: return "ERROR";
+        case TFTP_OPCODE_OACK: return "OACK";
+        case TFTP_OPCODE_DELETE: return "DELETE";
+        case TFTP_OPCODE_LS: return "LS";
+        default: return "opcode " + std::to_string(opcode);
+    }
+}
+
+void TFTPLogger::writeRecord(std::string& output, const TFTPLogRecord& record) {
+    if (binary) {
+        encodeRecord(output, record);
+    }
+    else {
+        formatRecord(output, record);
+    }
+}
+
+void TFTPLogger::writeOutput(const std::string& output) {
+    for (size_t written = 0; written < output.size(); ) {
+        ssize_t result = write(outputFd, output.data() + written, output.size() - written);
+        if (result <= 0) {
+            // Nowhere left to report it
+            break;
+        }
+        written += result;
+    }
+}
+
+void TFTPLogger::addRing(TFTPLogRing* ring) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rings.push_back(ring);
+}
+
+/**
+ * @brief Write the committed records of every thread in time order, and free the rings
+ * of the threads that exited.
+ */
+void TFTPLogger::drain() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<const TFTPLogRecord*> records;
+    std::vector<uint64_t> heads(rings.size());
+    std::vector<bool> closed(rings.size());
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < rings.size(); i++) {
+        // Closed before its head is read: nothing can follow the records taken now
+        closed[i] = rings[i]->closed.load(std::memory_order_acquire);
+        heads[i] = rings[i]->head.load(std::memory_order_acquire);
+        for (uint64_t next = rings[i]->tail.load(std::memory_order_relaxed); next < heads[i]; next++) {
+            records.push_back(&rings[i]->records[next % LOG_RING_SIZE]);
+        }
+        dropped += rings[i]->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    std::stable_sort(records.begin(), records.end(), [](const TFTPLogRecord* a, const TFTPLogRecord* b) { return a->timestamp < b->timestamp; });
+    std::string output;
+    for (const TFTPLogRecord* record : records) {
+        writeRecord(output, *record);
+    }
+    if (dropped > 0) {
+        TFTPLogRecord record;
+        record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        record.level = LOG_LEVEL_WARN;
+        record.event = LOG_EVENT_DROPPED;
+        record.length = 1;
+        record.args[0] = dropped;
+        writeRecord(output, record);
+    }
+    writeOutput(output);
+    size_t kept = 0;
+    for (size_t i = 0; i < rings.size(); i++) {
+        rings[i]->tail.store(heads[i], std::memory_order_release);
+        if (closed[i]) {
+            delete rings[i];
+        }
+        else {
+            rings[kept++] = rings[i];
+        }
+    }
+    rings.resize(kept);
+}
+
+void TFTPLogger::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stopRequested.wait_for(lock, std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS), [this]() { return stopping; })) {
+                return;
+            }
+        }
+        drain();
+    }
+}
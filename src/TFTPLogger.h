@@ -0,0 +1,240 @@
+#ifndef TFTP_LOGGER_H
+#define TFTP_LOGGER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <ostream>
+#include <streambuf>
+#include <cstdint>
+#include <cstddef>
+
+/* Log Levels */
+#define LOG_LEVEL_DEBUG     0   // every packet
+#define LOG_LEVEL_INFO      1   // every transfer, server start and shutdown
+#define LOG_LEVEL_WARN      2   // recovered from: timeouts, stray packets
+#define LOG_LEVEL_ERROR     3
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL  LOG_LEVEL_INFO  // call sites below are compiled out, build with -DLOG_COMPILED_LEVEL=0 to keep them
+#endif
+
+#define LOG_RING_SIZE           512     // records buffered per thread, more are dropped until the logger catches up
+#define LOG_RECORD_TEXT_SIZE    240     // longer messages are cut
+#define LOG_DRAIN_INTERVAL_MS   5
+#define LOG_EVENT_MAX_ARGS      (LOG_RECORD_TEXT_SIZE / 8)
+#define LOG_BINARY_MAGIC        "TFTPLOG1"
+
+/* Log Events: a format id logged with raw arguments, rendered by TFTPLogger::formatRecord */
+#define LOG_EVENT_TEXT              0   // not an event, a formatted message
+#define LOG_EVENT_DROPPED           1
+#define LOG_EVENT_REQUEST           2
+#define LOG_EVENT_SESSION_PORT      3
+#define LOG_EVENT_ACK_SENT          4
+#define LOG_EVENT_ERROR_SENT        5
+#define LOG_EVENT_ERROR_RECEIVED    6
+#define LOG_EVENT_DUPLICATE_ACK     7
+#define LOG_EVENT_TIMEOUT           8
+#define LOG_EVENT_RETRY_EXCEEDED    9
+#define LOG_EVENT_FILE_SENT         10
+#define LOG_EVENT_FILE_RECEIVED     11
+#define LOG_EVENT_SESSION_RTT       12
+#define LOG_EVENT_ZERO_COPY         13
+#define LOG_EVENT_COUNT             14
+
+/**
+ * @brief Log a message, written as a stream expression: LOG_INFO("sent " << size << " bytes").
+ *
+ * The message is only formatted if its level is enabled.
+ */
+#define TFTP_LOG(level, message) do { \
+        if (TFTPLogger::isEnabled(level)) { \
+            TFTPLogger::stream() << message; \
+            TFTPLogger::commit(level); \
+        } \
+    } while (0)
+
+#if LOG_COMPILED_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(message)  TFTP_LOG(LOG_LEVEL_DEBUG, message)
+#else
+#define LOG_DEBUG(message)  do { } while (0)
+#endif
+#if LOG_COMPILED_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(message)   TFTP_LOG(LOG_LEVEL_INFO, message)
+#else
+#define LOG_INFO(message)   do { } while (0)
+#endif
+#if LOG_COMPILED_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(message)   TFTP_LOG(LOG_LEVEL_WARN, message)
+#else
+#define LOG_WARN(message)   do { } while (0)
+#endif
+#define LOG_ERROR(message)  TFTP_LOG(LOG_LEVEL_ERROR, message)
+
+/**
+ * @brief Log an event, its arguments are stored as they are and only formatted when
+ * the log is written as text: LOG_DEBUG_EVENT(LOG_EVENT_ACK_SENT, address, block).
+ */
+#define TFTP_LOG_EVENT(level, event, ...) do { \
+        if (TFTPLogger::isEnabled(level)) { \
+            TFTPLogger::logEvent(level, event, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if LOG_COMPILED_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG_EVENT(event, ...) TFTP_LOG_EVENT(LOG_LEVEL_DEBUG, event, __VA_ARGS__)
+#else
+#define LOG_DEBUG_EVENT(event, ...) do { } while (0)
+#endif
+#if LOG_COMPILED_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO_EVENT(event, ...)  TFTP_LOG_EVENT(LOG_LEVEL_INFO, event, __VA_ARGS__)
+#else
+#define LOG_INFO_EVENT(event, ...)  do { } while (0)
+#endif
+#if LOG_COMPILED_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN_EVENT(event, ...)  TFTP_LOG_EVENT(LOG_LEVEL_WARN, event, __VA_ARGS__)
+#else
+#define LOG_WARN_EVENT(event, ...)  do { } while (0)
+#endif
+#define LOG_ERROR_EVENT(event, ...) TFTP_LOG_EVENT(LOG_LEVEL_ERROR, event, __VA_ARGS__)
+
+/**
+ * @brief A message or an event waiting in a thread's ring.
+ */
+struct TFTPLogRecord {
+    int64_t timestamp;          // steady clock, orders the records of different threads
+    int level;
+    uint16_t event;             // LOG_EVENT_TEXT for a formatted message
+    uint32_t length;            // bytes of text, or number of event arguments
+    union {
+        char text[LOG_RECORD_TEXT_SIZE];
+        int64_t args[LOG_EVENT_MAX_ARGS];
+    };
+};
+
+/**
+ * @brief Start of a binary log file.
+ */
+struct TFTPLogFileHeader {
+    char magic[8];              // LOG_BINARY_MAGIC
+    int64_t clockOffset;        // system clock minus steady clock when the file was opened, in ns
+};
+
+/**
+ * @brief A record in a binary log file, followed by its text or its 8 byte arguments.
+ */
+struct TFTPLogFileRecord {
+    int64_t timestamp;
+    uint16_t event;
+    uint8_t level;
+    uint8_t unused;
+    uint32_t length;
+};
+
+/**
+ * @brief Records of one thread: written by that thread only, read by the drain thread only.
+ */
+struct TFTPLogRing {
+    TFTPLogRecord records[LOG_RING_SIZE];
+    alignas(64) std::atomic<uint64_t> head{0};  // next record written
+    alignas(64) std::atomic<uint64_t> tail{0};  // next record drained
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> closed{false};            // the thread exited, the ring goes once drained
+};
+
+/**
+ * @brief Process wide asynchronous logger.
+ *
+ * A log call formats its message in place into the next record of its thread's ring
+ * and publishes it with a single store; it never takes a lock, never allocates after
+ * the thread's first message and never waits for stderr. When the ring is full the
+ * message is dropped and counted. A background thread drains every ring every few
+ * milliseconds, orders the records by time and writes them to stderr in one write,
+ * each prefixed with its level.
+ *
+ * The records left at exit are written by an exit handler; messages logged after it
+ * are written directly.
+ *
+ * Frequent messages are logged as events instead: a format id and raw integer
+ * arguments copied into the record, without formatting anything. In text mode the
+ * drain thread formats them; in binary mode it writes every record as it is to a
+ * file, and the log decoder renders that file as text offline, so the cost of a
+ * message is a few stores wherever it is written.
+ */
+class TFTPLogger {
+public:
+    static bool isEnabled(int level);
+    static std::ostream& stream();
+    static void commit(int level);
+    template<typename... Args>
+    static void logEvent(int level, uint16_t event, Args... args);
+    static void setLevel(int level);
+    static int parseLevel(const std::string& name);
+    static void flush();
+    static bool setBinaryOutput(const std::string& path);
+    static void formatRecord(std::string& output, const TFTPLogRecord& record);
+    static void encodeRecord(std::string& output, const TFTPLogRecord& record);
+    static bool decodeRecord(const std::string& input, size_t& offset, TFTPLogRecord& record);
+    static void formatTime(std::string& output, int64_t timestamp, int64_t clockOffset);
+
+private:
+    class TFTPLogBuffer : public std::streambuf {
+    public:
+        void reset(char* text, size_t size);
+        size_t length() const;
+    };
+    struct TFTPThreadLog {
+        TFTPLogRing* ring;
+        TFTPLogRecord* record;      // being written, the overflow record if the ring is full
+        TFTPLogRecord overflow;     // written and dropped when the ring is full
+        TFTPLogBuffer buffer;
+        std::ostream stream;
+        TFTPThreadLog();
+        ~TFTPThreadLog();
+    };
+    static std::atomic<int> minimumLevel;
+    static const char* const formats[LOG_EVENT_COUNT];
+    std::mutex mutex;               // guards the rings, the output and the drain
+    int outputFd;
+    bool binary;
+    std::condition_variable stopRequested;
+    std::vector<TFTPLogRing*> rings;
+    std::atomic<bool> stopped;
+    bool stopping;
+    std::thread thread;
+    TFTPLogger();
+    static TFTPLogger& instance();
+    static TFTPThreadLog& threadLog();
+    static TFTPLogRecord& nextRecord();
+    static void publish(int level);
+    static void stop();
+    static std::string opcodeName(int64_t opcode);
+    void writeRecord(std::string& output, const TFTPLogRecord& record);
+    void writeOutput(const std::string& output);
+    void addRing(TFTPLogRing* ring);
+    void drain();
+    void run();
+};
+
+/**
+ * @brief Log an event, used through the LOG_*_EVENT macros.
+ *
+ * @param level The level of the event.
+ * @param event One of the LOG_EVENT values, its format takes the arguments in order.
+ * @param args Integer arguments, at most LOG_EVENT_MAX_ARGS.
+ */
+template<typename... Args>
+void TFTPLogger::logEvent(int level, uint16_t event, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_EVENT_MAX_ARGS, "too many log event arguments");
+    TFTPLogRecord& record = nextRecord();
+    uint32_t count = 0;
+    ((record.args[count++] = (int64_t)args), ...);
+    record.event = event;
+    record.length = count;
+    publish(level);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "TFTPMappingGuard.h"
+#include <cstring>
+#include <atomic>
+#include <mutex>
+
+thread_local sigjmp_buf* TFTPMappingGuard::activeCopy = nullptr;
+
+/**
+ * @brief Copy bytes out of a file mapping.
+ *
+ * @param destination The buffer receiving the bytes.
+ * @param source The mapped bytes.
+ * @param size The number of bytes to copy.
+ * @return true if they were copied, false if the file no longer backs them.
+ */
+bool TFTPMappingGuard::copy(void* destination, const void* source, size_t size) {
+    static std::once_flag installed;
+    std::call_once(installed, installHandler);
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 1) != 0) {
+        activeCopy = nullptr;
+        return false;
+    }
+    activeCopy = &jump;
+    // The handler must see the copy start after activeCopy is set and end before it is cleared
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    memcpy(destination, source, size);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    activeCopy = nullptr;
+    return true;
+}
+
+void TFTPMappingGuard::installHandler() {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_flags = SA_SIGINFO;
+    act.sa_sigaction = &handleSigbus;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGBUS, &act, NULL);
+}
+
+void TFTPMappingGuard::handleSigbus(int signo, siginfo_t* info, void* context) {
+    if (activeCopy != nullptr) {
+        siglongjmp(*activeCopy, 1);
+    }
+    // Not raised by a guarded copy: delivered again with the default action once the handler returns
+    signal(SIGBUS, SIG_DFL);
+    raise(SIGBUS);
+}
@@ -0,0 +1,28 @@
+#ifndef TFTP_MAPPING_GUARD_H
+#define TFTP_MAPPING_GUARD_H
+
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
+
+/**
+ * @brief Copies out of a shared file mapping that fail instead of crashing when the
+ * file was truncated meanwhile.
+ *
+ * Touching a page of a MAP_SHARED mapping past the end of its file raises SIGBUS, and
+ * files are mapped while other tools may still change them. A copy made through copy()
+ * runs under a SIGBUS handler that jumps back out of it, so it returns false. A SIGBUS
+ * raised anywhere else keeps its default action. Sends from a mapping do not need it:
+ * the kernel fails them with EFAULT.
+ */
+class TFTPMappingGuard {
+public:
+    static bool copy(void* destination, const void* source, size_t size);
+
+private:
+    static thread_local sigjmp_buf* activeCopy;    // the copy of this thread in progress, nullptr if none
+    static void installHandler();
+    static void handleSigbus(int signo, siginfo_t* info, void* context);
+};
+
+#endif
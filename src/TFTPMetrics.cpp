@@ -0,0 +1,258 @@
+#include "TFTPMetrics.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+/*
+ * Prometheus family, labels and help of every counter, in METRIC order. Counters of one
+ * family follow each other.
+ */
+const char* const TFTPMetrics::counterNames[METRIC_COUNTER_COUNT][3] = {
+    {"tftp_requests_total", "{opcode=\"RRQ\"}", "Requests received, by opcode."},
+    {"tftp_requests_total", "{opcode=\"WRQ\"}", ""},
+    {"tftp_requests_total", "{opcode=\"LS\"}", ""},
+    {"tftp_requests_total", "{opcode=\"DELETE\"}", ""},
+    {"tftp_requests_total", "{opcode=\"invalid\"}", ""},
+    {"tftp_sessions_started_total", "", "Transfer sessions started."},
+    {"tftp_sessions_finished_total", "", "Transfer sessions finished."},
+    {"tftp_sent_bytes_total", "", "Bytes of the datagrams sent by the sessions."},
+    {"tftp_received_bytes_total", "", "Bytes of the datagrams received by the sessions."},
+    {"tftp_retransmissions_total", "", "Packets sent again after a loss or a timeout."},
+    {"tftp_timeouts_total", "", "Retransmission timeouts."},
+};
+
+/*
+ * Prometheus family and help of every histogram, in METRIC order.
+ */
+const char* const TFTPMetrics::histogramNames[METRIC_HISTOGRAM_COUNT][2] = {
+    {"tftp_block_rtt_seconds", "Time from sending a block or ACK once to its answer."},
+    {"tftp_disk_read_seconds", "Latency of the block reads."},
+    {"tftp_disk_write_seconds", "Latency of the upload writes."},
+};
+
+/**
+ * @brief Register the shard of a thread on its first value.
+ */
+TFTPMetrics::TFTPThreadMetrics::TFTPThreadMetrics() : shard(new TFTPMetricsShard()) {
+    TFTPMetrics& metrics = instance();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+    metrics.shards.push_back(shard);
+}
+
+/**
+ * @brief Add the values of an exiting thread to the totals, they must not go back.
+ */
+TFTPMetrics::TFTPThreadMetrics::~TFTPThreadMetrics() {
+    TFTPMetrics& metrics = instance();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        metrics.retired.counters[i].fetch_add(shard->counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        for (size_t j = 0; j < METRIC_HISTOGRAM_BUCKETS; j++) {
+            metrics.retired.buckets[i][j].fetch_add(shard->buckets[i][j].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        metrics.retired.sums[i].fetch_add(shard->sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < metrics.shards.size(); i++) {
+        if (metrics.shards[i] == shard) {
+            metrics.shards.erase(metrics.shards.begin() + i);
+            break;
+        }
+    }
+    delete shard;
+}
+
+/**
+ * @brief The registry, never destroyed, so threads can record values until the process ends.
+ */
+TFTPMetrics& TFTPMetrics::instance() {
+    static TFTPMetrics* metrics = new TFTPMetrics();
+    return *metrics;
+}
+
+TFTPMetricsShard& TFTPMetrics::threadShard() {
+    thread_local TFTPThreadMetrics metrics;
+    return *metrics.shard;
+}
+
+/**
+ * @brief Add to a counter of this thread.
+ *
+ * @param counter One of the METRIC counters.
+ * @param value The amount added.
+ */
+void TFTPMetrics::add(int counter, uint64_t value) {
+    std::atomic<uint64_t>& total = threadShard().counters[counter];
+    total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Record a latency in a histogram of this thread.
+ *
+ * @param histogram One of the METRIC histograms.
+ * @param nanoseconds The latency.
+ */
+void TFTPMetrics::record(int histogram, uint64_t nanoseconds) {
+    TFTPMetricsShard& shard = threadShard();
+    std::atomic<uint64_t>& bucket = shard.buckets[histogram][bucketIndex(nanoseconds)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    shard.sums[histogram].store(shard.sums[histogram].load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Sum the values of every thread.
+ *
+ * @param snapshot Set to the sums.
+ */
+void TFTPMetrics::snapshot(TFTPMetricsSnapshot& snapshot) {
+    TFTPMetrics& metrics = instance();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+    memset(&snapshot, 0, sizeof(snapshot));
+    std::vector<const TFTPMetricsShard*> shards(metrics.shards.begin(), metrics.shards.end());
+    shards.push_back(&metrics.retired);
+    for (const TFTPMetricsShard* shard : shards) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+            snapshot.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+            for (size_t j = 0; j < METRIC_HISTOGRAM_BUCKETS; j++) {
+                snapshot.buckets[i][j] += shard->buckets[i][j].load(std::memory_order_relaxed);
+            }
+            snapshot.sums[i] += shard->sums[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Write every metric in the Prometheus text format.
+ *
+ * Histograms are exported with power of two buckets, followed by their 50th, 99th and
+ * 99.9th percentiles taken from the full resolution buckets.
+ *
+ * @param output The metrics are appended to it.
+ */
+void TFTPMetrics::format(std::string& output) {
+    TFTPMetricsSnapshot values;
+    snapshot(values);
+    char line[256];
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        if (i == 0 || strcmp(counterNames[i][0], counterNames[i - 1][0]) != 0) {
+            output += std::string("# HELP ") + counterNames[i][0] + " " + counterNames[i][2] + "\n";
+            output += std::string("# TYPE ") + counterNames[i][0] + " counter\n";
+        }
+        snprintf(line, sizeof(line), "%s%s %llu\n", counterNames[i][0], counterNames[i][1], (unsigned long long)values.counters[i]);
+        output += line;
+    }
+    // The shards are read one after the other, a finish may be seen without its start
+    int64_t activeSessions = (int64_t)values.counters[METRIC_SESSIONS_STARTED] - (int64_t)values.counters[METRIC_SESSIONS_FINISHED];
+    formatValue(output, "tftp_active_sessions", "gauge", "Transfer sessions running.", (double)std::max<int64_t>(activeSessions, 0));
+
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        const char* name = histogramNames[i][0];
+        output += std::string("# HELP ") + name + " " + histogramNames[i][1] + "\n";
+        output += std::string("# TYPE ") + name + " histogram\n";
+        uint64_t cumulative = 0;
+        size_t next = 0;
+        for (int power = METRIC_EXPORT_MIN_BUCKET; power <= METRIC_EXPORT_MAX_BUCKET; power++) {
+            // Every bucket ends at or below a power of two
+            size_t end = bucketIndex((uint64_t)1 << power);
+            for (; next < end; next++) {
+                cumulative += values.buckets[i][next];
+            }
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, std::ldexp(1.0, power) / 1e9, (unsigned long long)cumulative);
+            output += line;
+        }
+        uint64_t count = values.getCount(i);
+        snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n", name, (unsigned long long)count,
+                 name, values.sums[i] / 1e9, name, (unsigned long long)count);
+        output += line;
+
+        std::string quantiles = std::string(name, strlen(name) - strlen("_seconds")) + "_quantile_seconds";
+        output += "# HELP " + quantiles + " Percentiles of " + name + ".\n";
+        output += "# TYPE " + quantiles + " gauge\n";
+        for (double percentile : {50.0, 99.0, 99.9}) {
+            snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %.9f\n", quantiles.c_str(), percentile / 100,
+                     values.getPercentile(i, percentile) / 1e9);
+            output += line;
+        }
+    }
+}
+
+/**
+ * @brief Write a single value in the Prometheus text format, with its help and type.
+ *
+ * @param output The value is appended to it.
+ * @param name The metric name.
+ * @param type counter or gauge.
+ * @param help What the value is.
+ * @param value The value.
+ */
+void TFTPMetrics::formatValue(std::string& output, const char* name, const char* type, const char* help, double value) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+    output += line;
+}
+
+/**
+ * @brief The histogram bucket of a value: the values below 2^METRIC_HISTOGRAM_SUB_BITS
+ * have their own bucket, larger ones share one with the values having the same highest
+ * METRIC_HISTOGRAM_SUB_BITS + 1 bits.
+ *
+ * @param value The value.
+ * @return The index of its bucket.
+ */
+size_t TFTPMetrics::bucketIndex(uint64_t value) {
+    const uint64_t subBuckets = (uint64_t)1 << METRIC_HISTOGRAM_SUB_BITS;
+    if (value < subBuckets) {
+        return value;
+    }
+    int power = 63 - __builtin_clzll(value);
+    uint64_t subBucket = (value >> (power - METRIC_HISTOGRAM_SUB_BITS)) & (subBuckets - 1);
+    return ((power - METRIC_HISTOGRAM_SUB_BITS + 1) << METRIC_HISTOGRAM_SUB_BITS) + subBucket;
+}
+
+/**
+ * @param index A bucket index.
+ * @return The smallest value of the bucket.
+ */
+uint64_t TFTPMetrics::bucketLowerBound(size_t index) {
+    const uint64_t subBuckets = (uint64_t)1 << METRIC_HISTOGRAM_SUB_BITS;
+    if (index < subBuckets) {
+        return index;
+    }
+    int power = (index >> METRIC_HISTOGRAM_SUB_BITS) + METRIC_HISTOGRAM_SUB_BITS - 1;
+    return (subBuckets + (index & (subBuckets - 1))) << (power - METRIC_HISTOGRAM_SUB_BITS);
+}
+
+uint64_t TFTPMetricsSnapshot::getCount(int histogram) const {
+    uint64_t count = 0;
+    for (size_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; i++) {
+        count += buckets[histogram][i];
+    }
+    return count;
+}
+
+/**
+ * @brief A percentile of a histogram.
+ *
+ * @param histogram One of the METRIC histograms.
+ * @param percentile Between 0 and 100.
+ * @return The largest value of the bucket holding the percentile, 0 for an empty histogram.
+ */
+uint64_t TFTPMetricsSnapshot::getPercentile(int histogram, double percentile) const {
+    uint64_t count = getCount(histogram);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(percentile / 100 * count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[histogram][i];
+        if (seen >= rank) {
+            return i + 1 < METRIC_HISTOGRAM_BUCKETS ? TFTPMetrics::bucketLowerBound(i + 1) - 1 : UINT64_MAX;
+        }
+    }
+    return UINT64_MAX;
+}
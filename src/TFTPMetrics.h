@@ -0,0 +1,93 @@
+#ifndef TFTP_METRICS_H
+#define TFTP_METRICS_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+/* Counters */
+#define METRIC_RRQ_REQUESTS         0
+#define METRIC_WRQ_REQUESTS         1
+#define METRIC_LS_REQUESTS          2
+#define METRIC_DELETE_REQUESTS      3
+#define METRIC_INVALID_REQUESTS     4
+#define METRIC_SESSIONS_STARTED     5
+#define METRIC_SESSIONS_FINISHED    6
+#define METRIC_BYTES_SENT           7   // datagrams of the sessions, headers included
+#define METRIC_BYTES_RECEIVED       8
+#define METRIC_RETRANSMISSIONS      9   // packets sent again
+#define METRIC_TIMEOUTS             10
+#define METRIC_COUNTER_COUNT        11
+
+/* Latency Histograms, recorded in ns */
+#define METRIC_BLOCK_RTT            0   // a block or ACK sent once until its answer
+#define METRIC_DISK_READ            1
+#define METRIC_DISK_WRITE           2
+#define METRIC_HISTOGRAM_COUNT      3
+
+#define METRIC_HISTOGRAM_SUB_BITS   3   // 8 buckets per power of two, values are kept within 12.5%
+#define METRIC_HISTOGRAM_BUCKETS    ((64 - METRIC_HISTOGRAM_SUB_BITS + 1) << METRIC_HISTOGRAM_SUB_BITS)
+#define METRIC_EXPORT_MIN_BUCKET    10  // exported histogram buckets are powers of two from 2^10 ns, about 1 us
+#define METRIC_EXPORT_MAX_BUCKET    35  // to about 34 s
+
+/**
+ * @brief Counters and histograms of one thread: written by that thread only.
+ */
+struct TFTPMetricsShard {
+    std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT] = {};
+    std::atomic<uint64_t> buckets[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint64_t> sums[METRIC_HISTOGRAM_COUNT] = {};
+};
+
+/**
+ * @brief The metrics summed over every thread at one point in time.
+ */
+struct TFTPMetricsSnapshot {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_HISTOGRAM_BUCKETS];
+    uint64_t sums[METRIC_HISTOGRAM_COUNT];
+    uint64_t getCount(int histogram) const;
+    uint64_t getPercentile(int histogram, double percentile) const;
+};
+
+/**
+ * @brief Process wide registry of counters and latency histograms.
+ *
+ * Every thread counts into its own shard, so recording a value is a relaxed load and
+ * store on a cache line no other thread writes: no lock, no atomic read-modify-write.
+ * Histograms are log-linear like HDR histograms: each power of two is split in
+ * 2^METRIC_HISTOGRAM_SUB_BITS buckets, so any value from a nanosecond to centuries
+ * is kept with a bounded relative error in a fixed array. A snapshot sums the shards
+ * of the running threads and the totals of the threads that exited.
+ *
+ * The snapshot is exported in the Prometheus text format by format().
+ */
+class TFTPMetrics {
+public:
+    static void add(int counter, uint64_t value = 1);
+    static void record(int histogram, uint64_t nanoseconds);
+    static void snapshot(TFTPMetricsSnapshot& snapshot);
+    static void format(std::string& output);
+    static void formatValue(std::string& output, const char* name, const char* type, const char* help, double value);
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t bucketLowerBound(size_t index);
+
+private:
+    struct TFTPThreadMetrics {
+        TFTPMetricsShard* shard;
+        TFTPThreadMetrics();
+        ~TFTPThreadMetrics();
+    };
+    static const char* const counterNames[METRIC_COUNTER_COUNT][3];
+    static const char* const histogramNames[METRIC_HISTOGRAM_COUNT][2];
+    std::mutex mutex;               // guards the shards and the totals of the exited threads
+    std::vector<TFTPMetricsShard*> shards;
+    TFTPMetricsShard retired;
+    TFTPMetrics() = default;
+    static TFTPMetrics& instance();
+    static TFTPMetricsShard& threadShard();
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "TFTPPacket.h"
 #include <fstream>
 #include <cstring>
+#include <cctype>
 #include <iostream>
 
 
@@ -14,8 +15,9 @@
  * @param opcode The TFTP opcode for the request (e.g., RRQ, WRQ).
  * @param filename The requested filename for the TFTP operation.
  * @param mode The TFTP transfer mode (e.g., "octet").
+ * @return The size of the request packet in bytes.
  */
-void TFTPPacket::createRequestPacket(uint8_t* packet, uint16_t opcode, const std::string& filename, const std::string& mode) {
+size_t TFTPPacket::createRequestPacket(uint8_t* packet, uint16_t opcode, const std::string& filename, const std::string& mode) {
     size_t index = 2;
     
     // Copy the filename into the packet
@@ -35,6 +37,25 @@ void TFTPPacket::createRequestPacket(uint8_t* packet, uint16_t opcode, const std
         }
     }
     packet[index++] = 0x00;
+    return index;
+}
+
+/**
+ * @brief Append option/value pairs to a packet.
+ *
+ * @param packet Pointer to the buffer holding the packet.
+ * @param index The offset at which the first option is written.
+ * @param options The options to append.
+ * @return The size of the packet after the options in bytes.
+ */
+size_t TFTPPacket::appendOptions(uint8_t* packet, size_t index, const TFTPOptions& options) {
+    for (const auto& option : options) {
+        std::memcpy(packet + index, option.first.c_str(), option.first.size() + 1);
+        index += option.first.size() + 1;
+        std::memcpy(packet + index, option.second.c_str(), option.second.size() + 1);
+        index += option.second.size() + 1;
+    }
+    return index;
 }
 
 /**
@@ -71,6 +92,116 @@ void TFTPPacket::createWRQPacket(uint8_t* packet, const std::string& filename, c
 }
 
 
+/**
+ * @brief Create a Read Request (RRQ) packet carrying options.
+ *
+ * @param packet Pointer to the buffer where the RRQ packet will be stored.
+ * @param filename The requested filename for the TFTP read operation.
+ * @param mode The TFTP transfer mode (e.g., "octet").
+ * @param options The options requested from the server.
+ * @return The size of the RRQ packet in bytes.
+ */
+size_t TFTPPacket::createRRQPacket(uint8_t* packet, const std::string& filename, const std::string& mode, const TFTPOptions& options) {
+    packet[0] = 0x00;
+    packet[1] = TFTP_OPCODE_RRQ;
+    return appendOptions(packet, createRequestPacket(packet, TFTP_OPCODE_RRQ, filename, mode), options);
+}
+
+
+/**
+ * @brief Create a Write Request (WRQ) packet carrying options.
+ *
+ * @param packet Pointer to the buffer where the WRQ packet will be stored.
+ * @param filename The requested filename for the TFTP write operation.
+ * @param mode The TFTP transfer mode (e.g., "octet").
+ * @param options The options requested from the server.
+ * @return The size of the WRQ packet in bytes.
+ */
+size_t TFTPPacket::createWRQPacket(uint8_t* packet, const std::string& filename, const std::string& mode, const TFTPOptions& options) {
+    packet[0] = 0x00;
+    packet[1] = TFTP_OPCODE_WRQ;
+    return appendOptions(packet, createRequestPacket(packet, TFTP_OPCODE_WRQ, filename, mode), options);
+}
+
+
+/**
+ * @brief Create an option acknowledgment (OACK) packet.
+ *
+ * This function populates the provided packet with the OACK opcode followed by the
+ * options the server accepted, each with its negotiated value.
+ *
+ * @param packet Pointer to the buffer where the OACK packet will be stored.
+ * @param options The accepted options.
+ * @return The size of the OACK packet in bytes.
+ */
+size_t TFTPPacket::createOACKPacket(uint8_t* packet, const TFTPOptions& options) {
+    packet[0] = 0x00;
+    packet[1] = TFTP_OPCODE_OACK;
+    return appendOptions(packet, 2, options);
+}
+
+
+/**
+ * @brief Parse the option/value pairs of a request or OACK packet.
+ *
+ * Option names are case insensitive and are returned in lowercase. Parsing stops at
+ * the end of the packet or at an empty option name (zero padding).
+ *
+ * @param packet Pointer to the received packet.
+ * @param packetSize The size of the received packet in bytes.
+ * @param offset The offset of the first option (after the mode, or 2 for an OACK).
+ * @param options Filled with the parsed options.
+ * @return true if the options are well formed, false otherwise.
+ */
+bool TFTPPacket::parseOptions(const uint8_t* packet, size_t packetSize, size_t offset, TFTPOptions& options) {
+    options.clear();
+    while (offset < packetSize && packet[offset] != 0x00) {
+        const char* name = reinterpret_cast<const char*>(packet + offset);
+        size_t nameLength = strnlen(name, packetSize - offset);
+        size_t valueOffset = offset + nameLength + 1;
+        if (valueOffset >= packetSize) {
+            return false;
+        }
+        const char* value = reinterpret_cast<const char*>(packet + valueOffset);
+        size_t valueLength = strnlen(value, packetSize - valueOffset);
+        if (valueOffset + valueLength >= packetSize) {
+            return false;
+        }
+        std::string optionName(name, nameLength);
+        for (char& c : optionName) {
+            c = std::tolower(c);
+        }
+        options[optionName] = std::string(value, valueLength);
+        offset = valueOffset + valueLength + 1;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Parse the decimal value of a numeric option.
+ *
+ * @param value The option value as received.
+ * @param minimum The smallest valid value.
+ * @param maximum The largest valid value.
+ * @param result Set to the parsed value.
+ * @return true if the value is a decimal number within [minimum, maximum], false otherwise.
+ */
+bool TFTPPacket::parseOptionValue(const std::string& value, uint64_t minimum, uint64_t maximum, uint64_t& result) {
+    if (value.empty() || value.size() > 19) {
+        return false;
+    }
+    result = 0;
+    for (char c : value) {
+        if (!std::isdigit(static_cast<unsigned char>(c))) {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    return result >= minimum && result <= maximum;
+}
+
+
 /**
  * @brief Create a Data packet.
  *
@@ -148,7 +279,7 @@ void TFTPPacket::createErrorPacket(uint8_t* packet, uint16_t errorCode, const st
  */
 void TFTPPacket::createDeletePacket(uint8_t* packet, const std::string& filename) {
     packet[0] = 0x00;
-    packet[1] = 0x06;
+    packet[1] = TFTP_OPCODE_DELETE;
     std::string mode = "octet";
     createRequestPacket(packet, TFTP_OPCODE_DELETE, filename, mode);
 }
@@ -164,30 +295,46 @@ void TFTPPacket::createDeletePacket(uint8_t* packet, const std::string& filename
  */
 void TFTPPacket::createLSPacket(uint8_t* packet) {
     packet[0] = 0x00;
-    packet[1] = 0x07;
+    packet[1] = TFTP_OPCODE_LS;
     packet[2] = 0x00;
 }
 
 
+/**
+ * @brief Create a list request packet carrying options.
+ *
+ * The options follow the empty byte that ends a plain LS packet.
+ *
+ * @param packet Pointer to the buffer where the LS packet will be stored.
+ * @param options The options selecting the files listed.
+ * @return The size of the LS packet in bytes.
+ */
+size_t TFTPPacket::createLSPacket(uint8_t* packet, const TFTPOptions& options) {
+    createLSPacket(packet);
+    return appendOptions(packet, 3, options);
+}
+
+
 /**
  * @brief Read a data block from the file.
  *
- * This function reads 512 bytes of data for the specified block number from the file.
+ * This function reads blockSize bytes of data for the specified block number from the file.
  *
  * @param filename The name of the file to read from.
  * @param blockNumber The block number to read.
  * @param data Pointer to the buffer where the read data will be stored.
  * @param dataSize Reference to the variable storing the actual size of the read data.
+ * @param blockSize The negotiated block size (512 unless blksize was negotiated).
  * @return The size of the data read in bytes.
  */
-size_t TFTPPacket::readDataBlock(const std::string& filename, uint16_t blockNumber, char* data, size_t& dataSize) {
-    // Read 512 bytes of data for the specified block number from the file
+size_t TFTPPacket::readDataBlock(const std::string& filename, uint16_t blockNumber, char* data, size_t& dataSize, size_t blockSize) {
+    // Read blockSize bytes of data for the specified block number from the file
     std::ifstream file(filename, std::ios::binary);
     dataSize = 0;
 
     if (file.is_open()) {
-        file.seekg((blockNumber - 1) * 512);
-        file.read(data, 512);
+        file.seekg((std::streamoff)(blockNumber - 1) * blockSize);
+        file.read(data, blockSize);
         dataSize = file.gcount();
     }
 
@@ -5,6 +5,12 @@
 | Opcode |  Filename  |  0  |   Mode    |   0  |
 ------------------------------------------------
 
+[RRQ/WRQ Packet with options (RFC 2347)]
+2 bytes     string    1 byte   string    1 byte  string  1 byte  string  1 byte
+-------------------------------------------------------------------------------
+| Opcode |  Filename  |  0  |   Mode    |   0  |  opt1  |   0  | value1 |   0  | ...
+-------------------------------------------------------------------------------
+
 [DATA Packet]
 2 bytes    2 bytes     n bytes
 ---------------------------------
@@ -23,6 +29,12 @@
 | Opcode | ErrorCode |  ErrMsg  |   0   |
 -----------------------------------------
 
+[OACK Packet]
+2 bytes    string  1 byte  string  1 byte
+------------------------------------------
+| Opcode |  opt1  |   0  | value1 |   0  | ...
+------------------------------------------
+
 [DELETE Packet]
 2 bytes     string    1 byte   
 -----------------------------
@@ -46,13 +58,34 @@
 #define		TFTP_OPCODE_DATA	3
 #define		TFTP_OPCODE_ACK		4
 #define		TFTP_OPCODE_ERROR	5
-#define     TFTP_OPCODE_DELETE  6
-#define     TFTP_OPCODE_LS      7
+#define		TFTP_OPCODE_OACK	6
+/* Custom opcodes, kept clear of the opcodes assigned by the RFCs */
+#define     TFTP_OPCODE_DELETE  20
+#define     TFTP_OPCODE_LS      21
 #define     MAX_PACKET_SIZE     516
+/* Block sizes (RFC 2348) */
+#define     DEFAULT_BLOCK_SIZE  512
+#define     MIN_BLOCK_SIZE      8
+#define     MAX_BLOCK_SIZE      65464
+#define     MAX_BLOCK_PACKET_SIZE   (MAX_BLOCK_SIZE + 4)
+/* Window sizes (RFC 7440) */
+#define     MAX_WINDOW_SIZE     65535
 #define     ACK_OK              0
 
 #define		TFTP_DEFAULT_TRANSFER_MODE		"octet"
 
+/* Options (RFC 2347, 2348, 2349, 7440) */
+#define TFTP_OPTION_BLKSIZE     "blksize"
+#define TFTP_OPTION_TIMEOUT     "timeout"
+#define TFTP_OPTION_TSIZE       "tsize"
+#define TFTP_OPTION_WINDOWSIZE  "windowsize"
+/* LS options, selecting the files listed */
+#define TFTP_OPTION_LS_PREFIX   "prefix"
+#define TFTP_OPTION_LS_MATCH    "match"
+#define TFTP_OPTION_LS_SORT     "sort"
+#define TFTP_OPTION_LS_OFFSET   "offset"
+#define TFTP_OPTION_LS_LIMIT    "limit"
+
 /* Error Codes */
 #define ERROR_NOT_DEFINED 0
 #define ERROR_FILE_NOT_FOUND 1
@@ -62,24 +95,37 @@
 #define ERROR_UNKNOWN_TID 5
 #define ERROR_FILE_ALREADY_EXISTS 6
 #define ERROR_NO_SUCH_USER 7
+#define ERROR_OPTION_NEGOTIATION 8
 
 #include <string>
+#include <map>
 #include <cstdint>
 
+/* Option names (lowercase) mapped to their values */
+typedef std::map<std::string, std::string> TFTPOptions;
+
 class TFTPPacket {
 public:
     static void createRRQPacket(uint8_t* packet, const std::string& filename, const std::string& mode);
     static void createWRQPacket(uint8_t* packet, const std::string& filename, const std::string& mode);
+    static size_t createRRQPacket(uint8_t* packet, const std::string& filename, const std::string& mode, const TFTPOptions& options);
+    static size_t createWRQPacket(uint8_t* packet, const std::string& filename, const std::string& mode, const TFTPOptions& options);
+    static size_t createOACKPacket(uint8_t* packet, const TFTPOptions& options);
     static void createDataPacket(uint8_t* packet, uint16_t blockNumber, const char* data, size_t dataSize);
     static void createACKPacket(uint8_t* packet, uint16_t blockNumber);
     static void createErrorPacket(uint8_t* packet, uint16_t errorCode, const std::string& errorMsg);
     static void createDeletePacket(uint8_t* packet, const std::string& filename);
     static void createLSPacket(uint8_t* packet);
+    static size_t createLSPacket(uint8_t* packet, const TFTPOptions& options);
+
+    static bool parseOptions(const uint8_t* packet, size_t packetSize, size_t offset, TFTPOptions& options);
+    static bool parseOptionValue(const std::string& value, uint64_t minimum, uint64_t maximum, uint64_t& result);
 
-    static size_t readDataBlock(const std::string& filename, uint16_t blockNumber, char* data, size_t& dataSize);
+    static size_t readDataBlock(const std::string& filename, uint16_t blockNumber, char* data, size_t& dataSize, size_t blockSize = DEFAULT_BLOCK_SIZE);
 
 private:
-    static void createRequestPacket(uint8_t* packet, uint16_t opcode, const std::string& filename, const std::string& mode);
+    static size_t createRequestPacket(uint8_t* packet, uint16_t opcode, const std::string& filename, const std::string& mode);
+    static size_t appendOptions(uint8_t* packet, size_t index, const TFTPOptions& options);
 };
 
 #endif
@@ -0,0 +1,192 @@
+#include "TFTPPacketCache.h"
+#include "TFTPPacket.h"
+#include "TFTPMappingGuard.h"
+#include "TFTPLogger.h"
+#include <cstring>
+#include <algorithm>
+
+/**
+ * @brief Build the DATA packets of a mapped file.
+ *
+ * The last block is the first one shorter than the block size, an empty one when the
+ * file size is a multiple of the block size. Block numbers wrap around past 65535.
+ * The image is left incomplete if the file was truncated under its mapping.
+ *
+ * @param file The mapped file.
+ * @param blockSize The negotiated block size.
+ */
+TFTPPacketImage::TFTPPacketImage(const TFTPCachedFile& file, size_t blockSize)
+    : device(file.device), inode(file.inode), fileSize(file.size), modified(file.modified), blockSize(blockSize), complete(false) {
+    uint32_t lastBlock = fileSize / blockSize + 1;
+    packets.resize(fileSize + (size_t)lastBlock * 4);
+    for (uint32_t block = 1; block <= lastBlock; block++) {
+        off_t offset = (off_t)(block - 1) * blockSize;
+        size_t dataSize = std::min<off_t>(blockSize, fileSize - offset);
+        uint8_t* packet = packets.data() + offset + (size_t)(block - 1) * 4;
+        TFTPPacket::createDataPacket(packet, (uint16_t)block, "", 0);
+        if (dataSize > 0 && !TFTPMappingGuard::copy(packet + 4, file.data + offset, dataSize)) {
+            return;
+        }
+    }
+    complete = true;
+}
+
+/**
+ * @brief The DATA packet of a block.
+ *
+ * @param block The block, from 1 to the last block of the file.
+ * @return The start of the packet.
+ */
+const uint8_t* TFTPPacketImage::getPacket(uint32_t block) const {
+    return packets.data() + (size_t)(block - 1) * (blockSize + 4);
+}
+
+size_t TFTPPacketImage::getPacketSize(uint32_t block) const {
+    off_t offset = (off_t)(block - 1) * blockSize;
+    return std::min<off_t>(blockSize, fileSize - offset) + 4;
+}
+
+size_t TFTPPacketImage::getMemorySize() const {
+    return packets.size();
+}
+
+bool TFTPPacketImage::isComplete() const {
+    return complete;
+}
+
+/**
+ * @brief Whether the image was built from this version of the file.
+ *
+ * @param file The mapped file.
+ * @return true if the file has the device, inode, size and modification time of the image.
+ */
+bool TFTPPacketImage::isImageOf(const TFTPCachedFile& file) const {
+    return file.device == device && file.inode == inode && file.size == fileSize
+        && file.modified.tv_sec == modified.tv_sec && file.modified.tv_nsec == modified.tv_nsec;
+}
+
+/**
+ * @brief Constructor for the TFTPPacketCache class.
+ *
+ * @param capacity The memory budget of the prebuilt packets.
+ * @param hotReads Reads after which a file that is not pinned gets an image, 0 for never.
+ */
+TFTPPacketCache::TFTPPacketCache(size_t capacity, uint64_t hotReads) : capacity(capacity), hotReads(hotReads) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Get the prebuilt packets of a file for a block size, building them if the file is hot.
+ *
+ * @param file The mapped file being read.
+ * @param blockSize The negotiated block size.
+ * @return The packet image, or nullptr if the file is not hot, does not fit the budget
+ * or is being imaged by another reader.
+ */
+std::shared_ptr<const TFTPPacketImage> TFTPPacketCache::acquire(const TFTPCachedFile& file, size_t blockSize) {
+    TFTPPacketImageKey key(file.path, blockSize);
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        if (it->second->second->isImageOf(file)) {
+            stats.hits++;
+            recentImages.splice(recentImages.begin(), recentImages, it->second);
+            return recentImages.front().second;
+        }
+        erase(it);
+    }
+    uint64_t fileReads = ++reads[file.path];
+    if (pinned.count(file.path) == 0 && (hotReads == 0 || fileReads < hotReads)) {
+        return nullptr;
+    }
+    size_t imageSize = file.size + (size_t)(file.size / blockSize + 1) * 4;
+    if (building.count(key) > 0 || !evict(imageSize)) {
+        return nullptr;
+    }
+    building.insert(key);
+    lock.unlock();
+    std::shared_ptr<const TFTPPacketImage> image = std::make_shared<TFTPPacketImage>(file, blockSize);
+    lock.lock();
+    building.erase(key);
+    if (!image->isComplete()) {
+        LOG_WARN("fail to prebuild the packets of " << file.path << ", it was truncated");
+        return nullptr;
+    }
+    stats.builds++;
+    if (!evict(imageSize)) {
+        // Other images took the room while it was built, only this reader uses it
+        return image;
+    }
+    recentImages.emplace_front(key, image);
+    index[key] = recentImages.begin();
+    stats.images++;
+    stats.memoryBytes += imageSize;
+    return image;
+}
+
+/**
+ * @brief Keep the prebuilt packets of a file from its first read on, whatever the reads of the others.
+ *
+ * @param path The path of the file.
+ */
+void TFTPPacketCache::pin(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pinned.insert(path);
+}
+
+/**
+ * @brief Drop the images of a file that is written or deleted. Their readers keep them.
+ *
+ * @param path The path of the file.
+ */
+void TFTPPacketCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.lower_bound(TFTPPacketImageKey(path, 0));
+    while (it != index.end() && it->first.first == path) {
+        auto next = std::next(it);
+        erase(it);
+        it = next;
+    }
+}
+
+TFTPPacketCacheStats TFTPPacketCache::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+/**
+ * @brief Remove an image from the cache. Called with the mutex held.
+ *
+ * @param it The index entry of the image.
+ */
+void TFTPPacketCache::erase(std::map<TFTPPacketImageKey, TFTPPacketImageList::iterator>::iterator it) {
+    stats.memoryBytes -= it->second->second->getMemorySize();
+    stats.images--;
+    recentImages.erase(it->second);
+    index.erase(it);
+}
+
+/**
+ * @brief Drop the least recently used images that are neither pinned nor sent from until
+ * there is room for another one. Called with the mutex held.
+ *
+ * @param needed The size of the image to make room for.
+ * @return true if the image fits the budget.
+ */
+bool TFTPPacketCache::evict(size_t needed) {
+    if (needed > capacity) {
+        return false;
+    }
+    auto it = recentImages.end();
+    while (stats.memoryBytes + needed > capacity && it != recentImages.begin()) {
+        --it;
+        if (it->second.use_count() > 1 || pinned.count(it->first.first) > 0) {
+            continue;
+        }
+        auto next = std::next(it);
+        stats.evictions++;
+        erase(index.find(it->first));
+        it = next;
+    }
+    return stats.memoryBytes + needed <= capacity;
+}
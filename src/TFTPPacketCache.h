@@ -0,0 +1,86 @@
+#ifndef TFTP_PACKET_CACHE_H
+#define TFTP_PACKET_CACHE_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include "TFTPFileCache.h"
+
+#define PACKET_CACHE_DEFAULT_MB     64  // prebuilt packets kept for hot files
+#define PACKET_CACHE_HOT_READS      8   // reads after which a file is hot, 0 for pinned files only
+
+/**
+ * @brief Every DATA packet of a file for one block size, header and payload, back to back.
+ */
+class TFTPPacketImage {
+public:
+    TFTPPacketImage(const TFTPCachedFile& file, size_t blockSize);
+    const uint8_t* getPacket(uint32_t block) const;
+    size_t getPacketSize(uint32_t block) const;
+    size_t getMemorySize() const;
+    bool isComplete() const;
+    bool isImageOf(const TFTPCachedFile& file) const;
+
+private:
+    dev_t device;
+    ino_t inode;
+    off_t fileSize;
+    struct timespec modified;
+    size_t blockSize;
+    std::vector<uint8_t> packets;       // block n at (n - 1) * (blockSize + 4)
+    bool complete;                      // false if the file was truncated while it was copied
+};
+
+/**
+ * @brief Counters of a packet cache.
+ */
+struct TFTPPacketCacheStats {
+    uint64_t hits;              // reads sent from a prebuilt image
+    uint64_t builds;
+    uint64_t evictions;
+    size_t images;
+    size_t memoryBytes;
+};
+
+/**
+ * @brief Server wide cache of prebuilt DATA packets for the hot files, so sending one of
+ * their blocks is a pointer lookup with no formatting.
+ *
+ * Pinned files get an image from their first read and keep it; other files get one
+ * once they were read PACKET_CACHE_HOT_READS times, and the least recently used of
+ * those images no session is sending from are dropped to stay within the budget. A
+ * file is only imaged while it fits the budget; the reader that builds the image pays
+ * for it and readers arriving meanwhile use the mapping. All members are thread safe.
+ */
+class TFTPPacketCache {
+public:
+    TFTPPacketCache(size_t capacity = (size_t)PACKET_CACHE_DEFAULT_MB << 20, uint64_t hotReads = PACKET_CACHE_HOT_READS);
+    std::shared_ptr<const TFTPPacketImage> acquire(const TFTPCachedFile& file, size_t blockSize);
+    void pin(const std::string& path);
+    void invalidate(const std::string& path);
+    TFTPPacketCacheStats getStats();
+
+private:
+    typedef std::pair<std::string, size_t> TFTPPacketImageKey;     // path and block size
+    typedef std::list<std::pair<TFTPPacketImageKey, std::shared_ptr<const TFTPPacketImage>>> TFTPPacketImageList;
+    size_t capacity;
+    uint64_t hotReads;
+    std::mutex mutex;
+    TFTPPacketImageList recentImages;   // most recently used first
+    std::map<TFTPPacketImageKey, TFTPPacketImageList::iterator> index;
+    std::set<TFTPPacketImageKey> building;
+    std::set<std::string> pinned;
+    std::unordered_map<std::string, uint64_t> reads;
+    TFTPPacketCacheStats stats;
+    void erase(std::map<TFTPPacketImageKey, TFTPPacketImageList::iterator>::iterator it);
+    bool evict(size_t needed);
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "TFTPRetransmitTimer.h"
+#include <algorithm>
+
+std::atomic<uint64_t> TFTPRetransmitTimer::totalSamples(0);
+std::atomic<uint64_t> TFTPRetransmitTimer::totalTimeouts(0);
+std::atomic<uint64_t> TFTPRetransmitTimer::totalTransfers(0);
+std::atomic<uint64_t> TFTPRetransmitTimer::totalSRTTMicros(0);
+std::atomic<uint64_t> TFTPRetransmitTimer::totalRTOMicros(0);
+
+/**
+ * @brief Constructor for the TFTPRetransmitTimer class.
+ *
+ * Starts with the initial timeout of RFC 6298 and the default limits.
+ */
+TFTPRetransmitTimer::TFTPRetransmitTimer()
+    : minimum(std::chrono::milliseconds(RTO_DEFAULT_MIN_MS)), maximum(std::chrono::milliseconds(RTO_DEFAULT_MAX_MS)),
+      srtt(0), rttvar(0), timeout(std::chrono::milliseconds(RTO_INITIAL_MS)), fixedTimeout(0), fixed(false), samples(0), timeouts(0) {
+    clampTimeout();
+}
+
+/**
+ * @brief Set the bounds of the timeout.
+ *
+ * @param minimum The smallest timeout, guards against spurious retransmissions.
+ * @param maximum The largest timeout, where the exponential backoff stops.
+ */
+void TFTPRetransmitTimer::setLimits(std::chrono::microseconds minimum, std::chrono::microseconds maximum) {
+    this->minimum = minimum;
+    this->maximum = std::max(minimum, maximum);
+    clampTimeout();
+}
+
+/**
+ * @brief Use a fixed timeout instead of the estimate. It still backs off on timeouts,
+ * until the peer answers again.
+ *
+ * @param timeout The timeout negotiated with the peer.
+ */
+void TFTPRetransmitTimer::setFixedTimeout(std::chrono::microseconds timeout) {
+    fixed = true;
+    fixedTimeout = timeout;
+    this->timeout = timeout;
+    this->maximum = std::max(this->maximum, timeout);
+}
+
+/**
+ * @brief Update the estimate with a round trip time and recompute the timeout.
+ *
+ * @param rtt Time from sending a packet (sent only once) to receiving its answer.
+ */
+void TFTPRetransmitTimer::addSample(std::chrono::microseconds rtt) {
+    samples++;
+    totalSamples++;
+    if (samples == 1) {
+        srtt = rtt;
+        rttvar = rtt / 2;
+    }
+    else {
+        std::chrono::microseconds delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+        rttvar = (3 * rttvar + delta) / 4;
+        srtt = (7 * srtt + rtt) / 8;
+    }
+    if (fixed) {
+        timeout = fixedTimeout;
+        return;
+    }
+    timeout = srtt + std::max(std::chrono::microseconds(RTO_CLOCK_GRANULARITY_US), 4 * rttvar);
+    clampTimeout();
+}
+
+/**
+ * @brief Double the timeout after it expired, up to the maximum.
+ */
+void TFTPRetransmitTimer::backoff() {
+    timeouts++;
+    totalTimeouts++;
+    timeout = std::min(timeout * 2, maximum);
+}
+
+/**
+ * @brief Undo the backoff of a fixed timeout once the peer answers, even with no RTT
+ * sample. An estimated timeout stays backed off until the next sample (RFC 6298).
+ *
+ * @return true if the timeout changed.
+ */
+bool TFTPRetransmitTimer::restoreFixedTimeout() {
+    if (!fixed || timeout == fixedTimeout) {
+        return false;
+    }
+    timeout = fixedTimeout;
+    return true;
+}
+
+/**
+ * @brief Add the final estimate of this transfer to the process wide stats.
+ */
+void TFTPRetransmitTimer::publish() {
+    totalTransfers++;
+    totalSRTTMicros += srtt.count();
+    totalRTOMicros += timeout.count();
+}
+
+/**
+ * @brief Keep the timeout within the limits.
+ */
+void TFTPRetransmitTimer::clampTimeout() {
+    if (!fixed) {
+        timeout = std::min(std::max(timeout, minimum), maximum);
+    }
+}
+
+std::chrono::microseconds TFTPRetransmitTimer::getTimeout() const {
+    return timeout;
+}
+
+std::chrono::microseconds TFTPRetransmitTimer::getMaximum() const {
+    return maximum;
+}
+
+std::chrono::microseconds TFTPRetransmitTimer::getSRTT() const {
+    return srtt;
+}
+
+std::chrono::microseconds TFTPRetransmitTimer::getRTTVAR() const {
+    return rttvar;
+}
+
+uint64_t TFTPRetransmitTimer::getSamples() const {
+    return samples;
+}
+
+uint64_t TFTPRetransmitTimer::getTimeouts() const {
+    return timeouts;
+}
+
+/**
+ * @brief Snapshot of the counters summed over every timer of the process.
+ *
+ * @return The retransmission stats.
+ */
+TFTPRetransmitStats TFTPRetransmitTimer::getStats() {
+    TFTPRetransmitStats stats;
+    stats.samples = totalSamples;
+    stats.timeouts = totalTimeouts;
+    stats.transfers = totalTransfers;
+    stats.srttSumMicros = totalSRTTMicros;
+    stats.rtoSumMicros = totalRTOMicros;
+    return stats;
+}
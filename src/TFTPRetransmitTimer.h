@@ -0,0 +1,70 @@
+#ifndef TFTP_RETRANSMIT_TIMER_H
+#define TFTP_RETRANSMIT_TIMER_H
+
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+#define RTO_DEFAULT_MIN_MS      20      // lower bound of the retransmission timeout
+#define RTO_DEFAULT_MAX_MS      5000    // upper bound, also where the backoff stops
+#define RTO_INITIAL_MS          1000    // timeout before the first RTT sample (RFC 6298)
+#define RTO_CLOCK_GRANULARITY_US 1000
+
+/**
+ * @brief Retransmission timeout counters summed over every timer of the process.
+ */
+struct TFTPRetransmitStats {
+    uint64_t samples;           // RTT samples taken
+    uint64_t timeouts;          // timeouts, each one backing the timer off
+    uint64_t transfers;         // timers that published their estimate
+    uint64_t srttSumMicros;     // sum of the published SRTT values
+    uint64_t rtoSumMicros;      // sum of the published RTO values
+};
+
+/**
+ * @brief Retransmission timeout of one transfer, estimated from its round trip times.
+ *
+ * Follows RFC 6298: SRTT and RTTVAR are updated from every RTT sample and the timeout
+ * is SRTT + 4 * RTTVAR, clamped to [minimum, maximum]. Each timeout doubles the timeout
+ * until the next sample. Karn's rule is up to the caller: a packet that was sent more
+ * than once must not give a sample, since its ACK may answer either copy.
+ *
+ * A timeout negotiated with the timeout option (RFC 2349) replaces the estimate; it is
+ * backed off the same way and restored as soon as the peer answers.
+ */
+class TFTPRetransmitTimer {
+public:
+    TFTPRetransmitTimer();
+    void setLimits(std::chrono::microseconds minimum, std::chrono::microseconds maximum);
+    void setFixedTimeout(std::chrono::microseconds timeout);
+    void addSample(std::chrono::microseconds rtt);
+    void backoff();
+    bool restoreFixedTimeout();
+    void publish();
+    std::chrono::microseconds getTimeout() const;
+    std::chrono::microseconds getMaximum() const;
+    std::chrono::microseconds getSRTT() const;
+    std::chrono::microseconds getRTTVAR() const;
+    uint64_t getSamples() const;
+    uint64_t getTimeouts() const;
+    static TFTPRetransmitStats getStats();
+
+private:
+    std::chrono::microseconds minimum;
+    std::chrono::microseconds maximum;
+    std::chrono::microseconds srtt;
+    std::chrono::microseconds rttvar;
+    std::chrono::microseconds timeout;
+    std::chrono::microseconds fixedTimeout;    // negotiated timeout, before any backoff
+    bool fixed;
+    uint64_t samples;
+    uint64_t timeouts;
+    void clampTimeout();
+    static std::atomic<uint64_t> totalSamples;
+    static std::atomic<uint64_t> totalTimeouts;
+    static std::atomic<uint64_t> totalTransfers;
+    static std::atomic<uint64_t> totalSRTTMicros;
+    static std::atomic<uint64_t> totalRTOMicros;
+};
+
+#endif
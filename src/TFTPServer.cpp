@@ -1,8 +1,21 @@
 #include "TFTPServer.h"
+#include "TFTPLogger.h"
+#include "TFTPMetrics.h"
 #include <iostream>
 #include <cstring>
 #include <unistd.h>
 #include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <memory>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "TFTPWorkerPool.h"
 
 /**
  * @brief Constructor for the TFTPServer class.
@@ -11,132 +24,84 @@
  * @action: Server is established and ready to accept clients
  * @param port The port on which the server will listen for TFTP requests.
  */
-TFTPServer::TFTPServer(int port) : port(port), nextClientId(1) {
-    // Create a UDP socket for the server.
-    serverSocket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (serverSocket < 0) {
-        std::cerr << "Error creating server socket" << std::endl;
-        exit(1);
+TFTPServer::TFTPServer(int port) : TFTPServer(port, TFTPServerConfig()) {
+}
+
+/**
+ * @brief Constructor for the TFTPServer class.
+ *
+ * This constructor initializes the TFTPServer with the specified port and configuration.
+ * @action: Server is established and ready to accept clients
+ * @param port The port on which the server will listen for TFTP requests.
+ * @param config The server configuration (e.g., thread or event loop mode).
+ */
+TFTPServer::TFTPServer(int port, const TFTPServerConfig& config) : port(port), config(config), fileCache((size_t)config.fileCacheMb << 20),
+      packetCache((size_t)config.packetCacheMb << 20, config.hotReads), fileWriter(config.writeThreads), fileCommitter(SERVER_DATABASE), nextClientId(1),
+      metricsStopping(false) {
+    for (const std::string& hotFile : config.hotFiles) {
+        packetCache.pin("serverDatabase/" + hotFile);
     }
     // Set up server address information.
+    memset(&serverAddress, 0, sizeof(serverAddress));
     serverAddress.sin_family = AF_INET;             
     serverAddress.sin_addr.s_addr = inet_addr("127.0.0.1");
     serverAddress.sin_port = htons(69);
-    // Bind the socket to the specified address and port.
-    if (bind(serverSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        std::cerr << "Error binding server socket" << std::endl;
+    serverSocket = createListenerSocket();
+    if (serverSocket < 0) {
         exit(1);
     }
     std::cout << "Server binded to port 69" << std::endl;
 }
 
+/**
+ * @brief Create a UDP socket bound to the server address.
+ *
+ * With more than one listener configured the socket is created with SO_REUSEPORT,
+ * so every listener can bind the same address and the kernel spreads incoming
+ * requests over them by client address.
+ *
+ * @return The bound socket, or -1 on failure.
+ */
+int TFTPServer::createListenerSocket() {
+    // Create a UDP socket for the server.
+    int listenSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (listenSocket < 0) {
+        LOG_ERROR("Error creating server socket");
+        return -1;
+    }
+    int reusePort = 1;
+    if (config.listenerCount > 1 && setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) < 0) {
+        LOG_ERROR("Error setting SO_REUSEPORT on server socket");
+        close(listenSocket);
+        return -1;
+    }
+    // Bind the socket to the specified address and port.
+    if (bind(listenSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+        LOG_ERROR("Error binding server socket");
+        close(listenSocket);
+        return -1;
+    }
+    return listenSocket;
+}
+
 /**
  * @brief Handles the write request from a TFTP client.
  *
- * This function processes the write request from a TFTP client, receives data packets,
- * and writes the data to a file.
+ * This function processes the write request from a TFTP client by driving a WRQ
+ * session on the client thread until the file is received or the transfer fails.
  *
  * @param clientSocket The socket used for communication with the TFTP client.
  * @param filename The name of the file to be written.
+ * @param options The options requested by the client.
  * @param clientAddress The client's address information.
  * @param clientId The unique identifier for the client.
- * @param files A map containing information about existing files on the server.
+ * @param files The index of the files on the server and their readers.
  */
-void TFTPServer::handleWriteRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress, int clientId, std::map<std::string, int>& files) {
-    std::string directory = "serverDatabase/";
-    std::string filePath = directory + filename;
-    if (fileExists(filename, files)) {
-        // Send an error packet (File already exists. - Error Code 6)
-        const std::string errorMessage = "File already exists.";
-        sendError(clientSocket, ERROR_FILE_ALREADY_EXISTS, errorMessage, clientAddress);
-        return;
-    }
-    std::ofstream file(filePath, std::ios::binary); 
-    if (!file) {
-        // Send an error packet (Disk full or allocation exceeded - Error Code 3)
-        const std::string errorMessage = "Disk full or allocation exceeded.";
-        sendError(clientSocket, ERROR_DISK_FULL, errorMessage, clientAddress);
-        return;
-    }
-
-    uint16_t blockNumber = 0;
-    char recievedBuffer[516];
-    memset(recievedBuffer, 0, sizeof(recievedBuffer));
-    sendACK(clientSocket, blockNumber, clientAddress);
-    uint16_t expectedBlockNumber = 1;
-    int retry = MAX_RETRY;
-    while (retry)
-    {
-        int readBytes = recvfrom(clientSocket, recievedBuffer, sizeof(recievedBuffer), 0, nullptr, nullptr);
-        if (readBytes < 0) {
-            std::cerr << "TIMEOUT occured" << std::endl;
-            retry--;
-            continue;
-        }
-        else if (readBytes > 516)
-        {
-            std::cerr << "Illegal Packet Recieved" << std::endl;
-            std::string errorMessage = "Illegal TFTP operation";
-            sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
-            continue;
-        }
-        else {
-            retry = MAX_RETRY;
-        }
-        // check for correct clientaddress and client port
-
-        // Extract the opcode from the received packet
-        uint16_t opcode = (uint16_t)(((recievedBuffer[1] & 0xFF) << 8) | (recievedBuffer[0] & 0XFF));
-        opcode = ntohs(opcode);
-        std::cerr << "Recieved Opcode:" << opcode << std::endl;
-        if (opcode != 3) {
-            std::cerr << "Illegal Opcode Recieved" << std::endl;
-            std::string errorMessage = "Illegal TFTP operation";
-            sendError(clientSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
-            continue;
-        }
-        uint16_t recvBlockNumber = (uint16_t)(((recievedBuffer[3] & 0xFF) << 8) | (recievedBuffer[2] & 0XFF));
-        recvBlockNumber = ntohs(recvBlockNumber);
-        std::cerr << "Recieved Block Number:" << recvBlockNumber << std::endl;
-        if (recvBlockNumber != expectedBlockNumber) {
-            std::cerr << "Incorrect Block Number Recieved" << std::endl;
-            std::string errorMessage = "Incorrect Block Number Recieved. Resend";
-            sendError(clientSocket, ERROR_NOT_DEFINED, errorMessage, clientAddress);
-            continue;
-        }
-        std::cerr << "Read Bytes: " << readBytes << std::endl;
-        int dataLength = readBytes - 4;
-        char recvData[dataLength];
-        memset(recvData, 0, dataLength);
-        std::cerr << "Copying data memory" << std::endl;
-        memcpy(recvData, recievedBuffer + 4, dataLength);
-        std::cerr << "Recieved data size: " << dataLength << std::endl;
-        // std::cerr << "Received Data: " << std::endl << std::endl << recvData << std::endl;
-        std::cerr << "Writing data in file" << std::endl;
-        file.write(reinterpret_cast<char*>(recvData), dataLength);
-        if (file.fail())
-        {
-            std::cerr << "File write error" << std::endl;
-            const std::string errorMessage = "Disk full or allocation exceeded.";
-            sendError(clientSocket, ERROR_DISK_FULL, errorMessage, clientAddress);
-            // code logic for rewrite.
-            break;
-        }
-        sendACK(clientSocket, expectedBlockNumber, clientAddress);
-        expectedBlockNumber++;
-        if(dataLength < 512) {
-            std::cerr << "File recieved Successfuly." << std::endl;
-            files.insert(std::make_pair(filename, 0));
-            break;
-        }
-    }
-    // TODO: Handle the write operation
-    file.close();
-    if (!retry)
-    {
-        std::cerr << "Max retry for receiving timeout exceeded. Shutting down server" << std::endl;
-    }
-    
+void TFTPServer::handleWriteRequest(int clientSocket, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress, int clientId, TFTPFileIndex& files) {
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(config.ioBackend));
+    TFTPSession session(*engine, clientSocket, clientId, TFTP_OPCODE_WRQ, filename, options, clientAddress, files);
+    configureSession(session);
+    runSession(session, *engine);
 }
 
 
@@ -163,121 +128,32 @@ void TFTPServer::sendError(int clientSocket, uint16_t errorCode, const std::stri
 
     // Send the error packet to the client
     if(sendto(clientSocket, packet, 4 + errorMsg.size() + 1, 0, (struct sockaddr*)&clientAddress, sizeof(clientAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send error packet" << std::endl;
+        LOG_ERROR("fail to send error packet");
         return;
     }
 
     // Log the successful sending of the error packet
-    std::cerr << "[LOG] : Error packet send to client " << clientAddress.sin_addr.s_addr << " with error code: " << errorCode << std::endl;
+    LOG_INFO_EVENT(LOG_EVENT_ERROR_SENT, clientAddress.sin_addr.s_addr, errorCode);
 }
 
 /**
  * @brief Handles a read request from a TFTP client.
  *
- * This function processes a read request from a TFTP client, reads the
- * specified file in blocks of 512 bytes, and sends the data to the client.
+ * This function processes a read request from a TFTP client by driving an RRQ
+ * session on the client thread, which sends the file in blocks of the negotiated block size.
  *
  * @param clientSocket The socket used for communication with the TFTP client.
  * @param filename The name of the file requested by the client.
+ * @param options The options requested by the client.
  * @param clientAddress The client's address information.
  * @param clientId The unique identifier for the client.
- * @param files A map containing information about the files being accessed.
+ * @param files The index of the files on the server and their readers.
  */
-void TFTPServer::handleReadRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress, int clientId, std::map<std::string, int>& files) {
-    // Set up file paths and open the requested file
-    std::string directory = "serverDatabase/";
-    std::string filePath = directory + filename;
-    std::ifstream file(filePath, std::ios::binary);
-
-    // Check if the file exists
-    if (!fileExists(filename, files)) {
-        // Send an error packet (File not found - Error Code 1)
-        const std::string errorMessage = "File not found";
-        sendError(clientSocket, ERROR_FILE_NOT_FOUND, errorMessage, clientAddress);
-        return;
-    }
-
-    // Update the number of readers for the file
-    int readers = files[filename];
-    readers++;
-    auto it = files.find(filename);
-    files.erase(it);
-    files.insert(std::make_pair(filename, readers));
-
-    // Read and send data in blocks of 512 bytes
-    uint16_t blockNumber = 1;
-    char dataBuffer[512];
-    int retry = MAX_RETRY;
-
-    while (retry) {
-        // Prepare data packet
-        uint8_t packet[516];
-        memset(packet, 0, sizeof(packet));
-        memset(dataBuffer, 0, 512);
-        size_t dataSize = file.gcount();
-
-        // Read data from the file
-        dataSize = TFTPPacket::readDataBlock(filePath, blockNumber, dataBuffer, dataSize);
-        if (dataSize == 0) {
-            break; // End of file
-        }
-        std::cerr << "Data Size: " << dataSize << std::endl;
-
-        // Create and send data packet
-        TFTPPacket::createDataPacket(packet, blockNumber, dataBuffer, dataSize);
-        sendto(clientSocket, packet, dataSize + 4, 0, (struct sockaddr*)&clientAddress, sizeof(clientAddress));
-
-        // Wait for acknowledgment
-        char ackBuffer[4];
-        int ackSize = recvfrom(clientSocket, ackBuffer, sizeof(ackBuffer), 0, nullptr, nullptr);
-        if (ackSize < 0) {
-            std::cerr << "TIMEOUT Occured" << std::endl;
-            retry--;
-            continue;
-        }
-        else if (ackSize > MAX_PACKET_SIZE) {
-            std::cerr << "Invalid acknowledgment received" << std::endl;
-            const std::string errorMessage = "Illegal TFTP operation";
-            sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, clientAddress);
-            continue;
-        }
-        else {
-            retry = MAX_RETRY;
-        }
-        std::cerr << "Acknoledment recieved" <<std::endl;
-        // Check the received acknowledgment packet (Opcode 4)
-        uint16_t ackOpcode = (ackBuffer[0] << 8) | ackBuffer[1];
-        uint16_t ackBlockNumber = (ackBuffer[2] << 8) | ackBuffer[3];
-        if (ackOpcode != 4 || ackBlockNumber != blockNumber) {
-            std::cerr << "Invalid acknowledgment received" << std::endl;
-            const std::string errorMessage = "Illegal TFTP operation";
-            sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, clientAddress);
-            continue;
-        }
-        std::cerr<< "Correct ACK packet recieved for blocknumber: " << ackBlockNumber << std::endl;
-
-        if(dataSize < 512) {
-            break;
-        }
-
-        ++blockNumber;
-    }
-
-// Close the file
-    file.close();
-
-    // Check for maximum retry limit
-    if (!retry)
-    {
-        std::cerr << "Max retry for receiving timeout exceeded. Shutting down server" << std::endl;
-    }
-
-    // Update the number of readers for the file
-    readers = files[filename];
-    readers--;
-    auto iter = files.find(filename);
-    files.erase(iter);
-    files.insert(std::make_pair(filename, readers));
+void TFTPServer::handleReadRequest(int clientSocket, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress, int clientId, TFTPFileIndex& files) {
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(config.ioBackend));
+    TFTPSession session(*engine, clientSocket, clientId, TFTP_OPCODE_RRQ, filename, options, clientAddress, files);
+    configureSession(session);
+    runSession(session, *engine);
 }
 
 /**
@@ -297,12 +173,55 @@ void TFTPServer::sendACK(int clientSocket, uint16_t blockNumber, struct sockaddr
 
     // Send the ACK packet
     if (sendto(clientSocket, packet, sizeof(packet), 0, (struct sockaddr*)&clientAddress, sizeof(clientAddress)) < 0) {
-        std::cerr << "[ERROR] : fail to send ACK packet" << std::endl;
+        LOG_ERROR("fail to send ACK packet");
         return;
     }
 
     // Log the successful ACK packet transmission
-    std::cerr << "[LOG] : ACK packet send to client " << clientAddress.sin_addr.s_addr << " with Block Number: " << blockNumber << std::endl;
+    LOG_DEBUG_EVENT(LOG_EVENT_ACK_SENT, clientAddress.sin_addr.s_addr, blockNumber);
+}
+
+/**
+ * @brief Drives a session to completion on the calling thread.
+ *
+ * Waits for packets with ppoll until the session deadline, which follows the
+ * session's retransmission timeout; an expired deadline is reported to the session
+ * so it can retransmit or give up. The I/O queued by every session step is submitted
+ * before waiting for the next packet.
+ *
+ * @param session The session to run.
+ * @param engine The I/O engine the session was created with.
+ */
+void TFTPServer::runSession(TFTPSession& session, TFTPIOEngine& engine) {
+    session.start();
+    engine.submit();
+    // Sized once the options are negotiated, one byte more to detect oversized packets
+    std::vector<uint8_t> buffer(session.getMaxPacketSize() + 1);
+    while (!session.isFinished()) {
+        struct sockaddr_in recvAddress;
+        socklen_t recvAddressLen = sizeof(recvAddress);
+        int bytesRead = recvfrom(session.getSocket(), buffer.data(), buffer.size(), MSG_DONTWAIT, (struct sockaddr*)&recvAddress, &recvAddressLen);
+        if (bytesRead >= 0) {
+            session.handlePacket(buffer.data(), bytesRead, recvAddress);
+            engine.submit();
+            continue;
+        }
+        // Zero-copy completions make the socket ready too
+        session.reapSendCompletions();
+        auto remaining = session.getDeadline() - std::chrono::steady_clock::now();
+        if (remaining > std::chrono::nanoseconds(0)) {
+            struct pollfd pollSocket = {session.getSocket(), POLLIN, 0};
+            struct timespec timeout;
+            auto remainingNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+            timeout.tv_sec = remainingNanos / 1000000000;
+            timeout.tv_nsec = remainingNanos % 1000000000;
+            if (ppoll(&pollSocket, 1, &timeout, nullptr) != 0) {
+                continue;
+            }
+        }
+        session.handleTimeout();
+        engine.submit();
+    }
 }
 
 /**
@@ -314,36 +233,28 @@ void TFTPServer::sendACK(int clientSocket, uint16_t blockNumber, struct sockaddr
  *
  * @param serverThreadSocket The socket for communication with the TFTP client in the thread.
  * @param filename The requested filename for RRQ, WRQ, or DELETE operations.
+ * @param options The options requested with an RRQ, WRQ or LS.
  * @param clientAddress The client's address information.
  * @param clientId The unique identifier for the client thread.
  * @param opcode The TFTP operation code received from the client.
  * @param clientThreads A map containing client thread information.
- * @param files A map containing information about files on the server.
+ * @param files The index of the files on the server and their readers.
  */
-void TFTPServer::handleClientThread(int serverThreadSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, uint16_t opcode, std::map<int, std::tuple<std::thread, bool>>& clientThreads, std::map<std::string, int>& files) {
-    // Set a receive timeout of 5 seconds for the socket
-    struct timeval timeout;
-    timeout.tv_sec = 5;  // seconds
-    timeout.tv_usec = 0; // microseconds
-    if (setsockopt(serverThreadSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
-        std::cerr << "Error setting receive timeout" << std::endl;
-        return;
-    }
-
+void TFTPServer::handleClientThread(int serverThreadSocket, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress,  int clientId, uint16_t opcode, std::map<int, std::tuple<std::thread, bool>>& clientThreads, TFTPFileIndex& files) {
     // Handle RRQ request (Opcode 1)
     if (opcode == TFTP_OPCODE_RRQ) {
-        handleReadRequest(serverThreadSocket, filename, clientAddress, clientId, files);
+        handleReadRequest(serverThreadSocket, filename, options, clientAddress, clientId, files);
     }
     // Handle WRQ request (Opcode 2)
     else if (opcode == TFTP_OPCODE_WRQ) {
-        handleWriteRequest(serverThreadSocket, filename, clientAddress, clientId, files);
+        handleWriteRequest(serverThreadSocket, filename, options, clientAddress, clientId, files);
     }
     else if(opcode == TFTP_OPCODE_DELETE) {
         handleDeleteRequest(serverThreadSocket, filename, clientAddress, clientId, files); 
     }
     else if (opcode == TFTP_OPCODE_LS) {
         // handle the list files
-        handleLSRequest(serverThreadSocket, clientAddress, clientId, files);
+        handleLSRequest(serverThreadSocket, options, clientAddress, clientId, files);
     }
     else {
         // Send an error packet (Illegal TFTP operation - Error Code 4)
@@ -353,63 +264,61 @@ void TFTPServer::handleClientThread(int serverThreadSocket, const std::string& f
 
     // set destroy thread bool variable to true.
     close(serverThreadSocket);
-    std::get<1>(clientThreads[clientId]) = true;
-    std::cerr << "[LOG]: Thread work completed. Can be Destroyed" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(clientThreadsMutex);
+        std::get<1>(clientThreads[clientId]) = true;
+        completedClientThreads.push_back(clientId);
+    }
+    clientThreadsChanged.notify_one();
+    LOG_DEBUG("Thread work completed. Can be Destroyed");
 }
 
 
 /**
- * @brief Destroys completed client threads after a specified interval.
+ * @brief Destroys client threads as soon as they complete.
  *
- * This function periodically checks for completed client threads, joins them, and removes
+ * This function waits until client threads report their completion, joins them, and removes
  * their entries from the clientThreads map. It repeats this process until the destroyTFTPServer
- * flag is set to true.
+ * flag is set to true and the listener loop wakes it up, then joins the remaining threads.
  *
  * @param clientThreads A map containing information about active client threads.
  */
 void TFTPServer::destroyClientThreads(std::map<int, std::tuple<std::thread, bool>>& clientThreads){
-    std::cerr << "[LOG]: destroy client thread started" << std::endl;
-    std::vector<int> keyToDelete;
-    // Sleep for 15 seconds
-    // Periodically check for completed threads and join them
+    LOG_DEBUG("destroy client thread started");
+    std::unique_lock<std::mutex> lock(clientThreadsMutex);
     while(!destroyTFTPServer){
-        std::this_thread::sleep_for(std::chrono::seconds(15));
-
-        // Iterate through clientThreads map
-        for (auto& pair : clientThreads) {
-            int key = pair.first;
-            auto& threadTuple = pair.second;
-            if (std::get<1>(threadTuple))
-            {
-                // Join the thread
-                std::get<0>(threadTuple).join();
-                std::cerr << " joined Thread ID: " << key << std::endl;
-                // clientThreads.erase(key);
-                keyToDelete.push_back(key);
-            }
-        }
-
-        // Remove completed threads from the clientThreads map
-        for(int value : keyToDelete){
-            auto it = clientThreads.find(value);
-            if (it != clientThreads.end()) {
-                clientThreads.erase(it);
-                std::cerr << "Removed the thread id from Map: " << value << std::endl;
+        clientThreadsChanged.wait(lock, [this] {
+            return destroyTFTPServer || !completedClientThreads.empty();
+        });
+        std::vector<int> completed;
+        completed.swap(completedClientThreads);
+        for (int key : completed) {
+            auto it = clientThreads.find(key);
+            if (it == clientThreads.end()) {
+                continue;
             }
+            // Join outside the lock, the thread only has to return
+            std::thread thread = std::move(std::get<0>(it->second));
+            clientThreads.erase(it);
+            lock.unlock();
+            thread.join();
+            LOG_DEBUG(" joined Thread ID: " << key);
+            lock.lock();
         }
-        keyToDelete.clear();
     }
 
     // Join any remaining threads when the destroyTFTPServer flag is set
+    std::vector<std::thread> remaining;
     for (auto& pair : clientThreads) {
-        int key = pair.first;
-        auto& threadTuple = pair.second;
-        // Join the thread
-        std::get<0>(threadTuple).join();
-        std::cerr << " joined Thread ID: " << key << std::endl;
+        remaining.push_back(std::move(std::get<0>(pair.second)));
     }
     clientThreads.clear();
-    std::cerr << "All threads joined" << std::endl;
+    completedClientThreads.clear();
+    lock.unlock();
+    for (std::thread& thread : remaining) {
+        thread.join();
+    }
+    LOG_INFO("All threads joined");
 }
 
 /**
@@ -446,17 +355,13 @@ shutdown_prompt:
  * @brief Start the TFTP server and handle incoming requests.
  *
  * This function initializes the server, sets up signal handling for server shutdown,
- * and enters a loop to listen for incoming TFTP requests. It creates threads to handle
- * different types of requests and manages the server's lifecycle.
+ * and hands the server socket to the configured request handling model: a thread per
+ * request, a single epoll event loop driving every session as a state machine, or an
+ * epoll dispatcher handing session steps to a fixed pool of worker threads.
  */
 void TFTPServer::start() {
     destroyTFTPServer = DESTROY_SERVER;
 
-    // Create a thread to destroy client threads periodically
-    std::thread destroyThread([this] {
-        destroyClientThreads(clientThreads);
-    });
-
     // Set up signal handling for graceful shutdown
     struct sigaction act;
 	memset(&act,0,sizeof(act));
@@ -465,122 +370,932 @@ void TFTPServer::start() {
 	act.sa_sigaction = &destroyTFTPHandler;
 	sigaction(SIGINT, &act, NULL);
 
-    // Initialize the file map
+    prepareUploadDirectory();
+    startMetricsExporter();
+    // Initialize the file index, then keep it up to date with the changes made meanwhile and later
+    bool watched = fileWatcher.watch(SERVER_DATABASE);
     initializeFileMap(files);
+    if (watched) {
+        fileWatcher.start([this](const std::string& filename) { handleFileEvent(filename); },
+                          [this]() { scanFileIndex(files); });
+    }
+    if (config.listenerCount > 1 && config.serverMode == SERVER_MODE_THREAD) {
+        LOG_WARN("listener shards need the epoll or pool mode, using a single listener");
+    }
+
+    if (config.listenerCount > 1 && config.serverMode != SERVER_MODE_THREAD) {
+        runListenerShards();
+    }
+    else if (config.serverMode == SERVER_MODE_EVENT_LOOP) {
+        runEventLoop(serverSocket);
+    }
+    else if (config.serverMode == SERVER_MODE_WORKER_POOL) {
+        runWorkerPool(serverSocket);
+    }
+    else {
+        runThreadModel();
+    }
+
+    // Check if the server is shutting down
+    if(destroyTFTPServer) {
+        LOG_INFO("Shutting Down Server....");
+    }
+    else {
+        LOG_ERROR("Error Occured. Force shutdown server");
+    }
+    if (metricsThread.joinable()) {
+        metricsStopping = true;
+        metricsThread.join();
+    }
+    persistFileIndex();
+    LOG_INFO("Server shut down process completed");
+    
+    // Terminate the server process
+    kill(getpid(),SIGTERM);
+}
+
+/**
+ * @brief Listen for requests and handle each one in its own thread.
+ *
+ * This function enters a loop to listen for incoming TFTP requests. It creates a thread
+ * per request and a helper thread that joins each one as soon as it completes.
+ */
+void TFTPServer::runThreadModel() {
+    // Create a thread to destroy client threads periodically
+    std::thread destroyThread([this] {
+        destroyClientThreads(clientThreads);
+    });
 
-    std::cerr << "Server is started and waiting to recieve data" << std::endl;
+    LOG_INFO("Server is started and waiting to recieve data");
+    std::unique_ptr<TFTPRequestBatch> requests(new TFTPRequestBatch());
+    auto lastStatsLog = std::chrono::steady_clock::now();
     struct timeval timeout;
     timeout.tv_sec = 5;  // seconds
     timeout.tv_usec = 0; // microseconds
     while (!destroyTFTPServer) {
         if (setsockopt(serverSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
-            std::cerr << "Error setting receive timeout" << std::endl;
+            LOG_ERROR("Error setting receive timeout");
             break;
         }
-        struct sockaddr_in clientAddress;
-        socklen_t clientAddrLen = sizeof(clientAddress);
-        char buffer[1024];
-        memset(buffer, 0, sizeof(buffer));
-        // Receive data from clients
-        std::cerr << "start receiving data" << std::endl;
-        int bytesRead = recvfrom(serverSocket, buffer, sizeof(buffer), 0, (struct sockaddr*)&clientAddress, &clientAddrLen);
-        if (bytesRead < 0) {
-            std::cerr << "Timeout Occured while listening" << std::endl;
-            continue;
-        }
-        else if (bytesRead > 516) {
-            std::cerr << "Error receiving data" << std::endl;
-            const std::string errorMessage = "Illegal TFTP operation";
-            sendError(serverSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+        // Receive data from clients: wait for one request, then take the queued ones with it
+        LOG_DEBUG("start receiving data");
+        int count = receiveRequests(serverSocket, *requests, MSG_WAITFORONE);
+        if (count < 0) {
+            LOG_DEBUG("Timeout Occured while listening");
             continue;
         }
-        std::cerr << "completed received data" << std::endl;
+        LOG_DEBUG("completed received data");
+
+        for (int i = 0; i < count; i++) {
+            struct sockaddr_in clientAddress = requests->addresses[i];
+            const char* buffer = requests->buffers[i];
+            int bytesRead = requests->sizes[i];
+            if (bytesRead > 516) {
+                LOG_ERROR("Error receiving data");
+                const std::string errorMessage = "Illegal TFTP operation";
+                sendError(serverSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+                continue;
+            }
 
-        // Extract the opcode from the received packet
-        uint16_t opcode = (uint16_t)(((buffer[1] & 0xFF) << 8) | (buffer[0] & 0XFF));
-        opcode = ntohs(opcode);
-        std::cerr << "Opcode:" << opcode << std::endl;
+            uint16_t opcode;
+            std::string filename;
+            TFTPOptions options;
+            if (!parseRequest(serverSocket, buffer, bytesRead, clientAddress, opcode, filename, options)) {
+                continue;
+            }
 
-        // Handle the list files request
-        if (opcode == TFTP_OPCODE_LS)
-        {
+            // Create a thread to handle the client request
             int clientId = 9800 + nextClientId++;
-            std::string filename;
-            clientThreads[clientId] = std::make_tuple(std::thread([this, clientId, clientAddress, buffer, bytesRead, filename, opcode] {
-                 int serverThreadSocket = socket(AF_INET, SOCK_DGRAM, 0);
-                struct sockaddr_in serverThreadSocketAddr;
-                serverThreadSocketAddr.sin_family = AF_INET;
-                serverThreadSocketAddr.sin_port = htons(clientId);
-                serverThreadSocketAddr.sin_addr.s_addr = inet_addr("127.0.0.1");   // INADDR_ANY;
-                if (bind(serverThreadSocket, (struct sockaddr*)&serverThreadSocketAddr, sizeof(serverThreadSocketAddr)) < 0) {
-                    std::cerr << "Error binding server socket" << std::endl;
+            LOG_DEBUG("Starting client thread");
+            std::lock_guard<std::mutex> lock(clientThreadsMutex);
+            clientThreads[clientId] = std::make_tuple(std::thread([this, clientId, clientAddress, filename, options, opcode] {
+                int serverThreadSocket = createSessionSocket();
+                if (serverThreadSocket < 0) {
                     exit(1);
                 }
-                std::cout << "Server binded to port " << clientId << std::endl;
-                handleClientThread(serverThreadSocket, filename, clientAddress, clientId, opcode, clientThreads, files);
-                
+                handleClientThread(serverThreadSocket, filename, options, clientAddress, clientId, opcode, clientThreads, files);
             }), false);
+        }
+        logBatchStats(*requests, std::vector<TFTPIOEngine*>(), lastStatsLog);
+    }
+    {
+        std::lock_guard<std::mutex> lock(clientThreadsMutex);
+        clientThreadsChanged.notify_all();
+    }
+    destroyThread.join();
+    LOG_DEBUG("destroy threads thread joined");
+}
 
+/**
+ * @brief Run one dispatch loop per SO_REUSEPORT listener, each pinned to its own core.
+ *
+ * The server socket is the first listener; the others are bound to the same address.
+ * Every shard parses its own requests and sets up its own sessions with the configured
+ * event loop or worker pool, so request acceptance scales with the number of shards.
+ * In worker pool mode the workers are divided between the shards. Only the event loop or
+ * dispatcher thread of a shard is pinned to a core, never its workers.
+ */
+void TFTPServer::runListenerShards() {
+    std::vector<int> listenSockets;
+    listenSockets.push_back(serverSocket);
+    for (int i = 1; i < config.listenerCount; i++) {
+        int listenSocket = createListenerSocket();
+        if (listenSocket < 0) {
+            break;
         }
-        // Handle RRQ, WRQ, or DELETE request
-        else if (opcode == TFTP_OPCODE_RRQ || opcode == TFTP_OPCODE_WRQ || opcode == TFTP_OPCODE_DELETE) {
-            int clientId = 9800 + nextClientId++;
-            std::cerr << "buffer read: " << buffer << std::endl;
-            std::string filename(buffer + 2);
-            std::cerr << "filename:" << filename << std::endl;
-               
-            std::string mode(buffer + 2 + filename.length() + 1);
-            std::cerr << "mode:" << mode << std::endl;
-            std::cerr << "Starting client thread" << std::endl;
-            for (int i = 0; mode[i] != '\0'; i++) {
-                mode[i] = std::tolower(mode[i]);
-            }
-
-            // Check if the mode is "octet"
-            if (mode != "octet"){
-                const std::string errorMessage = "Illegal TFTP operation";
-                sendError(serverSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+        listenSockets.push_back(listenSocket);
+    }
+    LOG_INFO("Started " << listenSockets.size() << " listener shards");
+
+    if (config.serverMode == SERVER_MODE_WORKER_POOL) {
+        int workerCount = config.workerCount > 0 ? config.workerCount : TFTPWorkerPool::defaultWorkerCount();
+        config.workerCount = std::max(1, workerCount / (int)listenSockets.size());
+    }
+
+    std::vector<std::thread> shards;
+    for (size_t i = 0; i < listenSockets.size(); i++) {
+        int listenSocket = listenSockets[i];
+        shards.emplace_back([this, i, listenSocket] {
+            // Only the shard's own thread is pinned: the event loop, or the dispatcher once
+            // its pool has started, so the workers keep running on any core
+            if (config.serverMode == SERVER_MODE_EVENT_LOOP) {
+                pinThreadToCore(i);
+                runEventLoop(listenSocket);
+            }
+            else {
+                runWorkerPool(listenSocket, i);
+            }
+        });
+    }
+    for (std::thread& shard : shards) {
+        shard.join();
+    }
+    for (size_t i = 1; i < listenSockets.size(); i++) {
+        close(listenSockets[i]);
+    }
+}
+
+/**
+ * @brief Restrict the calling thread to one core.
+ *
+ * @param core The core index, taken modulo the number of available cores.
+ */
+void TFTPServer::pinThreadToCore(int core) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core % TFTPWorkerPool::defaultWorkerCount(), &cpuSet);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0) {
+        LOG_ERROR("fail to pin listener shard to core " << core);
+    }
+}
+
+/**
+ * @brief Multiplex the listener and all session sockets on one epoll event loop.
+ *
+ * New requests are parsed on the listener socket and turned into sessions with their
+ * own socket. Readable session sockets are drained and fed to their session, the
+ * session deadlines are kept in a timer wheel whose expired timers trigger
+ * retransmissions, and finished sessions are reaped, all without blocking the loop
+ * thread. Only the sessions that ran are rescheduled or reaped, so the cost of a round
+ * does not grow with the number of idle sessions. Session I/O goes through one I/O engine, so with
+ * io_uring the receives, file reads and sends of all ready sessions are submitted
+ * together once per receive round.
+ *
+ * @param listenSocket The bound socket on which requests are received.
+ */
+void TFTPServer::runEventLoop(int listenSocket) {
+    TFTPEventLoop eventLoop;
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(config.ioBackend));
+    std::map<int, std::unique_ptr<TFTPSession>> sessions;
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL) | O_NONBLOCK);
+    if (!eventLoop.addSocket(listenSocket)) {
+        return;
+    }
+
+    LOG_INFO("Server is started in event loop mode and waiting to recieve data");
+    std::unique_ptr<TFTPRequestBatch> requests(new TFTPRequestBatch());
+    auto lastStatsLog = std::chrono::steady_clock::now();
+    std::vector<int> readySockets;
+    std::vector<int> receivingSockets;
+    TFTPTimerWheel timers;
+    std::vector<int> touchedSockets;    // sessions that ran this round
+    std::vector<int> expiredSockets;
+    while (!destroyTFTPServer) {
+        if (eventLoop.waitForEvents(readySockets, waitTimeoutMs(timers.nextExpiry())) < 0) {
+            LOG_ERROR("Error waiting for socket events");
+            break;
+        }
+
+        receivingSockets.clear();
+        for (int socket : readySockets) {
+            if (socket == listenSocket) {
+                // Accept every request waiting on the listener, a batch per recvmmsg
+                int count = LISTENER_BATCH_SIZE;
+                while (count == LISTENER_BATCH_SIZE) {
+                    count = receiveRequests(listenSocket, *requests, MSG_DONTWAIT);
+                    for (int i = 0; i < count; i++) {
+                        struct sockaddr_in clientAddress = requests->addresses[i];
+                        const char* buffer = requests->buffers[i];
+                        int bytesRead = requests->sizes[i];
+                        if (bytesRead > 516) {
+                            const std::string errorMessage = "Illegal TFTP operation";
+                            sendError(listenSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+                            continue;
+                        }
+                        uint16_t opcode;
+                        std::string filename;
+                        TFTPOptions options;
+                        if (!parseRequest(listenSocket, buffer, bytesRead, clientAddress, opcode, filename, options)) {
+                            continue;
+                        }
+                        int clientId = 9800 + nextClientId++;
+                        int sessionSocket = createSessionSocket();
+                        if (sessionSocket < 0) {
+                            const std::string errorMessage = "Server busy";
+                            sendError(listenSocket, ERROR_NOT_DEFINED, errorMessage, clientAddress);
+                            continue;
+                        }
+                        // DELETE completes immediately, no session is needed
+                        if (opcode == TFTP_OPCODE_DELETE) {
+                            handleDeleteRequest(sessionSocket, filename, clientAddress, clientId, files);
+                            close(sessionSocket);
+                            continue;
+                        }
+                        fcntl(sessionSocket, F_SETFL, fcntl(sessionSocket, F_GETFL) | O_NONBLOCK);
+                        if (!eventLoop.addSocket(sessionSocket)) {
+                            close(sessionSocket);
+                            continue;
+                        }
+                        // Sessions failing to start are reaped with the finished ones
+                        TFTPSession* session = new TFTPSession(*engine, sessionSocket, clientId, opcode, filename, options, clientAddress, files);
+                        sessions[sessionSocket].reset(session);
+                        configureSession(*session);
+                        session->start();
+                        touchedSockets.push_back(sessionSocket);
+                    }
+                }
                 continue;
             }
-            // Create a thread to handle the client request
-            clientThreads[clientId] = std::make_tuple(std::thread([this, clientId, clientAddress, buffer, bytesRead, filename, opcode] {
-                 int serverThreadSocket = socket(AF_INET, SOCK_DGRAM, 0);
-                struct sockaddr_in serverThreadSocketAddr;
-                serverThreadSocketAddr.sin_family = AF_INET;
-                serverThreadSocketAddr.sin_port = htons(clientId);
-                serverThreadSocketAddr.sin_addr.s_addr = inet_addr("127.0.0.1");   // INADDR_ANY;
-                if (bind(serverThreadSocket, (struct sockaddr*)&serverThreadSocketAddr, sizeof(serverThreadSocketAddr)) < 0) {
-                    std::cerr << "Error binding server socket" << std::endl;
-                    exit(1);
+
+            if (sessions.find(socket) != sessions.end()) {
+                receivingSockets.push_back(socket);
+            }
+        }
+
+        // Drain the ready session sockets, one recvmmsg per socket and round
+        while (!receivingSockets.empty()) {
+            std::vector<int> roundSockets;
+            roundSockets.swap(receivingSockets);
+            for (int socket : roundSockets) {
+                TFTPSession* session = sessions[socket].get();
+                if (session->isFinished()) {
+                    continue;
                 }
-                std::cout << "Server binded to port " << clientId << std::endl;
-                handleClientThread(serverThreadSocket, filename, clientAddress, clientId, opcode, clientThreads, files);
-                
-            }), false);
-            
+                touchedSockets.push_back(socket);
+                session->reapSendCompletions();
+                engine->prepareRecv(socket, session->getMaxPacketSize() + 1, [session, socket, &receivingSockets](const uint8_t* buffer, ssize_t bytesRead, struct sockaddr_in recvAddress) {
+                    if (bytesRead < 0) {
+                        return;
+                    }
+                    session->handlePacket(buffer, bytesRead, recvAddress);
+                    if (receivingSockets.empty() || receivingSockets.back() != socket) {
+                        receivingSockets.push_back(socket);
+                    }
+                }, SESSION_RECV_BATCH_SIZE);
+            }
+            engine->submit();
         }
-        else {
-            // Incorrect opcode received
-            std::cerr << "Incorrect opcode recieved" << std::endl;
-            const std::string errorMessage = "Illegal TFTP operation";
-            sendError(serverSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+
+        // Retransmit for sessions whose deadline expired
+        expiredSockets.clear();
+        timers.expire(std::chrono::steady_clock::now(), expiredSockets);
+        for (int socket : expiredSockets) {
+            sessions[socket]->handleTimeout();
+            touchedSockets.push_back(socket);
+        }
+        engine->submit();
+        logBatchStats(*requests, std::vector<TFTPIOEngine*>{engine.get()}, lastStatsLog);
+
+        // Follow the new deadlines of the sessions that ran and reap the finished ones
+        for (int socket : touchedSockets) {
+            auto it = sessions.find(socket);
+            if (it == sessions.end()) {
+                continue;
+            }
+            if (it->second->isFinished()) {
+                timers.cancel(socket);
+                eventLoop.removeSocket(socket);
+                close(socket);
+                sessions.erase(it);
+            }
+            else {
+                timers.schedule(socket, it->second->getDeadline());
+            }
+        }
+        touchedSockets.clear();
+    }
+
+    // Abort the sessions still in progress
+    engine->submit();
+    for (auto& pair : sessions) {
+        eventLoop.removeSocket(pair.first);
+        close(pair.first);
+    }
+    sessions.clear();
+    LOG_INFO("All sessions closed");
+}
+
+/**
+ * @brief Dispatch session steps from one epoll instance to a fixed pool of workers.
+ *
+ * The calling thread accepts requests on the listener and watches every session socket
+ * as a one-shot event, so a readable session is handed to exactly one worker, which
+ * drains its socket and rearms it. Workers report every session they stepped, and the
+ * dispatcher keeps the published deadlines in a timer wheel whose expired timers are
+ * queued as timeout steps.
+ * Bursts of requests only grow the bounded worker deques instead of creating threads;
+ * requests arriving while every deque is full are refused with an error.
+ *
+ * @param listenSocket The bound socket on which requests are received.
+ * @param core The core the dispatcher is pinned to once the workers have started, -1 for none.
+ */
+void TFTPServer::runWorkerPool(int listenSocket, int core) {
+    TFTPEventLoop eventLoop;
+    int workerCount = config.workerCount > 0 ? config.workerCount : TFTPWorkerPool::defaultWorkerCount();
+    std::vector<std::unique_ptr<TFTPIOEngine>> engines;
+    for (int i = 0; i < workerCount; i++) {
+        engines.emplace_back(TFTPIOEngine::create(config.ioBackend));
+    }
+    std::map<int, std::shared_ptr<TFTPPooledSession>> sessions;
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL) | O_NONBLOCK);
+    if (!eventLoop.addSocket(listenSocket)) {
+        return;
+    }
+    TFTPTimerUpdates updates;
+    TFTPTimerWheel timers;
+    std::vector<int> updatedSockets;
+    std::vector<int> expiredSockets;
+    TFTPWorkerPool pool(workerCount);
+    pool.start();
+    // Pinned after start, threads inherit the affinity of the thread creating them
+    if (core >= 0) {
+        pinThreadToCore(core);
+    }
+
+    LOG_INFO("Server is started in worker pool mode and waiting to recieve data");
+    std::unique_ptr<TFTPRequestBatch> requests(new TFTPRequestBatch());
+    auto lastStatsLog = std::chrono::steady_clock::now();
+    std::vector<TFTPIOEngine*> engineList;
+    for (auto& engine : engines) {
+        engineList.push_back(engine.get());
+    }
+    std::vector<int> readySockets;
+    while (!destroyTFTPServer) {
+        if (eventLoop.waitForEvents(readySockets, waitTimeoutMs(timers.nextExpiry())) < 0) {
+            LOG_ERROR("Error waiting for socket events");
+            break;
+        }
+
+        for (int socket : readySockets) {
+            if (socket == listenSocket) {
+                // Accept every request waiting on the listener, a batch per recvmmsg
+                int count = LISTENER_BATCH_SIZE;
+                while (count == LISTENER_BATCH_SIZE) {
+                    count = receiveRequests(listenSocket, *requests, MSG_DONTWAIT);
+                    for (int i = 0; i < count; i++) {
+                        struct sockaddr_in clientAddress = requests->addresses[i];
+                        const char* buffer = requests->buffers[i];
+                        int bytesRead = requests->sizes[i];
+                        if (bytesRead > 516) {
+                            const std::string errorMessage = "Illegal TFTP operation";
+                            sendError(listenSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+                            continue;
+                        }
+                        uint16_t opcode;
+                        std::string filename;
+                        TFTPOptions options;
+                        if (!parseRequest(listenSocket, buffer, bytesRead, clientAddress, opcode, filename, options)) {
+                            continue;
+                        }
+                        int clientId = 9800 + nextClientId++;
+                        int sessionSocket = createSessionSocket();
+                        if (sessionSocket < 0) {
+                            const std::string errorMessage = "Server busy";
+                            sendError(listenSocket, ERROR_NOT_DEFINED, errorMessage, clientAddress);
+                            continue;
+                        }
+                        // DELETE completes immediately, no session is needed
+                        if (opcode == TFTP_OPCODE_DELETE) {
+                            handleDeleteRequest(sessionSocket, filename, clientAddress, clientId, files);
+                            close(sessionSocket);
+                            continue;
+                        }
+                        fcntl(sessionSocket, F_SETFL, fcntl(sessionSocket, F_GETFL) | O_NONBLOCK);
+                        if (!eventLoop.addSocket(sessionSocket, true)) {
+                            close(sessionSocket);
+                            continue;
+                        }
+                        std::shared_ptr<TFTPPooledSession> pooled(new TFTPPooledSession());
+                        pooled->session.reset(new TFTPSession(*engines[0], sessionSocket, clientId, opcode, filename, options, clientAddress, files));
+                        configureSession(*pooled->session);
+                        pooled->deadline = pooled->session->getDeadline();
+                        if (!pool.submit(sessionSocket, [this, pooled, &engines, &eventLoop, &updates](int workerIndex) {
+                                runSessionStep(*pooled, SESSION_STEP_START, *engines[workerIndex], eventLoop, updates);
+                            })) {
+                            eventLoop.removeSocket(sessionSocket);
+                            const std::string errorMessage = "Server busy";
+                            sendError(sessionSocket, ERROR_NOT_DEFINED, errorMessage, clientAddress);
+                            continue;
+                        }
+                        sessions[sessionSocket] = pooled;
+                        timers.schedule(sessionSocket, pooled->deadline.load());
+                    }
+                }
+                continue;
+            }
+
+            auto it = sessions.find(socket);
+            if (it == sessions.end()) {
+                continue;
+            }
+            std::shared_ptr<TFTPPooledSession> pooled = it->second;
+            if (!pool.submit(socket, [this, pooled, &engines, &eventLoop, &updates](int workerIndex) {
+                    runSessionStep(*pooled, SESSION_STEP_RECEIVE, *engines[workerIndex], eventLoop, updates);
+                })) {
+                // Every deque is full, try again on the next event
+                eventLoop.rearmSocket(socket);
+            }
+        }
+
+        // Follow the deadlines the workers published and reap the finished sessions
+        {
+            std::lock_guard<std::mutex> lock(updates.mutex);
+            updatedSockets.swap(updates.sockets);
+        }
+        for (int socket : updatedSockets) {
+            auto it = sessions.find(socket);
+            if (it == sessions.end()) {
+                continue;
+            }
+            if (it->second->finished) {
+                timers.cancel(socket);
+                eventLoop.removeSocket(socket);
+                sessions.erase(it);
+            }
+            else {
+                timers.schedule(socket, it->second->deadline.load());
+            }
+        }
+        updatedSockets.clear();
+
+        // Queue timeout steps for expired deadlines
+        auto now = std::chrono::steady_clock::now();
+        expiredSockets.clear();
+        timers.expire(now, expiredSockets);
+        for (int socket : expiredSockets) {
+            auto it = sessions.find(socket);
+            if (it == sessions.end()) {
+                continue;
+            }
+            std::shared_ptr<TFTPPooledSession> pooled = it->second;
+            if (pooled->deadline.load() > now) {
+                // Moved by a step whose update is not drained yet
+                timers.schedule(socket, pooled->deadline.load());
+            }
+            else if (!pooled->timeoutQueued.exchange(true)) {
+                if (!pool.submit(socket, [this, pooled, &engines, &eventLoop, &updates](int workerIndex) {
+                        runSessionStep(*pooled, SESSION_STEP_TIMEOUT, *engines[workerIndex], eventLoop, updates);
+                    })) {
+                    // Every deque is full, try again on the next tick
+                    pooled->timeoutQueued = false;
+                    timers.schedule(socket, now + std::chrono::milliseconds(EVENT_LOOP_TICK_MS));
+                }
+            }
+        }
+        logBatchStats(*requests, engineList, lastStatsLog);
+    }
+
+    // Abort the sessions still in progress
+    pool.stop();
+    for (auto& pair : sessions) {
+        eventLoop.removeSocket(pair.first);
+    }
+    sessions.clear();
+    LOG_INFO("Worker pool executed " << pool.getExecutedTasks() << " session steps, " << pool.getStolenTasks() << " stolen");
+    LOG_INFO("All sessions closed");
+}
+
+/**
+ * @brief Run one step of a pooled session on the calling worker.
+ *
+ * A receive step drains the session socket and rearms it; a timeout step retransmits
+ * if the deadline is still expired once the session is locked. Both are skipped until
+ * the start step has run, a worker stealing from another deque may take them first. The session's I/O is
+ * submitted on the worker's engine before the step returns.
+ *
+ * @param pooled The session to step.
+ * @param step The step to run (SESSION_STEP_START, _RECEIVE or _TIMEOUT).
+ * @param engine The I/O engine of the calling worker.
+ * @param eventLoop The dispatcher's event loop, used to rearm the session socket.
+ * @param updates Where the session is reported once its deadline and state are published.
+ */
+void TFTPServer::runSessionStep(TFTPPooledSession& pooled, int step, TFTPIOEngine& engine, TFTPEventLoop& eventLoop, TFTPTimerUpdates& updates) {
+    std::lock_guard<std::mutex> lock(pooled.mutex);
+    TFTPSession& session = *pooled.session;
+    if (step == SESSION_STEP_TIMEOUT) {
+        pooled.timeoutQueued = false;
+    }
+    if (pooled.finished) {
+        return;
+    }
+    if (step != SESSION_STEP_START && !pooled.started) {
+        // Stolen ahead of the START step of the session, which rearms the socket and
+        // publishes the deadline once it has run
+        return;
+    }
+    session.setEngine(engine);
+
+    if (step == SESSION_STEP_START) {
+        session.start();
+        engine.submit();
+        pooled.started = true;
+    }
+    else if (step == SESSION_STEP_RECEIVE) {
+        // Drain the socket one recvmmsg per submit
+        session.reapSendCompletions();
+        bool received = true;
+        while (received && !session.isFinished()) {
+            received = false;
+            engine.prepareRecv(session.getSocket(), session.getMaxPacketSize() + 1, [&session, &received](const uint8_t* buffer, ssize_t bytesRead, struct sockaddr_in recvAddress) {
+                if (bytesRead < 0) {
+                    return;
+                }
+                session.handlePacket(buffer, bytesRead, recvAddress);
+                received = true;
+            }, SESSION_RECV_BATCH_SIZE);
+            engine.submit();
+        }
+        // Flush what the last batch queued, e.g. the final ACK of a write
+        engine.submit();
+    }
+    else if (session.getDeadline() <= std::chrono::steady_clock::now()) {
+        session.handleTimeout();
+        engine.submit();
+    }
+
+    pooled.deadline = session.getDeadline();
+    if (session.isFinished()) {
+        pooled.finished = true;
+    }
+    else if (step != SESSION_STEP_TIMEOUT) {
+        eventLoop.rearmSocket(session.getSocket());
+    }
+    std::lock_guard<std::mutex> updatesLock(updates.mutex);
+    updates.sockets.push_back(session.getSocket());
+}
+
+/**
+ * @brief Destructor for the TFTPPooledSession struct. Closes the session socket.
+ *
+ * Runs once neither the dispatcher nor a queued step refers to the session anymore.
+ */
+TFTPPooledSession::~TFTPPooledSession() {
+    if (session) {
+        int sessionSocket = session->getSocket();
+        session.reset();
+        close(sessionSocket);
+    }
+}
+
+/**
+ * @brief Receive a batch of requests on the listener socket with one recvmmsg.
+ *
+ * Every received request is null padded to the buffer size for parseRequest.
+ *
+ * @param listenSocket The socket on which requests are received.
+ * @param requests Filled with the received requests.
+ * @param flags MSG_DONTWAIT to return at once, or MSG_WAITFORONE to wait for the first request.
+ * @return The number of requests received, or -1 if none was (timeout or would block).
+ */
+int TFTPServer::receiveRequests(int listenSocket, TFTPRequestBatch& requests, int flags) {
+    struct mmsghdr messages[LISTENER_BATCH_SIZE];
+    struct iovec iovs[LISTENER_BATCH_SIZE];
+    for (int i = 0; i < LISTENER_BATCH_SIZE; i++) {
+        iovs[i].iov_base = requests.buffers[i];
+        iovs[i].iov_len = LISTENER_BUFFER_SIZE - 1;
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_name = &requests.addresses[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        messages[i].msg_hdr.msg_iov = &iovs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int count = recvmmsg(listenSocket, messages, LISTENER_BATCH_SIZE, flags, nullptr);
+    if (count <= 0) {
+        return -1;
+    }
+    requests.receiveCalls++;
+    requests.requests += count;
+    for (int i = 0; i < count; i++) {
+        requests.sizes[i] = messages[i].msg_len;
+        memset(requests.buffers[i] + requests.sizes[i], 0, LISTENER_BUFFER_SIZE - requests.sizes[i]);
+    }
+    return count;
+}
+
+/**
+ * @brief Log the average batch sizes of the listener and the session I/O engines.
+ *
+ * Logs at most once every BATCH_STATS_INTERVAL_SECONDS, and only when requests arrived.
+ *
+ * @param requests The listener's request batch and its counters.
+ * @param engines The I/O engines of the loop (may be empty).
+ * @param lastLog The time of the last log, updated when logging.
+ */
+void TFTPServer::logBatchStats(const TFTPRequestBatch& requests, const std::vector<TFTPIOEngine*>& engines, std::chrono::steady_clock::time_point& lastLog) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastLog < std::chrono::seconds(BATCH_STATS_INTERVAL_SECONDS) || requests.receiveCalls == 0) {
+        return;
+    }
+    lastLog = now;
+    uint64_t recvRequests = 0, recvDatagrams = 0, sendRequests = 0, sendDatagrams = 0;
+    for (TFTPIOEngine* engine : engines) {
+        recvRequests += engine->getRecvRequests();
+        recvDatagrams += engine->getRecvDatagrams();
+        sendRequests += engine->getSendRequests();
+        sendDatagrams += engine->getSendDatagrams();
+    }
+    std::ostringstream engineStats;
+    if (recvRequests > 0) {
+        engineStats << ", sessions " << (double)recvDatagrams / recvRequests << " datagrams per receive";
+    }
+    if (sendRequests > 0) {
+        engineStats << ", " << (double)sendDatagrams / sendRequests << " datagrams per send";
+    }
+    LOG_INFO("Listener " << (double)requests.requests / requests.receiveCalls << " requests per recvmmsg" << engineStats.str());
+    TFTPRetransmitStats rto = TFTPRetransmitTimer::getStats();
+    if (rto.transfers > 0) {
+        LOG_INFO("Retransmission " << rto.samples << " RTT samples, " << rto.timeouts << " timeouts, mean srtt "
+                 << rto.srttSumMicros / rto.transfers << " us, mean rto " << rto.rtoSumMicros / rto.transfers << " us over " << rto.transfers << " transfers");
+    }
+    TFTPFileCacheStats cache = fileCache.getStats();
+    if (cache.lookups > 0) {
+        LOG_INFO("File cache " << cache.hits << "/" << cache.lookups << " hits (" << 100.0 * cache.hits / cache.lookups << "%), "
+                 << cache.files << " files, " << (cache.mappedBytes >> 20) << " MB mapped, " << cache.evictions << " evictions, "
+                 << cache.invalidations << " invalidations");
+    }
+    TFTPPacketCacheStats packets = packetCache.getStats();
+    if (packets.builds > 0) {
+        LOG_INFO("Packet cache " << packets.hits << " hits, " << packets.builds << " builds, " << packets.images << " images, "
+                 << (packets.memoryBytes >> 20) << " MB, " << packets.evictions << " evictions");
+    }
+    TFTPFileWriterStats writes = fileWriter.getStats();
+    if (writes.writes + writes.inlineWrites > 0) {
+        LOG_INFO("File writer " << writes.writes << " writes behind, " << writes.inlineWrites << " inline, " << (writes.bytes >> 20) << " MB, "
+                 << writes.preallocations << " preallocations, " << writes.failures << " failures");
+    }
+    TFTPFileCommitterStats commits = fileCommitter.getStats();
+    if (commits.commits > 0) {
+        LOG_INFO("File committer " << commits.commits << " uploads in " << commits.groups << " groups, largest "
+                 << commits.largestGroup << ", " << commits.failures << " failures");
+    }
+}
+
+/**
+ * @brief Start the thread exporting the metrics, if a metrics socket or file is configured.
+ */
+void TFTPServer::startMetricsExporter() {
+    if (config.metricsSocket.empty() && config.metricsFile.empty()) {
+        return;
+    }
+    int metricsSocket = -1;
+    if (!config.metricsSocket.empty()) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, config.metricsSocket.c_str(), sizeof(address.sun_path) - 1);
+        // Left behind by a previous run
+        unlink(config.metricsSocket.c_str());
+        metricsSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (metricsSocket < 0 || bind(metricsSocket, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(metricsSocket, SOMAXCONN) < 0) {
+            LOG_ERROR("fail to listen on metrics socket " << config.metricsSocket << ": " << strerror(errno));
+            if (metricsSocket >= 0) {
+                close(metricsSocket);
+            }
+            metricsSocket = -1;
+        }
+    }
+    metricsThread = std::thread(&TFTPServer::runMetricsExporter, this, metricsSocket);
+}
+
+/**
+ * @brief Answer every connection to the metrics socket with the current metrics, and
+ * dump them to the metrics file every metricsIntervalSeconds, until the server stops.
+ *
+ * @param metricsSocket The listening Unix domain socket, -1 for none.
+ */
+void TFTPServer::runMetricsExporter(int metricsSocket) {
+    std::chrono::steady_clock::time_point nextDump = std::chrono::steady_clock::now();
+    while (!metricsStopping) {
+        if (!config.metricsFile.empty() && std::chrono::steady_clock::now() >= nextDump) {
+            writeMetricsFile();
+            nextDump = std::chrono::steady_clock::now() + std::chrono::seconds(config.metricsIntervalSeconds);
+        }
+        // A negative descriptor is ignored, poll then only waits
+        struct pollfd pollFd = {metricsSocket, POLLIN, 0};
+        if (poll(&pollFd, 1, METRICS_POLL_MS) <= 0) {
             continue;
         }
+        int connection = accept4(metricsSocket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            continue;
+        }
+        std::string metrics = formatMetrics();
+        for (size_t written = 0; written < metrics.size(); ) {
+            ssize_t result = send(connection, metrics.data() + written, metrics.size() - written, MSG_NOSIGNAL);
+            if (result <= 0) {
+                break;
+            }
+            written += result;
+        }
+        close(connection);
     }
-    // Check if the server is shutting down
-    if(destroyTFTPServer) {
-        std::cerr << "Shutting Down Server...." << std::endl;
+    if (!config.metricsFile.empty()) {
+        writeMetricsFile();
+    }
+    if (metricsSocket >= 0) {
+        close(metricsSocket);
+        unlink(config.metricsSocket.c_str());
+    }
+}
+
+/**
+ * @brief Replace the metrics file with the current metrics. The file is renamed into
+ * place, so a reader never sees it half written.
+ */
+void TFTPServer::writeMetricsFile() {
+    std::string tempPath = config.metricsFile + ".tmp";
+    std::ofstream file(tempPath, std::ios::trunc);
+    file << formatMetrics();
+    file.close();
+    if (!file || rename(tempPath.c_str(), config.metricsFile.c_str()) < 0) {
+        LOG_ERROR("fail to write metrics file " << config.metricsFile);
+        unlink(tempPath.c_str());
+    }
+}
+
+/**
+ * @brief The metrics of the registry and of the server's caches, in the Prometheus text format.
+ */
+std::string TFTPServer::formatMetrics() {
+    std::string output;
+    TFTPMetrics::format(output);
+    TFTPFileCacheStats cache = fileCache.getStats();
+    TFTPMetrics::formatValue(output, "tftp_file_cache_lookups_total", "counter", "Files looked up in the file cache.", cache.lookups);
+    TFTPMetrics::formatValue(output, "tftp_file_cache_hits_total", "counter", "File cache lookups served by an existing mapping.", cache.hits);
+    TFTPMetrics::formatValue(output, "tftp_file_cache_hit_ratio", "gauge", "Share of the file cache lookups that were hits.",
+                             cache.lookups > 0 ? (double)cache.hits / cache.lookups : 0);
+    TFTPPacketCacheStats packets = packetCache.getStats();
+    TFTPMetrics::formatValue(output, "tftp_packet_cache_hits_total", "counter", "Reads sent from a prebuilt packet image.", packets.hits);
+    TFTPMetrics::formatValue(output, "tftp_packet_cache_builds_total", "counter", "Packet images built.", packets.builds);
+    TFTPMetrics::formatValue(output, "tftp_packet_cache_memory_bytes", "gauge", "Memory held by the packet images.", packets.memoryBytes);
+    return output;
+}
+
+/**
+ * @brief Apply the server wide session settings to a new session.
+ *
+ * @param session The session, before it is started.
+ */
+void TFTPServer::configureSession(TFTPSession& session) {
+    session.setRetransmitLimits(std::chrono::milliseconds(config.minRtoMs), std::chrono::milliseconds(config.maxRtoMs));
+    session.setZeroCopy(config.zeroCopy);
+    session.setFileCache(config.fileCacheMb > 0 ? &fileCache : nullptr);
+    session.setPacketCache(config.packetCacheMb > 0 ? &packetCache : nullptr);
+    session.setFileWriter(config.writeThreads > 0 ? &fileWriter : nullptr);
+    session.setFileCommitter(&fileCommitter);
+    session.setTraceDirectory(config.traceDirectory);
+}
+
+/**
+ * @brief Time an event loop may wait for socket events.
+ *
+ * Waits at most EVENT_LOOP_TICK_MS, and wakes up in time for the nearest session deadline.
+ *
+ * @param nextDeadline The nearest deadline of the loop's sessions.
+ * @return The wait timeout in milliseconds, rounded up.
+ */
+int TFTPServer::waitTimeoutMs(std::chrono::steady_clock::time_point nextDeadline) {
+    auto now = std::chrono::steady_clock::now();
+    if (nextDeadline <= now) {
+        return 0;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(nextDeadline - now).count();
+    return (int)std::min<int64_t>(EVENT_LOOP_TICK_MS, (remaining + 999) / 1000);
+}
+
+/**
+ * @brief Parse a request received on the listener socket.
+ *
+ * This function extracts the opcode and, for RRQ, WRQ and DELETE, the filename and the
+ * transfer mode, followed by the options of RRQ and WRQ (RFC 2347). Invalid requests
+ * are answered with an error packet.
+ *
+ * @param listenSocket The socket the request was received on, used for error replies.
+ * @param buffer The received request, null padded.
+ * @param bytesRead The size of the received request in bytes.
+ * @param clientAddress The client's address information.
+ * @param opcode Set to the opcode of the request.
+ * @param filename Set to the requested filename (empty for LS).
+ * @param options Set to the requested options.
+ * @return true if the request is valid and should be handled, false otherwise.
+ */
+bool TFTPServer::parseRequest(int listenSocket, const char* buffer, int bytesRead, struct sockaddr_in clientAddress, uint16_t& opcode, std::string& filename, TFTPOptions& options) {
+    // Extract the opcode from the received packet
+    opcode = (uint16_t)(((buffer[1] & 0xFF) << 8) | (buffer[0] & 0XFF));
+    opcode = ntohs(opcode);
+    LOG_DEBUG_EVENT(LOG_EVENT_REQUEST, opcode, clientAddress.sin_addr.s_addr, ntohs(clientAddress.sin_port));
+
+    // Handle the list files request
+    options.clear();
+    if (opcode == TFTP_OPCODE_LS) {
+        TFTPMetrics::add(METRIC_LS_REQUESTS);
+        filename.clear();
+        // Options selecting the files listed follow the empty byte ending the opcode
+        if (bytesRead > 3 && !TFTPPacket::parseOptions((const uint8_t*)buffer, bytesRead, 3, options)) {
+            const std::string errorMessage = "Malformed options";
+            sendError(listenSocket, ERROR_OPTION_NEGOTIATION, errorMessage, clientAddress);
+            return false;
+        }
+        return true;
+    }
+    // Handle RRQ, WRQ, or DELETE request
+    else if (opcode == TFTP_OPCODE_RRQ || opcode == TFTP_OPCODE_WRQ || opcode == TFTP_OPCODE_DELETE) {
+        TFTPMetrics::add(opcode == TFTP_OPCODE_RRQ ? METRIC_RRQ_REQUESTS : opcode == TFTP_OPCODE_WRQ ? METRIC_WRQ_REQUESTS : METRIC_DELETE_REQUESTS);
+        LOG_DEBUG("buffer read: " << buffer);
+        filename = std::string(buffer + 2);
+        LOG_DEBUG("filename:" << filename);
+           
+        std::string mode(buffer + 2 + filename.length() + 1);
+        LOG_DEBUG("mode:" << mode);
+        for (int i = 0; mode[i] != '\0'; i++) {
+            mode[i] = std::tolower(mode[i]);
+        }
+
+        // Check if the mode is "octet"
+        if (mode != "octet"){
+            const std::string errorMessage = "Illegal TFTP operation";
+            sendError(listenSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+            return false;
+        }
+
+        // Options follow the mode string
+        size_t optionsOffset = 2 + filename.length() + 1 + mode.length() + 1;
+        if (opcode != TFTP_OPCODE_DELETE && optionsOffset < (size_t)bytesRead &&
+            !TFTPPacket::parseOptions((const uint8_t*)buffer, bytesRead, optionsOffset, options)) {
+            const std::string errorMessage = "Malformed options";
+            sendError(listenSocket, ERROR_OPTION_NEGOTIATION, errorMessage, clientAddress);
+            return false;
+        }
+        return true;
     }
     else {
-        std::cerr << "Error Occured. Force shutdown server" << std::endl;
+        // Incorrect opcode received
+        TFTPMetrics::add(METRIC_INVALID_REQUESTS);
+        LOG_WARN("Incorrect opcode recieved");
+        const std::string errorMessage = "Illegal TFTP operation";
+        sendError(listenSocket, ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+        return false;
     }
-    std::cerr << "All threads joined" << std::endl;
-    destroyThread.join();
-    std::cerr << "destroy threads thread joined" << std::endl;
-    std::cerr << "Server shut down process completed" << std::endl;
-    
-    // Terminate the server process
-    kill(getpid(),SIGTERM);
+}
+
+/**
+ * @brief Create the socket used for a single transfer.
+ *
+ * The socket is bound to a port chosen by the kernel, which serves as the server's
+ * transfer ID (TID) for the session.
+ *
+ * @return The bound socket, or -1 on failure.
+ */
+int TFTPServer::createSessionSocket() {
+    int sessionSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sessionSocket < 0) {
+        LOG_ERROR("Error creating session socket");
+        return -1;
+    }
+    struct sockaddr_in sessionAddress;
+    memset(&sessionAddress, 0, sizeof(sessionAddress));
+    sessionAddress.sin_family = AF_INET;
+    sessionAddress.sin_port = htons(0);
+    sessionAddress.sin_addr.s_addr = inet_addr("127.0.0.1");   // INADDR_ANY;
+    if (bind(sessionSocket, (struct sockaddr*)&sessionAddress, sizeof(sessionAddress)) < 0) {
+        LOG_ERROR("Error binding server socket");
+        close(sessionSocket);
+        return -1;
+    }
+    socklen_t sessionAddressLen = sizeof(sessionAddress);
+    getsockname(sessionSocket, (struct sockaddr*)&sessionAddress, &sessionAddressLen);
+    LOG_DEBUG_EVENT(LOG_EVENT_SESSION_PORT, ntohs(sessionAddress.sin_port));
+    return sessionSocket;
 }
 
 /**
@@ -618,79 +1333,138 @@ TFTPServer* TFTPServer::staticInstance = nullptr;
 
 
 /**
- * @brief Initialize the file map with filenames and initial reader count.
+ * @brief Initialize the file index with filenames and initial reader count.
  *
- * This method populates the provided map with filenames from a specified directory
- * and initializes the associated reader count to zero.
+ * The index is loaded from the snapshot saved at the last shutdown if the database
+ * directory was not changed since, otherwise the directory is scanned and a new
+ * snapshot is saved, so the next start does not scan it again.
  *
- * @param files The map to be initialized with filenames and initial reader count.
+ * @param files The index to be initialized with filenames and initial reader count.
  */
-void TFTPServer::initializeFileMap(std::map<std::string, int>& files) {
-    // Specify the directory path where files are located
-    std::string directoryPath = "serverDatabase";
-    std::cerr << "Initializing files in the File Map" << std::endl;
+void TFTPServer::initializeFileMap(TFTPFileIndex& files) {
+    LOG_INFO("Initializing files in the File Map");
+    struct timespec version;
+    bool versioned = getDatabaseVersion(version);
+    if (versioned && files.load(FILE_INDEX_SNAPSHOT, version)) {
+        LOG_INFO("Loaded " << files.size() << " files in the index from " << FILE_INDEX_SNAPSHOT);
+        return;
+    }
+    scanFileIndex(files);
+    if (versioned && !files.save(FILE_INDEX_SNAPSHOT, version)) {
+        LOG_ERROR("fail to save " << FILE_INDEX_SNAPSHOT);
+    }
+    LOG_INFO("Initialized " << files.size() << " files in the index");
+}
 
-    // Iterate over the files in the specified directory
-    for (const auto& entry : fs::directory_iterator(directoryPath)) {
-        if (entry.is_regular_file()) {
-            // Insert the filename into the map with an initial reader count of 0
-            files.insert(std::make_pair(entry.path().filename().string(), 0));
+/**
+ * @brief Create the directory the uploads are received in, and remove the uploads a
+ * crash left unfinished in it.
+ */
+void TFTPServer::prepareUploadDirectory() {
+    if (mkdir(SESSION_UPLOAD_DIRECTORY, 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR("fail to create " << SESSION_UPLOAD_DIRECTORY << ": " << strerror(errno));
+        return;
+    }
+    int removed = 0;
+    try {
+        for (const auto& entry : fs::directory_iterator(SESSION_UPLOAD_DIRECTORY)) {
+            if (unlink(entry.path().c_str()) == 0) {
+                removed++;
+            }
         }
+    } catch (const std::exception& e) {
+        LOG_ERROR("fail to scan " << SESSION_UPLOAD_DIRECTORY << ": " << e.what());
     }
-    std::cerr << "Initialized files in the map" << std::endl;
-    
-    // Display the initialized files and their reader counts
-    for (const auto& pair : files) {
-        std::cerr << "FILE NAME: " << pair.first << ", READERS: " << pair.second << std::endl;
+    if (removed > 0) {
+        LOG_INFO("Removed " << removed << " unfinished uploads");
     }
 }
 
+/**
+ * @brief Bring the file index in line with the database directory.
+ *
+ * Files found in the directory are added with no readers or get their size and
+ * modification time updated, indexed files missing from it are dropped.
+ *
+ * @param files The index of the files on the server and their readers.
+ */
+void TFTPServer::scanFileIndex(TFTPFileIndex& files) {
+    std::map<std::string, struct stat> found;
+    try {
+        for (const auto& entry : fs::directory_iterator(SERVER_DATABASE)) {
+            struct stat fileStat;
+            if (stat(entry.path().c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+                found[entry.path().filename().string()] = fileStat;
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("fail to scan " << SERVER_DATABASE << ": " << e.what());
+        return;
+    }
+    for (const auto& file : found) {
+        files.insert(file.first, file.second.st_size, file.second.st_mtim);
+    }
+    for (const TFTPFileInfo& file : files.snapshot()) {
+        if (found.count(file.name) == 0) {
+            files.erase(file.name);
+        }
+    }
+}
 
 /**
- * @brief Check if a file exists in the server database.
+ * @brief Apply a change of a database file reported by the file watcher.
  *
- * This function checks whether the specified filename exists in the provided map.
+ * The file is indexed with its size and modification time if it is on disk, dropped
+ * otherwise, and its cached mapping and packets are dropped either way.
  *
- * @param filename The name of the file to check.
- * @param files The map containing filenames and associated reader counts.
- * @return True if the file exists, false otherwise.
+ * @param filename The name of the changed file.
  */
-bool TFTPServer::fileExists(const std::string& filename, std::map<std::string, int>& files) {
-    auto it = files.find(filename);
-    if(it != files.end()) {
-        std::cerr << filename << " exists in the server database" << std::endl;
-        return true;
+void TFTPServer::handleFileEvent(const std::string& filename) {
+    std::string filePath = std::string(SERVER_DATABASE) + "/" + filename;
+    struct stat fileStat;
+    if (stat(filePath.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+        files.insert(filename, fileStat.st_size, fileStat.st_mtim);
     }
     else {
-        std::cerr << filename << " does not exists in the server database" << std::endl;
-        return false;
+        files.erase(filename);
     }
+    fileCache.invalidate(filePath);
+    packetCache.invalidate(filePath);
 }
 
 /**
- * @brief Check if a file can be deleted based on its existence and active readers.
+ * @brief Get the version of the database directory, which changes whenever a file is
+ * added to it or removed from it.
  *
- * This function checks whether the specified filename exists in the provided map
- * and if it has no active readers (reader count is zero).
- *
- * @param filename The name of the file to check for deletion.
- * @param files The map containing filenames and associated reader counts.
- * @return True if the file can be deleted, false otherwise.
+ * @param version Set to the modification time of the directory.
+ * @return true on success.
  */
-bool TFTPServer::canDelete(const std::string& filename, std::map<std::string, int>& files) {
-    auto it = files.find(filename);
-    if(it == files.end()) {
-        std::cerr << filename << " does not exists in the server database" << std::endl;
+bool TFTPServer::getDatabaseVersion(struct timespec& version) {
+    struct stat directoryStat;
+    if (stat(SERVER_DATABASE, &directoryStat) < 0) {
+        LOG_ERROR("fail to stat " << SERVER_DATABASE << ": " << strerror(errno));
         return false;
     }
+    version = directoryStat.st_mtim;
+    return true;
+}
 
-    if (files[filename] == 0){
-        std::cerr << filename << " has no active readers" << std::endl;
-        return true;
+/**
+ * @brief Stop the file watcher and save the file index for the next start, if the
+ * watcher kept it up to date.
+ *
+ * The version is taken before the watcher delivers its last changes, so a change made
+ * after them leaves the snapshot stale and the next start scans the directory.
+ */
+void TFTPServer::persistFileIndex() {
+    struct timespec version;
+    bool versioned = getDatabaseVersion(version);
+    if (!fileWatcher.stop()) {
+        // Changes made behind the server's back are not in the index
+        return;
     }
-    else {
-        std::cerr << filename << " has active readers. Can not delete." << std::endl;
-        return false;
+    if (versioned && !files.save(FILE_INDEX_SNAPSHOT, version)) {
+        LOG_ERROR("fail to save " << FILE_INDEX_SNAPSHOT);
     }
 }
 
@@ -704,45 +1478,47 @@ bool TFTPServer::canDelete(const std::string& filename, std::map<std::string, in
  * @param filename The name of the file to be deleted.
  * @param clientAddress The client's address information.
  * @param clientId The unique identifier for the client.
- * @param files The map containing filenames and associated reader counts.
+ * @param files The index of the files on the server and their readers.
  */
-void TFTPServer::handleDeleteRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, std::map<std::string, int>& files) {
-    // Check if the file exists in the server's database
-    if (!fileExists(filename, files)){
-        // send error regarding file not exists.
-        const std::string errorMessage = "File not found";
-        sendError(clientSocket, ERROR_FILE_NOT_FOUND, errorMessage, clientAddress);
-        return;
+void TFTPServer::handleDeleteRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, TFTPFileIndex& files) {
+    std::string directory = "serverDatabase/";
+    std::string filePath = directory + filename;
+    // The file is removed from disk with its index shard locked, so it cannot gain a reader meanwhile
+    int result = files.remove(filename, [this, &filePath]() {
+        try {
+            // Check if the file exists before attempting to delete
+            if (!fs::exists(filePath)) {
+                return false;
+            }
+            fs::remove(filePath);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Error: " << e.what());
+            return false;
+        }
+        fileCache.invalidate(filePath);
+        packetCache.invalidate(filePath);
+        return true;
+    });
+    if (result == FILE_INDEX_REMOVED) {
+        std::cout << "File deleted successfully.\n";
+        // send ack that file deleted succesfully.
+        sendACK(clientSocket, ACK_OK, clientAddress);
     }
-    else if (!canDelete(filename, files)) {
+    else if (result == FILE_INDEX_BUSY) {
         // Send an error packet (File has active readers - Error Code 0, Not defined in RFC)
-        //send error regarding active readers. cannot delete file.
+        LOG_WARN(filename << " has active readers. Can not delete.");
         const std::string errorMessage = "File has active readers. Cannot delete file.";
         sendError(clientSocket, ERROR_NOT_DEFINED, errorMessage, clientAddress);
-        return;
     }
-    std::string directory = "serverDatabase/";
-    std::string filePath = directory + filename;
-    try {
-        // Check if the file exists before attempting to delete
-        if (fs::exists(filePath)) {
-            fs::remove(filePath);
-            std::cout << "File deleted successfully.\n";
-            auto it = files.find(filename);
-            files.erase(it);
-            // send ack that file deleted succesfully.
-            sendACK(clientSocket, ACK_OK, clientAddress);
-            return;
-        } else {
-            const std::string errorMessage = "File not found";
-            sendError(clientSocket, ERROR_FILE_NOT_FOUND, errorMessage, clientAddress);
-            return;
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+    else if (result == FILE_INDEX_NOT_FOUND || !fs::exists(filePath)) {
+        // send error regarding file not exists.
+        LOG_WARN(filename << " does not exists in the server database");
+        const std::string errorMessage = "File not found";
+        sendError(clientSocket, ERROR_FILE_NOT_FOUND, errorMessage, clientAddress);
+    }
+    else {
         const std::string errorMessage = "Exception Occured. cannot delete file";
         sendError(clientSocket, ERROR_NOT_DEFINED, errorMessage, clientAddress);
-        return;
     }
 }
 
@@ -750,108 +1526,164 @@ void TFTPServer::handleDeleteRequest(int clientSocket, const std::string& filena
 /**
  * @brief Handle the LS request from the client.
  *
- * This function processes the client's request to list files and active readers.
+ * This function processes the client's request to list files and active readers
+ * by driving an LS session on the client thread.
  *
  * @param clientSocket The socket connected to the client.
+ * @param options The options selecting and ordering the listed files.
  * @param clientAddress The client's address information.
  * @param clientId The unique identifier for the client.
- * @param files The map containing filenames and associated reader counts.
- */
-void TFTPServer::handleLSRequest(int clientSocket, struct sockaddr_in clientAddress,  int clientId, std::map<std::string, int>& files) {
-    // Create a file to store the list of files and their reader counts
-    std::string filepath = "serverDatabase/ls.txt";
-    std::ofstream outputFile(filepath, std::ios::binary);
-    if (!outputFile) {
-        std::cerr << "Error creating the file." << std::endl;
-        return;
-    }
+ * @param files The index of the files on the server and their readers.
+ */
+void TFTPServer::handleLSRequest(int clientSocket, const TFTPOptions& options, struct sockaddr_in clientAddress,  int clientId, TFTPFileIndex& files) {
+    std::unique_ptr<TFTPIOEngine> engine(TFTPIOEngine::create(config.ioBackend));
+    TFTPSession session(*engine, clientSocket, clientId, TFTP_OPCODE_LS, "", options, clientAddress, files);
+    configureSession(session);
+    runSession(session, *engine);
+}
 
-    // Write file information to the ls.txt file
-    for (const auto& pair : files) {
-        outputFile << pair.first << "\t [Active Readers] : " << pair.second << "\n";
-    }
-    outputFile.close();
-    std::cerr << "[LOG] << ls.txt created and updated successfully." << std::endl;
-    uint16_t blockNumber = 1;
-    int retry = MAX_RETRY;
-    std::ifstream file(filepath, std::ios::binary);
-    // Continue sending data blocks until the file is fully transmitted
-    while (retry)
-    {
-        char dataBuffer[512];
-        uint8_t packet[516];
-        memset(packet, 0, sizeof(packet));
-        memset(dataBuffer, 0, 512);
-        size_t dataSize = file.gcount();
-        dataSize = TFTPPacket::readDataBlock(filepath, blockNumber, dataBuffer, dataSize);
-        std::cerr << "data of size: " << dataSize << " read successfully. " << dataBuffer << std::endl;
-        if (dataSize == 0) {
-                std::cerr << "datasize = 0" << std::endl;
-                break; // End of file
-        }
-
-        // Create a data packet with file information
-        std::cerr << "Data Size: " << dataSize << std::endl;
-        TFTPPacket::createDataPacket(packet, blockNumber, dataBuffer, dataSize);
-        std::cerr << "Data packet created" << std::endl;
-
-        // Send the data packet to the client
-        if (sendto(clientSocket, packet, dataSize + 4, 0, (struct sockaddr*)&clientAddress, sizeof(clientAddress)) < 0) {
-            std::cerr << "[ERROR] : fail to send Data packet" << std::endl;
-            return;
-        }
-        std::cerr << "[LOG] : Data packet send to client " << clientAddress.sin_addr.s_addr << std::endl;
-        char ackBuffer[4];
-
-        // Wait for acknowledgment from the client
-        int ackSize = recvfrom(clientSocket, ackBuffer, sizeof(ackBuffer), 0, nullptr, nullptr);
-        if (ackSize < 0) {
-            std::cerr << "TIMEOUT Occured" << std::endl;
-            retry--;
-            continue;
+int main(int argc, char* argv[]) {
+    TFTPServerConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--io" && i + 1 < argc) {
+            std::string backend = argv[++i];
+            if (backend == "syscall") {
+                config.ioBackend = IO_BACKEND_SYSCALL;
+            }
+            else if (backend == "io_uring") {
+                config.ioBackend = IO_BACKEND_IO_URING;
+            }
+            else {
+                std::cerr << "[ERROR] TFTP Server : Invalid I/O backend { syscall | io_uring }" << std::endl;
+                exit(1);
+            }
         }
-        else if (ackSize > MAX_PACKET_SIZE) {
-            std::cerr << "Invalid acknowledgment received" << std::endl;
-            const std::string errorMessage = "Illegal TFTP operation";
-            sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, clientAddress);
-            break;
+        else if (arg == "--mode" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "thread") {
+                config.serverMode = SERVER_MODE_THREAD;
+            }
+            else if (mode == "epoll") {
+                config.serverMode = SERVER_MODE_EVENT_LOOP;
+            }
+            else if (mode == "pool") {
+                config.serverMode = SERVER_MODE_WORKER_POOL;
+            }
+            else {
+                std::cerr << "[ERROR] TFTP Server : Invalid mode { thread | epoll | pool }" << std::endl;
+                exit(1);
+            }
         }
-        else {
-            retry = MAX_RETRY;
-        }
-        std::cerr << "Acknoledment recieved" <<std::endl;
-        // Check the received acknowledgment packet (Opcode 4)
-        uint16_t ackOpcode = (ackBuffer[0] << 8) | ackBuffer[1];
-        uint16_t ackBlockNumber = (ackBuffer[2] << 8) | ackBuffer[3];
-        if (ackOpcode != 4 || ackBlockNumber != blockNumber) {
-            std::cerr << "Invalid acknowledgment received" << std::endl;
-            // const std::string errorMessage = "Illegal TFTP operation";
-            // sendError(clientSocket, ERROR_ACCESS_VIOLATION, errorMessage, clientAddress);
-            continue;
+        else if (arg == "--listeners" && i + 1 < argc) {
+            config.listenerCount = atoi(argv[++i]);
+            if (config.listenerCount < 1) {
+                std::cerr << "[ERROR] TFTP Server : Invalid number of listeners" << std::endl;
+                exit(1);
+            }
         }
-        std::cerr<< "Correct ACK packet recieved for blocknumber: " << ackBlockNumber << std::endl;
-
-        if(dataSize < 512) {
-            break;
+        else if (arg == "--rto-min" && i + 1 < argc) {
+            config.minRtoMs = atoi(argv[++i]);
+            if (config.minRtoMs < 1) {
+                std::cerr << "[ERROR] TFTP Server : Invalid minimum retransmission timeout" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--rto-max" && i + 1 < argc) {
+            config.maxRtoMs = atoi(argv[++i]);
+            if (config.maxRtoMs < 1) {
+                std::cerr << "[ERROR] TFTP Server : Invalid maximum retransmission timeout" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--cache-mb" && i + 1 < argc) {
+            config.fileCacheMb = atoi(argv[++i]);
+            if (config.fileCacheMb < 0) {
+                std::cerr << "[ERROR] TFTP Server : Invalid file cache size" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--packet-cache-mb" && i + 1 < argc) {
+            config.packetCacheMb = atoi(argv[++i]);
+            if (config.packetCacheMb < 0) {
+                std::cerr << "[ERROR] TFTP Server : Invalid packet cache size" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--hot-reads" && i + 1 < argc) {
+            config.hotReads = atoi(argv[++i]);
+            if (config.hotReads < 0) {
+                std::cerr << "[ERROR] TFTP Server : Invalid number of hot reads" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--hot-file" && i + 1 < argc) {
+            config.hotFiles.push_back(argv[++i]);
+        }
+        else if (arg == "--write-threads" && i + 1 < argc) {
+            config.writeThreads = atoi(argv[++i]);
+            if (config.writeThreads < 0) {
+                std::cerr << "[ERROR] TFTP Server : Invalid number of write threads" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--zerocopy") {
+            config.zeroCopy = true;
+        }
+        else if (arg == "--log-level" && i + 1 < argc) {
+            int level = TFTPLogger::parseLevel(argv[++i]);
+            if (level < 0) {
+                std::cerr << "[ERROR] TFTP Server : Invalid log level { debug | info | warn | error }" << std::endl;
+                exit(1);
+            }
+            TFTPLogger::setLevel(level);
+        }
+        else if (arg == "--metrics-socket" && i + 1 < argc) {
+            config.metricsSocket = argv[++i];
+        }
+        else if (arg == "--metrics-file" && i + 1 < argc) {
+            config.metricsFile = argv[++i];
+        }
+        else if (arg == "--metrics-interval" && i + 1 < argc) {
+            config.metricsIntervalSeconds = atoi(argv[++i]);
+            if (config.metricsIntervalSeconds < 1) {
+                std::cerr << "[ERROR] TFTP Server : Invalid metrics interval" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--log-binary" && i + 1 < argc) {
+            std::string path = argv[++i];
+            if (!TFTPLogger::setBinaryOutput(path)) {
+                std::cerr << "[ERROR] TFTP Server : Cannot create binary log " << path << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            config.traceDirectory = argv[++i];
+            if (!fs::is_directory(config.traceDirectory)) {
+                std::cerr << "[ERROR] TFTP Server : Trace directory " << config.traceDirectory << " does not exist" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            config.workerCount = atoi(argv[++i]);
+            if (config.workerCount < 1) {
+                std::cerr << "[ERROR] TFTP Server : Invalid number of workers" << std::endl;
+                exit(1);
+            }
+        }
+        else {
+            std::cout << "Usage: " << argv[0] << " [--mode thread|epoll|pool] [--workers N] [--listeners N] [--io syscall|io_uring] [--rto-min MS] [--rto-max MS] [--zerocopy] [--cache-mb MB]"
+                      << " [--packet-cache-mb MB] [--hot-reads N] [--hot-file NAME]... [--write-threads N] [--log-level debug|info|warn|error] [--log-binary FILE]"
+                      << " [--metrics-socket PATH] [--metrics-file PATH] [--metrics-interval S] [--trace DIR]" << std::endl;
+            exit(1);
         }
-
-        ++blockNumber;
-    
-    }
-    if (!retry)
-    {
-        std::cerr << "Max retry for receiving timeout exceeded. Shutting down server" << std::endl;
     }
-
-}
-
-int main() {
     std :: cout << "starting the server" << std::endl;
-    TFTPServer server(54534);
+    TFTPServer server(54534, config);
     TFTPServer::getStaticInstance() = &server;
     std :: cout << "initialized the server" << std::endl;
     server.start();
     std :: cout << "server is started" << std::endl;
     return 0;
 }
-
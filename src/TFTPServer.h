@@ -10,40 +10,164 @@
 #include <chrono>
 #include <signal.h>
 #include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
 #include "TFTPPacket.h"
+#include "TFTPSession.h"
+#include "TFTPIOEngine.h"
+#include "TFTPEventLoop.h"
+#include "TFTPTimerWheel.h"
+#include "TFTPFileCache.h"
+#include "TFTPPacketCache.h"
+#include "TFTPFileIndex.h"
+#include "TFTPFileWatcher.h"
+#include "TFTPFileWriter.h"
+#include "TFTPFileCommitter.h"
 
 #define DESTROY_SERVER false
 #define MAX_RETRY   5
 #define DEFAULT_SLEEP_TIME 30
+#define SERVER_DATABASE         "serverDatabase"
+#define FILE_INDEX_SNAPSHOT     "serverDatabase.index"  // names of the served files, saved at shutdown
+
+/* Server Modes */
+#define SERVER_MODE_THREAD      0   // one blocking thread per request
+#define SERVER_MODE_EVENT_LOOP  1   // epoll event loop multiplexing all sessions
+#define SERVER_MODE_WORKER_POOL 2   // epoll dispatcher feeding session steps to a worker pool
+
+#define LISTENER_BATCH_SIZE             32  // requests taken per recvmmsg on the listener
+#define LISTENER_BUFFER_SIZE            1024
+#define SESSION_RECV_BATCH_SIZE         8   // datagrams taken per recvmmsg on a session socket
+#define BATCH_STATS_INTERVAL_SECONDS    10
+#define METRICS_DEFAULT_INTERVAL_SECONDS 10 // between two dumps of the metrics file
+#define METRICS_POLL_MS                 100 // how long the exporter waits for a connection before checking for shutdown
+
+/* Session steps run by the worker pool */
+#define SESSION_STEP_START      0
+#define SESSION_STEP_RECEIVE    1
+#define SESSION_STEP_TIMEOUT    2
 
 namespace fs = std::filesystem;
 
+struct TFTPServerConfig {
+    int serverMode = SERVER_MODE_WORKER_POOL;
+    int ioBackend = IO_BACKEND_SYSCALL;
+    int workerCount = 0;    // 0 = one worker per core
+    int listenerCount = 1;  // SO_REUSEPORT listener sockets, each with its own dispatch loop
+    int minRtoMs = RTO_DEFAULT_MIN_MS;  // bounds of the adaptive retransmission timeout
+    int maxRtoMs = RTO_DEFAULT_MAX_MS;
+    bool zeroCopy = false;  // MSG_ZEROCOPY sends of large read blocks
+    // Mappings kept for idle files, 0 maps files per session. Reads are served from shared
+    // mappings either way: a file truncated by another tool while it is read ends the
+    // transfer with an error, the prebuilt packets copy it under TFTPMappingGuard.
+    int fileCacheMb = FILE_CACHE_DEFAULT_MB;
+    int packetCacheMb = PACKET_CACHE_DEFAULT_MB;    // prebuilt DATA packets of hot files, 0 disables them
+    int hotReads = PACKET_CACHE_HOT_READS;      // reads that make a file hot, 0 for the pinned files only
+    std::vector<std::string> hotFiles;          // files whose packets are prebuilt from their first read
+    int writeThreads = WRITE_BEHIND_DEFAULT_THREADS;    // threads writing uploads behind their sessions, 0 writes them in the session
+    std::string metricsSocket;  // Unix domain socket answering every connection with the metrics, empty for none
+    std::string metricsFile;    // file the metrics are dumped to periodically, empty for none
+    int metricsIntervalSeconds = METRICS_DEFAULT_INTERVAL_SECONDS;
+    std::string traceDirectory; // every transfer writes its per block trace here, empty for none
+};
+
+/**
+ * @brief Requests received on the listener with one recvmmsg, and the batching counters.
+ */
+struct TFTPRequestBatch {
+    char buffers[LISTENER_BATCH_SIZE][LISTENER_BUFFER_SIZE];
+    int sizes[LISTENER_BATCH_SIZE];
+    struct sockaddr_in addresses[LISTENER_BATCH_SIZE];
+    uint64_t receiveCalls = 0;
+    uint64_t requests = 0;
+};
+
+/**
+ * @brief A session driven by the worker pool.
+ *
+ * The mutex serializes the steps of the session, which may run on any worker.
+ * finished and deadline are published after every step for the dispatcher.
+ */
+struct TFTPPooledSession {
+    std::unique_ptr<TFTPSession> session;
+    std::mutex mutex;
+    bool started = false;       // the START step has run, guarded by mutex
+    std::atomic<bool> finished{false};
+    std::atomic<bool> timeoutQueued{false};
+    std::atomic<std::chrono::steady_clock::time_point> deadline;
+    ~TFTPPooledSession();
+};
+
+/**
+ * @brief Sessions whose deadline changed or that finished, reported by the pool workers
+ * so the dispatcher can update its timer wheel.
+ */
+struct TFTPTimerUpdates {
+    std::mutex mutex;
+    std::vector<int> sockets;
+};
+
 class TFTPServer {
 public:
     TFTPServer(int port);
-    static TFTPServer*& getStaticInstance(); 
+    TFTPServer(int port, const TFTPServerConfig& config);
+    static TFTPServer*& getStaticInstance();
     void start();
 private:
     int port;
     int serverSocket;
     struct sockaddr_in serverAddress;
+    TFTPServerConfig config;
     static void destroyTFTPHandler(int signo, siginfo_t* info, void* context);
-    void handleReadRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, std::map<std::string, int>& files);
+    void handleReadRequest(int clientSocket, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress,  int clientId, TFTPFileIndex& files);
     void sendACK(int clientSocket, uint16_t blockNumber, struct sockaddr_in clientAddress);
-    void handleWriteRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, std::map<std::string, int>& files);
+    void handleWriteRequest(int clientSocket, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress,  int clientId, TFTPFileIndex& files);
     void sendError(int clientSocket, uint16_t errorCode, const std::string& errorMsg, struct sockaddr_in clientAddress);
-    void handleClientThread(int serverThreadSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, uint16_t opcode, std::map<int, std::tuple<std::thread, bool>>& clientThreads, std::map<std::string, int>& files);
+    void handleClientThread(int serverThreadSocket, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress,  int clientId, uint16_t opcode, std::map<int, std::tuple<std::thread, bool>>& clientThreads, TFTPFileIndex& files);
     void destroyClientThreads(std::map<int, std::tuple<std::thread, bool>>& clientThreads);
-    void handleDeleteRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, std::map<std::string, int>& files);
-    void handleLSRequest(int clientSocket, struct sockaddr_in clientAddress,  int clientId, std::map<std::string, int>& files);
+    void handleDeleteRequest(int clientSocket, const std::string& filename, struct sockaddr_in clientAddress,  int clientId, TFTPFileIndex& files);
+    void handleLSRequest(int clientSocket, const TFTPOptions& options, struct sockaddr_in clientAddress,  int clientId, TFTPFileIndex& files);
+    void runSession(TFTPSession& session, TFTPIOEngine& engine);
+    void runThreadModel();
+    void runEventLoop(int listenSocket);
+    void runWorkerPool(int listenSocket, int core = -1);
+    void runSessionStep(TFTPPooledSession& pooled, int step, TFTPIOEngine& engine, TFTPEventLoop& eventLoop, TFTPTimerUpdates& updates);
+    bool parseRequest(int listenSocket, const char* buffer, int bytesRead, struct sockaddr_in clientAddress, uint16_t& opcode, std::string& filename, TFTPOptions& options);
+    int createSessionSocket();
+    int createListenerSocket();
+    int receiveRequests(int listenSocket, TFTPRequestBatch& requests, int flags);
+    void configureSession(TFTPSession& session);
+    int waitTimeoutMs(std::chrono::steady_clock::time_point nextDeadline);
+    void logBatchStats(const TFTPRequestBatch& requests, const std::vector<TFTPIOEngine*>& engines, std::chrono::steady_clock::time_point& lastLog);
+    void runListenerShards();
+    void pinThreadToCore(int core);
     void destroyTFTP(int signum, siginfo_t* info, void* ptr);
-    bool fileExists(const std::string& filename, std::map<std::string, int>& files);
-    bool canDelete(const std::string& filename, std::map<std::string, int>& files);
-    void initializeFileMap(std::map<std::string, int>& files);
+    void prepareUploadDirectory();
+    void initializeFileMap(TFTPFileIndex& files);
+    void scanFileIndex(TFTPFileIndex& files);
+    void handleFileEvent(const std::string& filename);
+    bool getDatabaseVersion(struct timespec& version);
+    void persistFileIndex();
+    void startMetricsExporter();
+    void runMetricsExporter(int metricsSocket);
+    void writeMetricsFile();
+    std::string formatMetrics();
     std::map<int, std::tuple<std::thread, bool>> clientThreads;
-    std::map<std::string, int> files;
-    int nextClientId;
-    bool destroyTFTPServer;
+    std::vector<int> completedClientThreads;    // completed, not joined yet
+    std::mutex clientThreadsMutex;
+    std::condition_variable clientThreadsChanged;
+    TFTPFileIndex files;
+    TFTPFileCache fileCache;
+    TFTPPacketCache packetCache;
+    TFTPFileWriter fileWriter;
+    TFTPFileCommitter fileCommitter;    // syncs finished uploads and renames them into the database
+    TFTPFileWatcher fileWatcher;    // keeps the index up to date with the database
+    std::atomic<int> nextClientId;
+    std::atomic<bool> destroyTFTPServer;
+    std::thread metricsThread;
+    std::atomic<bool> metricsStopping;
     static TFTPServer* staticInstance;
 };
 
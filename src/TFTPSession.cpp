@@ -0,0 +1,1063 @@
+#include "TFTPSession.h"
+#include "TFTPLogger.h"
+#include "TFTPMetrics.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <limits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/errqueue.h>
+
+/**
+ * @brief Constructor for the TFTPSession class.
+ *
+ * @param engine The I/O engine on which the session queues its file and socket I/O.
+ * @param sessionSocket The socket used for communication with the TFTP client.
+ * @param clientId The unique identifier for the client.
+ * @param opcode The request opcode (RRQ, WRQ or LS).
+ * @param filename The requested filename (empty for LS).
+ * @param options The options the client requested (RFC 2347).
+ * @param clientAddress The client's address information.
+ * @param files The index of the files on the server and their readers.
+ */
+TFTPSession::TFTPSession(TFTPIOEngine& engine, int sessionSocket, int clientId, uint16_t opcode, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress, TFTPFileIndex& files)
+    : engine(&engine), sessionSocket(sessionSocket), clientId(clientId), opcode(opcode), filename(filename),
+      requestedOptions(options), blockSize(DEFAULT_BLOCK_SIZE), windowSize(1), clientAddress(clientAddress), files(files), state(SESSION_STATE_SENDING),
+      activeReader(false), blockIndex(0), windowStart(0), nextBlock(0), lastBlock(0), receivedInWindow(0), windowResent(false), fileFd(-1), fileSize(0), fileMap(nullptr), fileCache(nullptr), packetCache(nullptr), fileWriter(nullptr), fileCommitter(nullptr), zeroCopyAllowed(false), zeroCopy(false), zeroCopySends(0), zeroCopyCopied(0),
+      packetSize(0), packetSendCount(0), announcedSize(0), started(false) {
+    filePath = "serverDatabase/" + filename;
+    memset(packet, 0, sizeof(packet));
+    lastProgress = std::chrono::steady_clock::now();
+    resetDeadline();
+}
+
+/**
+ * @brief Destructor for the TFTPSession class.
+ *
+ * Releases the reader count and open file of a session that was dropped before finishing.
+ * Must not run while I/O of the session is still queued on the engine. The file mapping
+ * (or the reference to the cached one) is kept until now, blocks queued before the
+ * session finished are sent from it.
+ */
+TFTPSession::~TFTPSession() {
+    finish();
+    if (fileMap != nullptr && !cachedFile && !listing) {
+        munmap(const_cast<uint8_t*>(fileMap), fileSize);
+    }
+}
+
+/**
+ * @brief Queue the I/O of the following steps on another engine.
+ *
+ * Used when the next step runs on a different thread than the previous one.
+ * Nothing may be left queued on the previous engine.
+ *
+ * @param engine The I/O engine of the thread running the next step.
+ */
+void TFTPSession::setEngine(TFTPIOEngine& engine) {
+    this->engine = &engine;
+}
+
+/**
+ * @brief Set the bounds of the adaptive retransmission timeout.
+ *
+ * @param minimum The smallest retransmission timeout.
+ * @param maximum The largest retransmission timeout, where the backoff stops.
+ */
+void TFTPSession::setRetransmitLimits(std::chrono::microseconds minimum, std::chrono::microseconds maximum) {
+    retransmitTimer.setLimits(minimum, maximum);
+    resetDeadline();
+}
+
+/**
+ * @brief Share the mappings of the files read with the other sessions of the server.
+ *
+ * @param fileCache The server's file cache, nullptr to map files per session.
+ */
+void TFTPSession::setFileCache(TFTPFileCache* fileCache) {
+    this->fileCache = fileCache;
+}
+
+/**
+ * @brief Send the prebuilt packets of the hot files. Only used with a file cache.
+ *
+ * @param packetCache The server's packet cache, nullptr to format every block.
+ */
+void TFTPSession::setPacketCache(TFTPPacketCache* packetCache) {
+    this->packetCache = packetCache;
+}
+
+/**
+ * @brief Write uploads behind the session in large buffers.
+ *
+ * @param fileWriter The server's file writer, nullptr to write every block through the engine.
+ */
+void TFTPSession::setFileWriter(TFTPFileWriter* fileWriter) {
+    this->fileWriter = fileWriter;
+}
+
+/**
+ * @brief Sync and publish uploads with a shared file committer.
+ *
+ * Without one, an upload is renamed to its name as soon as it is written, without
+ * waiting for the disk.
+ *
+ * @param fileCommitter The committer, or nullptr.
+ */
+void TFTPSession::setFileCommitter(TFTPFileCommitter* fileCommitter) {
+    this->fileCommitter = fileCommitter;
+}
+
+/**
+ * @brief Allow sending the blocks of a read with MSG_ZEROCOPY.
+ *
+ * Only used for blksize from SESSION_ZEROCOPY_MIN_BLOCK_SIZE up, below it pinning the
+ * pages and reporting completions costs more than the copy it saves. The owner of the
+ * socket must call reapSendCompletions() whenever the socket is ready.
+ *
+ * @param enabled Whether zero-copy sends are allowed.
+ */
+void TFTPSession::setZeroCopy(bool enabled) {
+    zeroCopyAllowed = enabled;
+}
+
+/**
+ * @brief Trace the transfer and write its breakdown to a directory once it is finished.
+ *
+ * @param directory The directory, the trace is named after the client id. Empty to not trace.
+ */
+void TFTPSession::setTraceDirectory(const std::string& directory) {
+    traceDirectory = directory;
+}
+
+/**
+ * @brief Drain the zero-copy send completions from the socket's error queue.
+ *
+ * The kernel reports completed MSG_ZEROCOPY sends as ranges of send numbers. Nothing
+ * waits for them, the mapping outlives every send of the session, but left queued they
+ * keep the socket reporting an error and use up its option memory.
+ */
+void TFTPSession::reapSendCompletions() {
+    if (!zeroCopy) {
+        return;
+    }
+    char control[128];
+    while (true) {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(sessionSocket, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+            struct sock_extended_err* error = (struct sock_extended_err*)CMSG_DATA(header);
+            if (header->cmsg_level != SOL_IP || header->cmsg_type != IP_RECVERR || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            uint64_t completed = error->ee_data - error->ee_info + 1;
+            zeroCopySends += completed;
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zeroCopyCopied += completed;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Start the transfer by sending the first DATA or ACK packet.
+ */
+void TFTPSession::start() {
+    TFTPMetrics::add(METRIC_SESSIONS_STARTED);
+    started = true;
+    if (!traceDirectory.empty()) {
+        const char* request = opcode == TFTP_OPCODE_RRQ ? "RRQ" : opcode == TFTP_OPCODE_WRQ ? "WRQ" : "LS";
+        trace.reset(new TFTPTransferTrace(std::string(request) + " " + filename + " client " + std::to_string(clientId)));
+    }
+    if (opcode == TFTP_OPCODE_RRQ) {
+        startRead();
+    }
+    else if (opcode == TFTP_OPCODE_WRQ) {
+        startWrite();
+    }
+    else if (opcode == TFTP_OPCODE_LS) {
+        startList();
+    }
+    else {
+        const std::string errorMessage = "Illegal TFTP operation";
+        sendError(ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+        finish();
+    }
+}
+
+/**
+ * @brief Validate the read request, register the reader and send the first block.
+ */
+void TFTPSession::startRead() {
+    struct stat fileStat;
+    // Registered first, a file with readers cannot be deleted
+    activeReader = files.acquireReader(filename);
+    if (activeReader && fileCache != nullptr) {
+        // Mapped once for every reader of the file
+        cachedFile = fileCache->acquire(filePath);
+    }
+    if (activeReader && !cachedFile) {
+        fileFd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (!cachedFile && (fileFd < 0 || fstat(fileFd, &fileStat) < 0)) {
+        // Send an error packet (File not found - Error Code 1)
+        const std::string errorMessage = "File not found";
+        sendError(ERROR_FILE_NOT_FOUND, errorMessage, clientAddress);
+        finish();
+        return;
+    }
+    fileSize = cachedFile ? cachedFile->size : fileStat.st_size;
+    negotiateOptions();
+    mapFile();
+    startSending();
+}
+
+/**
+ * @brief Map the file being read so its blocks are sent without copying them.
+ *
+ * A file from the file cache is already mapped. Otherwise the session maps it, and
+ * falls back to reading the blocks into the ring if it cannot. Uploads never shrink a
+ * file that is read, but another tool may truncate it: the sends from the mapping then
+ * fail with EFAULT and end the transfer. The session never reads the mapped bytes
+ * itself, that would raise SIGBUS.
+ */
+void TFTPSession::mapFile() {
+    if (cachedFile) {
+        fileMap = cachedFile->data;
+        if (packetCache != nullptr) {
+            packetImage = packetCache->acquire(*cachedFile, blockSize);
+        }
+    }
+    else if (fileSize > 0) {
+        // Blocks are read in order from the one descriptor, let the kernel read ahead of the window
+        posix_fadvise(fileFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fileFd, 0);
+        if (mapping == MAP_FAILED) {
+            LOG_WARN("fail to map file for client " << clientId << ", reading it instead");
+            return;
+        }
+        madvise(mapping, fileSize, MADV_SEQUENTIAL);
+        fileMap = (const uint8_t*)mapping;
+    }
+    if (fileMap != nullptr && zeroCopyAllowed && blockSize >= SESSION_ZEROCOPY_MIN_BLOCK_SIZE) {
+        int enable = 1;
+        zeroCopy = setsockopt(sessionSocket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+    }
+}
+
+/**
+ * @brief Size of a ring slot: a whole DATA packet, or only its header if the file is mapped.
+ *
+ * @return The slot size in bytes.
+ */
+size_t TFTPSession::getSlotSize() const {
+    return fileMap != nullptr ? 4 : blockSize + 4;
+}
+
+/**
+ * @brief Validate the write request, create the temporary file and acknowledge block 0.
+ */
+void TFTPSession::startWrite() {
+    if (files.contains(filename)) {
+        // Send an error packet (File already exists. - Error Code 6)
+        const std::string errorMessage = "File already exists.";
+        sendError(ERROR_FILE_ALREADY_EXISTS, errorMessage, clientAddress);
+        finish();
+        return;
+    }
+    tempPath = std::string(SESSION_UPLOAD_DIRECTORY) + "/" + filename + "." + std::to_string(clientId);
+    fileFd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fileFd < 0) {
+        // Send an error packet (Disk full or allocation exceeded - Error Code 3)
+        const std::string errorMessage = "Disk full or allocation exceeded.";
+        sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+        finish();
+        return;
+    }
+    state = SESSION_STATE_RECEIVING;
+    negotiateOptions();
+    if (announcedSize > (uint64_t)std::numeric_limits<off_t>::max()) {
+        // No file can be that large (RFC 2349)
+        const std::string errorMessage = "Disk full or allocation exceeded.";
+        sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+        finish();
+        return;
+    }
+    if (fileWriter != nullptr) {
+        writeStream = fileWriter->open(fileFd);
+        fileFd = -1;
+        // The client announced the size, reserve it in one piece
+        if (announcedSize > 0 && !writeStream->preallocate((off_t)announcedSize)) {
+            // Send an error packet (Disk full or allocation exceeded - Error Code 3)
+            const std::string errorMessage = "Disk full or allocation exceeded.";
+            sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+            finish();
+            return;
+        }
+    }
+    else {
+        window.resize(windowSize * blockSize);
+    }
+    if (windowSize > 1) {
+        // Room for a whole window of DATA, a smaller buffer drops the end of every window
+        int receiveBuffer = windowSize * (blockSize + 4) * 2;
+        setsockopt(sessionSocket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+    if (!acceptedOptions.empty()) {
+        sendOACK();
+    }
+    else {
+        sendACK(0);
+    }
+    blockIndex = 1;
+}
+
+/**
+ * @brief Send the first block of the list of files with their reader counts, sizes and
+ * modification times.
+ *
+ * The listing is built in memory by the file index and sent from there like a mapped
+ * file, so LS never touches the disk and concurrent LS share one listing.
+ */
+void TFTPSession::startList() {
+    listing = files.getListing(parseListQuery());
+    fileMap = (const uint8_t*)listing->data();
+    fileSize = listing->size();
+    startSending();
+}
+
+/**
+ * @brief Read the files an LS asks for from its options.
+ *
+ * "prefix" and "match" (a shell pattern) filter the names, "sort" orders the files by
+ * "name", "size" or "mtime", reversed with a leading '-', and "offset" and "limit"
+ * page through them. Like unknown options, invalid values are ignored.
+ *
+ * @return The query of the listing.
+ */
+TFTPListQuery TFTPSession::parseListQuery() {
+    TFTPListQuery query;
+    uint64_t value;
+    auto option = requestedOptions.find(TFTP_OPTION_LS_PREFIX);
+    if (option != requestedOptions.end()) {
+        query.prefix = option->second;
+    }
+    option = requestedOptions.find(TFTP_OPTION_LS_MATCH);
+    if (option != requestedOptions.end()) {
+        query.pattern = option->second;
+    }
+    option = requestedOptions.find(TFTP_OPTION_LS_SORT);
+    if (option != requestedOptions.end()) {
+        std::string key = option->second;
+        bool descending = !key.empty() && key[0] == '-';
+        if (descending) {
+            key.erase(0, 1);
+        }
+        if (key == "name" || key == "size" || key == "mtime") {
+            query.sortKey = key == "name" ? LIST_SORT_NAME : key == "size" ? LIST_SORT_SIZE : LIST_SORT_MODIFIED;
+            query.descending = descending;
+        }
+    }
+    option = requestedOptions.find(TFTP_OPTION_LS_OFFSET);
+    if (option != requestedOptions.end() && TFTPPacket::parseOptionValue(option->second, 0, UINT64_MAX, value)) {
+        query.offset = value;
+    }
+    option = requestedOptions.find(TFTP_OPTION_LS_LIMIT);
+    if (option != requestedOptions.end() && TFTPPacket::parseOptionValue(option->second, 0, UINT64_MAX, value)) {
+        query.limit = value;
+    }
+    return query;
+}
+
+/**
+ * @brief Set up the block ring and send the OACK or the first window.
+ *
+ * The last block is the first one shorter than the block size, an empty one when
+ * the file size is a multiple of the block size.
+ */
+void TFTPSession::startSending() {
+    lastBlock = fileSize / blockSize + 1;
+    window.resize(windowSize * getSlotSize());
+    windowPacketSizes.assign(windowSize, 0);
+    windowBlocks.assign(windowSize, 0);
+    windowSendCounts.assign(windowSize, 0);
+    windowSendSubmits.assign(windowSize, 0);
+    windowSentAt.assign(windowSize, std::chrono::steady_clock::time_point());
+    state = SESSION_STATE_SENDING;
+    if (!acceptedOptions.empty()) {
+        // Block 0 is the OACK, the client acknowledges it with ACK 0
+        windowStart = 0;
+        sendOACK();
+        return;
+    }
+    windowStart = 1;
+    nextBlock = 1;
+    sendWindow();
+}
+
+/**
+ * @brief Decide which of the requested options are accepted and apply them.
+ *
+ * Unknown options and invalid values are ignored, as RFC 2347 allows, so the
+ * transfer falls back to the RFC 1350 behaviour for them.
+ */
+void TFTPSession::negotiateOptions() {
+    acceptedOptions.clear();
+    uint64_t value;
+    auto option = requestedOptions.find(TFTP_OPTION_TIMEOUT);
+    if (option != requestedOptions.end() && TFTPPacket::parseOptionValue(option->second, 1, SESSION_MAX_TIMEOUT_SECONDS, value)) {
+        retransmitTimer.setFixedTimeout(std::chrono::seconds(value));
+        acceptedOptions[TFTP_OPTION_TIMEOUT] = std::to_string(value);
+    }
+    option = requestedOptions.find(TFTP_OPTION_TSIZE);
+    if (option != requestedOptions.end() && TFTPPacket::parseOptionValue(option->second, 0, UINT64_MAX, value)) {
+        // RRQ: the client sends 0 and learns the file size, WRQ: the client announces the size.
+        // A size of 0 is left out since some clients (e.g. curl) reject it in an OACK.
+        uint64_t transferSize = opcode == TFTP_OPCODE_RRQ ? (uint64_t)fileSize : value;
+        if (opcode == TFTP_OPCODE_WRQ) {
+            announcedSize = value;
+        }
+        if (transferSize > 0 || opcode == TFTP_OPCODE_WRQ) {
+            acceptedOptions[TFTP_OPTION_TSIZE] = std::to_string(transferSize);
+        }
+    }
+    option = requestedOptions.find(TFTP_OPTION_BLKSIZE);
+    if (option != requestedOptions.end() && TFTPPacket::parseOptionValue(option->second, MIN_BLOCK_SIZE, UINT64_MAX, value)) {
+        // A larger request is answered with the largest block size we support
+        blockSize = std::min<uint64_t>(value, MAX_BLOCK_SIZE);
+        acceptedOptions[TFTP_OPTION_BLKSIZE] = std::to_string(blockSize);
+    }
+    option = requestedOptions.find(TFTP_OPTION_WINDOWSIZE);
+    if (option != requestedOptions.end() && TFTPPacket::parseOptionValue(option->second, 1, MAX_WINDOW_SIZE, value)) {
+        windowSize = std::min<uint64_t>(value, SESSION_MAX_WINDOW_SIZE);
+        acceptedOptions[TFTP_OPTION_WINDOWSIZE] = std::to_string(windowSize);
+    }
+    for (const auto& accepted : acceptedOptions) {
+        LOG_INFO("Option " << accepted.first << " accepted for client " << clientId << " with value " << accepted.second);
+    }
+}
+
+/**
+ * @brief Process a packet received on the session socket.
+ *
+ * Packets from an unknown transfer ID are answered with an error and otherwise ignored.
+ *
+ * @param buffer The received packet.
+ * @param bytesRead The size of the received packet in bytes.
+ * @param recvAddress The address the packet was received from.
+ */
+void TFTPSession::handlePacket(const uint8_t* buffer, int bytesRead, struct sockaddr_in recvAddress) {
+    if (state == SESSION_STATE_FINISHED) {
+        return;
+    }
+    if (recvAddress.sin_addr.s_addr != clientAddress.sin_addr.s_addr || recvAddress.sin_port != clientAddress.sin_port) {
+        LOG_WARN("Corrupt packet from different source received");
+        const std::string errorMessage = "Unknown transfer ID";
+        sendError(ERROR_UNKNOWN_TID, errorMessage, recvAddress);
+        return;
+    }
+    if (bytesRead < 4 || (size_t)bytesRead > getMaxPacketSize()) {
+        LOG_WARN("Illegal Packet Recieved");
+        const std::string errorMessage = "Illegal TFTP operation";
+        sendError(ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+        return;
+    }
+
+    uint16_t recvOpcode = (buffer[0] << 8) | buffer[1];
+    uint16_t recvBlockNumber = (buffer[2] << 8) | buffer[3];
+    if (recvOpcode == TFTP_OPCODE_ERROR) {
+        LOG_WARN_EVENT(LOG_EVENT_ERROR_RECEIVED, clientId, recvBlockNumber);
+        finish();
+    }
+    else if (state == SESSION_STATE_SENDING && recvOpcode == TFTP_OPCODE_ACK) {
+        handleACK(recvBlockNumber);
+    }
+    else if (state == SESSION_STATE_RECEIVING && recvOpcode == TFTP_OPCODE_DATA) {
+        handleData(recvBlockNumber, buffer + 4, bytesRead - 4);
+    }
+    else if (state == SESSION_STATE_FLUSHING && recvOpcode == TFTP_OPCODE_DATA) {
+        // The last window again, answered once the file is committed
+    }
+    else if (state == SESSION_STATE_LINGERING && recvOpcode == TFTP_OPCODE_DATA) {
+        // The final ACK was lost and the client sent the last window again
+        if (recvBlockNumber == (uint16_t)(blockIndex - 1)) {
+            engine->prepareSend(sessionSocket, packet, packetSize, clientAddress);
+        }
+    }
+    else {
+        LOG_WARN("Illegal Opcode Recieved");
+        const std::string errorMessage = "Illegal TFTP operation";
+        sendError(ERROR_ILLEGAL_TFTP_OPERATION, errorMessage, clientAddress);
+        finish();
+    }
+}
+
+/**
+ * @brief Process an ACK and send the next window.
+ *
+ * An ACK for a block before the end of the window means the blocks after it were
+ * lost, so sending resumes right after it (RFC 7440). ACKs for blocks that are not
+ * in flight are ignored so a delayed ACK does not double the traffic.
+ *
+ * @param ackBlockNumber The acknowledged block number.
+ */
+void TFTPSession::handleACK(uint16_t ackBlockNumber) {
+    if (windowStart == 0) {
+        if (ackBlockNumber != 0) {
+            LOG_DEBUG_EVENT(LOG_EVENT_DUPLICATE_ACK, clientId, ackBlockNumber);
+            return;
+        }
+        // OACK acknowledged, start with the first window
+        makeProgress(packetSendCount, packetSentAt);
+        if (trace) {
+            trace->span(TRACE_STAGE_RTT, 0, packetSentAt);
+        }
+        windowStart = 1;
+        nextBlock = 1;
+        sendWindow();
+        return;
+    }
+    if (ackBlockNumber == (uint16_t)(windowStart - 1) && windowSize > 1 && !windowResent) {
+        // The first block of the window was lost, send the window again once
+        windowResent = true;
+        nextBlock = windowStart;
+        sendWindow();
+        return;
+    }
+    // Widen the 16 bit block number, relative to the last acknowledged block
+    uint32_t ackedBlock = windowStart - 1 + (uint16_t)(ackBlockNumber - (uint16_t)(windowStart - 1));
+    if (ackedBlock < windowStart || ackedBlock >= nextBlock) {
+        LOG_DEBUG_EVENT(LOG_EVENT_DUPLICATE_ACK, clientId, ackBlockNumber);
+        return;
+    }
+    size_t slot = ackedBlock % windowSize;
+    makeProgress(windowSendCounts[slot], windowSentAt[slot]);
+    if (trace) {
+        trace->span(TRACE_STAGE_RTT, ackedBlock, windowSentAt[slot]);
+    }
+    if (ackedBlock == lastBlock) {
+        LOG_INFO_EVENT(LOG_EVENT_FILE_SENT, clientId, lastBlock);
+        finish();
+        return;
+    }
+    windowStart = ackedBlock + 1;
+    nextBlock = windowStart;
+    windowResent = false;
+    sendWindow();
+}
+
+/**
+ * @brief Write a received DATA block to the file and acknowledge the window.
+ *
+ * The last block of a window (or of the file) is acknowledged; the ACK is linked to
+ * the write, so a block is only acknowledged once it is stored. A block out of order
+ * means a loss, it is answered with an ACK for the last block received in order. A
+ * lone repeat of the previous block means our ACK was lost, so it is acknowledged again.
+ *
+ * @param recvBlockNumber The block number of the received DATA packet.
+ * @param data Pointer to the received payload.
+ * @param dataLength The size of the received payload in bytes.
+ */
+void TFTPSession::handleData(uint16_t recvBlockNumber, const uint8_t* data, size_t dataLength) {
+    if (recvBlockNumber != (uint16_t)blockIndex) {
+        if (receivedInWindow > 0 || recvBlockNumber == (uint16_t)(blockIndex - 1)) {
+            receivedInWindow = 0;
+            sendACK(blockIndex - 1);
+        }
+        return;
+    }
+    if (trace) {
+        trace->span(TRACE_STAGE_RECEIVE, blockIndex, lastProgress);
+        if (receivedInWindow == 0) {
+            trace->span(TRACE_STAGE_RTT, blockIndex - 1, packetSentAt);
+        }
+    }
+    if (receivedInWindow == 0) {
+        // First block after our ACK, it answers the ACK
+        makeProgress(packetSendCount, packetSentAt);
+    }
+    else {
+        lastProgress = std::chrono::steady_clock::now();
+    }
+    bool finalBlock = dataLength < blockSize;
+    off_t offset = (off_t)(blockIndex - 1) * blockSize;
+    uint8_t* buffer = window.data() + (blockIndex % windowSize) * blockSize;
+    ++blockIndex;
+    ++receivedInWindow;
+    bool acknowledge = finalBlock || receivedInWindow == windowSize;
+    if (acknowledge) {
+        TFTPPacket::createACKPacket(packet, recvBlockNumber);
+        packetSize = 4;
+        packetSendCount = 0;
+        receivedInWindow = 0;
+    }
+    std::chrono::steady_clock::time_point writtenAt = std::chrono::steady_clock::now();
+    if (writeStream) {
+        bool appended = writeStream->append(data, dataLength);
+        if (trace) {
+            // Only the copy into the write-behind buffer, the disk write is part of the commit
+            trace->span(TRACE_STAGE_WRITE, blockIndex - 1, writtenAt);
+        }
+        if (!appended) {
+            LOG_ERROR("File write error");
+            const std::string errorMessage = "Disk full or allocation exceeded.";
+            sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+            finish();
+        }
+        else if (finalBlock) {
+            writeStream->flush();
+            state = SESSION_STATE_FLUSHING;
+            flushStartedAt = std::chrono::steady_clock::now();
+            completeFlush();
+        }
+        else if (acknowledge) {
+            sendPacket();
+        }
+        else {
+            resetDeadline();
+        }
+        return;
+    }
+    if (finalBlock) {
+        // The final ACK waits until the file is committed
+        state = SESSION_STATE_FLUSHING;
+        flushStartedAt = writtenAt;
+    }
+    // An empty final block is still queued as a write of nothing, so that the commit
+    // starts from its callback after the writes queued before it
+    memcpy(buffer, data, dataLength);
+    uint32_t block = blockIndex - 1;
+    engine->prepareWrite(fileFd, buffer, dataLength, offset, acknowledge && !finalBlock, [this, dataLength, finalBlock, block, writtenAt](ssize_t result) {
+        if (result != (ssize_t)dataLength) {
+            LOG_ERROR("File write error");
+            const std::string errorMessage = "Disk full or allocation exceeded.";
+            sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+            finish();
+            return;
+        }
+        if (trace) {
+            trace->span(TRACE_STAGE_WRITE, block, writtenAt);
+        }
+        if (finalBlock) {
+            completeFlush();
+        }
+    });
+    if (finalBlock) {
+        return;
+    }
+    if (acknowledge) {
+        sendPacket();
+    }
+    else {
+        resetDeadline();
+    }
+}
+
+/**
+ * @brief Send the final ACK of an upload once its last writes are done and the file is
+ * committed, or check again shortly.
+ */
+void TFTPSession::completeFlush() {
+    if (!fileCommit) {
+        if (writeStream && !writeStream->isIdle()) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(WRITE_BEHIND_POLL_US);
+            return;
+        }
+        if (writeStream && (writeStream->hasFailed() || !writeStream->trim())) {
+            LOG_ERROR("File write error");
+            const std::string errorMessage = "Disk full or allocation exceeded.";
+            sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+            finish();
+            return;
+        }
+        startCommit();
+    }
+    int status = fileCommit->status.load(std::memory_order_acquire);
+    if (status == FILE_COMMIT_PENDING) {
+        deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(FILE_COMMIT_POLL_US);
+        return;
+    }
+    if (status == FILE_COMMIT_EXISTS) {
+        // Another upload of the same name was committed first
+        const std::string errorMessage = "File already exists.";
+        sendError(ERROR_FILE_ALREADY_EXISTS, errorMessage, clientAddress);
+        finish();
+        return;
+    }
+    if (status == FILE_COMMIT_FAILED) {
+        const std::string errorMessage = "Disk full or allocation exceeded.";
+        sendError(ERROR_DISK_FULL, errorMessage, clientAddress);
+        finish();
+        return;
+    }
+    sendPacket();
+    completeWrite();
+}
+
+/**
+ * @brief Hand the written temporary file over to the committer, or publish it now
+ * without one.
+ */
+void TFTPSession::startCommit() {
+    int fd = writeStream ? writeStream->release() : fileFd;
+    fileFd = -1;
+    writeStream.reset();
+    if (fileCommitter != nullptr) {
+        fileCommit = fileCommitter->commit(fd, tempPath, filePath);
+    }
+    else {
+        fileCommit = TFTPFileCommitter::publish(fd, tempPath, filePath);
+    }
+}
+
+/**
+ * @brief Publish the committed file in the file map and linger for a lost final ACK.
+ *
+ * The client resends its last window if the final ACK is lost, at the latest after its
+ * maximum retransmission timeout, so the session stays that long to answer it.
+ */
+void TFTPSession::completeWrite() {
+    LOG_INFO_EVENT(LOG_EVENT_FILE_RECEIVED, clientId, fileCommit->fileStat.st_size);
+    if (trace) {
+        trace->span(TRACE_STAGE_COMMIT, blockIndex - 1, flushStartedAt);
+    }
+    files.insert(filename, fileCommit->fileStat.st_size, fileCommit->fileStat.st_mtim);
+    if (fileCache != nullptr) {
+        fileCache->invalidate(filePath);
+    }
+    if (packetCache != nullptr) {
+        packetCache->invalidate(filePath);
+    }
+    state = SESSION_STATE_LINGERING;
+    deadline = std::chrono::steady_clock::now() + retransmitTimer.getMaximum();
+}
+
+/**
+ * @brief Retransmit the last packet with a backed off timeout, or give up.
+ *
+ * The session is dropped once it made no progress for SESSION_MAX_RETRY times the
+ * maximum retransmission timeout.
+ */
+void TFTPSession::handleTimeout() {
+    if (state == SESSION_STATE_FINISHED) {
+        return;
+    }
+    if (state == SESSION_STATE_LINGERING) {
+        finish();
+        return;
+    }
+    if (state == SESSION_STATE_FLUSHING) {
+        if (writeStream || fileCommit) {
+            completeFlush();
+        }
+        else {
+            // The last block is still being written
+            deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(WRITE_BEHIND_POLL_US);
+        }
+        return;
+    }
+    if (std::chrono::steady_clock::now() - lastProgress >= SESSION_MAX_RETRY * retransmitTimer.getMaximum()) {
+        LOG_WARN_EVENT(LOG_EVENT_RETRY_EXCEEDED, clientId);
+        finish();
+        return;
+    }
+    retransmitTimer.backoff();
+    TFTPMetrics::add(METRIC_TIMEOUTS);
+    if (trace) {
+        trace->mark(TRACE_STAGE_TIMEOUT, state == SESSION_STATE_SENDING ? windowStart : blockIndex);
+    }
+    LOG_WARN_EVENT(LOG_EVENT_TIMEOUT, clientId, retransmitTimer.getTimeout().count());
+    if (state == SESSION_STATE_SENDING && windowStart > 0) {
+        // Send the whole window again
+        nextBlock = windowStart;
+        sendWindow();
+    }
+    else if (state == SESSION_STATE_RECEIVING && receivedInWindow > 0) {
+        // Part of the window arrived, let the client resume after it
+        receivedInWindow = 0;
+        sendACK(blockIndex - 1);
+    }
+    else {
+        sendPacket();
+    }
+}
+
+/**
+ * @brief Send the blocks of the window that are not in flight yet.
+ */
+void TFTPSession::sendWindow() {
+    while (nextBlock < windowStart + windowSize && nextBlock <= lastBlock) {
+        sendBlock(nextBlock++);
+    }
+    resetDeadline();
+}
+
+/**
+ * @brief Send a DATA block from its ring slot, reading it from the file first if needed.
+ *
+ * A slot is reused only once its block is acknowledged, so a retransmission after a
+ * loss or timeout is sent from memory. The send is linked to the read so a block is
+ * never sent half filled. A slot whose last send is still queued, e.g. a window resent
+ * for an ACK followed by a later ACK in the same batch, is flushed before it is reused.
+ * If the file is mapped, the slot only holds the header and the data is sent from the
+ * mapping; a block of a prebuilt image is sent as it is and the slot is not used.
+ *
+ * @param block The block to send.
+ */
+void TFTPSession::sendBlock(uint32_t block) {
+    size_t slot = block % windowSize;
+    uint8_t* blockPacket = window.data() + slot * getSlotSize();
+    off_t offset = (off_t)(block - 1) * blockSize;
+    int flags = zeroCopy ? MSG_ZEROCOPY : 0;
+    if (windowBlocks[slot] != block) {
+        if (packetImage == nullptr && windowSendCounts[slot] > 0 && windowSendSubmits[slot] == engine->getSubmits()) {
+            engine->submit();
+        }
+        size_t dataSize = offset < fileSize ? std::min<off_t>(blockSize, fileSize - offset) : 0;
+        if (packetImage == nullptr) {
+            TFTPPacket::createDataPacket(blockPacket, (uint16_t)block, "", 0);
+        }
+        windowPacketSizes[slot] = dataSize + 4;
+        windowBlocks[slot] = block;
+        windowSendCounts[slot] = 0;
+        if (dataSize > 0 && fileMap == nullptr) {
+            std::chrono::steady_clock::time_point readAt = std::chrono::steady_clock::now();
+            engine->prepareRead(fileFd, blockPacket + 4, dataSize, offset, true, [this, dataSize, block, readAt](ssize_t result) {
+                if (result != (ssize_t)dataSize) {
+                    LOG_ERROR("fail to read block for client " << clientId);
+                }
+                else if (trace) {
+                    trace->span(TRACE_STAGE_READ, block, readAt);
+                }
+            });
+        }
+    }
+    if (packetImage != nullptr) {
+        engine->prepareSend(sessionSocket, packetImage->getPacket(block), windowPacketSizes[slot], nullptr, 0, clientAddress, flags, traceSend(block));
+    }
+    else if (fileMap != nullptr) {
+        engine->prepareSend(sessionSocket, blockPacket, 4, fileMap + offset, windowPacketSizes[slot] - 4, clientAddress, flags, checkMappedSend(block));
+    }
+    else {
+        engine->prepareSend(sessionSocket, blockPacket, windowPacketSizes[slot], clientAddress, traceSend(block));
+    }
+    if (windowSendCounts[slot]++ > 0) {
+        TFTPMetrics::add(METRIC_RETRANSMISSIONS);
+        if (trace) {
+            trace->mark(TRACE_STAGE_RETRANSMIT, block);
+        }
+    }
+    windowSendSubmits[slot] = engine->getSubmits();
+    windowSentAt[slot] = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Send (or resend) the last ACK or OACK packet of the session.
+ */
+void TFTPSession::sendPacket() {
+    // The ACK of the last block received, or the OACK that stands for the ACK of block 0
+    uint32_t block = opcode == TFTP_OPCODE_WRQ ? blockIndex - 1 : 0;
+    engine->prepareSend(sessionSocket, packet, packetSize, clientAddress, traceSend(block));
+    if (packetSendCount++ > 0) {
+        TFTPMetrics::add(METRIC_RETRANSMISSIONS);
+        if (trace) {
+            trace->mark(TRACE_STAGE_RETRANSMIT, block);
+        }
+    }
+    packetSentAt = std::chrono::steady_clock::now();
+    resetDeadline();
+}
+
+/**
+ * @brief The completion of a send of a traced session, which records how long the
+ * send was queued and executed.
+ *
+ * @param block The block sent or acknowledged.
+ * @return The callback for prepareSend, empty if the session is not traced.
+ */
+TFTPIOCallback TFTPSession::traceSend(uint32_t block) {
+    if (!trace) {
+        return nullptr;
+    }
+    std::chrono::steady_clock::time_point queuedAt = std::chrono::steady_clock::now();
+    return [this, block, queuedAt](ssize_t result) {
+        if (result >= 0) {
+            trace->span(TRACE_STAGE_SEND, block, queuedAt);
+        }
+        else if (result != -ECANCELED) {
+            LOG_ERROR("I/O operation failed: " << strerror(-result));
+        }
+    };
+}
+
+/**
+ * @brief The completion of a send from the file mapping, which ends the transfer if
+ * the file was truncated under the mapping: the kernel fails the send with EFAULT.
+ *
+ * @param block The block sent.
+ * @return The callback for prepareSend.
+ */
+TFTPIOCallback TFTPSession::checkMappedSend(uint32_t block) {
+    TFTPIOCallback traced = traceSend(block);
+    return [this, traced](ssize_t result) {
+        if (result == -EFAULT && state != SESSION_STATE_FINISHED) {
+            LOG_ERROR("file changed while being read by client " << clientId);
+            const std::string errorMessage = "File changed while being read";
+            sendError(ERROR_NOT_DEFINED, errorMessage, clientAddress);
+            finish();
+        }
+        else if (traced) {
+            traced(result);
+        }
+        else if (result < 0 && result != -ECANCELED && result != -EFAULT) {
+            LOG_ERROR("I/O operation failed: " << strerror(-result));
+        }
+    };
+}
+
+/**
+ * @brief Build and send an ACK packet; it is kept for retransmission.
+ *
+ * @param ackBlockNumber The block number being acknowledged.
+ */
+void TFTPSession::sendACK(uint16_t ackBlockNumber) {
+    TFTPPacket::createACKPacket(packet, ackBlockNumber);
+    packetSize = 4;
+    packetSendCount = 0;
+    sendPacket();
+}
+
+/**
+ * @brief Build and send an OACK packet with the accepted options; it is kept for retransmission.
+ */
+void TFTPSession::sendOACK() {
+    packetSize = TFTPPacket::createOACKPacket(packet, acceptedOptions);
+    packetSendCount = 0;
+    sendPacket();
+}
+
+/**
+ * @brief Send an error packet to the given address.
+ *
+ * @param errorCode The TFTP error code.
+ * @param errorMsg The error message associated with the error code.
+ * @param address The address the error packet is sent to.
+ */
+void TFTPSession::sendError(uint16_t errorCode, const std::string& errorMsg, struct sockaddr_in address) {
+    uint8_t errorPacket[4 + errorMsg.size() + 1];
+    TFTPPacket::createErrorPacket(errorPacket, errorCode, errorMsg);
+    errorPacket[4 + errorMsg.size()] = '\0';
+    if (sendto(sessionSocket, errorPacket, sizeof(errorPacket), 0, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        LOG_ERROR("fail to send error packet");
+        return;
+    }
+    LOG_INFO_EVENT(LOG_EVENT_ERROR_SENT, address.sin_addr.s_addr, errorCode);
+}
+
+/**
+ * @brief Push the session deadline one retransmission timeout into the future.
+ */
+void TFTPSession::resetDeadline() {
+    deadline = std::chrono::steady_clock::now() + retransmitTimer.getTimeout();
+}
+
+/**
+ * @brief Record that the client answered a packet and take an RTT sample from it.
+ *
+ * Following Karn's rule, a packet that was sent more than once gives no sample.
+ *
+ * @param sendCount How many times the answered packet was sent.
+ * @param sentAt When the answered packet was last sent.
+ */
+void TFTPSession::makeProgress(int sendCount, std::chrono::steady_clock::time_point sentAt) {
+    lastProgress = std::chrono::steady_clock::now();
+    retransmitTimer.restoreFixedTimeout();
+    if (sendCount == 1) {
+        retransmitTimer.addSample(std::chrono::duration_cast<std::chrono::microseconds>(lastProgress - sentAt));
+        TFTPMetrics::record(METRIC_BLOCK_RTT, std::chrono::duration_cast<std::chrono::nanoseconds>(lastProgress - sentAt).count());
+    }
+}
+
+/**
+ * @brief Mark the session finished and release its file and reader count. An upload
+ * that did not complete is removed, one being committed is left to the committer.
+ */
+void TFTPSession::finish() {
+    if (state == SESSION_STATE_FINISHED) {
+        return;
+    }
+    if (started) {
+        // A session refused or dropped before it started was never counted as started
+        TFTPMetrics::add(METRIC_SESSIONS_FINISHED);
+    }
+    if (retransmitTimer.getSamples() > 0) {
+        LOG_INFO_EVENT(LOG_EVENT_SESSION_RTT, clientId, retransmitTimer.getSRTT().count(), retransmitTimer.getRTTVAR().count(),
+                       retransmitTimer.getTimeout().count(), retransmitTimer.getTimeouts());
+        retransmitTimer.publish();
+    }
+    if (zeroCopy) {
+        reapSendCompletions();
+        LOG_INFO_EVENT(LOG_EVENT_ZERO_COPY, clientId, zeroCopySends, zeroCopyCopied);
+    }
+    if (trace) {
+        // Kept until the session is destroyed, sends still queued record into it
+        std::string tracePath = traceDirectory + "/trace-" + std::to_string(clientId) + ".json";
+        if (trace->dump(tracePath)) {
+            LOG_INFO("Trace of client " << clientId << " written to " << tracePath << ": " << trace->summary());
+        }
+        else {
+            LOG_ERROR("fail to write trace " << tracePath);
+        }
+    }
+    if (activeReader) {
+        files.releaseReader(filename);
+        activeReader = false;
+    }
+    if ((fileFd >= 0 || writeStream) && (state == SESSION_STATE_RECEIVING || state == SESSION_STATE_FLUSHING)) {
+        // Upload cut short before it was handed to the committer
+        unlink(tempPath.c_str());
+    }
+    if (fileFd >= 0) {
+        close(fileFd);
+        fileFd = -1;
+    }
+    // Closed once the writes queued behind it are done
+    writeStream.reset();
+    state = SESSION_STATE_FINISHED;
+}
+
+bool TFTPSession::isFinished() const {
+    return state == SESSION_STATE_FINISHED;
+}
+
+int TFTPSession::getSocket() const {
+    return sessionSocket;
+}
+
+int TFTPSession::getClientId() const {
+    return clientId;
+}
+
+/**
+ * @brief Largest packet the client may send on this session.
+ *
+ * Only a write session receives DATA packets, every other session receives ACKs.
+ *
+ * @return The packet size in bytes, larger than 516 when a bigger blksize was negotiated.
+ */
+size_t TFTPSession::getMaxPacketSize() const {
+    return opcode == TFTP_OPCODE_WRQ ? blockSize + 4 : MAX_PACKET_SIZE;
+}
+
+std::chrono::steady_clock::time_point TFTPSession::getDeadline() const {
+    return deadline;
+}
@@ -0,0 +1,167 @@
+#ifndef TFTP_SESSION_H
+#define TFTP_SESSION_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include "TFTPPacket.h"
+#include "TFTPIOEngine.h"
+#include "TFTPRetransmitTimer.h"
+#include "TFTPFileCache.h"
+#include "TFTPPacketCache.h"
+#include "TFTPFileIndex.h"
+#include "TFTPFileWriter.h"
+#include "TFTPFileCommitter.h"
+#include "TFTPTransferTrace.h"
+
+#define SESSION_MAX_RETRY           5   // a session is dropped after this many maximum timeouts without progress
+#define SESSION_MAX_TIMEOUT_SECONDS 255 // largest value of the timeout option (RFC 2349)
+#define SESSION_MAX_WINDOW_SIZE     64  // largest window accepted, bounds the block ring per session
+#define SESSION_ZEROCOPY_MIN_BLOCK_SIZE 16384   // smallest blksize sent with MSG_ZEROCOPY, pinning pages costs more below
+#define SESSION_UPLOAD_DIRECTORY    "serverDatabase/.uploads"   // uploads are written here until they are committed
+
+/* Session States */
+#define SESSION_STATE_SENDING       0   // window of DATA sent, waiting for its ACK (RRQ, LS)
+#define SESSION_STATE_RECEIVING     1   // ACK sent, waiting for the next window of DATA (WRQ)
+#define SESSION_STATE_FINISHED      2
+#define SESSION_STATE_LINGERING     3   // final ACK sent, answering a retransmitted last block until the deadline (WRQ)
+#define SESSION_STATE_FLUSHING      4   // last block received, its final ACK waits until the file is written and committed (WRQ)
+
+/**
+ * @brief State machine for a single RRQ, WRQ or LS transfer.
+ *
+ * A session never blocks: it is fed with received packets and timeout events by
+ * whoever owns its socket (a client thread, the event loop or a pool worker) and
+ * queues its file and socket I/O on an I/O engine. The owner submits the engine
+ * after every step and closes the socket once the session is finished. Steps of one
+ * session must not run concurrently; the shared file index is thread safe.
+ *
+ * Blocks move in windows (RFC 7440): the sender keeps up to windowSize blocks in flight
+ * in a ring and the receiver acknowledges the last block of each window, or the last
+ * block received in order after a loss, from which the sender resumes. A read maps
+ * the file and sends every block from the mapping, only its header lives in the ring,
+ * or sends the prebuilt packets of a hot file as they are; with zero-copy the owner
+ * drains the send completions whenever the socket is ready. A write hands its blocks
+ * to the server's file writer and acknowledges them without waiting for the disk,
+ * only the final ACK waits until the whole file is written. An upload goes to a
+ * temporary file that the file committer syncs and renames to its name before the
+ * final ACK, so a file is only ever seen complete.
+ *
+ * The deadline is the only timer of a session: the retransmission timeout while the
+ * transfer runs, and once a write completed, the linger time during which a lost final
+ * ACK is sent again (RFC 1350 dallying).
+ *
+ * A traced session times every stage of every block and writes the breakdown once it
+ * is finished.
+ */
+class TFTPSession {
+public:
+    TFTPSession(TFTPIOEngine& engine, int sessionSocket, int clientId, uint16_t opcode, const std::string& filename, const TFTPOptions& options, struct sockaddr_in clientAddress, TFTPFileIndex& files);
+    ~TFTPSession();
+    void setEngine(TFTPIOEngine& engine);
+    void setRetransmitLimits(std::chrono::microseconds minimum, std::chrono::microseconds maximum);
+    void setFileCache(TFTPFileCache* fileCache);
+    void setPacketCache(TFTPPacketCache* packetCache);
+    void setFileWriter(TFTPFileWriter* fileWriter);
+    void setFileCommitter(TFTPFileCommitter* fileCommitter);
+    void setZeroCopy(bool enabled);
+    void setTraceDirectory(const std::string& directory);
+    void reapSendCompletions();
+    void start();
+    void handlePacket(const uint8_t* buffer, int bytesRead, struct sockaddr_in recvAddress);
+    void handleTimeout();
+    bool isFinished() const;
+    int getSocket() const;
+    int getClientId() const;
+    size_t getMaxPacketSize() const;
+    std::chrono::steady_clock::time_point getDeadline() const;
+
+private:
+    TFTPIOEngine* engine;
+    int sessionSocket;
+    int clientId;
+    uint16_t opcode;
+    std::string filename;
+    std::string filePath;
+    std::string tempPath;               // upload being received (WRQ)
+    TFTPOptions requestedOptions;
+    TFTPOptions acceptedOptions;
+    size_t blockSize;
+    size_t windowSize;
+    struct sockaddr_in clientAddress;
+    TFTPFileIndex& files;
+    int state;
+    TFTPRetransmitTimer retransmitTimer;
+    std::chrono::steady_clock::time_point lastProgress;
+    bool activeReader;
+    uint32_t blockIndex;                // next block expected (WRQ)
+    uint32_t windowStart;               // first block not acknowledged, 0 while the OACK is in flight (RRQ, LS)
+    uint32_t nextBlock;                 // next block to send (RRQ, LS)
+    uint32_t lastBlock;                 // block shorter than blockSize that ends the transfer (RRQ, LS)
+    size_t receivedInWindow;            // blocks received in order since the last ACK (WRQ)
+    bool windowResent;                  // window sent again for an ACK of the block before it (RRQ, LS)
+    int fileFd;
+    off_t fileSize;
+    const uint8_t* fileMap;             // file mapped for reading (RRQ) or listing (LS), nullptr if read into the ring
+    TFTPFileCache* fileCache;
+    std::shared_ptr<const TFTPCachedFile> cachedFile;  // mapping shared with the other readers, if cached
+    TFTPPacketCache* packetCache;
+    std::shared_ptr<const TFTPPacketImage> packetImage;     // prebuilt DATA packets, if the file is hot
+    std::shared_ptr<const std::string> listing;     // LS text, shared with the other LS sessions
+    TFTPFileWriter* fileWriter;
+    std::shared_ptr<TFTPWriteStream> writeStream;   // upload written behind the session, owns the file (WRQ)
+    TFTPFileCommitter* fileCommitter;
+    std::shared_ptr<TFTPFileCommit> fileCommit;     // upload handed to the committer, owns the file (WRQ)
+    bool zeroCopyAllowed;
+    bool zeroCopy;                      // blocks sent with MSG_ZEROCOPY
+    uint64_t zeroCopySends;             // zero-copy sends completed
+    uint64_t zeroCopyCopied;            // completed sends the kernel copied anyway
+    uint8_t packet[MAX_PACKET_SIZE];    // last ACK or OACK, kept for retransmission
+    size_t packetSize;
+    int packetSendCount;
+    uint64_t announcedSize;             // size the client announced with tsize, 0 if none (WRQ)
+    bool started;                       // start() ran and counted the session as started
+    std::chrono::steady_clock::time_point packetSentAt;
+    std::vector<uint8_t> window;        // windowSize slots of DATA in flight or being written, headers only if the file is mapped
+    std::vector<size_t> windowPacketSizes;
+    std::vector<uint32_t> windowBlocks; // block held by each slot, 0 for none
+    std::vector<int> windowSendCounts;  // times the block of each slot was sent, RTT samples need 1 (Karn)
+    std::vector<uint64_t> windowSendSubmits;    // engine submit count when each slot was last sent
+    std::vector<std::chrono::steady_clock::time_point> windowSentAt;
+    std::chrono::steady_clock::time_point deadline;
+    std::string traceDirectory;         // where the trace of the transfer is written, empty if not traced
+    std::unique_ptr<TFTPTransferTrace> trace;
+    std::chrono::steady_clock::time_point flushStartedAt;
+    void startRead();
+    void startWrite();
+    void startList();
+    TFTPListQuery parseListQuery();
+    void startSending();
+    void mapFile();
+    size_t getSlotSize() const;
+    void negotiateOptions();
+    void handleACK(uint16_t ackBlockNumber);
+    void handleData(uint16_t recvBlockNumber, const uint8_t* data, size_t dataLength);
+    void completeFlush();
+    void startCommit();
+    void completeWrite();
+    void sendWindow();
+    void sendBlock(uint32_t block);
+    void sendPacket();
+    TFTPIOCallback traceSend(uint32_t block);
+    TFTPIOCallback checkMappedSend(uint32_t block);
+    void sendACK(uint16_t ackBlockNumber);
+    void sendOACK();
+    void sendError(uint16_t errorCode, const std::string& errorMsg, struct sockaddr_in address);
+    void resetDeadline();
+    void makeProgress(int sendCount, std::chrono::steady_clock::time_point sentAt);
+    void finish();
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "TFTPTimerWheel.h"
+
+/**
+ * @brief Constructor for the TFTPTimerWheel class. Ticks count from now.
+ */
+TFTPTimerWheel::TFTPTimerWheel() : startTime(std::chrono::steady_clock::now()), currentTick(0), count(0) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            slots[level][slot] = -1;
+        }
+    }
+}
+
+/**
+ * @brief Schedule the timer of a key, replacing its previous expiry if it had one.
+ *
+ * @param key The timer key, e.g. a session socket.
+ * @param when When the timer expires; a time in the past expires on the next expire().
+ */
+void TFTPTimerWheel::schedule(int key, std::chrono::steady_clock::time_point when) {
+    if ((size_t)key >= nodes.size()) {
+        nodes.resize(key + 1);
+    }
+    if (nodes[key].level >= 0) {
+        unlink(key);
+    }
+    nodes[key].expiry = toTick(when, true);
+    insert(key);
+}
+
+/**
+ * @brief Cancel the timer of a key; does nothing if it is not scheduled.
+ *
+ * @param key The timer key.
+ */
+void TFTPTimerWheel::cancel(int key) {
+    if (isScheduled(key)) {
+        unlink(key);
+    }
+}
+
+bool TFTPTimerWheel::isScheduled(int key) const {
+    return key >= 0 && (size_t)key < nodes.size() && nodes[key].level >= 0;
+}
+
+/**
+ * @brief Advance the wheel to the given time and collect the timers that expired.
+ *
+ * Expired timers are no longer scheduled; the caller reschedules the ones it still needs.
+ *
+ * @param now The current time.
+ * @param expired Expired keys are appended to it.
+ * @return The number of timers that expired.
+ */
+size_t TFTPTimerWheel::expire(std::chrono::steady_clock::time_point now, std::vector<int>& expired) {
+    size_t expiredCount = 0;
+    uint64_t nowTick = toTick(now, false);
+    while (currentTick <= nowTick) {
+        if (count == 0) {
+            // Nothing to cascade or fire, skip the idle ticks at once
+            currentTick = nowTick + 1;
+            break;
+        }
+        if ((currentTick & (TIMER_WHEEL_SLOTS - 1)) == 0) {
+            // Level 0 wrapped around: bring down the timers due in the next range, highest level first
+            int level = 1;
+            while (level < TIMER_WHEEL_LEVELS - 1 && ((currentTick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)) == 0) {
+                level++;
+            }
+            for (; level >= 1; level--) {
+                cascade(level);
+            }
+        }
+        int slot = currentTick & (TIMER_WHEEL_SLOTS - 1);
+        while (slots[0][slot] >= 0) {
+            int key = slots[0][slot];
+            unlink(key);
+            expired.push_back(key);
+            expiredCount++;
+        }
+        currentTick++;
+    }
+    return expiredCount;
+}
+
+/**
+ * @brief Earliest time expire() may have work to do, to bound an event loop wait.
+ *
+ * Exact for timers in level 0; for farther timers it is the next cascade, which is early
+ * but never late.
+ *
+ * @return The next expiry, or time_point::max() if no timer is scheduled.
+ */
+std::chrono::steady_clock::time_point TFTPTimerWheel::nextExpiry() const {
+    if (count == 0) {
+        return std::chrono::steady_clock::time_point::max();
+    }
+    uint64_t tick = currentTick;
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++, tick++) {
+        if (slots[0][tick & (TIMER_WHEEL_SLOTS - 1)] >= 0 || (i > 0 && (tick & (TIMER_WHEEL_SLOTS - 1)) == 0)) {
+            break;
+        }
+    }
+    return startTime + std::chrono::microseconds(tick * TIMER_WHEEL_TICK_US);
+}
+
+size_t TFTPTimerWheel::size() const {
+    return count;
+}
+
+/**
+ * @brief Convert a time to wheel ticks.
+ *
+ * @param when The time to convert.
+ * @param roundUp Round a partial tick up, so a timer never fires before its time.
+ * @return The tick, 0 for times before the wheel was created.
+ */
+uint64_t TFTPTimerWheel::toTick(std::chrono::steady_clock::time_point when, bool roundUp) const {
+    if (when <= startTime) {
+        return 0;
+    }
+    if (when == std::chrono::steady_clock::time_point::max()) {
+        return UINT64_MAX;
+    }
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(when - startTime).count();
+    return micros / TIMER_WHEEL_TICK_US + (roundUp && micros % TIMER_WHEEL_TICK_US ? 1 : 0);
+}
+
+/**
+ * @brief Link a timer into the slot of its expiry, in the lowest level whose range covers it.
+ *
+ * @param key The timer key; its expiry is set.
+ */
+void TFTPTimerWheel::insert(int key) {
+    TFTPTimerNode& node = nodes[key];
+    if (node.expiry < currentTick) {
+        node.expiry = currentTick;
+    }
+    uint64_t delta = node.expiry - currentTick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))) {
+        // Beyond the range of the wheel, expire at its end
+        node.expiry = currentTick + (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+    node.level = level;
+    node.slot = (node.expiry >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    node.prev = -1;
+    node.next = slots[level][node.slot];
+    if (node.next >= 0) {
+        nodes[node.next].prev = key;
+    }
+    slots[level][node.slot] = key;
+    count++;
+}
+
+/**
+ * @brief Remove a scheduled timer from its slot.
+ *
+ * @param key The timer key.
+ */
+void TFTPTimerWheel::unlink(int key) {
+    TFTPTimerNode& node = nodes[key];
+    if (node.prev >= 0) {
+        nodes[node.prev].next = node.next;
+    }
+    else {
+        slots[node.level][node.slot] = node.next;
+    }
+    if (node.next >= 0) {
+        nodes[node.next].prev = node.prev;
+    }
+    node.prev = -1;
+    node.next = -1;
+    node.level = -1;
+    count--;
+}
+
+/**
+ * @brief Move the timers of the current slot of a level down to the levels below.
+ *
+ * @param level The level to cascade, at least 1.
+ */
+void TFTPTimerWheel::cascade(int level) {
+    int slot = (currentTick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    int key = slots[level][slot];
+    slots[level][slot] = -1;
+    while (key >= 0) {
+        int next = nodes[key].next;
+        nodes[key].level = -1;
+        count--;
+        insert(key);
+        key = next;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef TFTP_TIMER_WHEEL_H
+#define TFTP_TIMER_WHEEL_H
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_SLOT_BITS   8
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_TICK_US     1000    // resolution of the wheel, 4 levels of 256 slots span ~50 days
+
+/**
+ * @brief One timer of the wheel, linked into the slot it is waiting in.
+ */
+struct TFTPTimerNode {
+    int prev = -1;
+    int next = -1;
+    int level = -1;             // -1 when not scheduled
+    int slot = 0;
+    uint64_t expiry = 0;        // in ticks
+};
+
+/**
+ * @brief Hierarchical timer wheel for the session timers of an event loop.
+ *
+ * Timers are identified by a small non-negative key, the session socket, and are kept
+ * in intrusive lists indexed by key, so scheduling, rescheduling and cancelling are O(1)
+ * with no allocation once a key was seen. Level 0 holds the timers due within
+ * TIMER_WHEEL_SLOTS ticks; every higher level covers TIMER_WHEEL_SLOTS times the range
+ * of the one below and is cascaded down when the lower level wraps around.
+ *
+ * Timers never fire early, and at most one tick late once expire() is called. The wheel
+ * is not thread safe: it belongs to the thread running the event loop.
+ */
+class TFTPTimerWheel {
+public:
+    TFTPTimerWheel();
+    void schedule(int key, std::chrono::steady_clock::time_point when);
+    void cancel(int key);
+    bool isScheduled(int key) const;
+    size_t expire(std::chrono::steady_clock::time_point now, std::vector<int>& expired);
+    std::chrono::steady_clock::time_point nextExpiry() const;
+    size_t size() const;
+
+private:
+    std::chrono::steady_clock::time_point startTime;
+    uint64_t currentTick;           // every tick before it was processed
+    size_t count;
+    int slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    std::vector<TFTPTimerNode> nodes;
+    uint64_t toTick(std::chrono::steady_clock::time_point when, bool roundUp) const;
+    void insert(int key);
+    void unlink(int key);
+    void cascade(int level);
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "TFTPTransferTrace.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+const char* const TFTPTransferTrace::stageNames[TRACE_STAGE_COUNT] = {
+    "read", "build", "send", "rtt", "receive", "write", "commit", "retransmit", "timeout"
+};
+
+/**
+ * @brief Constructor for the TFTPTransferTrace class.
+ *
+ * @param name What is traced, e.g. the request and the client, shown as the process name.
+ */
+TFTPTransferTrace::TFTPTransferTrace(const std::string& name)
+    : name(name), startedAt(std::chrono::steady_clock::now()), events(TRACE_RING_SIZE), recorded(0) {
+    memset(stageStats, 0, sizeof(stageStats));
+}
+
+/**
+ * @brief Record a stage of a block that ends now.
+ *
+ * @param stage One of the TRACE_STAGE values.
+ * @param block The block, 0 for the packets before the first block.
+ * @param start When the stage started.
+ */
+void TFTPTransferTrace::span(int stage, uint32_t block, std::chrono::steady_clock::time_point start) {
+    add(stage, block, start, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/**
+ * @brief Record that something happened to a block now, e.g. a timeout.
+ *
+ * @param stage One of the TRACE_STAGE values.
+ * @param block The block.
+ */
+void TFTPTransferTrace::mark(int stage, uint32_t block) {
+    add(stage, block, std::chrono::steady_clock::now(), -1);
+}
+
+void TFTPTransferTrace::add(int stage, uint32_t block, std::chrono::steady_clock::time_point start, int64_t duration) {
+    TFTPTraceEvent& event = events[recorded % TRACE_RING_SIZE];
+    event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - startedAt).count();
+    event.duration = duration;
+    event.block = block;
+    event.stage = stage;
+    recorded++;
+    TFTPTraceStageStats& stats = stageStats[stage];
+    stats.count++;
+    if (duration > 0) {
+        stats.totalDuration += duration;
+        stats.maxDuration = std::max(stats.maxDuration, duration);
+    }
+}
+
+/**
+ * @return The events kept in the ring, oldest first.
+ */
+std::vector<TFTPTraceEvent> TFTPTransferTrace::getEvents() const {
+    std::vector<TFTPTraceEvent> kept;
+    uint64_t first = recorded > TRACE_RING_SIZE ? recorded - TRACE_RING_SIZE : 0;
+    for (uint64_t i = first; i < recorded; i++) {
+        kept.push_back(events[i % TRACE_RING_SIZE]);
+    }
+    return kept;
+}
+
+TFTPTraceStageStats TFTPTransferTrace::getStageStats(int stage) const {
+    return stageStats[stage];
+}
+
+/**
+ * @brief Write the kept events as Chrome trace JSON.
+ *
+ * @param path The file, replaced if it exists.
+ * @return true if the file was written, false otherwise.
+ */
+bool TFTPTransferTrace::dump(const std::string& path) const {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"" << escapeJSON(name) << "\"}}";
+    for (int stage = 0; stage < TRACE_STAGE_COUNT; stage++) {
+        snprintf(line, sizeof(line), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", stage, stageNames[stage]);
+        file << line;
+    }
+    for (const TFTPTraceEvent& event : getEvents()) {
+        // Chrome traces count in microseconds
+        if (event.duration < 0) {
+            snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"block\":%u}}",
+                     stageNames[event.stage], event.stage, event.start / 1000.0, event.block);
+        }
+        else {
+            snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"block\":%u}}",
+                     stageNames[event.stage], event.stage, event.start / 1000.0, event.duration / 1000.0, event.block);
+        }
+        file << line;
+    }
+    file << "\n]}\n";
+    file.close();
+    return !file.fail();
+}
+
+/**
+ * @brief Where the time of the transfer went: for every stage seen, how often and
+ * how long it took on average and at most.
+ *
+ * @return One line, e.g. "read 128 x 3 us (max 40 us), send 130 x 5 us (max 12 us)".
+ */
+std::string TFTPTransferTrace::summary() const {
+    std::ostringstream output;
+    for (int stage = 0; stage < TRACE_STAGE_COUNT; stage++) {
+        const TFTPTraceStageStats& stats = stageStats[stage];
+        if (stats.count == 0) {
+            continue;
+        }
+        if (output.tellp() > 0) {
+            output << ", ";
+        }
+        output << stageNames[stage] << " " << stats.count;
+        if (stage != TRACE_STAGE_RETRANSMIT && stage != TRACE_STAGE_TIMEOUT) {
+            output << " x " << stats.totalDuration / (int64_t)stats.count / 1000 << " us (max " << stats.maxDuration / 1000 << " us)";
+        }
+    }
+    return recorded > 0 ? output.str() : "nothing recorded";
+}
+
+std::string TFTPTransferTrace::escapeJSON(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
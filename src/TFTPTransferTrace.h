@@ -0,0 +1,71 @@
+#ifndef TFTP_TRANSFER_TRACE_H
+#define TFTP_TRANSFER_TRACE_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+/* Trace Stages */
+#define TRACE_STAGE_READ        0   // block read from the file
+#define TRACE_STAGE_BUILD       1   // DATA packet formatted
+#define TRACE_STAGE_SEND        2   // datagram handed to the kernel
+#define TRACE_STAGE_RTT         3   // packet sent until the peer answered it
+#define TRACE_STAGE_RECEIVE     4   // waiting for a DATA block since the previous one
+#define TRACE_STAGE_WRITE       5   // block written to the file
+#define TRACE_STAGE_COMMIT      6   // last block received until the upload is durable
+#define TRACE_STAGE_RETRANSMIT  7   // packet sent again, no duration
+#define TRACE_STAGE_TIMEOUT     8   // retransmission timeout, no duration
+#define TRACE_STAGE_COUNT       9
+
+#define TRACE_RING_SIZE         8192    // events kept per transfer, the oldest are overwritten
+
+/**
+ * @brief A stage of one block, or a mark if its duration is negative.
+ */
+struct TFTPTraceEvent {
+    int64_t start;              // ns since the trace started
+    int64_t duration;           // ns
+    uint32_t block;
+    int stage;
+};
+
+/**
+ * @brief Totals of a stage over the whole transfer, overwritten events included.
+ */
+struct TFTPTraceStageStats {
+    uint64_t count;
+    int64_t totalDuration;
+    int64_t maxDuration;
+};
+
+/**
+ * @brief Timings of the stages of every block of one transfer.
+ *
+ * Events go into a fixed ring, so tracing a long transfer keeps its last
+ * TRACE_RING_SIZE events without growing; the per stage totals cover all of them.
+ * Once the transfer is done the ring is written as Chrome trace JSON, one track per
+ * stage, to be opened in chrome://tracing or Perfetto.
+ */
+class TFTPTransferTrace {
+public:
+    TFTPTransferTrace(const std::string& name);
+    void span(int stage, uint32_t block, std::chrono::steady_clock::time_point start);
+    void mark(int stage, uint32_t block);
+    bool dump(const std::string& path) const;
+    std::string summary() const;
+    std::vector<TFTPTraceEvent> getEvents() const;
+    TFTPTraceStageStats getStageStats(int stage) const;
+
+private:
+    static const char* const stageNames[TRACE_STAGE_COUNT];
+    std::string name;
+    std::chrono::steady_clock::time_point startedAt;
+    std::vector<TFTPTraceEvent> events;
+    uint64_t recorded;
+    TFTPTraceStageStats stageStats[TRACE_STAGE_COUNT];
+    void add(int stage, uint32_t block, std::chrono::steady_clock::time_point start, int64_t duration);
+    static std::string escapeJSON(const std::string& text);
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "TFTPWorkerPool.h"
+#include "TFTPLogger.h"
+
+/**
+ * @brief Constructor for the TFTPWorkerPool class.
+ *
+ * @param workerCount The number of worker threads, at least one.
+ */
+TFTPWorkerPool::TFTPWorkerPool(int workerCount)
+    : workerCount(workerCount < 1 ? 1 : workerCount), queuedTasks(0), executedTasks(0), stolenTasks(0), stopping(false) {
+    for (int i = 0; i < this->workerCount; i++) {
+        queues.emplace_back(new WorkerQueue());
+    }
+}
+
+/**
+ * @brief Destructor for the TFTPWorkerPool class. Stops the workers.
+ */
+TFTPWorkerPool::~TFTPWorkerPool() {
+    stop();
+}
+
+/**
+ * @brief Start the worker threads.
+ */
+void TFTPWorkerPool::start() {
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back([this, i] {
+            runWorker(i);
+        });
+    }
+    LOG_INFO("Worker pool started with " << workerCount << " workers");
+}
+
+/**
+ * @brief Stop the worker threads after their current task and drop the queued tasks.
+ */
+void TFTPWorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    for (auto& queue : queues) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->tasks.clear();
+    }
+    queuedTasks = 0;
+}
+
+/**
+ * @brief Queue a task, preferably on the given worker.
+ *
+ * If the preferred worker's deque is full the task goes to the next worker with room.
+ *
+ * @param preferredWorker The worker the task should run on, taken modulo the worker count.
+ * @param task The task to run. It receives the index of the worker executing it.
+ * @return true if the task was queued, false if every deque is full.
+ */
+bool TFTPWorkerPool::submit(int preferredWorker, TFTPWorkerTask task) {
+    for (int i = 0; i < workerCount; i++) {
+        WorkerQueue& queue = *queues[(preferredWorker + i) % workerCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.size() < WORKER_POOL_QUEUE_CAPACITY) {
+            queue.tasks.push_back(std::move(task));
+            {
+                std::lock_guard<std::mutex> sleepLock(sleepMutex);
+                queuedTasks++;
+            }
+            wakeUp.notify_one();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Run tasks until the pool is stopped, sleeping while there is nothing to do.
+ *
+ * @param workerIndex The index of the worker.
+ */
+void TFTPWorkerPool::runWorker(int workerIndex) {
+    while (true) {
+        TFTPWorkerTask task;
+        if (takeTask(workerIndex, task)) {
+            task(workerIndex);
+            executedTasks++;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] {
+            return stopping || queuedTasks > 0;
+        });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Take the oldest task of the worker's own deque or steal the newest of another.
+ *
+ * @param workerIndex The index of the worker.
+ * @param task Set to the task taken.
+ * @return true if a task was taken, false if every deque is empty.
+ */
+bool TFTPWorkerPool::takeTask(int workerIndex, TFTPWorkerTask& task) {
+    for (int i = 0; i < workerCount; i++) {
+        WorkerQueue& queue = *queues[(workerIndex + i) % workerCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            stolenTasks++;
+        }
+        queuedTasks--;
+        return true;
+    }
+    return false;
+}
+
+int TFTPWorkerPool::getWorkerCount() const {
+    return workerCount;
+}
+
+uint64_t TFTPWorkerPool::getExecutedTasks() const {
+    return executedTasks;
+}
+
+uint64_t TFTPWorkerPool::getStolenTasks() const {
+    return stolenTasks;
+}
+
+/**
+ * @brief The default number of workers: one per available core.
+ */
+int TFTPWorkerPool::defaultWorkerCount() {
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 0 ? (int)cores : 1;
+}
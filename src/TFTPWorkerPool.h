@@ -0,0 +1,55 @@
+#ifndef TFTP_WORKER_POOL_H
+#define TFTP_WORKER_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+#define WORKER_POOL_QUEUE_CAPACITY  1024    // tasks per worker deque
+
+typedef std::function<void(int workerIndex)> TFTPWorkerTask;
+
+/**
+ * @brief Fixed set of worker threads with one bounded task deque per worker.
+ *
+ * A task is queued on its preferred worker so the steps of one session tend to run
+ * on the same thread. A worker takes tasks from the front of its own deque and, once
+ * it is empty, steals from the back of the other deques, so a worker stuck on slow
+ * disk I/O does not hold up the sessions queued behind it.
+ */
+class TFTPWorkerPool {
+public:
+    TFTPWorkerPool(int workerCount);
+    ~TFTPWorkerPool();
+    void start();
+    void stop();
+    bool submit(int preferredWorker, TFTPWorkerTask task);
+    int getWorkerCount() const;
+    uint64_t getExecutedTasks() const;
+    uint64_t getStolenTasks() const;
+    static int defaultWorkerCount();
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<TFTPWorkerTask> tasks;
+    };
+    int workerCount;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<int> queuedTasks;
+    std::atomic<uint64_t> executedTasks;
+    std::atomic<uint64_t> stolenTasks;
+    bool stopping;
+    void runWorker(int workerIndex);
+    bool takeTask(int workerIndex, TFTPWorkerTask& task);
+};
+
+#endif